@@ -0,0 +1,83 @@
+// SEEN <nick>: when a user was last active and what they did.
+// Build with `make plugins`, run with IRCSERV_PLUGINS=plugins/seen.so.
+#include "Plugin.hpp"
+#include "Utils.hpp"
+#include "Clock.hpp"
+#include <map>
+#include <ctime>
+
+namespace {
+
+struct Sighting {
+    time_t when;
+    std::string what;
+};
+
+class Seen : public Plugin {
+private:
+    PluginHost& _host;
+    std::map<std::string, Sighting> _seen;      // ircCaseFold(nick) -> last sighting
+
+    void saw(const std::string& nick, const std::string& what) {
+        Sighting& sighting = _seen[ircCaseFold(nick)];
+        sighting.when = Clock::now();
+        sighting.what = what;
+    }
+
+    void reply(Client& client, const std::string& text) {
+        _host.send(&client, ":SeenServ NOTICE " + client.getNickname() + " :" + text + "\r\n");
+    }
+
+public:
+    explicit Seen(PluginHost& host) : _host(host) {}
+
+    const char* name() const {
+        return "seen";
+    }
+
+    void onCommand(Client& client, const Message& msg) {
+        const std::string& nick = msg.param(0);
+        if (nick.empty()) {
+            reply(client, "Usage: SEEN <nick>");
+            return;
+        }
+        if (_host.findUser(nick)) {
+            reply(client, nick + " is online right now");
+            return;
+        }
+        std::map<std::string, Sighting>::const_iterator it = _seen.find(ircCaseFold(nick));
+        if (it == _seen.end()) {
+            reply(client, "I have not seen " + nick);
+            return;
+        }
+        reply(client, nick + " was last seen " + toString(Clock::now() - it->second.when)
+                      + " seconds ago, " + it->second.what);
+    }
+
+    void onJoin(Client& client, Channel& channel, const Message&) {
+        saw(client.getNickname(), "joining " + channel.getName());
+    }
+
+    void onPart(Client& client, Channel& channel, const Message&) {
+        saw(client.getNickname(), "leaving " + channel.getName());
+    }
+
+    void onPrivmsg(Client& client, Channel& channel, const Message&) {
+        saw(client.getNickname(), "talking in " + channel.getName());
+    }
+
+    void onNick(Client& client, const std::string& oldNick, const Message&) {
+        saw(oldNick, "changing nick to " + client.getNickname());
+    }
+};
+
+} // namespace
+
+extern "C" Plugin* ircservPlugin(PluginHost& host) {
+    if (host.apiVersion() != PLUGIN_API_VERSION)
+        return NULL;
+    Seen* seen = new Seen(host);
+    host.registerCommand(seen, "SEEN");
+    host.subscribe(seen, PLUGIN_JOIN | PLUGIN_PART | PLUGIN_PRIVMSG | PLUGIN_NICK);
+    return seen;
+}
@@ -0,0 +1,74 @@
+#include "includes/Binary.hpp"
+#include <cstring>
+
+void Binary::putU8(std::string& out, unsigned char value) {
+    out += static_cast<char>(value);
+}
+
+void Binary::putU32(std::string& out, uint32_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void Binary::putU64(std::string& out, uint64_t value) {
+    out.append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+void Binary::putStr(std::string& out, const std::string& value) {
+    putU32(out, value.size());
+    out.append(value);
+}
+
+Binary::Reader::Reader(const char* data, size_t len) : _pos(data), _end(data + len), _ok(true) {
+}
+
+bool Binary::Reader::take(void* dst, size_t len) {
+    if (!_ok || static_cast<size_t>(_end - _pos) < len)
+        return _ok = false;
+    std::memcpy(dst, _pos, len);
+    _pos += len;
+    return true;
+}
+
+bool Binary::Reader::ok() const {
+    return _ok;
+}
+
+bool Binary::Reader::atEnd() const {
+    return _pos == _end;
+}
+
+bool Binary::Reader::expect(const char* magic, size_t len) {
+    if (!_ok || static_cast<size_t>(_end - _pos) < len || std::memcmp(_pos, magic, len) != 0)
+        return _ok = false;
+    _pos += len;
+    return true;
+}
+
+unsigned char Binary::Reader::u8() {
+    unsigned char value = 0;
+    take(&value, sizeof(value));
+    return value;
+}
+
+uint32_t Binary::Reader::u32() {
+    uint32_t value = 0;
+    take(&value, sizeof(value));
+    return value;
+}
+
+uint64_t Binary::Reader::u64() {
+    uint64_t value = 0;
+    take(&value, sizeof(value));
+    return value;
+}
+
+std::string Binary::Reader::str() {
+    uint32_t len = u32();
+    if (!_ok || static_cast<size_t>(_end - _pos) < len) {
+        _ok = false;
+        return std::string();
+    }
+    std::string value(_pos, len);
+    _pos += len;
+    return value;
+}
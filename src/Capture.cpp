@@ -0,0 +1,92 @@
+#include "includes/Capture.hpp"
+#include "includes/Binary.hpp"
+#include "includes/Metrics.hpp"
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+Capture::Capture() : _fd(-1), _last(0), _nextId(1) {}
+
+Capture::~Capture() {
+    flush();
+    if (_fd != -1)
+        ::close(_fd);
+}
+
+void Capture::configure(bool resumed) {
+    const char* path = std::getenv("IRCSERV_CAPTURE");
+    if (!path || !*path)
+        return;
+    _path = path;
+    _fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC | (resumed ? 0 : O_TRUNC), 0600);
+    if (_fd == -1) {
+        std::cerr << "Capture disabled: cannot open " << _path << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    struct timeval now;
+    gettimeofday(&now, NULL);
+    _pending.append(CAPTURE_MAGIC, sizeof(CAPTURE_MAGIC));
+    Binary::putU64(_pending, static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_usec);
+    _last = Metrics::monotonicUs();
+}
+
+void Capture::record(CaptureRecord type, uint32_t id) {
+    uint64_t now = Metrics::monotonicUs();
+    uint64_t delta = now - _last;
+    _last = now;
+    Binary::putU8(_pending, type);
+    Binary::putU32(_pending, id);
+    Binary::putU32(_pending, delta > 0xffffffffULL ? 0xffffffffU : static_cast<uint32_t>(delta));
+}
+
+void Capture::open(int fd, bool local) {
+    if (_fd == -1)
+        return;
+    close(fd);          // Still mapped if the fd was handed to a link
+    uint32_t id = _nextId++;
+    _ids[fd] = id;
+    record(CAPTURE_OPEN, id);
+    Binary::putU8(_pending, local ? CAPTURE_LOCAL : 0);
+}
+
+void Capture::data(int fd, const char* bytes, size_t len) {
+    std::map<int, uint32_t>::const_iterator it = _ids.find(fd);
+    if (_fd == -1 || it == _ids.end())
+        return;
+    record(CAPTURE_DATA, it->second);
+    Binary::putU32(_pending, len);
+    _pending.append(bytes, len);
+    if (_pending.size() >= CAPTURE_FLUSH_BYTES)
+        flush();
+}
+
+void Capture::close(int fd) {
+    std::map<int, uint32_t>::iterator it = _ids.find(fd);
+    if (_fd == -1 || it == _ids.end())
+        return;
+    record(CAPTURE_CLOSE, it->second);
+    _ids.erase(it);
+}
+
+// A failed write stops the capture rather than the server
+void Capture::flush() {
+    size_t done = 0;
+    while (_fd != -1 && done < _pending.size()) {
+        ssize_t n = write(_fd, _pending.data() + done, _pending.size() - done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0) {
+            std::cerr << "Capture to " << _path << " stopped: " << strerror(errno) << std::endl;
+            ::close(_fd);
+            _fd = -1;
+            break;
+        }
+        done += n;
+    }
+    _pending.clear();
+}
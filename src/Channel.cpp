@@ -1,12 +1,23 @@
 #include "includes/Channel.hpp"
+#include "includes/Client.hpp"
+#include "includes/Replies.hpp"
+#include "includes/Utils.hpp"
+#include "includes/Clock.hpp"
 #include <algorithm>
 
-Channel::Channel(const std::string& name, Client* creator) : _name(name) {
+Channel::Channel(const std::string& name, Client* creator)
+    : _name(name), _topicRestricted(false), _inviteOnly(false),
+      _createdAt(Clock::now()), _topicSetAt(0), _namesDirty(true), _listGeneration(0) {
     // Add the creator as the first client and operator
     _clients.push_back(creator);
+    _memberSet.insert(creator);
     _operators.push_back(creator);
 }
 
+Channel::Channel(const std::string& name, time_t createdAt)
+    : _name(name), _topicRestricted(false), _inviteOnly(false),
+      _createdAt(createdAt), _topicSetAt(0), _namesDirty(true), _listGeneration(0) {
+}
 
 Channel::~Channel() {
     // Nothing to deallocate manually
@@ -23,8 +34,12 @@ bool Channel::isOperator(Client* client) const {
     return false;
 }
 
+const std::vector<Client*>& Channel::getOperators() const {
+    return _operators;
+}
+
 bool Channel::isTopicRestricted() const {
-    return !_topic.empty();
+    return _topicRestricted;
 }
 
 void Channel::addOperator(Client* client) {
@@ -33,12 +48,14 @@ void Channel::addOperator(Client* client) {
             return; // already an operator
     }
     _operators.push_back(client);
+    _namesDirty = true;
 }
 
 void Channel::removeOperator(Client* client) {
     std::vector<Client*>::iterator it = std::find(_operators.begin(), _operators.end(), client);
     if (it != _operators.end()) {
         _operators.erase(it);
+        _namesDirty = true;
     }
 }
 
@@ -48,19 +65,37 @@ const std::string& Channel::getTopic() const {
 
 void Channel::setTopic(const std::string& topic) {
     _topic = topic;
+    _topicSetAt = Clock::now();
+}
+
+void Channel::restoreTopic(const std::string& topic, time_t setAt) {
+    _topic = topic;
+    _topicSetAt = setAt;
+}
+
+time_t Channel::getCreationTime() const {
+    return _createdAt;
+}
+
+void Channel::setCreationTime(time_t createdAt) {
+    _createdAt = createdAt;
+}
+
+time_t Channel::getTopicTime() const {
+    return _topicSetAt;
 }
 
 bool Channel::hasClient(Client* client) const {
-    return std::find(_clients.begin(), _clients.end(), client) != _clients.end();
+    return _memberSet.count(client) != 0;
 }
 
 bool Channel::addClient(Client* client) {
     // Avoid duplicates
-    for (std::vector<Client*>::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (*it == client)
-            return false;
-    }
+    if (!_memberSet.insert(client).second)
+        return false;
     _clients.push_back(client);
+    if (!_namesDirty)
+        appendNameEntry(client);
     return true;
 }
 
@@ -80,23 +115,183 @@ bool Channel::isPasswordProtected() const {
 void Channel::setPassword(const std::string& password) {
     _password = password;
 }
+const std::string& Channel::getPassword() const {
+    return _password;
+}
 
 bool Channel::removeClient(Client* client) {
-    // Find the client in the vector
-    std::vector<Client*>::iterator it = std::find(_clients.begin(), _clients.end(), client);
-    
-    if (it == _clients.end()) {
+    if (!_memberSet.erase(client)) {
         return false; // Client not found
     }
-    
+
     // Remove from clients
-    _clients.erase(it);
+    _clients.erase(std::find(_clients.begin(), _clients.end(), client));
+    _banCache.erase(client);
+    _namesDirty = true;
     
     // Also remove from operators if they are one
-    it = std::find(_operators.begin(), _operators.end(), client);
+    std::vector<Client*>::iterator it = std::find(_operators.begin(), _operators.end(), client);
     if (it != _operators.end()) {
         _operators.erase(it);
     }
     
     return true;
-}
\ No newline at end of file
+}
+
+// Room left for names on one 353 line once the worst-case header is in:
+// ":server 353 <nick> = <channel> :" ... "\r\n"
+size_t Channel::namesChunkBudget() const {
+    return IRC_LINE_MAX - (sizeof(":" SERVER_NAME " 353 ") - 1) - NICKLEN
+        - 3 - _name.size() - 2 - 2;
+}
+
+void Channel::appendNameEntry(Client* client) const {
+    const std::string& nick = client->getNickname();
+    size_t entryLen = nick.size() + (isOperator(client) ? 1 : 0);
+
+    if (_namesChunks.empty() || _namesChunks.back().size() + 1 + entryLen > namesChunkBudget()) {
+        _namesChunks.push_back(std::string());
+        _namesChunks.back().reserve(namesChunkBudget());
+    } else {
+        _namesChunks.back() += ' ';
+    }
+    if (isOperator(client))
+        _namesChunks.back() += '@';
+    _namesChunks.back() += nick;
+}
+
+const std::vector<std::string>& Channel::getNamesChunks() const {
+    if (_namesDirty) {
+        _namesChunks.clear();
+        for (size_t i = 0; i < _clients.size(); ++i)
+            appendNameEntry(_clients[i]);
+        _namesDirty = false;
+    }
+    return _namesChunks;
+}
+
+void Channel::invalidateNames() {
+    _namesDirty = true;
+}
+
+Channel::MaskEntry::MaskEntry(const std::string& raw, const std::string& by, time_t at)
+    : mask(raw), setBy(by), setAt(at) {
+}
+
+bool Channel::addMask(ListMode list, const std::string& raw, const std::string& setBy) {
+    std::vector<MaskEntry>& entries = _lists[list];
+    std::string normalised = Mask::normalise(raw);
+
+    if (entries.size() >= MAXLIST)
+        return false;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (ircEquals(entries[i].mask.str(), normalised))
+            return false;
+    }
+    entries.push_back(MaskEntry(normalised, setBy, Clock::now()));
+    ++_listGeneration;
+    return true;
+}
+
+bool Channel::removeMask(ListMode list, const std::string& raw) {
+    std::vector<MaskEntry>& entries = _lists[list];
+    std::string normalised = Mask::normalise(raw);
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (ircEquals(entries[i].mask.str(), normalised)) {
+            entries.erase(entries.begin() + i);
+            ++_listGeneration;
+            return true;
+        }
+    }
+    return false;
+}
+
+void Channel::restoreMask(ListMode list, const std::string& raw, const std::string& setBy, time_t setAt) {
+    if (_lists[list].size() >= MAXLIST)
+        return;
+    _lists[list].push_back(MaskEntry(raw, setBy, setAt));
+    ++_listGeneration;
+}
+
+const std::vector<Channel::MaskEntry>& Channel::getMasks(ListMode list) const {
+    return _lists[list];
+}
+
+bool Channel::computeBanned(const Client* client) const {
+    const std::vector<MaskEntry>& bans = _lists[BAN_LIST];
+    const std::vector<MaskEntry>& excepts = _lists[EXCEPT_LIST];
+
+    for (size_t i = 0; i < bans.size(); ++i) {
+        if (!bans[i].mask.matches(*client))
+            continue;
+        for (size_t j = 0; j < excepts.size(); ++j) {
+            if (excepts[j].mask.matches(*client))
+                return false;
+        }
+        return true;
+    }
+    return false;
+}
+
+// Members hit the cache on every PRIVMSG; non-members (JOIN attempts)
+// are evaluated directly and not remembered.
+bool Channel::isBanned(Client* client) const {
+    if (_lists[BAN_LIST].empty())
+        return false;
+    if (!hasClient(client))
+        return computeBanned(client);
+
+    std::map<Client*, BanCacheEntry>::iterator it = _banCache.find(client);
+    if (it != _banCache.end() && it->second.listGeneration == _listGeneration
+        && it->second.prefixGeneration == client->getPrefixGeneration())
+        return it->second.banned;
+
+    BanCacheEntry entry;
+    entry.listGeneration = _listGeneration;
+    entry.prefixGeneration = client->getPrefixGeneration();
+    entry.banned = computeBanned(client);
+    _banCache[client] = entry;
+    return entry.banned;
+}
+
+bool Channel::isInviteExempt(Client* client) const {
+    const std::vector<MaskEntry>& invex = _lists[INVITE_LIST];
+    for (size_t i = 0; i < invex.size(); ++i) {
+        if (invex[i].mask.matches(*client))
+            return true;
+    }
+    return false;
+}
+
+HistoryRing& Channel::history() {
+    return _history;
+}
+
+const HistoryRing& Channel::history() const {
+    return _history;
+}
+
+void Channel::addSavedOperator(const std::string& prefix) {
+    _savedOperators.insert(prefix);
+}
+
+const std::set<std::string>& Channel::getSavedOperators() const {
+    return _savedOperators;
+}
+
+bool Channel::isSavedOperator(Client* client) const {
+    return _savedOperators.count(client->getPrefix().substr(1)) != 0;
+}
+
+void Channel::clearSavedOperators() {
+    _savedOperators.clear();
+}
+
+// Matched on the full nick!user@host, the same identity the snapshot saw
+bool Channel::claimSavedOperator(Client* client) {
+    if (_savedOperators.erase(client->getPrefix().substr(1)) == 0)
+        return false;
+    addOperator(client);
+    return true;
+}
@@ -1,7 +1,22 @@
 #include "includes/Client.hpp"
+#include "includes/Scan.hpp"
+#include "includes/Utils.hpp"
+#include <arpa/inet.h>
+
+namespace {
+
+// Drained buffers, ready to be swapped into the next client that needs one
+std::vector<std::string> g_spareBuffers;
+
+} // namespace
 
 Client::Client(int fd, const std::string& ip) 
-    : _fd(fd), _ip(ip), _authenticated(false) , _registered(false) {
+    : _ip(ip), _inputStart(0), _lineEnd(std::string::npos), _lineBad(std::string::npos), _scanned(0), _nickTs(0), _fd(fd), _ipv4(0),
+      _prefixGeneration(0), _caps(0), _authenticated(false), _registered(false), _oper(false) {
+    struct in_addr addr;
+    if (inet_pton(AF_INET, ip.c_str(), &addr) == 1)
+        _ipv4 = addr.s_addr;
+    rebuildPrefix();
 }
 
 Client::~Client() {
@@ -15,6 +30,10 @@ const std::string& Client::getIp() const {
     return _ip;
 }
 
+uint32_t Client::getIpv4() const {
+    return _ipv4;
+}
+
 const std::string& Client::getNickname() const {
     return _nickname;
 }
@@ -29,11 +48,60 @@ bool Client::isAuthenticated() const {
 
 void Client::setNickname(const std::string& nickname) {
     _nickname = nickname;
+    rebuildPrefix();
 }
 
 
 void Client::setUsername(const std::string& username) {
     _username = username;
+    rebuildPrefix();
+}
+
+const std::string& Client::getPrefix() const {
+    return _prefix;
+}
+
+unsigned int Client::getPrefixGeneration() const {
+    return _prefixGeneration;
+}
+
+const std::string& Client::getUid() const {
+    return _uid;
+}
+
+void Client::setUid(const std::string& uid) {
+    _uid = uid;
+}
+
+time_t Client::getNickTs() const {
+    return _nickTs;
+}
+
+void Client::setNickTs(time_t ts) {
+    _nickTs = ts;
+}
+
+bool Client::isLocal() const {
+    return _fd >= 0;
+}
+
+// Render the message source once so broadcasts can append it as-is
+// instead of concatenating ":" + nick on every message.
+void Client::rebuildPrefix() {
+    ++_prefixGeneration;
+    _prefix.clear();
+    _prefix.reserve(1 + _nickname.size() + 1 + _username.size() + 1 + _ip.size() + 1);
+    _prefix += ':';
+    if (_nickname.empty())
+        _prefix += '*';
+    else
+        _prefix += _nickname;
+    if (!_username.empty()) {
+        _prefix += '!';
+        _prefix += _username;
+        _prefix += '@';
+        _prefix += _ip;
+    }
 }
 
 void Client::setRealname(const std::string& realname) {
@@ -46,53 +114,129 @@ void Client::setAuthenticated(bool auth) {
 
 void Client::appendToInputBuffer(const std::string& data)
 {
-    _inputBuffer += data;
+    appendToInputBuffer(data.data(), data.size());
+}
+
+void Client::appendToInputBuffer(const char* data, size_t len) {
+    acquireBuffer(_inputBuffer);
+    _inputBuffer.append(data, len);
+    findLineEnd();
+}
+
+// Each byte is scanned once: only what arrived since the last look,
+// and nothing while a complete line is already waiting. The same pass
+// notes the line's first NUL or CR; one past its '\n' is left for the
+// next line's scan to find.
+void Client::findLineEnd() {
+    if (_lineEnd != std::string::npos)
+        return;
+    Scan::Line found = Scan::scanLine(_inputBuffer.data() + _scanned, _inputBuffer.size() - _scanned);
+    if (_lineBad == std::string::npos && found.bad < found.end)
+        _lineBad = _scanned + found.bad;
+    size_t end = _scanned + found.end;
+    if (end < _inputBuffer.size())
+        _lineEnd = end;
+    _scanned = end;
 }
 
 bool Client::hasCompleteMessage() const {
-    // Check for standard IRC ending \r\n
-    if (_inputBuffer.find("\r\n") != std::string::npos)
-        return true;
-        
-    // Also accept just \n for easier testing with regular netcat
-    if (_inputBuffer.find("\n") != std::string::npos)
-        return true;
-        
-    return false;
+    return _lineEnd != std::string::npos;
+}
+
+// Lines end at "\n", with or without the "\r" before it. Consumed input
+// stays in the buffer until it is at least half of it, so a burst of
+// lines is not shifted down once per line.
+bool Client::getNextMessage(std::string& message, bool& invalid) {
+    if (_lineEnd == std::string::npos)
+        return false;
+
+    size_t end = _lineEnd;
+    if (end > _inputStart && _inputBuffer[end - 1] == '\r')
+        --end;
+    message.assign(_inputBuffer, _inputStart, end - _inputStart);
+    invalid = _lineBad < end;
+
+    _inputStart = _lineEnd + 1;
+    _lineEnd = std::string::npos;
+    _lineBad = std::string::npos;
+    if (_inputStart == _inputBuffer.size()) {
+        releaseBuffer(_inputBuffer);
+        _inputStart = 0;
+    } else if (_inputStart * 2 >= _inputBuffer.size()) {
+        _inputBuffer.erase(0, _inputStart);
+        _inputStart = 0;
+    }
+    _scanned = _inputStart;
+    findLineEnd();
+    return true;
 }
 
 std::string Client::getNextMessage() {
     std::string message;
-    size_t pos = _inputBuffer.find("\r\n");
-    
-    if (pos != std::string::npos) {
-        message = _inputBuffer.substr(0, pos);
-        _inputBuffer.erase(0, pos + 2);
-        return message;
-    }
-    
-    // Try with just \n
-    pos = _inputBuffer.find("\n");
-    if (pos != std::string::npos) {
-        message = _inputBuffer.substr(0, pos);
-        _inputBuffer.erase(0, pos + 1);
-        return message;
-    }
-    
+    bool invalid;
+    getNextMessage(message, invalid);
     return message;
 }
 
-
 void Client::addToOutputBuffer(const std::string& message) {
+    acquireBuffer(_outputBuffer);
     _outputBuffer += message;
 }
 
-std::string Client::getOutputBuffer() {
+// Callers append to it, so it is backed before they do
+std::string& Client::outputBuffer() {
+    acquireBuffer(_outputBuffer);
     return _outputBuffer;
 }
 
+const std::string& Client::getOutputBuffer() const {
+    return _outputBuffer;
+}
+
+void Client::consumeOutput(size_t sent) {
+    if (sent >= _outputBuffer.size())
+        releaseBuffer(_outputBuffer);
+    else
+        _outputBuffer.erase(0, sent);
+}
+
 void Client::clearOutputBuffer() {
-    _outputBuffer.clear();
+    releaseBuffer(_outputBuffer);
+}
+
+// Only an empty buffer without room of its own takes a spare; one that
+// already has data or capacity keeps it
+void Client::acquireBuffer(std::string& buffer) {
+    if (!buffer.empty() || buffer.capacity() >= CLIENT_BUFFER_MIN)
+        return;
+    if (g_spareBuffers.empty()) {
+        buffer.reserve(CLIENT_BUFFER_MIN);
+        return;
+    }
+    buffer.swap(g_spareBuffers.back());
+    g_spareBuffers.pop_back();
+}
+
+// Emptied, and its memory either pooled or freed. A buffer that grew past
+// CLIENT_BUFFER_MAX (a big LIST, a flood) is not kept around.
+void Client::releaseBuffer(std::string& buffer) {
+    buffer.clear();
+    size_t capacity = buffer.capacity();
+    if (capacity >= CLIENT_BUFFER_MIN && capacity <= CLIENT_BUFFER_MAX
+            && g_spareBuffers.size() < CLIENT_BUFFER_SPARES) {
+        // Growing the vector would copy the spares, and a copy of an
+        // empty string has no capacity, so it is sized once
+        if (g_spareBuffers.capacity() < CLIENT_BUFFER_SPARES)
+            g_spareBuffers.reserve(CLIENT_BUFFER_SPARES);
+        g_spareBuffers.push_back(std::string());
+        g_spareBuffers.back().swap(buffer);
+    } else {
+        std::string().swap(buffer);
+    }
+}
+
+size_t Client::spareBuffers() {
+    return g_spareBuffers.size();
 }
 
 bool Client::hasDataToSend() const {
@@ -109,4 +253,67 @@ bool Client::isRegistered() const {
 
 void Client::setRegistered(bool reg) {
     _registered = reg;
-}
\ No newline at end of file
+}
+
+bool Client::isOper() const {
+    return _oper;
+}
+
+void Client::setOper(bool oper) {
+    _oper = oper;
+}
+
+const std::set<std::string>& Client::getChannels() const {
+    return _channels;
+}
+
+void Client::addChannel(const std::string& key) {
+    _channels.insert(key);
+}
+
+void Client::removeChannel(const std::string& key) {
+    _channels.erase(key);
+}
+
+const std::map<std::string, std::string>& Client::getMonitors() const {
+    return _monitors;
+}
+
+bool Client::addMonitor(const std::string& key, const std::string& nick) {
+    return _monitors.insert(std::make_pair(key, nick)).second;
+}
+
+bool Client::removeMonitor(const std::string& key) {
+    return _monitors.erase(key) != 0;
+}
+
+bool Client::hasCap(ClientCap cap) const {
+    return (_caps & cap) != 0;
+}
+
+void Client::setCaps(unsigned int caps) {
+    _caps = caps;
+}
+
+unsigned int Client::getCaps() const {
+    return _caps;
+}
+
+std::string Client::getInputBuffer() const {
+    return _inputBuffer.substr(_inputStart);
+}
+
+bool Client::hasPendingInput() const {
+    return _inputStart < _inputBuffer.size();
+}
+
+size_t Client::memoryUsage() const {
+    size_t bytes = sizeof(Client) + stringHeapBytes(_ip) + stringHeapBytes(_nickname)
+        + stringHeapBytes(_username) + stringHeapBytes(_realname) + stringHeapBytes(_prefix)
+        + stringHeapBytes(_uid) + stringHeapBytes(_inputBuffer) + stringHeapBytes(_outputBuffer);
+    for (std::set<std::string>::const_iterator it = _channels.begin(); it != _channels.end(); ++it)
+        bytes += TREE_NODE_BYTES + sizeof(std::string) + stringHeapBytes(*it);
+    for (std::map<std::string, std::string>::const_iterator it = _monitors.begin(); it != _monitors.end(); ++it)
+        bytes += TREE_NODE_BYTES + 2 * sizeof(std::string) + stringHeapBytes(it->first) + stringHeapBytes(it->second);
+    return bytes;
+}
@@ -0,0 +1,34 @@
+#include "includes/Clock.hpp"
+#include <sys/time.h>
+
+bool Clock::_manual = false;
+uint64_t Clock::_millis = 0;
+
+time_t Clock::now() {
+    if (_manual)
+        return static_cast<time_t>(_millis / 1000);
+    return time(NULL);
+}
+
+uint64_t Clock::nowMillis() {
+    if (_manual)
+        return _millis;
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return static_cast<uint64_t>(tv.tv_sec) * 1000 + tv.tv_usec / 1000;
+}
+
+// Stops the clock at `millis` (0: wherever it is now)
+void Clock::setManual(uint64_t millis) {
+    _millis = millis ? millis : nowMillis();
+    _manual = true;
+}
+
+void Clock::advance(uint64_t millis) {
+    if (_manual)
+        _millis += millis;
+}
+
+void Clock::setReal() {
+    _manual = false;
+}
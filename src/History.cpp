@@ -0,0 +1,119 @@
+#include "includes/History.hpp"
+#include "includes/Clock.hpp"
+#include <ctime>
+#include <cstdio>
+
+HistoryRing::HistoryRing() : _head(0) {
+}
+
+const HistoryEntry& HistoryRing::push(const std::string& line) {
+    uint64_t now = currentTimeMillis();
+    // Keep the ring ordered even if the clock steps backwards
+    if (!_entries.empty() && now < at(size() - 1).time)
+        now = at(size() - 1).time;
+
+    HistoryEntry* slot;
+    if (_entries.size() < HISTORY_LEN) {
+        _entries.push_back(HistoryEntry());
+        slot = &_entries.back();
+    } else {
+        slot = &_entries[_head];
+        _head = (_head + 1) % HISTORY_LEN;
+    }
+
+    slot->time = now;
+    slot->line.assign("@time=");
+    appendServerTime(slot->line, now);
+    slot->line += ' ';
+    slot->tagLen = slot->line.size();
+    slot->line.append(line);
+    return *slot;
+}
+
+void HistoryRing::restore(const HistoryEntry& entry) {
+    if (_entries.size() < HISTORY_LEN) {
+        _entries.push_back(entry);
+        return;
+    }
+    _entries[_head] = entry;
+    _head = (_head + 1) % HISTORY_LEN;
+}
+
+size_t HistoryRing::size() const {
+    return _entries.size();
+}
+
+bool HistoryRing::empty() const {
+    return _entries.empty();
+}
+
+const HistoryEntry& HistoryRing::at(size_t index) const {
+    return _entries[(_head + index) % _entries.size()];
+}
+
+size_t HistoryRing::lowerBound(uint64_t t, bool strict) const {
+    size_t lo = 0;
+    size_t hi = size();
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        uint64_t midTime = at(mid).time;
+        if (midTime < t || (strict && midTime == t))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    return lo;
+}
+
+uint64_t currentTimeMillis() {
+    return Clock::nowMillis();
+}
+
+std::string formatServerTime(uint64_t millis) {
+    std::string out;
+    appendServerTime(out, millis);
+    return out;
+}
+
+void appendServerTime(std::string& out, uint64_t millis) {
+    time_t seconds = static_cast<time_t>(millis / 1000);
+    struct tm utc;
+    gmtime_r(&seconds, &utc);
+
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%04d-%02d-%02dT%02d:%02d:%02d.%03uZ",
+             utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday,
+             utc.tm_hour, utc.tm_min, utc.tm_sec,
+             static_cast<unsigned int>(millis % 1000));
+    out.append(buf);
+}
+
+bool parseServerTime(const std::string& text, uint64_t& millis) {
+    struct tm utc = tm();
+    unsigned int ms = 0;
+    int consumed = 0;
+
+    if (sscanf(text.c_str(), "%4d-%2d-%2dT%2d:%2d:%2d%n",
+               &utc.tm_year, &utc.tm_mon, &utc.tm_mday,
+               &utc.tm_hour, &utc.tm_min, &utc.tm_sec, &consumed) != 6)
+        return false;
+    const char* rest = text.c_str() + consumed;
+    if (*rest == '.') {
+        int digits = 0;
+        if (sscanf(rest, ".%3u%n", &ms, &digits) != 1)
+            return false;
+        for (int scale = digits - 1; scale < 3; ++scale)
+            ms *= 10;       // ".5" is 500ms
+        rest += digits;
+    }
+    if (*rest != 'Z' || rest[1] != '\0')
+        return false;
+
+    utc.tm_year -= 1900;
+    utc.tm_mon -= 1;
+    time_t seconds = timegm(&utc);
+    if (seconds == static_cast<time_t>(-1))
+        return false;
+    millis = static_cast<uint64_t>(seconds) * 1000 + ms;
+    return true;
+}
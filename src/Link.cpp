@@ -0,0 +1,73 @@
+#include "includes/Link.hpp"
+#include "includes/Clock.hpp"
+
+Link::Link(int fd, State state, bool outbound, const std::string& target)
+    : _fd(fd), _state(state), _outbound(outbound), _target(target), _since(Clock::now()) {
+}
+
+int Link::getFd() const {
+    return _fd;
+}
+
+Link::State Link::getState() const {
+    return _state;
+}
+
+void Link::setState(State state) {
+    _state = state;
+}
+
+bool Link::isOutbound() const {
+    return _outbound;
+}
+
+const std::string& Link::getTarget() const {
+    return _target;
+}
+
+const std::string& Link::getSid() const {
+    return _sid;
+}
+
+const std::string& Link::getDescription() const {
+    return _description;
+}
+
+void Link::setPeer(const std::string& sid, const std::string& description) {
+    _sid = sid;
+    _description = description;
+}
+
+time_t Link::getSince() const {
+    return _since;
+}
+
+void Link::appendToInputBuffer(const char* data, size_t len) {
+    _input.append(data, len);
+}
+
+bool Link::hasCompleteMessage() const {
+    return _input.find('\n') != std::string::npos;
+}
+
+std::string Link::getNextMessage() {
+    size_t pos = _input.find('\n');
+    if (pos == std::string::npos)
+        return std::string();
+    size_t len = pos > 0 && _input[pos - 1] == '\r' ? pos - 1 : pos;
+    std::string message = _input.substr(0, len);
+    _input.erase(0, pos + 1);
+    return message;
+}
+
+void Link::send(const std::string& line) {
+    _output += line;
+}
+
+std::string& Link::outputBuffer() {
+    return _output;
+}
+
+bool Link::hasDataToSend() const {
+    return !_output.empty();
+}
@@ -0,0 +1,948 @@
+#include "includes/Server.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+#include <netdb.h>
+
+// Server-to-server protocol (TS6-like, one line per message):
+//   SERVER <sid> <password> :<description>               handshake, both ways
+//   :<sid> SID <sid> <hops> :<description>                 server behind the sender
+//   :<sid> UID <uid> <nick> <nickTs> <user> <host> :<realname>
+//   :<sid> SJOIN <chanTs> <#chan> +<modes> :[@]<uid>...    burst and every JOIN
+//   :<sid> TB <#chan> <topicTs> :<topic>                   burst topic
+//   :<sid> BMASK <chanTs> <#chan> <b|e|I> :<mask>...       burst lists
+//   :<sid> EOB                                             end of burst
+//   :<uid> PART|TOPIC|PRIVMSG <#chan> [:<text>]
+//   :<uid> KICK <#chan> <uid> [:<reason>]
+//   :<uid> TMODE <chanTs> <#chan> <modes> [<args>...]
+//   :<uid> NICK <nick> <nickTs>      :<uid> QUIT :<reason>
+//   :<sid> KILL <uid> :<reason>      :<sid> SQUIT <sid> :<reason>
+// Users are known by UID everywhere, so a nick change can never be
+// mistaken for another user. Nick and channel clashes are settled by
+// timestamp: the older claim wins, a tie loses on both sides.
+namespace {
+
+const char UID_DIGITS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+const char LIST_MODES[] = "beI";            // Indexed by Channel::ListMode
+const char NETSPLIT_REASON[] = "*.net *.split";
+
+// A digit followed by two digits or capitals
+bool isValidSid(const std::string& sid) {
+    if (sid.size() != 3 || !isdigit(static_cast<unsigned char>(sid[0])))
+        return false;
+    for (size_t i = 1; i < sid.size(); ++i) {
+        if (!isdigit(static_cast<unsigned char>(sid[i])) && !isupper(static_cast<unsigned char>(sid[i])))
+            return false;
+    }
+    return true;
+}
+
+bool isChannelName(const std::string& name) {
+    return name.size() > 1 && name.size() <= CHANNELLEN && (name[0] == '#' || name[0] == '&');
+}
+
+std::vector<std::string> splitWords(const std::string& text) {
+    std::vector<std::string> words;
+    size_t start = 0;
+    while (start < text.size()) {
+        size_t space = text.find(' ', start);
+        if (space == std::string::npos)
+            space = text.size();
+        if (space > start)
+            words.push_back(text.substr(start, space - start));
+        start = space + 1;
+    }
+    return words;
+}
+
+// "<head><item> <item>...\r\n", split so no line exceeds IRC_LINE_MAX
+void appendSplit(std::string& out, const std::string& head, const std::vector<std::string>& items) {
+    std::string line;
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (!line.empty() && head.size() + line.size() + 1 + items[i].size() + 2 > IRC_LINE_MAX) {
+            out.append(head).append(line).append("\r\n");
+            line.clear();
+        }
+        if (!line.empty())
+            line += ' ';
+        line += items[i];
+    }
+    if (!line.empty())
+        out.append(head).append(line).append("\r\n");
+}
+
+} // namespace
+
+// IRCSERV_SID, IRCSERV_LINK_PASSWORD and IRCSERV_LINKS ("host:port,...")
+void Server::configureLinks() {
+    _sid = SERVER_SID;
+    if (const char* sid = std::getenv("IRCSERV_SID"))
+        _sid = sid;
+    if (!isValidSid(_sid))
+        throw std::runtime_error("Invalid IRCSERV_SID: " + _sid + " (a digit, then two digits or capitals)");
+    if (const char* password = std::getenv("IRCSERV_LINK_PASSWORD"))
+        _linkPassword = password;
+    _description = "ircserv";
+
+    _linkTargets.clear();
+    const char* links = std::getenv("IRCSERV_LINKS");
+    std::string list = links ? links : "";
+    std::replace(list.begin(), list.end(), ',', ' ');
+    std::vector<std::string> addresses = splitWords(list);
+    for (size_t i = 0; i < addresses.size(); ++i) {
+        LinkTarget target;
+        target.address = addresses[i];
+        target.nextAttempt = 0;
+        _linkTargets.push_back(target);
+    }
+    if (!_linkTargets.empty() && _linkPassword.empty()) {
+        std::cerr << RED << "✗ IRCSERV_LINKS ignored: IRCSERV_LINK_PASSWORD is not set" << RESET << std::endl;
+        _linkTargets.clear();
+    }
+}
+
+// SID + 6 characters; the counter only moves forward, so a UID is never
+// handed to two users over the life of the process
+std::string Server::nextUid() {
+    std::string uid(_sid);
+    uid.resize(9);
+    unsigned long n = _nextUid++;
+    for (size_t i = 8; i >= 3; --i) {
+        uid[i] = UID_DIGITS[n % 36];
+        n /= 36;
+    }
+    return uid;
+}
+
+Link* Server::findLink(int fd) {
+    LinkMap::iterator it = _links.find(fd);
+    if (it == _links.end())
+        return NULL;
+    return it->second;
+}
+
+// Autoconnect, handshake timeouts and runaway send queues; from runTimers()
+void Server::checkLinks() {
+    time_t now = Clock::now();
+    std::vector<std::pair<Link*, std::string> > doomed;
+    for (LinkMap::iterator it = _links.begin(); it != _links.end(); ++it) {
+        Link* link = it->second;
+        if (link->getState() != Link::ACTIVE && now - link->getSince() >= LINK_HANDSHAKE_TIMEOUT)
+            doomed.push_back(std::make_pair(link, std::string("Handshake timeout")));
+        else if (link->outputBuffer().size() > LINK_SENDQ_MAX)
+            doomed.push_back(std::make_pair(link, std::string("SendQ exceeded")));
+    }
+    for (size_t i = 0; i < doomed.size(); ++i)
+        dropLink(doomed[i].first, doomed[i].second);
+    connectLinks();
+}
+
+void Server::connectLinks() {
+    time_t now = Clock::now();
+    for (size_t i = 0; i < _linkTargets.size(); ++i) {
+        LinkTarget& target = _linkTargets[i];
+        // Already linked, possibly because the other side connected first
+        if (now < target.nextAttempt || (!target.sid.empty() && _servers.count(target.sid)))
+            continue;
+        bool pending = false;
+        for (LinkMap::iterator it = _links.begin(); it != _links.end() && !pending; ++it)
+            pending = it->second->getTarget() == target.address;
+        if (pending)
+            continue;
+        target.nextAttempt = now + LINK_RETRY;
+
+        size_t colon = target.address.rfind(':');
+        struct addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+        struct addrinfo* found = NULL;
+        if (colon == std::string::npos
+            || getaddrinfo(target.address.substr(0, colon).c_str(), target.address.substr(colon + 1).c_str(),
+                           &hints, &found) != 0) {
+            std::cerr << RED << "✗ Link to " << target.address << ": cannot resolve" << RESET << std::endl;
+            continue;
+        }
+        int fd = socket(AF_INET, SOCK_STREAM, 0);
+        if (fd < 0) {
+            freeaddrinfo(found);
+            continue;
+        }
+        setNonBlocking(fd);
+        int rc = connect(fd, found->ai_addr, found->ai_addrlen);
+        freeaddrinfo(found);
+        if (rc < 0 && errno != EINPROGRESS) {
+            std::cerr << RED << "✗ Link to " << target.address << ": " << strerror(errno) << RESET << std::endl;
+            close(fd);
+            continue;
+        }
+
+        // Writable once connected; handleLinkOutput() sends SERVER then
+        watchFd(fd, POLLIN | POLLOUT);
+        _links[fd] = new Link(fd, Link::CONNECTING, true, target.address);
+        std::cout << BLUE << "⇄ Connecting to " << target.address << " [fd: " << fd << "]" << RESET << std::endl;
+    }
+}
+
+// An unregistered connection opened with SERVER: it is a peer, not a
+// client. The socket stays in _pollfds, only its owner changes.
+void Server::acceptLink(Client* client, const std::string& line) {
+    int fd = client->getFd();
+    std::string pending = client->getInputBuffer();
+
+    unindexClient(client);
+    dropStreams(fd);
+    _clients.erase(fd);
+    delete client;      // Unsent client notices are dropped with it
+
+    Link* link = new Link(fd, Link::HANDSHAKE, false, "");
+    _links[fd] = link;
+    link->appendToInputBuffer(pending.data(), pending.size());
+    std::cout << BLUE << "⇄ Server connecting on fd " << fd << RESET << std::endl;
+
+    processLinkMessage(link, line);
+    drainLinkInput(fd);
+}
+
+// Both sides are authenticated: remember the peer, send it everything we
+// know, then introduce it to the rest of the network
+void Server::activateLink(Link* link) {
+    RemoteServer server;
+    server.route = link;
+    server.uplink = _sid;
+    server.description = link->getDescription();
+    server.hops = 1;
+    _servers[link->getSid()] = server;
+
+    sendBurst(link);
+    link->setState(Link::ACTIVE);
+    sendToLinks(":" + _sid + " SID " + link->getSid() + " 1 :" + link->getDescription() + "\r\n", link);
+
+    for (size_t i = 0; i < _linkTargets.size(); ++i) {
+        if (link->isOutbound() && _linkTargets[i].address == link->getTarget())
+            _linkTargets[i].sid = link->getSid();
+    }
+    std::cout << BOLD << GREEN << "✓ Linked to server " << link->getSid() << " (" << link->getDescription() << ")"
+              << RESET << std::endl;
+}
+
+void Server::handleLinkInput(Link* link) {
+    char buffer[16384];
+    ssize_t bytesRead = recv(link->getFd(), buffer, sizeof(buffer), 0);
+    if (bytesRead <= 0) {
+        if (bytesRead == 0)
+            dropLink(link, "Connection closed");
+        else if (errno != EWOULDBLOCK && errno != EAGAIN)
+            dropLink(link, strerror(errno));
+        return;
+    }
+    link->appendToInputBuffer(buffer, bytesRead);
+    drainLinkInput(link->getFd());
+}
+
+// A message may close the link, so look it up again for every line
+void Server::drainLinkInput(int fd) {
+    Link* link;
+    while ((link = findLink(fd)) != NULL && link->hasCompleteMessage())
+        processLinkMessage(link, link->getNextMessage());
+}
+
+// One send() per wakeup carries everything queued since the last one
+void Server::handleLinkOutput(Link* link) {
+    int fd = link->getFd();
+    if (link->getState() == Link::CONNECTING) {
+        int error = 0;
+        socklen_t len = sizeof(error);
+        if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &error, &len) < 0 || error != 0) {
+            dropLink(link, strerror(error ? error : errno));
+            return;
+        }
+        link->setState(Link::HANDSHAKE);
+        link->send("SERVER " + _sid + " " + _linkPassword + " :" + _description + "\r\n");
+    }
+
+    std::string& out = link->outputBuffer();
+    if (out.empty()) {
+        disableWriteEvent(fd);
+        return;
+    }
+    ssize_t sent = ::send(fd, out.data(), out.size(), 0);
+    if (sent > 0) {
+        out.erase(0, sent);
+        if (out.empty())
+            disableWriteEvent(fd);
+    } else if (sent < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
+        dropLink(link, strerror(errno));
+    }
+}
+
+// Close a link; if it was up, everything behind it has split off
+void Server::dropLink(Link* link, const std::string& reason) {
+    int fd = link->getFd();
+    bool active = link->getState() == Link::ACTIVE;
+    std::string peer = !link->getSid().empty() ? link->getSid()
+                     : !link->getTarget().empty() ? link->getTarget() : "fd " + toString(fd);
+    std::cout << BOLD << RED << "✗ Link to " << peer << " closed: " << reason << RESET << std::endl;
+
+    // Last words; whatever does not fit in the socket buffer is lost
+    if (link->getState() != Link::CONNECTING) {
+        link->send("ERROR :Closing Link: " + reason + "\r\n");
+        ::send(fd, link->outputBuffer().data(), link->outputBuffer().size(), 0);
+    }
+    forgetPollfd(fd);
+    _links.erase(fd);
+    close(fd);
+
+    if (active) {
+        sendToLinks(":" + _sid + " SQUIT " + link->getSid() + " :" + reason + "\r\n", NULL);
+        std::set<std::string> behind;
+        for (ServerMap::iterator it = _servers.begin(); it != _servers.end(); ++it) {
+            if (it->second.route == link)
+                behind.insert(it->first);
+        }
+        removeServers(behind, NETSPLIT_REASON);
+    }
+    delete link;
+}
+
+void Server::closeLinks(const std::string& reason) {
+    while (!_links.empty())
+        dropLink(_links.begin()->second, reason);
+}
+
+// Servers, nearest first so every uplink is introduced before the
+// servers behind it, then users, then channels with their members,
+// topic and lists. All of it goes out as one batch.
+void Server::sendBurst(Link* link) {
+    std::string& out = link->outputBuffer();
+
+    std::vector<std::pair<int, std::string> > servers;
+    for (ServerMap::iterator it = _servers.begin(); it != _servers.end(); ++it) {
+        if (it->second.route != link)
+            servers.push_back(std::make_pair(it->second.hops, it->first));
+    }
+    std::sort(servers.begin(), servers.end());
+    for (size_t i = 0; i < servers.size(); ++i) {
+        const RemoteServer& server = _servers[servers[i].second];
+        out.append(":").append(server.uplink).append(" SID ").append(servers[i].second).append(" ")
+           .append(toString(server.hops + 1)).append(" :").append(server.description).append("\r\n");
+    }
+
+    for (UidIndex::iterator it = _uidIndex.begin(); it != _uidIndex.end(); ++it) {
+        if (it->second->isRegistered() && routeOf(it->second) != link)
+            out.append(uidLine(it->second));
+    }
+
+    for (ChannelMap::iterator it = _channels.begin(); it != _channels.end(); ++it) {
+        const Channel& channel = it->second;
+        const std::vector<Client*>& clients = channel.getClients();
+        std::vector<std::string> members;
+        for (size_t i = 0; i < clients.size(); ++i) {
+            if (routeOf(clients[i]) != link)
+                members.push_back((channel.isOperator(clients[i]) ? "@" : "") + clients[i]->getUid());
+        }
+        if (members.empty())
+            continue;
+
+        std::string ts = toString(channel.getCreationTime());
+        std::string modes("+");
+        if (channel.isInviteOnly())
+            modes += 'i';
+        if (channel.isTopicRestricted())
+            modes += 't';
+        appendSplit(out, ":" + _sid + " SJOIN " + ts + " " + channel.getName() + " " + modes + " :", members);
+
+        if (!channel.getTopic().empty())
+            out.append(":").append(_sid).append(" TB ").append(channel.getName()).append(" ")
+               .append(toString(channel.getTopicTime())).append(" :").append(channel.getTopic()).append("\r\n");
+        for (int list = 0; list < Channel::LIST_MODE_COUNT; ++list) {
+            const std::vector<Channel::MaskEntry>& entries = channel.getMasks(static_cast<Channel::ListMode>(list));
+            std::vector<std::string> masks;
+            for (size_t i = 0; i < entries.size(); ++i)
+                masks.push_back(entries[i].mask.str());
+            appendSplit(out, ":" + _sid + " BMASK " + ts + " " + channel.getName() + " " + LIST_MODES[list] + " :", masks);
+        }
+    }
+
+    out.append(":").append(_sid).append(" EOB\r\n");
+    enableWriteEvent(link->getFd());
+}
+
+void Server::sendToLinks(const std::string& line, Link* except) {
+    for (LinkMap::iterator it = _links.begin(); it != _links.end(); ++it) {
+        Link* link = it->second;
+        if (link == except || link->getState() != Link::ACTIVE)
+            continue;
+        link->send(line);
+        enableWriteEvent(link->getFd());
+    }
+}
+
+// Channel messages only travel towards servers with members in the channel
+void Server::relayToChannelLinks(const Channel& channel, const std::string& line, Link* except) {
+    std::set<Link*> targets;
+    const std::vector<Client*>& clients = channel.getClients();
+    for (size_t i = 0; i < clients.size(); ++i) {
+        if (clients[i]->isLocal())
+            continue;
+        Link* route = routeOf(clients[i]);
+        if (route && route != except)
+            targets.insert(route);
+    }
+    for (std::set<Link*>::iterator it = targets.begin(); it != targets.end(); ++it) {
+        (*it)->send(line);
+        enableWriteEvent((*it)->getFd());
+    }
+}
+
+void Server::relayJoin(const Channel& channel, Client* client) {
+    if (_links.empty())
+        return;
+    sendToLinks(":" + _sid + " SJOIN " + toString(channel.getCreationTime()) + " " + channel.getName() + " + :"
+                + (channel.isOperator(client) ? "@" : "") + client->getUid() + "\r\n", NULL);
+}
+
+// Messages must arrive from the direction of their source; anything
+// else is stale or looping and is dropped
+bool Server::fromLink(Link* link, const std::string& source) {
+    if (source.size() == 3) {
+        ServerMap::iterator it = _servers.find(source);
+        return it != _servers.end() && it->second.route == link;
+    }
+    Client* user = getClientByUid(source);
+    return user && !user->isLocal() && routeOf(user) == link;
+}
+
+Link* Server::routeOf(const Client* user) const {
+    ServerMap::const_iterator it = _servers.find(user->getUid().substr(0, 3));
+    if (it == _servers.end())
+        return NULL;
+    return it->second.route;
+}
+
+// How a link message's source appears to our clients
+std::string Server::sourcePrefix(const std::string& source) {
+    Client* user = getClientByUid(source);
+    if (user)
+        return user->getPrefix();
+    return ":" SERVER_NAME;
+}
+
+std::string Server::uidLine(const Client* user) const {
+    std::string line;
+    line.append(":").append(user->getUid(), 0, 3).append(" UID ").append(user->getUid())
+        .append(" ").append(user->getNickname()).append(" ").append(toString(user->getNickTs()))
+        .append(" ").append(user->getUsername()).append(" ").append(user->getIp())
+        .append(" :").append(user->getRealname()).append("\r\n");
+    return line;
+}
+
+void Server::removeServers(const std::set<std::string>& sids, const std::string& reason) {
+    if (sids.empty())
+        return;
+    std::vector<Client*> gone;
+    for (UidIndex::iterator it = _uidIndex.begin(); it != _uidIndex.end(); ++it) {
+        if (sids.count(it->first.substr(0, 3)))
+            gone.push_back(it->second);
+    }
+    for (size_t i = 0; i < gone.size(); ++i)
+        removeRemoteUser(gone[i], reason);
+    for (std::set<std::string>::const_iterator it = sids.begin(); it != sids.end(); ++it)
+        _servers.erase(*it);
+    std::cout << BOLD << RED << "✗ Netsplit: lost " << sids.size() << " servers and " << gone.size() << " users"
+              << RESET << std::endl;
+}
+
+void Server::removeRemoteUser(Client* user, const std::string& reason) {
+    removeClientFromChannels(user, reason);
+    notifyWatchers(user->getNickname(), RPL_MONOFFLINE, user->getNickname());
+    unindexClient(user);
+    delete user;
+}
+
+// Remove a user from the whole network (nick collisions, KILL)
+void Server::killUser(Client* user, const std::string& reason, Link* except) {
+    sendToLinks(":" + _sid + " KILL " + user->getUid() + " :" + reason + "\r\n", except);
+    if (!user->isLocal()) {
+        removeRemoteUser(user, "Killed (" + reason + ")");
+        return;
+    }
+    // Best effort: the socket is closed right after
+    user->addToOutputBuffer("ERROR :Closing Link: Killed (" + reason + ")\r\n");
+    ::send(user->getFd(), user->getOutputBuffer().data(), user->getOutputBuffer().size(), 0);
+    _metrics.disconnect(Metrics::DISCONNECT_KILLED);
+    handleClientDisconnect(user->getFd(), "Killed (" + reason + ")");
+}
+
+// Modes from a link are applied without permission checks (the origin
+// server made them); returns what actually changed, as handleMode does
+std::string Server::applyModes(Channel& channel, const std::string& modes, const std::vector<std::string>& args,
+                               size_t next, const std::string& setBy, std::string& appliedArgs) {
+    std::string applied;
+    bool adding = true;
+    char lastSign = 0;
+    for (size_t i = 0; i < modes.size(); ++i) {
+        char mode = modes[i];
+        if (mode == '+' || mode == '-') {
+            adding = (mode == '+');
+            continue;
+        }
+
+        bool changed = false;
+        std::string mask;       // The argument as local clients see it
+        const char* list = std::strchr(LIST_MODES, mode);
+        if (list && mode) {
+            if (next >= args.size())
+                continue;
+            Channel::ListMode which = static_cast<Channel::ListMode>(list - LIST_MODES);
+            mask = Mask::normalise(args[next++]);
+            changed = adding ? channel.addMask(which, mask, setBy) : channel.removeMask(which, mask);
+        } else if (mode == 'o') {
+            // Users travel as UIDs; local clients see the nick
+            if (next >= args.size())
+                continue;
+            Client* user = getClientByUid(args[next++]);
+            if (user && channel.hasClient(user) && channel.isOperator(user) != adding) {
+                if (adding)
+                    channel.addOperator(user);
+                else
+                    channel.removeOperator(user);
+                mask = user->getNickname();
+                changed = true;
+            }
+        } else if (mode == 'i' || mode == 't') {
+            bool current = mode == 'i' ? channel.isInviteOnly() : channel.isTopicRestricted();
+            if (current != adding) {
+                if (mode == 'i')
+                    channel.setInviteOnly(adding);
+                else
+                    channel.setTopicRestricted(adding);
+                changed = true;
+            }
+        }
+
+        if (!changed)
+            continue;
+        if (lastSign != (adding ? '+' : '-')) {
+            lastSign = adding ? '+' : '-';
+            applied += lastSign;
+        }
+        applied += mode;
+        if (!mask.empty())
+            appliedArgs.append(" ").append(mask);
+    }
+    return applied;
+}
+
+// Our copy of a channel is younger than the network's: ops and modes set
+// here are dropped before the older state is applied
+void Server::resetChannelModes(Channel& channel) {
+    std::string head = ":" SERVER_NAME " MODE " + channel.getName() + " ";
+
+    std::vector<Client*> operators = channel.getOperators();
+    for (size_t i = 0; i < operators.size(); ++i) {
+        channel.removeOperator(operators[i]);
+        sendToLocalMembers(channel, head + "-o " + operators[i]->getNickname() + "\r\n", NULL);
+    }
+    if (channel.isInviteOnly()) {
+        channel.setInviteOnly(false);
+        sendToLocalMembers(channel, head + "-i\r\n", NULL);
+    }
+    if (channel.isTopicRestricted()) {
+        channel.setTopicRestricted(false);
+        sendToLocalMembers(channel, head + "-t\r\n", NULL);
+    }
+    for (int list = 0; list < Channel::LIST_MODE_COUNT; ++list) {
+        Channel::ListMode which = static_cast<Channel::ListMode>(list);
+        std::vector<Channel::MaskEntry> entries = channel.getMasks(which);
+        for (size_t i = 0; i < entries.size(); ++i) {
+            channel.removeMask(which, entries[i].mask.str());
+            sendToLocalMembers(channel, head + "-" + LIST_MODES[list] + " " + entries[i].mask.str() + "\r\n", NULL);
+        }
+    }
+}
+
+void Server::processLinkMessage(Link* link, const std::string& line) {
+    Message msg;
+    if (!parseMessage(line, msg))
+        return;
+    if (msg.command == "ERROR") {
+        dropLink(link, "Remote: " + msg.param(0));
+        return;
+    }
+    if (link->getState() != Link::ACTIVE) {
+        // Anything before the peer's SERVER (client notices) is ignored
+        if (msg.command == "SERVER")
+            linkServer(link, msg);
+        return;
+    }
+    if (msg.command == "PING") {
+        link->send(":" + _sid + " PONG " + _sid + " :" + msg.param(0) + "\r\n");
+        enableWriteEvent(link->getFd());
+        return;
+    }
+    if (msg.source.empty() || !fromLink(link, msg.source))
+        return;
+
+    std::string raw = line + "\r\n";     // Forwarded unchanged
+    if (msg.command == "PRIVMSG")
+        linkPrivmsg(link, msg, raw);
+    else if (msg.command == "SJOIN")
+        linkSjoin(link, msg, raw);
+    else if (msg.command == "PART")
+        linkPart(link, msg, raw);
+    else if (msg.command == "QUIT")
+        linkQuit(link, msg, raw);
+    else if (msg.command == "NICK")
+        linkNick(link, msg, raw);
+    else if (msg.command == "UID")
+        linkUid(link, msg, raw);
+    else if (msg.command == "TMODE")
+        linkTmode(link, msg, raw);
+    else if (msg.command == "TOPIC" || msg.command == "TB")
+        linkTopic(link, msg, raw);
+    else if (msg.command == "KICK")
+        linkKick(link, msg, raw);
+    else if (msg.command == "BMASK")
+        linkBmask(link, msg, raw);
+    else if (msg.command == "SID")
+        linkSid(link, msg, raw);
+    else if (msg.command == "SQUIT")
+        linkSquit(link, msg, raw);
+    else if (msg.command == "KILL") {
+        if (Client* user = getClientByUid(msg.param(0)))
+            killUser(user, msg.param(1), link);
+    } else if (msg.command == "EOB")
+        std::cout << GREEN << "✓ Burst from " << msg.source << " complete" << RESET << std::endl;
+}
+
+// SERVER <sid> <password> :<description>
+void Server::linkServer(Link* link, const Message& msg) {
+    const std::string& sid = msg.param(0);
+    if (msg.param(1) != _linkPassword) {
+        dropLink(link, "Bad link password");
+        return;
+    }
+    if (!isValidSid(sid)) {
+        dropLink(link, "Invalid SID " + sid);
+        return;
+    }
+    if (sid == _sid || _servers.count(sid)) {
+        dropLink(link, "Server " + sid + " already exists");
+        return;
+    }
+    link->setPeer(sid, msg.param(2));
+    if (!link->isOutbound())
+        link->send("SERVER " + _sid + " " + _linkPassword + " :" + _description + "\r\n");
+    activateLink(link);
+}
+
+// :<uplink> SID <sid> <hops> :<description>
+void Server::linkSid(Link* link, const Message& msg, const std::string& line) {
+    const std::string& sid = msg.param(0);
+    if (!isValidSid(sid))
+        return;
+    if (sid == _sid || _servers.count(sid)) {
+        // The same server reachable two ways would be a loop
+        dropLink(link, "Server " + sid + " already exists");
+        return;
+    }
+    RemoteServer server;
+    server.route = link;
+    server.uplink = msg.source;
+    server.description = msg.param(2);
+    server.hops = _servers[msg.source].hops + 1;
+    _servers[sid] = server;
+    std::cout << BLUE << "⇄ Server " << sid << " joined behind " << msg.source << RESET << std::endl;
+    sendToLinks(line, link);
+}
+
+// :<sid> UID <uid> <nick> <nickTs> <user> <host> :<realname>
+void Server::linkUid(Link* link, const Message& msg, const std::string& line) {
+    const std::string& uid = msg.param(0);
+    const std::string& nick = msg.param(1);
+    time_t ts = std::strtol(msg.param(2).c_str(), NULL, 10);
+    if (msg.params.size() < 6 || uid.size() != 9 || uid.compare(0, 3, msg.source) != 0
+        || _uidIndex.count(uid) || !isValidNickname(nick))
+        return;
+
+    if (Client* holder = getClientByNickname(nick)) {
+        time_t holderTs = holder->getNickTs();
+        if (holderTs >= ts)
+            killUser(holder, "Nick collision", NULL);
+        if (holderTs <= ts) {
+            // Never introduced here: only its own side needs the KILL
+            link->send(":" + _sid + " KILL " + uid + " :Nick collision\r\n");
+            enableWriteEvent(link->getFd());
+            return;
+        }
+    }
+
+    Client* user = new Client(-1, msg.param(4));
+    user->setUid(uid);
+    user->setNickname(nick);
+    user->setNickTs(ts);
+    setNames(user, msg.param(3), msg.param(5));
+    user->setAuthenticated(true);
+    user->setRegistered(true);
+    _uidIndex[uid] = user;
+    _nickIndex[ircCaseFold(nick)] = user;
+    _hostIndex.insert(std::make_pair(user->getIp(), user));
+    notifyWatchers(nick, RPL_MONONLINE, user->getPrefix().substr(1));
+    sendToLinks(line, link);
+}
+
+// :<sid> SJOIN <chanTs> <#chan> +<modes> :[@]<uid>...
+// Older channel TS: our ops and modes are dropped and theirs applied.
+// Equal: both sides' state is merged. Newer: members join, ops and
+// modes are ignored (the other side will adopt ours).
+void Server::linkSjoin(Link* link, const Message& msg, const std::string& line) {
+    time_t ts = std::strtol(msg.param(0).c_str(), NULL, 10);
+    const std::string& name = msg.param(1);
+    if (msg.params.size() < 4 || !isChannelName(name))
+        return;
+    std::string key = ircCaseFold(name);
+
+    ChannelMap::iterator it = _channels.find(key);
+    bool created = it == _channels.end();
+    if (created)
+        it = _channels.insert(std::make_pair(key, Channel(name, ts))).first;
+    Channel& channel = it->second;
+
+    bool theirs = true;
+    if (!created && ts < channel.getCreationTime()) {
+        channel.setCreationTime(ts);
+        resetChannelModes(channel);
+    } else if (!created && ts > channel.getCreationTime()) {
+        theirs = false;
+    }
+    if (theirs) {
+        std::string appliedArgs;
+        std::string applied = applyModes(channel, msg.param(2), std::vector<std::string>(), 0, SERVER_NAME, appliedArgs);
+        if (!applied.empty())
+            sendToLocalMembers(channel, ":" SERVER_NAME " MODE " + channel.getName() + " " + applied + appliedArgs + "\r\n", NULL);
+    }
+
+    std::vector<std::string> members = splitWords(msg.param(3));
+    for (size_t i = 0; i < members.size(); ++i) {
+        bool op = members[i][0] == '@';
+        Client* user = getClientByUid(op ? members[i].substr(1) : members[i]);
+        if (!user || user->isLocal() || routeOf(user) != link)
+            continue;
+        if (channel.addClient(user)) {
+            user->addChannel(key);
+            sendToLocalMembers(channel, user->getPrefix() + " JOIN " + channel.getName() + "\r\n", user);
+            if (_plugins.wants(PLUGIN_JOIN)) {
+                Message join;
+                join.source = user->getUid();
+                join.command = "JOIN";
+                join.params.push_back(channel.getName());
+                _plugins.join(*user, channel, join);
+            }
+        }
+        if (op && theirs && !channel.isOperator(user)) {
+            channel.addOperator(user);
+            sendToLocalMembers(channel, ":" SERVER_NAME " MODE " + channel.getName() + " +o " + user->getNickname() + "\r\n", NULL);
+        }
+    }
+    if (channel.getClients().empty())
+        _channels.erase(it);
+    sendToLinks(line, link);
+}
+
+// :<uid> PART <#chan> [:<reason>]
+void Server::linkPart(Link* link, const Message& msg, const std::string& line) {
+    Client* user = getClientByUid(msg.source);
+    std::string key = ircCaseFold(msg.param(0));
+    ChannelMap::iterator it = _channels.find(key);
+    if (user && it != _channels.end() && it->second.removeClient(user)) {
+        std::string partMsg = user->getPrefix() + " PART " + it->second.getName();
+        if (msg.params.size() > 1)
+            partMsg.append(" :").append(msg.param(1));
+        sendToLocalMembers(it->second, partMsg + "\r\n", NULL);
+        if (_plugins.wants(PLUGIN_PART))
+            _plugins.part(*user, it->second, msg);
+        user->removeChannel(key);
+        if (it->second.getClients().empty())
+            _channels.erase(it);
+    }
+    sendToLinks(line, link);
+}
+
+// :<uid> KICK <#chan> <uid> [:<reason>]
+void Server::linkKick(Link* link, const Message& msg, const std::string& line) {
+    Client* target = getClientByUid(msg.param(1));
+    std::string key = ircCaseFold(msg.param(0));
+    ChannelMap::iterator it = _channels.find(key);
+    if (target && it != _channels.end() && it->second.hasClient(target)) {
+        std::string kickMsg = sourcePrefix(msg.source) + " KICK " + it->second.getName() + " " + target->getNickname();
+        if (msg.params.size() > 2)
+            kickMsg.append(" :").append(msg.param(2));
+        sendToLocalMembers(it->second, kickMsg + "\r\n", NULL);
+        it->second.removeClient(target);
+        target->removeChannel(key);
+        if (it->second.getClients().empty())
+            _channels.erase(it);
+    }
+    sendToLinks(line, link);
+}
+
+// :<uid> TMODE <chanTs> <#chan> <modes> [<args>...]; a newer channel's
+// modes are stale and go no further
+void Server::linkTmode(Link* link, const Message& msg, const std::string& line) {
+    time_t ts = std::strtol(msg.param(0).c_str(), NULL, 10);
+    Channel* channel = findChannel(msg.param(1));
+    if (channel) {
+        if (ts > channel->getCreationTime())
+            return;
+        std::string prefix = sourcePrefix(msg.source);
+        std::string appliedArgs;
+        std::string applied = applyModes(*channel, msg.param(2), msg.params, 3, prefix.substr(1), appliedArgs);
+        if (!applied.empty())
+            sendToLocalMembers(*channel, prefix + " MODE " + channel->getName() + " " + applied + appliedArgs + "\r\n", NULL);
+    }
+    sendToLinks(line, link);
+}
+
+// :<sid> BMASK <chanTs> <#chan> <b|e|I> :<mask>...
+void Server::linkBmask(Link* link, const Message& msg, const std::string& line) {
+    time_t ts = std::strtol(msg.param(0).c_str(), NULL, 10);
+    Channel* channel = findChannel(msg.param(1));
+    const std::string& type = msg.param(2);
+    if (type.size() != 1 || !std::strchr(LIST_MODES, type[0]))
+        return;
+    if (channel) {
+        if (ts > channel->getCreationTime())
+            return;
+        std::vector<std::string> masks = splitWords(msg.param(3));
+        std::string appliedArgs;
+        std::string applied = applyModes(*channel, "+" + std::string(masks.size(), type[0]), masks, 0,
+                                         SERVER_NAME, appliedArgs);
+        if (!applied.empty())
+            sendToLocalMembers(*channel, ":" SERVER_NAME " MODE " + channel->getName() + " " + applied + appliedArgs + "\r\n", NULL);
+    }
+    sendToLinks(line, link);
+}
+
+// :<uid> TOPIC <#chan> :<topic>, or in a burst :<sid> TB <#chan> <topicTs> :<topic>
+// where the older of two topics is kept
+void Server::linkTopic(Link* link, const Message& msg, const std::string& line) {
+    bool burst = msg.command == "TB";
+    Channel* channel = findChannel(msg.param(0));
+    std::string topic = msg.param(burst ? 2 : 1).substr(0, TOPICLEN);
+    if (channel && burst) {
+        time_t ts = std::strtol(msg.param(1).c_str(), NULL, 10);
+        if (!topic.empty() && (channel->getTopic().empty() || ts < channel->getTopicTime())) {
+            channel->restoreTopic(topic, ts);
+            sendToLocalMembers(*channel, ":" SERVER_NAME " TOPIC " + channel->getName() + " :topic is now: " + topic + "\r\n", NULL);
+        }
+    } else if (channel) {
+        channel->setTopic(topic);
+        sendToLocalMembers(*channel, sourcePrefix(msg.source) + " TOPIC " + channel->getName()
+                           + " :topic is now: " + topic + "\r\n", NULL);
+    }
+    sendToLinks(line, link);
+}
+
+// :<uid> PRIVMSG <#chan> :<text>
+void Server::linkPrivmsg(Link* link, const Message& msg, const std::string& line) {
+    Client* user = getClientByUid(msg.source);
+    Channel* channel = findChannel(msg.param(0));
+    if (!user || !channel || msg.params.size() < 2)
+        return;
+
+    std::string message;
+    message.reserve(user->getPrefix().size() + channel->getName().size() + msg.param(1).size() + 14);
+    message.append(user->getPrefix()).append(" PRIVMSG ").append(channel->getName())
+           .append(" :").append(msg.param(1)).append("\r\n");
+
+    // Every server keeps its own history of the channel
+    const HistoryEntry& entry = channel->history().push(message);
+    _messageLog.append(entry.time, ircCaseFold(channel->getName()), message);
+    const std::vector<Client*>& clients = channel->getClients();
+    for (size_t i = 0; i < clients.size(); ++i) {
+        if (!clients[i]->isLocal())
+            continue;
+        sendHistoryLine(clients[i], entry);
+        enableWriteEvent(clients[i]->getFd());
+    }
+    relayToChannelLinks(*channel, line, link);
+    if (_plugins.wants(PLUGIN_PRIVMSG))
+        _plugins.privmsg(*user, *channel, msg);
+}
+
+// :<uid> NICK <nick> <nickTs>
+void Server::linkNick(Link* link, const Message& msg, const std::string& line) {
+    Client* user = getClientByUid(msg.source);
+    const std::string& nick = msg.param(0);
+    time_t ts = std::strtol(msg.param(1).c_str(), NULL, 10);
+    if (!user || !isValidNickname(nick))
+        return;
+
+    Client* holder = getClientByNickname(nick);
+    if (holder && holder != user) {
+        time_t holderTs = holder->getNickTs();
+        if (holderTs >= ts)
+            killUser(holder, "Nick collision", NULL);
+        if (holderTs <= ts) {
+            killUser(user, "Nick collision", NULL);
+            return;
+        }
+    }
+
+    std::string oldNick = user->getNickname();
+    std::string nickMsg = user->getPrefix() + " NICK " + nick + "\r\n";
+    _nickIndex.erase(ircCaseFold(oldNick));
+    _nickIndex[ircCaseFold(nick)] = user;
+    user->setNickname(nick);
+    user->setNickTs(ts);
+    const std::set<std::string>& joined = user->getChannels();
+    for (std::set<std::string>::const_iterator key = joined.begin(); key != joined.end(); ++key) {
+        ChannelMap::iterator it = _channels.find(*key);
+        if (it != _channels.end())
+            it->second.invalidateNames();
+    }
+    sendToCommonChannels(user, nickMsg);
+    if (ircCaseFold(oldNick) != ircCaseFold(nick)) {
+        notifyWatchers(oldNick, RPL_MONOFFLINE, oldNick);
+        notifyWatchers(nick, RPL_MONONLINE, user->getPrefix().substr(1));
+    }
+    sendToLinks(line, link);
+    if (oldNick != nick && _plugins.wants(PLUGIN_NICK))
+        _plugins.nick(*user, oldNick, msg);
+}
+
+// :<uid> QUIT :<reason>
+void Server::linkQuit(Link* link, const Message& msg, const std::string& line) {
+    Client* user = getClientByUid(msg.source);
+    if (!user)
+        return;
+    removeRemoteUser(user, msg.param(0));
+    sendToLinks(line, link);
+}
+
+// :<sid> SQUIT <sid> :<reason>: that server and everything it introduced is gone
+void Server::linkSquit(Link* link, const Message& msg, const std::string& line) {
+    const std::string& sid = msg.param(0);
+    if (sid == _sid || sid == link->getSid()) {
+        dropLink(link, msg.param(1));
+        return;
+    }
+    ServerMap::iterator it = _servers.find(sid);
+    if (it == _servers.end() || it->second.route != link)
+        return;
+
+    std::set<std::string> gone;
+    gone.insert(sid);
+    for (bool grew = true; grew; ) {
+        grew = false;
+        for (ServerMap::iterator s = _servers.begin(); s != _servers.end(); ++s) {
+            if (gone.count(s->second.uplink) && gone.insert(s->first).second)
+                grew = true;
+        }
+    }
+    removeServers(gone, NETSPLIT_REASON);
+    sendToLinks(line, link);
+}
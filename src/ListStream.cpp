@@ -0,0 +1,88 @@
+#include "includes/ListStream.hpp"
+#include "includes/Server.hpp"
+#include <cstdlib>
+
+// Channels examined per fill() even when none of them match, so a
+// selective filter over a huge network still yields to the event loop.
+#define LIST_SCAN_LIMIT 1024
+
+ListStream::ListStream(const std::string& params)
+    : _minUsers(0), _maxUsers(0), _topicNewer(-1), _topicOlder(-1),
+      _createdNewer(-1), _createdOlder(-1), _started(false) {
+    // Filters may be separated by commas and/or spaces
+    std::string token;
+    for (size_t i = 0; i <= params.size(); ++i) {
+        if (i == params.size() || params[i] == ',' || params[i] == ' ') {
+            if (!token.empty())
+                parseFilter(token);
+            token.clear();
+        } else {
+            token += params[i];
+        }
+    }
+}
+
+void ListStream::parseFilter(const std::string& token) {
+    const char* arg = token.c_str();
+
+    if (token[0] == '>' && token.size() > 1)
+        _minUsers = std::strtoul(arg + 1, NULL, 10) + 1;
+    else if (token[0] == '<' && token.size() > 1)
+        _maxUsers = std::strtoul(arg + 1, NULL, 10);
+    else if ((token[0] == 'T' || token[0] == 't') && token.size() > 2 && (token[1] == '<' || token[1] == '>'))
+        (token[1] == '<' ? _topicNewer : _topicOlder) = std::strtol(arg + 2, NULL, 10);
+    else if ((token[0] == 'C' || token[0] == 'c') && token.size() > 2 && (token[1] == '<' || token[1] == '>'))
+        (token[1] == '<' ? _createdNewer : _createdOlder) = std::strtol(arg + 2, NULL, 10);
+    else if (token[0] == '!' && token.size() > 1)
+        _notMasks.push_back(token.substr(1));
+    else
+        _masks.push_back(token);
+}
+
+bool ListStream::fill(Server& server, Client& client, size_t budget) {
+    std::string& out = client.outputBuffer();
+    const std::string& nick = client.getNickname();
+
+    if (!_started) {
+        Reply::append(out, RPL_LISTSTART, nick, "Channel");
+        _started = true;
+    }
+
+    const ChannelMap& channels = server.getChannels();
+    ChannelMap::const_iterator it = _cursor.empty() ? channels.begin() : channels.upper_bound(_cursor);
+    size_t start = out.size();
+    time_t now = Clock::now();
+
+    for (size_t scanned = 0; it != channels.end() && scanned < LIST_SCAN_LIMIT
+            && out.size() - start < budget; ++it, ++scanned) {
+        _cursor = it->first;
+        const Channel& channel = it->second;
+        size_t users = channel.getClients().size();
+
+        if (users < _minUsers || (_maxUsers && users >= _maxUsers))
+            continue;
+        if (_topicNewer >= 0 && (!channel.getTopicTime() || now - channel.getTopicTime() >= _topicNewer * 60))
+            continue;
+        if (_topicOlder >= 0 && (!channel.getTopicTime() || now - channel.getTopicTime() <= _topicOlder * 60))
+            continue;
+        if (_createdNewer >= 0 && now - channel.getCreationTime() >= _createdNewer * 60)
+            continue;
+        if (_createdOlder >= 0 && now - channel.getCreationTime() <= _createdOlder * 60)
+            continue;
+
+        bool wanted = _masks.empty();
+        for (size_t i = 0; !wanted && i < _masks.size(); ++i)
+            wanted = matchMask(_masks[i], channel.getName());
+        for (size_t i = 0; wanted && i < _notMasks.size(); ++i)
+            wanted = !matchMask(_notMasks[i], channel.getName());
+        if (!wanted)
+            continue;
+
+        Reply::appendText(out, RPL_LIST, nick, channel.getName(), toString(users), channel.getTopic());
+    }
+
+    if (it != channels.end())
+        return false;
+    Reply::append(out, RPL_LISTEND, nick);
+    return true;
+}
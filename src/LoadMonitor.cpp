@@ -0,0 +1,57 @@
+#include "includes/LoadMonitor.hpp"
+#include <cstdlib>
+#include <algorithm>
+
+LoadMonitor::LoadMonitor()
+    : _lagLimitUs(static_cast<uint64_t>(OVERLOAD_LAG_MS) * 1000), _busyLimit(OVERLOAD_BUSY_PCT),
+      _passStart(0), _windowStart(0), _windowBusy(0), _windowLag(0), _windowReady(0),
+      _lag(0), _busy(0), _ready(0), _overloaded(false), _calm(0) {}
+
+void LoadMonitor::configure() {
+    if (const char* lag = std::getenv("IRCSERV_OVERLOAD_LAG_MS"))
+        _lagLimitUs = static_cast<uint64_t>(std::strtoul(lag, NULL, 10)) * 1000;
+    if (const char* busy = std::getenv("IRCSERV_OVERLOAD_BUSY"))
+        _busyLimit = std::min<unsigned long>(std::strtoul(busy, NULL, 10), 100);
+    _windowStart = Metrics::monotonicUs();
+}
+
+void LoadMonitor::beginPass(size_t ready) {
+    _passStart = Metrics::monotonicUs();
+    _windowReady = std::max(_windowReady, ready);
+}
+
+bool LoadMonitor::endPass() {
+    uint64_t now = Metrics::monotonicUs();
+    if (_passStart) {
+        uint64_t elapsed = now - _passStart;
+        _passes.record(elapsed);
+        _windowBusy += elapsed;
+        _windowLag = std::max(_windowLag, elapsed);
+        _passStart = 0;
+    }
+    if (now - _windowStart < LOAD_WINDOW_US)
+        return false;
+
+    _lag = _windowLag;
+    _busy = static_cast<unsigned>(std::min<uint64_t>(_windowBusy * 100 / (now - _windowStart), 100));
+    _ready = _windowReady;
+    _windowStart = now;
+    _windowBusy = 0;
+    _windowLag = 0;
+    _windowReady = 0;
+
+    if (!_lagLimitUs)
+        return false;
+    bool hot = _lag >= _lagLimitUs || _busy >= _busyLimit;
+    if (!_overloaded) {
+        _overloaded = hot;
+        _calm = 0;
+        return _overloaded;
+    }
+    bool calm = _lag < _lagLimitUs / 2 && _busy < _busyLimit / 2;
+    _calm = calm ? _calm + 1 : 0;
+    if (_calm < OVERLOAD_RECOVERY)
+        return false;
+    _overloaded = false;
+    return true;
+}
@@ -0,0 +1,246 @@
+#include "includes/Server.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+#include <sys/un.h>
+#include <sys/stat.h>
+
+// Local listener for bots and bridges on the same host. A connection's
+// uid comes from the kernel (SO_PEERCRED), so a trusted uid is
+// authenticated on accept and goes straight to NICK/USER; any other
+// local user still has to send PASS like a TCP client.
+//
+// The admin socket answers one request per connection with the metrics
+// in Prometheus text format: a plain newline gets the bare text, an
+// HTTP GET (curl --unix-socket) gets it wrapped in an HTTP/1.0 reply.
+namespace {
+
+const size_t ADMIN_REQUEST_MAX = 8192;
+
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    size_t start = 0;
+    while (start <= text.size()) {
+        size_t comma = text.find(',', start);
+        if (comma == std::string::npos)
+            comma = text.size();
+        if (comma > start)
+            items.push_back(text.substr(start, comma - start));
+        start = comma + 1;
+    }
+    return items;
+}
+
+// The uid on the other end of a connected AF_UNIX socket
+bool peerUid(int fd, uid_t& uid) {
+#ifdef SO_PEERCRED
+    struct ucred cred;
+    socklen_t len = sizeof(cred);
+    if (getsockopt(fd, SOL_SOCKET, SO_PEERCRED, &cred, &len) == -1)
+        return false;
+    uid = cred.uid;
+    return true;
+#else
+    gid_t gid;
+    return getpeereid(fd, &uid, &gid) == 0;
+#endif
+}
+
+// Bound and listening; a socket file left by a crash is replaced, one
+// still being listened on means another server owns the path
+int listenUnix(const std::string& path) {
+    struct sockaddr_un addr;
+    std::memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    if (path.size() >= sizeof(addr.sun_path))
+        throw std::runtime_error("Unix socket path too long: " + path);
+    std::strcpy(addr.sun_path, path.c_str());
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd == -1)
+        throw std::runtime_error("Failed to create unix socket: " + std::string(strerror(errno)));
+
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISSOCK(st.st_mode)) {
+        if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == 0) {
+            close(fd);
+            throw std::runtime_error("Unix socket already in use: " + path);
+        }
+        unlink(path.c_str());
+    }
+
+    if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1 || listen(fd, SOMAXCONN) == -1) {
+        std::string error = strerror(errno);
+        close(fd);
+        throw std::runtime_error("Failed to listen on " + path + ": " + error);
+    }
+    return fd;
+}
+
+} // namespace
+
+// IRCSERV_UNIX_SOCKET and IRCSERV_ADMIN_SOCKET name the sockets;
+// IRCSERV_UNIX_TRUSTED lists the uids let in without PASS (our own uid
+// when unset)
+void Server::configureUnixSocket() {
+    _unixTrusted.clear();
+    const char* path = std::getenv("IRCSERV_UNIX_SOCKET");
+    _unixPath = path ? path : "";
+    const char* admin = std::getenv("IRCSERV_ADMIN_SOCKET");
+    _adminPath = admin ? admin : "";
+
+    const char* trusted = std::getenv("IRCSERV_UNIX_TRUSTED");
+    if (!trusted) {
+        _unixTrusted.insert(geteuid());
+        return;
+    }
+    std::vector<std::string> uids = splitList(trusted);
+    for (size_t i = 0; i < uids.size(); ++i) {
+        char* end = NULL;
+        unsigned long uid = std::strtoul(uids[i].c_str(), &end, 10);
+        if (*end != '\0')
+            throw std::runtime_error("Invalid uid in IRCSERV_UNIX_TRUSTED: " + uids[i]);
+        _unixTrusted.insert(static_cast<uid_t>(uid));
+    }
+}
+
+// Either listener may be open already, handed over by a hot upgrade
+void Server::setupUnixSocket() {
+    if (!_unixPath.empty() && _unixSocket == -1) {
+        _unixSocket = listenUnix(_unixPath);
+        setNonBlocking(_unixSocket);
+        watchFd(_unixSocket, POLLIN);
+        std::cout << GREEN << "✓ Listening on " << _unixPath << RESET << std::endl;
+    }
+    if (!_adminPath.empty() && _adminSocket == -1) {
+        _adminSocket = listenUnix(_adminPath);
+        setNonBlocking(_adminSocket);
+        watchFd(_adminSocket, POLLIN);
+        std::cout << GREEN << "✓ Metrics on " << _adminPath << RESET << std::endl;
+    }
+}
+
+// unlinkPaths is false when a hot upgrade handed the sockets on
+void Server::closeUnixSocket(bool unlinkPaths) {
+    while (!_adminConns.empty())
+        closeAdmin(_adminConns.begin()->first);
+    int* listeners[] = { &_unixSocket, &_adminSocket };
+    const std::string* paths[] = { &_unixPath, &_adminPath };
+    for (size_t i = 0; i < 2; ++i) {
+        if (*listeners[i] == -1)
+            continue;
+        forgetPollfd(*listeners[i]);
+        close(*listeners[i]);
+        *listeners[i] = -1;
+        if (unlinkPaths)
+            unlink(paths[i]->c_str());
+    }
+}
+
+void Server::acceptUnixClient() {
+    int clientFd = accept(_unixSocket, NULL, NULL);
+    if (clientFd == -1) {
+        if (errno != EWOULDBLOCK && errno != EAGAIN)
+            std::cerr << "Failed to accept local connection: " << strerror(errno) << std::endl;
+        return;
+    }
+
+    uid_t uid = 0;
+    bool trusted = peerUid(clientFd, uid) && _unixTrusted.count(uid);
+    Client* client = adoptClient(clientFd, "localhost");
+    _capture.open(clientFd, true);
+    _metrics.add(Metrics::CONNECTIONS);
+
+    std::cout << BOLD << GREEN << "✓ New local client (uid " << uid << (trusted ? ", trusted" : "")
+              << ") [fd: " << clientFd << "]" << RESET << std::endl;
+    if (trusted) {
+        client->setAuthenticated(true);
+        sendToClient(clientFd, "Welcome to the IRC server! Authenticated by peer credentials, please register with NICK and USER.\r\n");
+    } else {
+        sendToClient(clientFd, "Welcome to the IRC server! Please authenticate with PASS, NICK, and USER commands.\r\n");
+    }
+}
+
+void Server::acceptAdmin() {
+    int fd = accept(_adminSocket, NULL, NULL);
+    if (fd == -1)
+        return;
+    setNonBlocking(fd);
+    watchFd(fd, POLLIN);
+    AdminRequest& request = _adminConns[fd];
+    request.since = Clock::now();
+    request.answered = false;
+}
+
+// Reads the request, answers once it is complete, then waits for the
+// peer to close so nothing is left unread (which would reset it).
+// "trace" (or GET /trace) asks for the slow command trace instead.
+void Server::handleAdmin(int fd, short revents) {
+    AdminRequest& request = _adminConns[fd];
+    if (revents & (POLLIN | POLLHUP | POLLERR)) {
+        char buffer[1024];
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0 && !(n < 0 && (errno == EWOULDBLOCK || errno == EAGAIN))) {
+            closeAdmin(fd);
+            return;
+        }
+        if (n > 0 && !request.answered) {
+            request.input.append(buffer, n);
+            if (request.input.size() > ADMIN_REQUEST_MAX) {
+                closeAdmin(fd);
+                return;
+            }
+            bool http = request.input.compare(0, 4, "GET ") == 0;
+            if (request.input.find(http ? "\r\n\r\n" : "\n") == std::string::npos)
+                return;
+
+            std::string body;
+            bool trace = request.input.compare(0, http ? 11 : 5, http ? "GET /trace " : "trace") == 0;
+            if (trace)
+                _metrics.renderTrace(body);
+            else
+                renderMetrics(body);
+            if (http) {
+                request.output = "HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: "
+                               + toString(body.size()) + "\r\nConnection: close\r\n\r\n";
+            }
+            request.output += body;
+            request.answered = true;
+            enableWriteEvent(fd);
+        }
+    }
+
+    if (!request.output.empty()) {
+        ssize_t sent = ::send(fd, request.output.data(), request.output.size(), 0);
+        if (sent > 0)
+            request.output.erase(0, sent);
+        else if (sent < 0 && errno != EWOULDBLOCK && errno != EAGAIN) {
+            closeAdmin(fd);
+            return;
+        }
+        if (request.output.empty()) {
+            disableWriteEvent(fd);
+            shutdown(fd, SHUT_WR);
+        }
+    }
+}
+
+void Server::closeAdmin(int fd) {
+    forgetPollfd(fd);
+    close(fd);
+    _adminConns.erase(fd);
+}
+
+// Admin peers that never finish a request or never hang up
+void Server::checkAdmin() {
+    time_t now = Clock::now();
+    std::vector<int> stale;
+    for (std::map<int, AdminRequest>::iterator it = _adminConns.begin(); it != _adminConns.end(); ++it) {
+        if (now - it->second.since >= ADMIN_TIMEOUT)
+            stale.push_back(it->first);
+    }
+    for (size_t i = 0; i < stale.size(); ++i)
+        closeAdmin(stale[i]);
+}
@@ -0,0 +1,80 @@
+#include "includes/Mask.hpp"
+#include "includes/Client.hpp"
+#include "includes/Utils.hpp"
+#include <arpa/inet.h>
+#include <cstdlib>
+
+std::string Mask::normalise(const std::string& raw) {
+    size_t bang = raw.find('!');
+    size_t at = raw.find('@', bang == std::string::npos ? 0 : bang);
+    std::string nick, user, host;
+
+    if (bang == std::string::npos && at == std::string::npos) {
+        nick = raw;
+    } else if (bang == std::string::npos) {
+        user = raw.substr(0, at);
+        host = raw.substr(at + 1);
+    } else {
+        nick = raw.substr(0, bang);
+        user = raw.substr(bang + 1, at == std::string::npos ? std::string::npos : at - bang - 1);
+        if (at != std::string::npos)
+            host = raw.substr(at + 1);
+    }
+    return (nick.empty() ? "*" : nick) + "!" + (user.empty() ? "*" : user) + "@" + (host.empty() ? "*" : host);
+}
+
+void Mask::Part::compile(const std::string& text) {
+    pattern = text;
+    literalLen = text.find_first_of("*?");
+    literal = literalLen == std::string::npos;
+    if (literal)
+        literalLen = text.size();
+    any = text == "*";
+}
+
+bool Mask::Part::matches(const std::string& value) const {
+    if (any)
+        return true;
+    if (literal)
+        return ircEquals(pattern, value);
+    // Cheap reject on the literal prefix before running the glob
+    if (value.size() < literalLen || !ircEqualsN(pattern, value, literalLen))
+        return false;
+    return matchMask(pattern, value);
+}
+
+Mask::Mask(const std::string& raw)
+    : _text(normalise(raw)), _cidr(false), _network(0), _netmask(0) {
+    size_t bang = _text.find('!');
+    size_t at = _text.find('@', bang);
+    _nick.compile(_text.substr(0, bang));
+    _user.compile(_text.substr(bang + 1, at - bang - 1));
+    _host.compile(_text.substr(at + 1));
+
+    // a.b.c.d/n host: compare as a network instead of a string
+    std::string host = _text.substr(at + 1);
+    size_t slash = host.find('/');
+    if (slash != std::string::npos) {
+        struct in_addr addr;
+        char* end = NULL;
+        long bits = std::strtol(host.c_str() + slash + 1, &end, 10);
+        if (*end == '\0' && bits >= 0 && bits <= 32
+            && inet_pton(AF_INET, host.substr(0, slash).c_str(), &addr) == 1) {
+            _netmask = bits == 0 ? 0 : htonl(~0u << (32 - bits));
+            _network = addr.s_addr & _netmask;
+            _cidr = true;
+        }
+    }
+}
+
+const std::string& Mask::str() const {
+    return _text;
+}
+
+bool Mask::matches(const Client& client) const {
+    if (!_nick.matches(client.getNickname()) || !_user.matches(client.getUsername()))
+        return false;
+    if (_cidr)
+        return client.getIpv4() != 0 && (client.getIpv4() & _netmask) == _network;
+    return _host.matches(client.getIp());
+}
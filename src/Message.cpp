@@ -0,0 +1,83 @@
+#include "includes/Message.hpp"
+#include <cctype>
+
+const std::string& Message::param(size_t n) const {
+    static const std::string empty;
+    return n < params.size() ? params[n] : empty;
+}
+
+namespace {
+
+void setParam(Message& out, size_t n, const std::string& line, size_t pos, size_t len) {
+    if (n == out.params.size())
+        out.params.push_back(std::string());
+    out.params[n].assign(line, pos, len);
+}
+
+#define COMMAND_NAME(id, name) name,
+const char* const COMMAND_NAMES[] = { BUILTIN_COMMANDS(COMMAND_NAME) "other" };
+#undef COMMAND_NAME
+
+} // namespace
+
+// A flat scan: the first byte rules out nearly every entry
+CommandId commandId(const std::string& name) {
+    if (name.empty())
+        return CMD_OTHER;
+    for (size_t i = 0; i < CMD_OTHER; ++i) {
+        if (COMMAND_NAMES[i][0] == name[0] && name == COMMAND_NAMES[i])
+            return static_cast<CommandId>(i);
+    }
+    return CMD_OTHER;
+}
+
+const char* commandName(CommandId id) {
+    return COMMAND_NAMES[id];
+}
+
+// Fields are assigned rather than rebuilt, so a Message parsed into over
+// and over reuses the storage of its strings
+bool parseMessage(const std::string& line, Message& out) {
+    out.source.clear();
+    out.command.clear();
+    size_t count = 0;
+
+    size_t pos = 0;
+    size_t end = line.size();
+    while (end > 0 && (line[end - 1] == '\r' || line[end - 1] == '\n'))
+        --end;
+
+    if (pos < end && line[pos] == ':') {
+        size_t space = line.find(' ', pos);
+        if (space == std::string::npos || space >= end) {
+            out.params.clear();
+            return false;
+        }
+        out.source.assign(line, pos + 1, space - pos - 1);
+        pos = space;
+    }
+
+    while (pos < end) {
+        while (pos < end && line[pos] == ' ')
+            ++pos;
+        if (pos >= end)
+            break;
+        if (!out.command.empty() && line[pos] == ':') {
+            setParam(out, count++, line, pos + 1, end - pos - 1);
+            break;
+        }
+        size_t space = line.find(' ', pos);
+        if (space == std::string::npos || space > end)
+            space = end;
+        if (out.command.empty())
+            out.command.assign(line, pos, space - pos);
+        else
+            setParam(out, count++, line, pos, space - pos);
+        pos = space;
+    }
+    out.params.resize(count);
+
+    for (size_t i = 0; i < out.command.size(); ++i)
+        out.command[i] = toupper(static_cast<unsigned char>(out.command[i]));
+    return !out.command.empty();
+}
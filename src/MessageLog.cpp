@@ -0,0 +1,444 @@
+#include "includes/MessageLog.hpp"
+#include <algorithm>
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <ctime>
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+namespace {
+
+// FNV-1a, only used to skip other channels' records in the index
+uint32_t hashKey(const std::string& key) {
+    uint32_t hash = 2166136261u;
+    for (size_t i = 0; i < key.size(); ++i) {
+        hash ^= static_cast<unsigned char>(key[i]);
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+// Bytes written; fewer than `len` on an error (errno says which)
+size_t writeAll(int fd, const char* data, size_t len) {
+    size_t done = 0;
+    while (done < len) {
+        ssize_t n = write(fd, data + done, len - done);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            break;
+        }
+        done += n;
+    }
+    return done;
+}
+
+bool readAll(int fd, char* data, size_t len, off_t offset) {
+    while (len > 0) {
+        ssize_t n = pread(fd, data, len, offset);
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR)
+                continue;
+            return false;
+        }
+        data += n;
+        len -= n;
+        offset += n;
+    }
+    return true;
+}
+
+// The writer's own fsync timer. Not Clock: that belongs to the event
+// loop thread and may be stepped by hand, while this feeds a
+// pthread_cond_timedwait() deadline, which is on CLOCK_REALTIME.
+uint64_t realTimeMillis() {
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000 + now.tv_nsec / 1000000;
+}
+
+} // namespace
+
+MessageLog::MessageLog()
+    : _policy(FSYNC_INTERVAL), _enabled(false), _threadStarted(false), _stopping(false), _flushing(false),
+      _dropped(0),
+      _logFd(-1), _indexFd(-1), _segmentSize(0), _indexSize(0), _lastSync(0) {
+    pthread_mutex_init(&_mutex, NULL);
+    pthread_cond_init(&_wake, NULL);
+    pthread_cond_init(&_flushed, NULL);
+}
+
+MessageLog::~MessageLog() {
+    close();
+    pthread_cond_destroy(&_flushed);
+    pthread_cond_destroy(&_wake);
+    pthread_mutex_destroy(&_mutex);
+}
+
+void MessageLog::open() {
+    if (_threadStarted)
+        return;
+    _segments.clear();
+    _dropped = 0;
+
+    const char* dir = std::getenv("IRCSERV_LOG_DIR");
+    _dir = dir ? dir : "";
+    if (_dir.empty())
+        return;
+
+    const char* policy = std::getenv("IRCSERV_LOG_FSYNC");
+    if (policy && std::strcmp(policy, "always") == 0)
+        _policy = FSYNC_ALWAYS;
+    else if (policy && std::strcmp(policy, "never") == 0)
+        _policy = FSYNC_NEVER;
+    else
+        _policy = FSYNC_INTERVAL;
+
+    if (mkdir(_dir.c_str(), 0755) < 0 && errno != EEXIST) {
+        std::cerr << "Message log disabled: cannot create " << _dir << ": " << strerror(errno) << std::endl;
+        return;
+    }
+
+    // Existing segments stay readable; new messages go to a fresh one
+    DIR* handle = opendir(_dir.c_str());
+    if (!handle) {
+        std::cerr << "Message log disabled: cannot read " << _dir << ": " << strerror(errno) << std::endl;
+        return;
+    }
+    while (struct dirent* entry = readdir(handle)) {
+        unsigned int number;
+        char ext[8];
+        if (std::sscanf(entry->d_name, "%8u.%3s", &number, ext) == 2 && std::strcmp(ext, "idx") == 0)
+            _segments.push_back(number);
+    }
+    closedir(handle);
+    std::sort(_segments.begin(), _segments.end());
+
+    if (pthread_create(&_thread, NULL, &MessageLog::writerMain, this) != 0) {
+        std::cerr << "Message log disabled: cannot start writer thread" << std::endl;
+        return;
+    }
+    _threadStarted = true;
+    _enabled = true;
+}
+
+bool MessageLog::enabled() const {
+    return _enabled;
+}
+
+void MessageLog::append(uint64_t time, const std::string& channelKey, const std::string& line) {
+    if (!_enabled)
+        return;
+
+    LogRecordHeader header;
+    header.time = time;
+    header.channelLen = channelKey.size();
+    header.lineLen = line.size();
+
+    LogIndexEntry entry;
+    entry.time = time;
+    entry.channelHash = hashKey(channelKey);
+    entry.length = sizeof(header) + channelKey.size() + line.size();
+
+    pthread_mutex_lock(&_mutex);
+    if (_pending.size() + entry.length > MSGLOG_PENDING_MAX) {
+        ++_dropped;     // The disk is not keeping up; memory stays bounded
+        pthread_mutex_unlock(&_mutex);
+        return;
+    }
+    bool wasEmpty = _pending.empty();
+    entry.offset = _pending.size();
+    _pending.append(reinterpret_cast<const char*>(&header), sizeof(header));
+    _pending.append(channelKey);
+    _pending.append(line);
+    _pendingIndex.push_back(entry);
+    if (wasEmpty)
+        pthread_cond_signal(&_wake);
+    pthread_mutex_unlock(&_mutex);
+}
+
+uint64_t MessageLog::dropped() const {
+    pthread_mutex_lock(&_mutex);
+    uint64_t dropped = _dropped;
+    pthread_mutex_unlock(&_mutex);
+    return dropped;
+}
+
+void MessageLog::flush() {
+    if (!_threadStarted)
+        return;
+    pthread_mutex_lock(&_mutex);
+    _flushing = true;
+    pthread_cond_signal(&_wake);
+    while (_flushing)
+        pthread_cond_wait(&_flushed, &_mutex);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void MessageLog::close() {
+    if (!_threadStarted)
+        return;
+    pthread_mutex_lock(&_mutex);
+    _stopping = true;
+    pthread_cond_signal(&_wake);
+    pthread_mutex_unlock(&_mutex);
+    pthread_join(_thread, NULL);
+    _threadStarted = false;
+    _stopping = false;
+    _enabled = false;
+}
+
+void* MessageLog::writerMain(void* self) {
+    static_cast<MessageLog*>(self)->writerLoop();
+    return NULL;
+}
+
+void MessageLog::writerLoop() {
+    std::string data;
+    std::vector<LogIndexEntry> index;
+    bool dirty = false;
+
+    pthread_mutex_lock(&_mutex);
+    for (;;) {
+        while (!_stopping && !_flushing && _pending.empty()) {
+            if (!dirty) {
+                pthread_cond_wait(&_wake, &_mutex);
+                continue;
+            }
+            // Unsynced data under the interval policy: sleep until it is due
+            uint64_t due = _lastSync + MSGLOG_FSYNC_INTERVAL;
+            struct timespec deadline;
+            deadline.tv_sec = due / 1000;
+            deadline.tv_nsec = (due % 1000) * 1000000;
+            if (pthread_cond_timedwait(&_wake, &_mutex, &deadline) == ETIMEDOUT) {
+                pthread_mutex_unlock(&_mutex);
+                syncSegment();
+                dirty = false;
+                pthread_mutex_lock(&_mutex);
+            }
+        }
+        if (_pending.empty() && _stopping)
+            break;      // Stopping and fully drained
+        if (_pending.empty()) {
+            // A flush: everything queued before it is written; the next
+            // batch opens a new segment
+            pthread_mutex_unlock(&_mutex);
+            closeSegment();
+            dirty = false;
+            pthread_mutex_lock(&_mutex);
+            _flushing = false;
+            pthread_cond_broadcast(&_flushed);
+            continue;
+        }
+
+        // Take the whole batch; appends go to a fresh buffer meanwhile
+        data.swap(_pending);
+        index.swap(_pendingIndex);
+        pthread_mutex_unlock(&_mutex);
+
+        writeBatch(data, index);
+        data.clear();
+        index.clear();
+        if (_policy == FSYNC_ALWAYS
+            || (_policy == FSYNC_INTERVAL && realTimeMillis() >= _lastSync + MSGLOG_FSYNC_INTERVAL)) {
+            syncSegment();
+            dirty = false;
+        } else {
+            dirty = _policy == FSYNC_INTERVAL;
+        }
+
+        pthread_mutex_lock(&_mutex);
+    }
+    pthread_mutex_unlock(&_mutex);
+    closeSegment();
+}
+
+void MessageLog::writeBatch(std::string& data, std::vector<LogIndexEntry>& index) {
+    if (_logFd < 0 || _segmentSize >= MSGLOG_SEGMENT_BYTES) {
+        closeSegment();
+        pthread_mutex_lock(&_mutex);
+        unsigned int number = _segments.empty() ? 1 : _segments.back() + 1;
+        pthread_mutex_unlock(&_mutex);
+        openSegment(number);
+    }
+    if (_logFd < 0) {
+        pthread_mutex_lock(&_mutex);
+        _dropped += index.size();
+        pthread_mutex_unlock(&_mutex);
+        return;
+    }
+
+    for (size_t i = 0; i < index.size(); ++i)
+        index[i].offset += _segmentSize;
+
+    // Records first: an index entry never points past written data. A
+    // short write is cut back off, so both files end on a whole record
+    // and every offset stays right, and the next batch starts a new
+    // segment rather than appending after a failure.
+    size_t indexBytes = index.size() * sizeof(LogIndexEntry);
+    size_t written = writeAll(_logFd, data.data(), data.size());
+    if (written == data.size()) {
+        written = writeAll(_indexFd, reinterpret_cast<const char*>(&index[0]), indexBytes);
+        if (written == indexBytes) {
+            _segmentSize += data.size();
+            _indexSize += indexBytes;
+            return;
+        }
+        std::cerr << "Message log index write failed: " << strerror(errno) << std::endl;
+        undoPartialWrite(_indexFd, _indexSize);
+    } else {
+        std::cerr << "Message log write failed: " << strerror(errno) << std::endl;
+    }
+    undoPartialWrite(_logFd, _segmentSize);
+    closeSegment();
+
+    pthread_mutex_lock(&_mutex);
+    _dropped += index.size();
+    pthread_mutex_unlock(&_mutex);
+}
+
+bool MessageLog::undoPartialWrite(int fd, uint64_t size) {
+    if (ftruncate(fd, size) == 0)
+        return true;
+    std::cerr << "Message log: cannot truncate a partial write: " << strerror(errno) << std::endl;
+    return false;
+}
+
+void MessageLog::openSegment(unsigned int number) {
+    _logFd = ::open(segmentPath(number, "log").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    _indexFd = ::open(segmentPath(number, "idx").c_str(), O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (_logFd < 0 || _indexFd < 0) {
+        std::cerr << "Message log: cannot open segment " << number << ": " << strerror(errno) << std::endl;
+        closeSegment();
+        return;
+    }
+    // Normally new and empty; sizes come from the files in case it is not
+    struct stat logStat, indexStat;
+    if (fstat(_logFd, &logStat) < 0 || fstat(_indexFd, &indexStat) < 0
+        || indexStat.st_size % sizeof(LogIndexEntry) != 0) {
+        std::cerr << "Message log: unusable segment " << number << std::endl;
+        closeSegment();
+        return;
+    }
+    _segmentSize = logStat.st_size;
+    _indexSize = indexStat.st_size;
+    _lastSync = realTimeMillis();
+
+    pthread_mutex_lock(&_mutex);
+    _segments.push_back(number);
+    pthread_mutex_unlock(&_mutex);
+}
+
+void MessageLog::closeSegment() {
+    if (_logFd >= 0) {
+        if (_policy != FSYNC_NEVER)
+            syncSegment();
+        ::close(_logFd);
+    }
+    if (_indexFd >= 0)
+        ::close(_indexFd);
+    _logFd = -1;
+    _indexFd = -1;
+}
+
+void MessageLog::syncSegment() {
+    if (_logFd >= 0)
+        fdatasync(_logFd);
+    if (_indexFd >= 0)
+        fdatasync(_indexFd);
+    _lastSync = realTimeMillis();
+}
+
+std::string MessageLog::segmentPath(unsigned int number, const char* ext) const {
+    char name[32];
+    std::snprintf(name, sizeof(name), "/%08u.%s", number, ext);
+    return _dir + name;
+}
+
+void MessageLog::query(const std::string& channelKey, uint64_t from, uint64_t to,
+                       size_t limit, bool newest, std::vector<LogRecord>& out) const {
+    out.clear();
+    if (_dir.empty() || limit == 0)
+        return;
+
+    pthread_mutex_lock(&_mutex);
+    std::vector<unsigned int> segments(_segments);
+    pthread_mutex_unlock(&_mutex);
+
+    size_t budget = MSGLOG_QUERY_SCAN_MAX;
+    if (newest) {
+        for (size_t i = segments.size(); i-- > 0 && out.size() < limit && budget > 0; )
+            scanSegment(segments[i], channelKey, from, to, limit, true, budget, out);
+        std::reverse(out.begin(), out.end());
+    } else {
+        for (size_t i = 0; i < segments.size() && out.size() < limit && budget > 0; ++i)
+            scanSegment(segments[i], channelKey, from, to, limit, false, budget, out);
+    }
+}
+
+// Appends matches in scan order (newest first when `newest`)
+void MessageLog::scanSegment(unsigned int number, const std::string& channelKey, uint64_t from, uint64_t to,
+                             size_t limit, bool newest, size_t& budget, std::vector<LogRecord>& out) const {
+    int indexFd = ::open(segmentPath(number, "idx").c_str(), O_RDONLY);
+    if (indexFd < 0)
+        return;
+    struct stat st;
+    size_t count = fstat(indexFd, &st) == 0 ? st.st_size / sizeof(LogIndexEntry) : 0;
+    if (count == 0) {
+        ::close(indexFd);
+        return;
+    }
+    void* mapped = mmap(NULL, count * sizeof(LogIndexEntry), PROT_READ, MAP_SHARED, indexFd, 0);
+    ::close(indexFd);
+    if (mapped == MAP_FAILED)
+        return;
+    const LogIndexEntry* entries = static_cast<const LogIndexEntry*>(mapped);
+
+    // [first, last) is the slice with from <= time <= to
+    size_t lo = 0, hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].time < from) lo = mid + 1; else hi = mid;
+    }
+    size_t first = lo;
+    hi = count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (entries[mid].time <= to) lo = mid + 1; else hi = mid;
+    }
+    size_t last = lo;
+
+    uint32_t hash = hashKey(channelKey);
+    int logFd = -1;
+    std::string record;
+    for (size_t n = first; n < last && out.size() < limit && budget > 0; ++n, --budget) {
+        const LogIndexEntry& entry = entries[newest ? last - 1 - (n - first) : n];
+        if (entry.channelHash != hash)
+            continue;
+        if (logFd < 0 && (logFd = ::open(segmentPath(number, "log").c_str(), O_RDONLY)) < 0)
+            break;
+
+        record.resize(entry.length);
+        if (!readAll(logFd, &record[0], entry.length, entry.offset))
+            continue;
+        LogRecordHeader header;
+        std::memcpy(&header, record.data(), sizeof(header));
+        if (sizeof(header) + header.channelLen + header.lineLen != entry.length
+            || record.compare(sizeof(header), header.channelLen, channelKey) != 0)
+            continue;   // Hash collision or damaged record
+
+        LogRecord result;
+        result.time = header.time;
+        result.line = record.substr(sizeof(header) + header.channelLen);
+        out.push_back(result);
+    }
+    if (logFd >= 0)
+        ::close(logFd);
+    munmap(mapped, count * sizeof(LogIndexEntry));
+}
@@ -0,0 +1,221 @@
+#include "includes/Metrics.hpp"
+#include "includes/Utils.hpp"
+#include <cctype>
+#include <algorithm>
+#include <cstdlib>
+#include <cstdio>
+#include <sys/time.h>
+
+namespace {
+
+struct CounterInfo {
+    const char* metric;
+    const char* help;
+};
+
+#define METRIC_INFO(name, metric, help) { metric, help },
+const CounterInfo COUNTERS[] = { METRIC_COUNTERS(METRIC_INFO) };
+#undef METRIC_INFO
+
+#define METRIC_LABEL(name, label) label,
+const char* const DISCONNECTS[] = { METRIC_DISCONNECTS(METRIC_LABEL) };
+#undef METRIC_LABEL
+
+void header(std::string& out, const std::string& metric, const char* help, const char* type) {
+    out.append("# HELP ").append(metric).append(" ").append(help).append("\n");
+    out.append("# TYPE ").append(metric).append(" ").append(type).append("\n");
+}
+
+void sample(std::string& out, const std::string& metric, const std::string& labels, uint64_t value) {
+    out.append(metric);
+    if (!labels.empty())
+        out.append("{").append(labels).append("}");
+    out.append(" ").append(toString(value)).append("\n");
+}
+
+// Cumulative buckets, then _sum and _count, as Prometheus expects
+void histogram(std::string& out, const std::string& metric, const std::string& labels, const Histogram& h) {
+    uint64_t cumulative = 0;
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i) {
+        cumulative += h.buckets[i];
+        std::string le = i + 1 < HISTOGRAM_BUCKETS ? toString(Histogram::upperBound(i)) : "+Inf";
+        sample(out, metric + "_bucket", (labels.empty() ? "" : labels + ",") + "le=\"" + le + "\"", cumulative);
+    }
+    sample(out, metric + "_sum", labels, h.sum);
+    sample(out, metric + "_count", labels, h.count);
+}
+
+} // namespace
+
+Histogram::Histogram() : count(0), sum(0), max(0) {
+    for (size_t i = 0; i < HISTOGRAM_BUCKETS; ++i)
+        buckets[i] = 0;
+}
+
+void Histogram::record(uint64_t value) {
+    size_t bucket = 0;
+    while (bucket + 1 < HISTOGRAM_BUCKETS && (value >> bucket))
+        ++bucket;
+    ++buckets[bucket];
+    ++count;
+    sum += value;
+    if (value > max)
+        max = value;
+}
+
+uint64_t Histogram::upperBound(size_t bucket) {
+    return (static_cast<uint64_t>(1) << bucket) - 1;
+}
+
+uint64_t Histogram::quantile(double q) const {
+    if (!count)
+        return 0;
+    uint64_t rank = static_cast<uint64_t>(q * (count - 1)) + 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i + 1 < HISTOGRAM_BUCKETS; ++i) {
+        seen += buckets[i];
+        if (seen >= rank)
+            return std::min(upperBound(i), max);
+    }
+    return max;
+}
+
+Metrics::Metrics()
+    : _current(NULL), _currentName(NULL), _currentFd(-1), _started(0), _callFanOut(0),
+      _traceThresholdUs(0), _markCount(0), _traceNext(0) {
+    for (size_t i = 0; i < COUNTER_COUNT; ++i)
+        _counters[i] = 0;
+    for (size_t i = 0; i < DISCONNECT_COUNT; ++i)
+        _disconnects[i] = 0;
+    for (size_t i = 0; i < CMD_OTHER; ++i)
+        _builtins[i] = NULL;
+}
+
+void Metrics::configure() {
+    if (const char* threshold = std::getenv("IRCSERV_TRACE_SLOW_US"))
+        _traceThresholdUs = std::strtoul(threshold, NULL, 10);
+}
+
+uint64_t Metrics::monotonicUs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+// Command names come from clients, so the label set is capped and only
+// plain words become labels; built-in commands always get theirs. Only
+// the first line of each built-in searches the map.
+void Metrics::beginCommand(CommandId id, const std::string& command, size_t bytes, int fd) {
+    std::pair<const std::string, CommandStats>* entry = id != CMD_OTHER ? _builtins[id] : NULL;
+    if (!entry) {
+        std::map<std::string, CommandStats>::iterator it = _commands.find(command);
+        if (it == _commands.end()) {
+            bool word = !command.empty() && command.size() <= 16;
+            for (size_t i = 0; i < command.size() && word; ++i)
+                word = isalnum(static_cast<unsigned char>(command[i]));
+            bool labelled = id != CMD_OTHER || (word && _commands.size() < METRIC_COMMANDS_MAX);
+            it = _commands.insert(std::make_pair(labelled ? command : "other", CommandStats())).first;
+        }
+        entry = &*it;
+        if (id != CMD_OTHER)
+            _builtins[id] = entry;
+    }
+    _current = &entry->second;
+    _current->calls++;
+    _current->bytes += bytes;
+    _counters[MESSAGES_IN]++;
+    _currentName = &entry->first;
+    _currentFd = fd;
+    _callFanOut = 0;
+    _markCount = 0;
+    _started = monotonicUs();
+}
+
+void Metrics::endCommand() {
+    if (!_current)
+        return;
+    uint64_t elapsed = monotonicUs() - _started;
+    _current->latency.record(elapsed);
+    _current->fanOutSizes.record(_callFanOut);
+
+    if (_traceThresholdUs && elapsed >= _traceThresholdUs) {
+        if (_trace.size() < TRACE_RING)
+            _trace.push_back(TraceSpan());
+        TraceSpan& span = _trace[_traceNext];
+        _traceNext = (_traceNext + 1) % TRACE_RING;
+
+        struct timeval wall;
+        gettimeofday(&wall, NULL);
+        span.startUs = static_cast<uint64_t>(wall.tv_sec) * 1000000 + wall.tv_usec - elapsed;
+        span.durationUs = elapsed;
+        span.command = *_currentName;
+        span.fd = _currentFd;
+        span.fanOut = _callFanOut;
+        span.marks.assign(_marks, _marks + _markCount);
+    }
+    _current = NULL;
+}
+
+// <unix time> <command> fd=<fd> <duration>us fanout=<n> [<phase>=+<offset>us...]
+void Metrics::renderTrace(std::string& out) const {
+    for (size_t n = 0; n < _trace.size(); ++n) {
+        const TraceSpan& span = _trace[_trace.size() < TRACE_RING ? n : (_traceNext + n) % TRACE_RING];
+        char start[32];
+        snprintf(start, sizeof(start), "%lu.%06lu", static_cast<unsigned long>(span.startUs / 1000000),
+                 static_cast<unsigned long>(span.startUs % 1000000));
+        out.append(start).append(" ").append(span.command)
+           .append(" fd=").append(toString(span.fd))
+           .append(" ").append(toString(span.durationUs)).append("us")
+           .append(" fanout=").append(toString(span.fanOut));
+        for (size_t i = 0; i < span.marks.size(); ++i)
+            out.append(" ").append(span.marks[i].label).append("=+").append(toString(span.marks[i].offset)).append("us");
+        out.append("\n");
+    }
+}
+
+void Metrics::render(std::string& out) const {
+    for (size_t i = 0; i < COUNTER_COUNT; ++i) {
+        std::string metric = std::string("ircserv_") + COUNTERS[i].metric + "_total";
+        header(out, metric, COUNTERS[i].help, "counter");
+        sample(out, metric, "", _counters[i]);
+    }
+
+    header(out, "ircserv_disconnects_total", "Clients gone, by cause", "counter");
+    for (size_t i = 0; i < DISCONNECT_COUNT; ++i)
+        sample(out, "ircserv_disconnects_total", std::string("reason=\"") + DISCONNECTS[i] + "\"", _disconnects[i]);
+
+    static const char* const columns[][2] = {
+        { "ircserv_command_calls_total", "Lines received, by command" },
+        { "ircserv_command_bytes_total", "Bytes received, by command" },
+        { "ircserv_command_fanout_total", "Lines queued for other users, by command" }
+    };
+    for (size_t c = 0; c < 3; ++c) {
+        header(out, columns[c][0], columns[c][1], "counter");
+        for (std::map<std::string, CommandStats>::const_iterator it = _commands.begin(); it != _commands.end(); ++it) {
+            uint64_t value = c == 0 ? it->second.calls : c == 1 ? it->second.bytes : it->second.fanOut;
+            sample(out, columns[c][0], "command=\"" + it->first + "\"", value);
+        }
+    }
+
+    header(out, "ircserv_command_duration_microseconds", "Time spent handling a line, by command", "histogram");
+    for (std::map<std::string, CommandStats>::const_iterator it = _commands.begin(); it != _commands.end(); ++it)
+        histogram(out, "ircserv_command_duration_microseconds", "command=\"" + it->first + "\"", it->second.latency);
+    header(out, "ircserv_command_fanout_lines", "Lines queued for other users per call, by command", "histogram");
+    for (std::map<std::string, CommandStats>::const_iterator it = _commands.begin(); it != _commands.end(); ++it)
+        histogram(out, "ircserv_command_fanout_lines", "command=\"" + it->first + "\"", it->second.fanOutSizes);
+}
+
+void Metrics::renderGauge(std::string& out, const char* metric, const char* help, uint64_t value) {
+    header(out, metric, help, "gauge");
+    sample(out, metric, "", value);
+}
+
+void Metrics::renderCounter(std::string& out, const char* metric, const char* help, uint64_t value) {
+    header(out, metric, help, "counter");
+    sample(out, metric, "", value);
+}
+
+void Metrics::renderHistogram(std::string& out, const char* metric, const char* help, const Histogram& h) {
+    header(out, metric, help, "histogram");
+    histogram(out, metric, "", h);
+}
@@ -0,0 +1,118 @@
+#include "includes/Motd.hpp"
+#include "includes/Clock.hpp"
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+Motd::Motd(const std::string& path)
+    : _path(path), _loaded(false), _lastCheck(0), _dev(0), _ino(0), _size(0), _mtime(0) {
+}
+
+Motd::~Motd() {
+}
+
+const ReplyTemplate& Motd::block() const {
+    return _block;
+}
+
+void Motd::refresh() {
+    time_t now = Clock::now();
+    if (_loaded && now == _lastCheck)
+        return;
+    _lastCheck = now;
+
+    struct stat st;
+    if (stat(_path.c_str(), &st) == -1) {
+        if (!_loaded || _ino != 0) {
+            // File missing (or gone since last time): serve 422
+            std::string rendered;
+            Reply::append(rendered, ERR_NOMOTD, ReplyTemplate::nickSlot());
+            _block.assign(rendered);
+            _dev = 0;
+            _ino = 0;
+            _loaded = true;
+        }
+        return;
+    }
+    if (_loaded && st.st_dev == _dev && st.st_ino == _ino
+        && st.st_size == _size && st.st_mtime == _mtime)
+        return;
+
+    _dev = st.st_dev;
+    _ino = st.st_ino;
+    _size = st.st_size;
+    _mtime = st.st_mtime;
+    load();
+    _loaded = true;
+}
+
+// Plain read() up to EOF rather than mmap of the size refresh() saw: a
+// file truncated in between would fault past its new end.
+void Motd::load() {
+    int fd = open(_path.c_str(), O_RDONLY);
+    if (fd == -1) {
+        frame(NULL, 0);
+        return;
+    }
+
+    std::string data;
+    data.reserve(static_cast<size_t>(_size));
+    char buffer[4096];
+    for (;;) {
+        ssize_t n = read(fd, buffer, sizeof(buffer));
+        if (n == 0)
+            break;
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            close(fd);
+            frame(NULL, 0);
+            return;
+        }
+        data.append(buffer, n);
+    }
+    close(fd);
+    frame(data.data(), data.size());
+}
+
+// Turn the raw file into ready-to-send 372 lines, splitting anything that
+// would not fit into a single IRC line.
+void Motd::frame(const char* data, size_t len) {
+    const std::string& nick = ReplyTemplate::nickSlot();
+    std::string rendered;
+
+    if (!data) {
+        Reply::append(rendered, ERR_NOMOTD, nick);
+        _block.assign(rendered);
+        return;
+    }
+
+    const size_t maxText = IRC_LINE_MAX - (sizeof(":" SERVER_NAME " 372 ") - 1) - NICKLEN - 2 - 2 - 2;
+    Reply::appendText(rendered, RPL_MOTDSTART, nick, "- " SERVER_NAME " Message of the day - ");
+
+    size_t pos = 0;
+    while (pos < len) {
+        const char* nl = static_cast<const char*>(memchr(data + pos, '\n', len - pos));
+        size_t end = nl ? static_cast<size_t>(nl - data) : len;
+        size_t lineEnd = end;
+        if (lineEnd > pos && data[lineEnd - 1] == '\r')
+            --lineEnd;
+
+        do {
+            size_t chunk = lineEnd - pos < maxText ? lineEnd - pos : maxText;
+            std::string text("- ");
+            for (size_t i = pos; i < pos + chunk; ++i) {
+                if (data[i] != '\0')   // NUL would clash with the nick slot
+                    text += data[i];
+            }
+            Reply::appendText(rendered, RPL_MOTD, nick, text);
+            pos += chunk;
+        } while (pos < lineEnd);
+
+        pos = end + 1;
+    }
+    Reply::append(rendered, RPL_ENDOFMOTD, nick);
+    _block.assign(rendered);
+}
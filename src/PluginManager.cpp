@@ -0,0 +1,183 @@
+#include "includes/PluginManager.hpp"
+#include "includes/Server.hpp"
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <algorithm>
+#include <dlfcn.h>
+
+namespace {
+
+// Index into _subscribers for one PluginEvent bit
+size_t slot(PluginEvent event) {
+    size_t index = 0;
+    while ((1 << index) != event)
+        ++index;
+    return index;
+}
+
+std::string upper(const std::string& text) {
+    std::string out(text);
+    for (size_t i = 0; i < out.size(); ++i)
+        out[i] = toupper(static_cast<unsigned char>(out[i]));
+    return out;
+}
+
+} // namespace
+
+PluginManager::PluginManager(Server& server) : _server(server), _events(0) {
+}
+
+PluginManager::~PluginManager() {
+    unloadAll();
+}
+
+void PluginManager::configure() {
+    const char* list = std::getenv("IRCSERV_PLUGINS");
+    std::string paths = list ? list : "";
+    size_t start = 0;
+    while (start < paths.size()) {
+        size_t comma = paths.find(',', start);
+        if (comma == std::string::npos)
+            comma = paths.size();
+        if (comma > start)
+            load(paths.substr(start, comma - start));
+        start = comma + 1;
+    }
+}
+
+void PluginManager::load(const std::string& path) {
+    void* handle = dlopen(path.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if (!handle)
+        throw std::runtime_error("Cannot load plugin " + path + ": " + dlerror());
+
+    // POSIX leaves function pointers from void* to the platform; dlsym relies on it
+    PluginEntry entry = NULL;
+    void* symbol = dlsym(handle, PLUGIN_ENTRY);
+    std::memcpy(&entry, &symbol, sizeof(entry));
+    Plugin* plugin = entry ? entry(*this) : NULL;
+    if (!plugin) {
+        forgetUnowned();        // Anything it registered before giving up
+        dlclose(handle);
+        throw std::runtime_error("Plugin " + path + " has no usable " PLUGIN_ENTRY "()");
+    }
+
+    Loaded loaded;
+    loaded.path = path;
+    loaded.handle = handle;
+    loaded.plugin = plugin;
+    _loaded.push_back(loaded);
+    std::cout << GREEN << "✓ Loaded plugin " << plugin->name() << " from " << path << RESET << std::endl;
+}
+
+// Newest first, so a plugin never outlives one it was loaded after
+void PluginManager::unloadAll() {
+    _commands.clear();
+    for (size_t i = 0; i < PLUGIN_EVENTS; ++i)
+        _subscribers[i].clear();
+    _events = 0;
+    while (!_loaded.empty()) {
+        Loaded& loaded = _loaded.back();
+        delete loaded.plugin;
+        dlclose(loaded.handle);
+        _loaded.pop_back();
+    }
+}
+
+void PluginManager::forgetUnowned() {
+    std::set<Plugin*> owned;
+    for (size_t i = 0; i < _loaded.size(); ++i)
+        owned.insert(_loaded[i].plugin);
+
+    for (std::map<std::string, Plugin*>::iterator it = _commands.begin(); it != _commands.end(); ) {
+        if (owned.count(it->second))
+            ++it;
+        else
+            _commands.erase(it++);
+    }
+    _events = 0;
+    for (size_t i = 0; i < PLUGIN_EVENTS; ++i) {
+        std::vector<Plugin*> kept;
+        for (size_t j = 0; j < _subscribers[i].size(); ++j) {
+            if (owned.count(_subscribers[i][j]))
+                kept.push_back(_subscribers[i][j]);
+        }
+        _subscribers[i].swap(kept);
+        if (!_subscribers[i].empty())
+            _events |= 1 << i;
+    }
+}
+
+bool PluginManager::command(Client& client, const Message& msg) {
+    std::map<std::string, Plugin*>::iterator it = _commands.find(msg.command);
+    if (it == _commands.end())
+        return false;
+    it->second->onCommand(client, msg);
+    return true;
+}
+
+void PluginManager::join(Client& client, Channel& channel, const Message& msg) {
+    std::vector<Plugin*>& plugins = _subscribers[slot(PLUGIN_JOIN)];
+    for (size_t i = 0; i < plugins.size(); ++i)
+        plugins[i]->onJoin(client, channel, msg);
+}
+
+void PluginManager::part(Client& client, Channel& channel, const Message& msg) {
+    std::vector<Plugin*>& plugins = _subscribers[slot(PLUGIN_PART)];
+    for (size_t i = 0; i < plugins.size(); ++i)
+        plugins[i]->onPart(client, channel, msg);
+}
+
+void PluginManager::privmsg(Client& client, Channel& channel, const Message& msg) {
+    std::vector<Plugin*>& plugins = _subscribers[slot(PLUGIN_PRIVMSG)];
+    for (size_t i = 0; i < plugins.size(); ++i)
+        plugins[i]->onPrivmsg(client, channel, msg);
+}
+
+void PluginManager::nick(Client& client, const std::string& oldNick, const Message& msg) {
+    std::vector<Plugin*>& plugins = _subscribers[slot(PLUGIN_NICK)];
+    for (size_t i = 0; i < plugins.size(); ++i)
+        plugins[i]->onNick(client, oldNick, msg);
+}
+
+int PluginManager::apiVersion() const {
+    return PLUGIN_API_VERSION;
+}
+
+// Consulted only after the built-in commands, so those names are refused
+// rather than accepted and never called
+bool PluginManager::registerCommand(Plugin* plugin, const std::string& command) {
+    std::string name = upper(command);
+    if (name.empty() || commandId(name) != CMD_OTHER || _commands.count(name))
+        return false;
+    _commands[name] = plugin;
+    return true;
+}
+
+void PluginManager::subscribe(Plugin* plugin, int events) {
+    for (size_t i = 0; i < PLUGIN_EVENTS; ++i) {
+        std::vector<Plugin*>& plugins = _subscribers[i];
+        if ((events & (1 << i)) && std::find(plugins.begin(), plugins.end(), plugin) == plugins.end())
+            plugins.push_back(plugin);
+    }
+    _events |= events;
+}
+
+Client* PluginManager::findUser(const std::string& nick) {
+    return _server.getClientByNickname(nick);
+}
+
+Channel* PluginManager::findChannel(const std::string& name) {
+    return _server.findChannel(name);
+}
+
+void PluginManager::send(Client* client, const std::string& line) {
+    if (!client || !client->isLocal())
+        return;
+    client->addToOutputBuffer(line);
+    _server.enableWriteEvent(client->getFd());
+}
+
+void PluginManager::sendToChannel(const Channel& channel, const std::string& line, Client* except) {
+    _server.sendToLocalMembers(channel, line, except);
+}
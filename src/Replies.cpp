@@ -0,0 +1,159 @@
+#include "includes/Replies.hpp"
+#include <algorithm>
+
+namespace {
+
+struct NumericEntry {
+    const char* code;       // Always three digits
+    const char* text;       // Fixed trailing text, "" when none
+    size_t textLen;
+};
+
+// Built entirely at compile time from IRC_NUMERICS, lengths included.
+#define IRC_NUMERIC_ENTRY(name, code, text) { code, text, sizeof(text) - 1 },
+const NumericEntry g_numerics[NUMERIC_COUNT] = {
+    IRC_NUMERICS(IRC_NUMERIC_ENTRY)
+};
+#undef IRC_NUMERIC_ENTRY
+
+const size_t SERVER_NAME_LEN = sizeof(SERVER_NAME) - 1;
+
+// Room for `more` bytes in one go. A reserve of exactly what is needed
+// reallocates on every append where reserve() grows to the size asked
+// for (libc++, COW libstdc++), making a burst of replies quadratic.
+void reserveFor(std::string& out, size_t more)
+{
+    size_t need = out.size() + more;
+    if (out.capacity() < need)
+        out.reserve(std::max(need, 2 * out.capacity()));
+}
+
+// Shared by every overload: params may be empty, text may be NULL (use the
+// catalogue text) and the target falls back to "*" before registration.
+void build(std::string& out, Numeric id, const std::string& target,
+           const std::string* const* params, size_t paramCount,
+           const std::string* text)
+{
+    const NumericEntry& entry = g_numerics[id];
+    const char* trailing = text ? text->c_str() : entry.text;
+    size_t trailingLen = text ? text->size() : entry.textLen;
+    bool hasTrailing = text != NULL || trailingLen > 0;
+
+    // ":" server " " code " " target
+    size_t len = 1 + SERVER_NAME_LEN + 1 + 3 + 1 + (target.empty() ? 1 : target.size());
+    for (size_t i = 0; i < paramCount; ++i)
+        len += 1 + params[i]->size();
+    if (hasTrailing)
+        len += 2 + trailingLen;
+    len += 2;
+
+    reserveFor(out, len);
+    out += ':';
+    out.append(SERVER_NAME, SERVER_NAME_LEN);
+    out += ' ';
+    out.append(entry.code, 3);
+    out += ' ';
+    if (target.empty())
+        out += '*';
+    else
+        out += target;
+    for (size_t i = 0; i < paramCount; ++i) {
+        out += ' ';
+        out += *params[i];
+    }
+    if (hasTrailing) {
+        out.append(" :", 2);
+        out.append(trailing, trailingLen);
+    }
+    out.append("\r\n", 2);
+}
+
+} // namespace
+
+void Reply::append(std::string& out, Numeric id, const std::string& target)
+{
+    build(out, id, target, NULL, 0, NULL);
+}
+
+void Reply::append(std::string& out, Numeric id, const std::string& target,
+                   const std::string& p1)
+{
+    const std::string* params[] = { &p1 };
+    build(out, id, target, params, 1, NULL);
+}
+
+void Reply::append(std::string& out, Numeric id, const std::string& target,
+                   const std::string& p1, const std::string& p2)
+{
+    const std::string* params[] = { &p1, &p2 };
+    build(out, id, target, params, 2, NULL);
+}
+
+void Reply::appendText(std::string& out, Numeric id, const std::string& target,
+                       const std::string& text)
+{
+    build(out, id, target, NULL, 0, &text);
+}
+
+void Reply::appendText(std::string& out, Numeric id, const std::string& target,
+                       const std::string& p1, const std::string& text)
+{
+    const std::string* params[] = { &p1 };
+    build(out, id, target, params, 1, &text);
+}
+
+void Reply::appendText(std::string& out, Numeric id, const std::string& target,
+                       const std::string& p1, const std::string& p2, const std::string& text)
+{
+    const std::string* params[] = { &p1, &p2 };
+    build(out, id, target, params, 2, &text);
+}
+
+void Reply::appendList(std::string& out, Numeric id, const std::string& target,
+                       const std::string* const* params, size_t count, const std::string& text)
+{
+    build(out, id, target, params, count, &text);
+}
+
+ReplyTemplate::ReplyTemplate() : _fixedSize(0) {
+}
+
+// NUL can never appear in an IRC line, so it is safe as a marker.
+const std::string& ReplyTemplate::nickSlot()
+{
+    static const std::string slot(1, '\0');
+    return slot;
+}
+
+void ReplyTemplate::assign(const std::string& rendered)
+{
+    _parts.clear();
+    _fixedSize = 0;
+
+    size_t start = 0;
+    for (;;) {
+        size_t slot = rendered.find('\0', start);
+        _parts.push_back(rendered.substr(start, slot == std::string::npos ? std::string::npos : slot - start));
+        _fixedSize += _parts.back().size();
+        if (slot == std::string::npos)
+            break;
+        start = slot + 1;
+    }
+}
+
+void ReplyTemplate::render(std::string& out, const std::string& nick) const
+{
+    if (_parts.empty())
+        return;
+    reserveFor(out, _fixedSize + (_parts.size() - 1) * nick.size());
+    out += _parts[0];
+    for (size_t i = 1; i < _parts.size(); ++i) {
+        out += nick;
+        out += _parts[i];
+    }
+}
+
+bool ReplyTemplate::empty() const
+{
+    return _parts.empty();
+}
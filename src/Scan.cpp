@@ -0,0 +1,211 @@
+#include "includes/Scan.hpp"
+#include <cstdlib>
+#include <cstring>
+
+#if defined(__GNUC__) && defined(__SSE2__) && (defined(__x86_64__) || defined(__i386__))
+#define SCAN_X86 1
+#include <immintrin.h>
+#endif
+
+namespace {
+
+struct Kernels {
+    const char* name;
+    Scan::Line (*scanLine)(const char*, size_t);
+    void (*foldUpper)(char*, size_t);
+    void (*foldIrc)(char*, size_t);
+};
+
+// The scalar versions also finish the vector ones' last partial block
+Scan::Line scanFrom(const char* data, size_t i, size_t len, Scan::Line found) {
+    for (; i < len; ++i) {
+        if ((data[i] == '\0' || data[i] == '\r') && found.bad == len)
+            found.bad = i;
+        if (data[i] == '\n') {
+            found.end = i;
+            break;
+        }
+    }
+    return found;
+}
+
+void upperFrom(char* data, size_t i, size_t len) {
+    for (; i < len; ++i) {
+        if (data[i] >= 'a' && data[i] <= 'z')
+            data[i] -= 32;
+    }
+}
+
+// ircToLower, inlined
+void ircFrom(char* data, size_t i, size_t len) {
+    for (; i < len; ++i) {
+        if (data[i] >= 'A' && data[i] <= '^')
+            data[i] += 32;
+    }
+}
+
+Scan::Line scanLineScalar(const char* data, size_t len) {
+    Scan::Line found = { len, len };
+    return scanFrom(data, 0, len, found);
+}
+
+void foldUpperScalar(char* data, size_t len) {
+    upperFrom(data, 0, len);
+}
+
+void foldIrcScalar(char* data, size_t len) {
+    ircFrom(data, 0, len);
+}
+
+const Kernels SCALAR = { "scalar", scanLineScalar, foldUpperScalar, foldIrcScalar };
+
+#ifdef SCAN_X86
+
+// Bytes in [lo, hi] move by `delta`. The compares are signed, which is
+// harmless: every range here is ASCII and bytes >= 0x80 compare negative.
+inline __m128i shiftRange(__m128i v, char lo, char hi, char delta) {
+    __m128i in = _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(lo - 1)),
+                               _mm_cmplt_epi8(v, _mm_set1_epi8(hi + 1)));
+    return _mm_add_epi8(v, _mm_and_si128(in, _mm_set1_epi8(delta)));
+}
+
+Scan::Line scanLineSse2(const char* data, size_t len) {
+    Scan::Line found = { len, len };
+    const __m128i lf = _mm_set1_epi8('\n');
+    const __m128i cr = _mm_set1_epi8('\r');
+    const __m128i nul = _mm_setzero_si128();
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        unsigned ends = _mm_movemask_epi8(_mm_cmpeq_epi8(v, lf));
+        unsigned bad = _mm_movemask_epi8(_mm_or_si128(_mm_cmpeq_epi8(v, cr), _mm_cmpeq_epi8(v, nul)));
+        if (bad && found.bad == len)
+            found.bad = i + __builtin_ctz(bad);
+        if (ends) {
+            found.end = i + __builtin_ctz(ends);
+            return found;
+        }
+    }
+    return scanFrom(data, i, len, found);
+}
+
+void foldUpperSse2(char* data, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i* p = reinterpret_cast<__m128i*>(data + i);
+        _mm_storeu_si128(p, shiftRange(_mm_loadu_si128(p), 'a', 'z', -32));
+    }
+    upperFrom(data, i, len);
+}
+
+void foldIrcSse2(char* data, size_t len) {
+    size_t i = 0;
+    for (; i + 16 <= len; i += 16) {
+        __m128i* p = reinterpret_cast<__m128i*>(data + i);
+        _mm_storeu_si128(p, shiftRange(_mm_loadu_si128(p), 'A', '^', 32));
+    }
+    ircFrom(data, i, len);
+}
+
+const Kernels SSE2 = { "sse2", scanLineSse2, foldUpperSse2, foldIrcSse2 };
+
+// AVX2 only runs once the CPU has been seen to support it, so these are
+// compiled for it without raising the baseline of the whole build
+#define SCAN_AVX2 __attribute__((target("avx2")))
+
+SCAN_AVX2 inline __m256i shiftRange256(__m256i v, char lo, char hi, char delta) {
+    __m256i in = _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(lo - 1)),
+                                  _mm256_cmpgt_epi8(_mm256_set1_epi8(hi + 1), v));
+    return _mm256_add_epi8(v, _mm256_and_si256(in, _mm256_set1_epi8(delta)));
+}
+
+SCAN_AVX2 Scan::Line scanLineAvx2(const char* data, size_t len) {
+    Scan::Line found = { len, len };
+    const __m256i lf = _mm256_set1_epi8('\n');
+    const __m256i cr = _mm256_set1_epi8('\r');
+    const __m256i nul = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        unsigned ends = _mm256_movemask_epi8(_mm256_cmpeq_epi8(v, lf));
+        unsigned bad = _mm256_movemask_epi8(_mm256_or_si256(_mm256_cmpeq_epi8(v, cr), _mm256_cmpeq_epi8(v, nul)));
+        if (bad && found.bad == len)
+            found.bad = i + __builtin_ctz(bad);
+        if (ends) {
+            found.end = i + __builtin_ctz(ends);
+            return found;
+        }
+    }
+    if (found.bad != len)
+        return scanFrom(data, i, len, found);
+    Scan::Line rest = scanLineSse2(data + i, len - i);
+    found.end = i + rest.end;
+    found.bad = i + rest.bad;
+    return found;
+}
+
+SCAN_AVX2 void foldUpperAvx2(char* data, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i* p = reinterpret_cast<__m256i*>(data + i);
+        _mm256_storeu_si256(p, shiftRange256(_mm256_loadu_si256(p), 'a', 'z', -32));
+    }
+    foldUpperSse2(data + i, len - i);
+}
+
+SCAN_AVX2 void foldIrcAvx2(char* data, size_t len) {
+    size_t i = 0;
+    for (; i + 32 <= len; i += 32) {
+        __m256i* p = reinterpret_cast<__m256i*>(data + i);
+        _mm256_storeu_si256(p, shiftRange256(_mm256_loadu_si256(p), 'A', '^', 32));
+    }
+    foldIrcSse2(data + i, len - i);
+}
+
+const Kernels AVX2 = { "avx2", scanLineAvx2, foldUpperAvx2, foldIrcAvx2 };
+
+#endif // SCAN_X86
+
+// Scalar until the selection below has run, so even code running in
+// other static constructors gets a working kernel
+const Kernels* g_kernels = &SCALAR;
+
+const Kernels* pickKernels() {
+    const char* pinned = std::getenv("IRCSERV_SIMD");
+    if (pinned && std::strcmp(pinned, "scalar") == 0)
+        return &SCALAR;
+#ifdef SCAN_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && !(pinned && std::strcmp(pinned, "sse2") == 0))
+        return &AVX2;
+    return &SSE2;
+#else
+    return &SCALAR;
+#endif
+}
+
+struct Selector {
+    Selector() { g_kernels = pickKernels(); }
+} g_selector;
+
+} // namespace
+
+namespace Scan {
+
+Line scanLine(const char* data, size_t len) {
+    return g_kernels->scanLine(data, len);
+}
+
+void foldUpper(char* data, size_t len) {
+    g_kernels->foldUpper(data, len);
+}
+
+void foldIrc(char* data, size_t len) {
+    g_kernels->foldIrc(data, len);
+}
+
+const char* implementation() {
+    return g_kernels->name;
+}
+
+} // namespace Scan
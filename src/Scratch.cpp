@@ -0,0 +1,35 @@
+#include "includes/Scratch.hpp"
+
+Scratch::Scratch() : _used(0), _highWater(0) {}
+
+std::string& Scratch::string() {
+    if (_used == _strings.size())
+        _strings.push_back(std::string());
+    std::string& str = _strings[_used++];
+    str.clear();
+    if (_used > _highWater)
+        _highWater = _used;
+    return str;
+}
+
+size_t Scratch::mark() const {
+    return _used;
+}
+
+void Scratch::release(size_t mark) {
+    if (mark < _used)
+        _used = mark;
+}
+
+// A one-off huge reply is not kept for the rest of the process
+void Scratch::reset() {
+    for (size_t i = 0; i < _strings.size(); ++i) {
+        if (_strings[i].capacity() > SCRATCH_KEEP_BYTES)
+            std::string().swap(_strings[i]);
+    }
+    _used = 0;
+}
+
+size_t Scratch::highWater() const {
+    return _highWater;
+}
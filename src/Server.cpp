@@ -1,11 +1,42 @@
 #include "includes/Server.hpp"
 #include "includes/Client.hpp"
 #include "includes/Channel.hpp"
+#include "includes/ListStream.hpp"
+#include "includes/WhoStream.hpp"
+#include "includes/Scan.hpp"
 #include <stdexcept>
+#include <cstdlib>
 #include <cstring>
 #include <cerrno>
 #include <sstream>
-Server::Server(const char* port, const char* password) : _running(false) {
+#include <algorithm>
+#include <csignal>
+#include <sys/time.h>
+
+namespace {
+
+// Set from signal handlers, consumed by runTimers()
+volatile sig_atomic_t g_snapshotRequested = 0;     // SIGUSR1
+volatile sig_atomic_t g_upgradeRequested = 0;      // SIGUSR2
+volatile sig_atomic_t g_shutdownRequested = 0;     // SIGTERM/SIGINT, counts repeats
+
+void requestSnapshot(int) {
+    g_snapshotRequested = 1;
+}
+
+void requestUpgrade(int) {
+    g_upgradeRequested = 1;
+}
+
+void requestShutdown(int) {
+    g_shutdownRequested = g_shutdownRequested + 1;
+}
+
+} // namespace
+
+Server::Server(const char* port, const char* password)
+    : _running(false), _motd(MOTD_PATH), _draining(false), _drainDeadline(0), _restoreDeadline(0), _handedOff(false), _nextUid(0),
+      _plugins(*this), _currentMessage(NULL), _nextVirtualFd(VIRTUAL_FD_BASE) {
     _port = std::atoi(port);
     if (_port <= 0 || _port > 65535) 
     {
@@ -17,9 +48,90 @@ Server::Server(const char* port, const char* password) : _running(false) {
         throw std::runtime_error("Password cannot be empty");
     }
     _serverSocket = -1;
+    _unixSocket = -1;
+    _adminSocket = -1;
+    _startTime = Clock::now();
+    // IRCSERV_OPERS="name:password,..."
+    if (const char* opers = std::getenv("IRCSERV_OPERS")) {
+        std::istringstream list(opers);
+        std::string entry;
+        while (std::getline(list, entry, ',')) {
+            size_t colon = entry.find(':');
+            if (colon != std::string::npos && colon > 0 && colon + 1 < entry.size())
+                _opers[entry.substr(0, colon)] = entry.substr(colon + 1);
+        }
+    }
+    _joinReplay = HISTORY_JOIN_REPLAY;
+    if (const char* replay = std::getenv("IRCSERV_JOIN_REPLAY"))
+        _joinReplay = std::min<size_t>(std::strtoul(replay, NULL, 10), HISTORY_LEN);
+    buildWelcomeBurst();
+}
+
+// Everything a newly registered client receives before the MOTD only
+// depends on the nick, so render it once and splice the nick in later.
+void Server::buildWelcomeBurst() {
+    const std::string& nick = ReplyTemplate::nickSlot();
+    std::string rendered;
+
+    Reply::appendText(rendered, RPL_WELCOME, nick, "Welcome to the IRC server " + nick + "!");
+    Reply::appendText(rendered, RPL_YOURHOST, nick, "Your host is " SERVER_NAME ", running version 1.0");
+    Reply::appendText(rendered, RPL_CREATED, nick, "This server was created today");
+    Reply::append(rendered, RPL_MYINFO, nick, SERVER_NAME " 1.0 o", "mtikl");
+
+    // At most 13 tokens per 005 line
+    std::vector<std::string> tokens = isupportTokens();
+    for (size_t i = 0; i < tokens.size(); i += 13) {
+        std::string line;
+        for (size_t j = i; j < tokens.size() && j < i + 13; ++j) {
+            if (j != i)
+                line += ' ';
+            line += tokens[j];
+        }
+        Reply::append(rendered, RPL_ISUPPORT, nick, line);
+    }
+    _welcomeBurst.assign(rendered);
+}
+
+// ISUPPORT (005) advertisement, generated from the limits the server enforces
+std::vector<std::string> Server::isupportTokens() const {
+    std::vector<std::string> tokens;
+    std::ostringstream oss;
+
+    tokens.push_back("NETWORK=ircserv");
+    tokens.push_back("CASEMAPPING=rfc1459");
+    tokens.push_back("CHANTYPES=#&");
+    tokens.push_back("PREFIX=(o)@");
+    tokens.push_back("CHANMODES=beI,,,it");
+    tokens.push_back("EXCEPTS=e");
+    tokens.push_back("INVEX=I");
+    oss << "MAXLIST=beI:" << MAXLIST;
+    tokens.push_back(oss.str());
+    oss.str("");
+    tokens.push_back("ELIST=CMNTU");
+    oss << "CHATHISTORY=" << CHATHISTORY_MAX;
+    tokens.push_back(oss.str());
+    oss.str("");
+    oss << "MONITOR=" << MONITOR_MAX;
+    tokens.push_back(oss.str());
+    oss.str("");
+    oss << "NICKLEN=" << NICKLEN;
+    tokens.push_back(oss.str());
+    oss.str("");
+    oss << "CHANNELLEN=" << CHANNELLEN;
+    tokens.push_back(oss.str());
+    oss.str("");
+    oss << "TOPICLEN=" << TOPICLEN;
+    tokens.push_back(oss.str());
+    return tokens;
 }
 
 Server::~Server() {
+    // Plugins may hold Client and Channel pointers; they go first
+    _plugins.unloadAll();
+
+    // The new process owns the socket file after a hot upgrade
+    closeUnixSocket(!_handedOff);
+
     // Close server socket if open
     if (_serverSocket != -1) {
         close(_serverSocket);
@@ -31,29 +143,66 @@ Server::~Server() {
             close(it->fd);
         }
     }
+
+    while (!_streams.empty())
+        dropStreams(_streams.begin()->first);
+
+    // Remote users first: telling them apart reads the local ones
+    for (UidIndex::iterator it = _uidIndex.begin(); it != _uidIndex.end(); ++it) {
+        if (!it->second->isLocal())
+            delete it->second;
+    }
+    for (ClientMap::iterator it = _clients.begin(); it != _clients.end(); ++it)
+        delete it->second;
+    for (LinkMap::iterator it = _links.begin(); it != _links.end(); ++it)
+        delete it->second;
 }
 
 Client* Server::getClientByNickname(const std::string& nickname) 
 {
-    for (std::vector<Client>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->getNickname() == nickname) {
-            return &(*it);
-        }
-    }
-    return NULL;  // Client not found
+    NickIndex::iterator it = _nickIndex.find(ircCaseFold(nickname));
+    if (it == _nickIndex.end())
+        return NULL;  // Client not found
+    return it->second;
+}
+
+Client* Server::getClientByUid(const std::string& uid)
+{
+    UidIndex::iterator it = _uidIndex.find(uid);
+    if (it == _uidIndex.end())
+        return NULL;
+    return it->second;
 }
 
 
 void Server::start() {
-    setupSocket();
-    bindSocket();
-    listenSocket();
+    signal(SIGPIPE, SIG_IGN);
+    configure();
+
+    // Started by a hot upgrade: sockets and state come from the old process
+    const char* handoff = std::getenv("IRCSERV_UPGRADE_FD");
+    if (handoff) {
+        int sock = std::atoi(handoff);
+        unsetenv("IRCSERV_UPGRADE_FD");
+        if (!resumeFromUpgrade(sock))
+            throw std::runtime_error("Hot upgrade handoff failed");
+        if (_unixSocket == -1)
+            setupUnixSocket();      // Not handed over, e.g. newly configured
+    } else {
+        setupSocket();
+        bindSocket();
+        listenSocket();
+
+        // Add the server socket to _pollfds so poll() can monitor it
+        watchFd(_serverSocket, POLLIN); // We want to know when someone tries to connect
+        setupUnixSocket();
+    }
 
-    // Add the server socket to _pollfds so poll() can monitor it
-    pollfd serverPollfd;
-    serverPollfd.fd = _serverSocket;
-    serverPollfd.events = POLLIN; // We want to know when someone tries to connect
-    _pollfds.push_back(serverPollfd);
+    openStorage(handoff != NULL);
+    signal(SIGUSR1, requestSnapshot);
+    signal(SIGUSR2, requestUpgrade);
+    signal(SIGTERM, requestShutdown);
+    signal(SIGINT, requestShutdown);
 
     _running = true;
     
@@ -68,9 +217,192 @@ void Server::start() {
     std::cout << RESET;
 
     // Infinite loop that checks for events on sockets
-    while (_running) {
-        handleEvents(); // Use poll to monitor all fds (server + clients)
+    while (_running)
+        runOnce(POLL_TIMEOUT_MS);
+
+    // Leave a current snapshot behind unless another process took over
+    if (!_handedOff && _snapshot.enabled()) {
+        _snapshot.wait();
+        if (_snapshot.start(_channels))
+            _snapshot.wait();
+    }
+}
+
+// Environment-driven settings shared by start() and embed()
+void Server::configure() {
+    configureLinks();       // UIDs carry our SID, even for clients resumed below
+    configureUnixSocket();
+    _plugins.configure();
+    _metrics.configure();
+    _load.configure();
+}
+
+// Message log, capture and the channel snapshot; a resumed process
+// (hot upgrade) already has the channels and appends to the capture
+void Server::openStorage(bool resumed) {
+    _messageLog.open();
+    _capture.configure(resumed);
+    if (_capture.enabled())
+        std::cout << YELLOW << "⚠ Capturing client input to " << _capture.path() << RESET << std::endl;
+
+    // Channel state from the last snapshot, before anyone can JOIN
+    _snapshot.configure();
+    if (!resumed) {
+        struct timeval loadStart, loadEnd;
+        gettimeofday(&loadStart, NULL);
+        size_t restored = _snapshot.load(_channels);
+        gettimeofday(&loadEnd, NULL);
+        if (restored)
+            std::cout << GREEN << "✓ Restored " << restored << " channels from " << _snapshot.path() << " in "
+                      << ((loadEnd.tv_sec - loadStart.tv_sec) * 1000000L + (loadEnd.tv_usec - loadStart.tv_usec)) / 1000.0
+                      << " ms" << RESET << std::endl;
+    }
+    // Restored channels (or ones a hot upgrade carried over) get a while
+    // for their members and operators to come back
+    if (!_channels.empty())
+        _restoreDeadline = Clock::now() + SNAPSHOT_GRACE;
+}
+
+// Nobody would ever delete a restored channel that stays empty, since
+// that happens on the last PART, and saved operators who never return
+// would leave it op-less for good. Once the grace period is over the
+// empty ones go, and an op-less one goes to its longest-standing member
+// as a new channel goes to its first.
+void Server::expireRestoredChannels() {
+    _restoreDeadline = 0;
+    size_t expired = 0;
+    for (ChannelMap::iterator it = _channels.begin(); it != _channels.end(); ) {
+        Channel& channel = it->second;
+        if (channel.getClients().empty()) {
+            _channels.erase(it++);
+            ++expired;
+            continue;
+        }
+        if (!channel.getSavedOperators().empty()) {
+            channel.clearSavedOperators();
+            if (channel.getOperators().empty()) {
+                Client* heir = channel.getClients()[0];
+                channel.addOperator(heir);
+                sendToLocalMembers(channel, ":" SERVER_NAME " MODE " + channel.getName() + " +o " + heir->getNickname() + "\r\n", NULL);
+                sendToLinks(":" + _sid + " TMODE " + toString(channel.getCreationTime()) + " " + channel.getName()
+                            + " +o " + heir->getUid() + "\r\n", NULL);
+            }
+        }
+        ++it;
+    }
+    if (expired)
+        std::cout << BLUE << "✓ " << expired << " restored channels expired unclaimed" << RESET << std::endl;
+}
+
+// The core without main(): no TCP listener, no signal handlers other
+// than SIGPIPE, no banner. The host supplies clients through attach()
+// or attachVirtual() and turns the loop with runOnce(); the IRCSERV_*
+// environment applies as it does to start(). Console logging still goes
+// to std::cout, which a host silences with std::cout.rdbuf(NULL).
+void Server::embed() {
+    signal(SIGPIPE, SIG_IGN);
+    configure();
+
+    pollfd listener;
+    listener.fd = -1;           // Slot 0 is the TCP listener; poll() skips it
+    listener.events = 0;
+    listener.revents = 0;
+    _pollfds.push_back(listener);
+    setupUnixSocket();
+
+    openStorage(false);
+    _running = true;
+}
+
+// One turn of the event loop; false once the server has stopped
+bool Server::runOnce(int timeoutMs) {
+    handleEvents(timeoutMs); // Use poll to monitor all fds (server + clients)
+    runTimers();
+    if (_load.endPass()) {
+        if (_load.overloaded()) {
+            _metrics.add(Metrics::OVERLOADS);
+            std::cout << BOLD << YELLOW << "⚠ Overloaded (slowest pass " << _load.lagUs() / 1000 << " ms, "
+                      << _load.busyPercent() << "% busy): shedding new connections, NAMES/LIST/WHO/CHATHISTORY"
+                      << " and JOIN replay" << RESET << std::endl;
+        } else {
+            std::cout << GREEN << "✓ Load recovered, shedding stopped" << RESET << std::endl;
+        }
+    }
+    return _running;
+}
+
+// One end of a connected stream socket (a socketpair, typically) as a
+// new client; the host keeps the other end and talks IRC over it
+Client* Server::attach(int fd, const std::string& host) {
+    Client* client = adoptClient(fd, host);
+    _capture.open(fd, false);
+    _metrics.add(Metrics::CONNECTIONS);
+    return client;
+}
+
+// A client with no socket at all: input arrives through deliver() and
+// output is collected with takeOutput(). Its fd is only a key, drawn
+// from above VIRTUAL_FD_BASE so it never collides with a real one.
+Client* Server::attachVirtual(const std::string& host) {
+    int fd = _nextVirtualFd++;
+    Client* client = addClient(fd, host);
+    _capture.open(fd, false);
+    _metrics.add(Metrics::CONNECTIONS);
+    return client;
+}
+
+void Server::deliver(Client* client, const char* data, size_t len) {
+    consumeInput(client->getFd(), data, len);
+}
+
+// Everything queued for the client, as a socket would have sent it;
+// long LIST/WHO replies are produced a buffer at a time
+std::string Server::takeOutput(Client* client) {
+    if (client->getOutputBuffer().size() < STREAM_LOW_WATER)
+        pumpStreams(client);
+    std::string out(client->getOutputBuffer());
+    client->clearOutputBuffer();    // Back to the pool
+    return out;
+}
+
+void Server::detach(Client* client, const std::string& reason) {
+    handleClientDisconnect(client->getFd(), reason);
+}
+
+// Periodic work, run after every poll() wakeup (at least once a second)
+void Server::runTimers() {
+    if (g_shutdownRequested && !_draining)
+        beginDrain();
+    if (_draining) {
+        // A second signal, an empty queue or the deadline ends the drain
+        if (g_shutdownRequested > 1 || drained() || Clock::now() >= _drainDeadline)
+            _running = false;
+        return;
     }
+    if (g_upgradeRequested) {
+        g_upgradeRequested = 0;
+        hotUpgrade();
+        if (!_running)
+            return;
+    }
+
+    _snapshot.reap();
+    // Periodic snapshots wait out an overload; the fork is not free
+    if (g_snapshotRequested || (_snapshot.due(Clock::now()) && !_load.overloaded())) {
+        // An on-demand request waits for a running writer to finish
+        if (!_snapshot.running()) {
+            g_snapshotRequested = 0;
+            if (_snapshot.start(_channels))
+                std::cout << BLUE << "✓ Snapshot of " << _channels.size() << " channels started" << RESET << std::endl;
+        }
+    }
+
+    if (_restoreDeadline && Clock::now() >= _restoreDeadline)
+        expireRestoredChannels();
+
+    checkLinks();
+    checkAdmin();
+    _capture.flush();
 }
 
 void Server::setupSocket() {
@@ -104,44 +436,69 @@ void Server::bindSocket() {
 }
 
 void Server::listenSocket() {
-    if (listen(_serverSocket, 5) == -1) {
+    if (listen(_serverSocket, SOMAXCONN) == -1) {
         close(_serverSocket);
         throw std::runtime_error("Failed to listen on socket: " + std::string(strerror(errno)));
     }
 }
 
 // 🔁 This is the heart of the event loop
-void Server::handleEvents() {
+void Server::handleEvents(int timeoutMs) {
     // poll blocks until there's activity on any fd in _pollfds
-    int activity = poll(&_pollfds[0], _pollfds.size(), -1); // -1 = wait forever
+    int activity = poll(&_pollfds[0], _pollfds.size(), timeoutMs); // Wake up for timers
 
     if (activity < 0) {
         if (errno == EINTR)
             return; // poll was interrupted by signal, just try again
         throw std::runtime_error("Poll failed: " + std::string(strerror(errno)));
     }
+    _load.beginPass(activity);
+    _scratch.reset();
 
     // Check if the server socket has an event (i.e., new incoming connection)
-    if (_pollfds[0].revents & POLLIN) 
-    {
-        acceptClient(); // Accept the new client connection
-    }
-
-    // Check all other file descriptors (clients)
-    for (size_t i = 1; i < _pollfds.size(); i++) {
-    if (_pollfds[i].revents & POLLIN) {
-        // Client sent data to us
-        handleClientMessage(_pollfds[i].fd);
-    }
-    if (_pollfds[i].revents & POLLOUT) {  // Changed from 'else if' to 'if'
-        handleClientOutput(_pollfds[i].fd);
-    }
-    if (_pollfds[i].revents & (POLLHUP | POLLERR | POLLNVAL)) {
-        // Client disconnected or error occurred
-        handleClientDisconnect(_pollfds[i].fd);
+    if (_pollfds[0].revents) {
+        --activity;
+        if (_pollfds[0].revents & POLLIN)
+            acceptClient(); // Accept the new client connection
+    }
+
+    // Check all other file descriptors (clients), newest first: a slot
+    // freed by a disconnect is filled from the end, which is already done.
+    // Once every ready fd is handled the idle ones are not even looked at.
+    for (size_t i = _pollfds.size(); activity > 0 && i-- > 1; ) {
+        if (i >= _pollfds.size() || !_pollfds[i].revents)
+            continue;   // Gone with an earlier disconnect, or nothing to do
+        --activity;
+        int fd = _pollfds[i].fd;
+        short revents = _pollfds[i].revents;
+        if (fd == _unixSocket || fd == _adminSocket) {
+            if (revents & POLLIN) {
+                if (fd == _unixSocket)
+                    acceptUnixClient();
+                else
+                    acceptAdmin();
+            }
+            continue;
+        }
+        if (_adminConns.count(fd)) {
+            handleAdmin(fd, revents);
+            continue;
+        }
+        if (revents & POLLIN) {
+            // Client sent data to us
+            handleClientMessage(fd);
+        }
+        if ((revents & POLLOUT) && isPolled(fd)) {  // Changed from 'else if' to 'if'
+            handleClientOutput(fd);
+        }
+        if ((revents & (POLLHUP | POLLERR | POLLNVAL)) && isPolled(fd)) {
+            // Client disconnected or error occurred
+            if (getClientByFd(fd))
+                _metrics.disconnect(Metrics::DISCONNECT_HANGUP);
+            handleClientDisconnect(fd);
+        }
     }
 }
-}
 
 void Server::acceptClient() {
     struct sockaddr_in clientAddr;
@@ -155,20 +512,21 @@ void Server::acceptClient() {
         return;
     }
 
-    // Set the client socket to non-blocking
-    setNonBlocking(clientFd);
-
-    // Add new client to poll list
-    pollfd clientPollfd;
-    clientPollfd.fd = clientFd;
-    clientPollfd.events = POLLIN; // Monitor for readable data from this client
-    _pollfds.push_back(clientPollfd);
+    // New users are the first thing an overloaded server turns away;
+    // local clients and existing sessions keep working
+    if (_load.overloaded()) {
+        static const char refusal[] = "ERROR :Server overloaded, try again later\r\n";
+        ::send(clientFd, refusal, sizeof(refusal) - 1, 0);
+        close(clientFd);
+        _metrics.add(Metrics::SHED_CONNECTIONS);
+        return;
+    }
 
-    // Create and store a Client object
     char clientIP[INET_ADDRSTRLEN]; // is the e maximum size required to store an IPv4 address in the standard "dotted-decimal" notation (like "192.168.0.1")
     inet_ntop(AF_INET, &(clientAddr.sin_addr), clientIP, INET_ADDRSTRLEN);
-    Client newClient(clientFd, clientIP);
-    _clients.push_back(newClient);
+    adoptClient(clientFd, clientIP);
+    _capture.open(clientFd, false);
+    _metrics.add(Metrics::CONNECTIONS);
 
     std::cout << BOLD << GREEN << "✓ New client connected from " << clientIP << " [fd: " << clientFd << "]" << RESET << std::endl;
 
@@ -177,19 +535,53 @@ void Server::acceptClient() {
     sendToClient(clientFd, welcomeMsg);
 }
 
+// Everything a connected socket needs to take part in the event loop
+Client* Server::adoptClient(int fd, const std::string& ip) {
+    // Set the client socket to non-blocking
+    setNonBlocking(fd);
+
+    // Add new client to poll list
+    watchFd(fd, POLLIN); // Monitor for readable data from this client
+    return addClient(fd, ip);
+}
+
+// Create and store a Client object
+Client* Server::addClient(int fd, const std::string& ip) {
+    Client* client = new Client(fd, ip);
+    client->setUid(nextUid());
+    _clients[fd] = client;
+    _uidIndex[client->getUid()] = client;
+    _hostIndex.insert(std::make_pair(client->getIp(), client));
+    return client;
+}
+
 void Server::handleClientMessage(int fd) {
+    if (Link* link = findLink(fd)) {
+        handleLinkInput(link);
+        return;
+    }
+
     char buffer[1024];
     int bytesRead = recv(fd, buffer, sizeof(buffer) - 1, 0);
     
+    _metrics.add(Metrics::RECV_CALLS);
     if (bytesRead <= 0) {
         if (bytesRead == 0 || (errno != EWOULDBLOCK && errno != EAGAIN)) {
             // Connection closed or error
+            _metrics.disconnect(bytesRead == 0 ? Metrics::DISCONNECT_EOF : Metrics::DISCONNECT_RECV_ERROR);
             handleClientDisconnect(fd);
         }
         return;
     }
     
     buffer[bytesRead] = '\0';  // Null terminate the buffer
+    consumeInput(fd, buffer, bytesRead);
+}
+
+// Bytes read from (or delivered to) a client, framed and dispatched
+void Server::consumeInput(int fd, const char* data, size_t len) {
+    _metrics.add(Metrics::BYTES_RECEIVED, len);
+    _capture.data(fd, data, len);
     
     // Find the client
     Client* client = getClientByFd(fd);
@@ -199,39 +591,155 @@ void Server::handleClientMessage(int fd) {
     }
     
     // Add the received data to the client's input buffer
-    client->appendToInputBuffer(buffer);
+    client->appendToInputBuffer(data, len);
     
     // Process any complete messages in the buffer
-    while (client->hasCompleteMessage()) { // NICK user1\r\nUSER user1 0 * :Real Name\r\n it will always continue until no cammand remain 
-        std::string message = client->getNextMessage();
+    Scratch::Scope scope(_scratch);
+    std::string& message = _scratch.string();
+    bool invalid;
+    while (client->getNextMessage(message, invalid)) { // NICK user1\r\nUSER user1 0 * :Real Name\r\n it will always continue until no cammand remain 
+
+        // NUL ends a string in most clients and a lone CR ends a line in
+        // some, so a line carrying either is dropped rather than relayed
+        if (invalid) {
+            _metrics.add(Metrics::INVALID_LINES);
+            std::cout << RED << "✗ Dropped a line with NUL or CR from client " << fd << RESET << std::endl;
+            continue;
+        }
         std::cout << CYAN << "← Received from client " << fd << ": " << RESET << message << std::endl;
+
+        // Another server introducing itself: the connection becomes a link
+        if (!client->isRegistered() && !_linkPassword.empty() && ircEqualsN(message, "SERVER ", 7)) {
+            acceptLink(client, message);
+            break;
+        }
         
          // Process command instead of just echoing back
         processCommand(client, message);
     }
 }
 
-void Server::handleClientDisconnect(int fd) {
+void Server::handleClientDisconnect(int fd, const std::string& reason) {
+    if (Link* link = findLink(fd)) {
+        dropLink(link, "Connection closed");
+        return;
+    }
+
+    Client* client = getClientByFd(fd);
+    if (!client)
+        return;     // Already gone earlier in this poll round
     std::cout << BOLD << RED << "✗ Client " << fd << " disconnected" << RESET << std::endl;
+    _capture.close(fd);
+
+    if (client->isRegistered())
+        sendToLinks(":" + client->getUid() + " QUIT :" + reason + "\r\n", NULL);
+    removeClientFromChannels(client, reason);
+    unwatchAll(client);
+    if (client->isRegistered())
+        notifyWatchers(client->getNickname(), RPL_MONOFFLINE, client->getNickname());
+    unindexClient(client);
+    dropStreams(fd);
 
     // Remove from pollfds vector
-    for (std::vector<pollfd>::iterator it = _pollfds.begin(); it != _pollfds.end(); ++it) {
-        if (it->fd == fd) {
-            _pollfds.erase(it);
+    forgetPollfd(fd);
+
+    // Remove from clients map
+    _clients.erase(fd);
+    delete client;
+
+    // Close the socket
+    if (fd < VIRTUAL_FD_BASE)
+        close(fd);
+}
+
+void Server::removeClientFromChannels(Client* client, const std::string& reason) {
+    std::string quitMsg;
+    quitMsg.reserve(client->getPrefix().size() + reason.size() + 10);
+    quitMsg.append(client->getPrefix()).append(" QUIT :").append(reason).append("\r\n");
+    sendToCommonChannels(client, quitMsg);
+
+    // Copy: leaving each channel edits the client's own set
+    std::set<std::string> joined = client->getChannels();
+    for (std::set<std::string>::iterator key = joined.begin(); key != joined.end(); ++key) {
+        ChannelMap::iterator it = _channels.find(*key);
+        client->removeChannel(*key);
+        if (it == _channels.end() || !it->second.removeClient(client))
+            continue;
+        if (it->second.getClients().empty())
+            _channels.erase(it);
+    }
+}
+
+void Server::unindexClient(Client* client) {
+    if (!client->getNickname().empty()) {
+        NickIndex::iterator nick = _nickIndex.find(ircCaseFold(client->getNickname()));
+        if (nick != _nickIndex.end() && nick->second == client)
+            _nickIndex.erase(nick);
+    }
+    std::pair<HostIndex::iterator, HostIndex::iterator> range = _hostIndex.equal_range(client->getIp());
+    for (HostIndex::iterator it = range.first; it != range.second; ++it) {
+        if (it->second == client) {
+            _hostIndex.erase(it);
             break;
         }
     }
+    unindexNames(client);
+    _uidIndex.erase(client->getUid());
+}
 
-    // Remove from clients vector
-    for (std::vector<Client>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->getFd() == fd) {
-            _clients.erase(it);
-            break;
+// WHO matches usernames and real names too, so they are indexed like the
+// nick and the host
+void Server::setNames(Client* client, const std::string& username, const std::string& realname) {
+    unindexNames(client);
+    client->setUsername(username);
+    client->setRealname(realname);
+    _nameIndex.insert(std::make_pair(ircCaseFold(username), client));
+    _nameIndex.insert(std::make_pair(ircCaseFold(realname), client));
+}
+
+void Server::unindexNames(Client* client) {
+    const std::string* names[] = { &client->getUsername(), &client->getRealname() };
+    for (size_t n = 0; n < 2; ++n) {
+        std::pair<NameIndex::iterator, NameIndex::iterator> range = _nameIndex.equal_range(ircCaseFold(*names[n]));
+        for (NameIndex::iterator it = range.first; it != range.second; ++it) {
+            if (it->second == client) {
+                _nameIndex.erase(it);
+                break;
+            }
         }
     }
+}
 
-    // Close the socket
-    close(fd);
+// Channel broadcasts only ever write to our own clients; remote members
+// hear about it from their server
+void Server::sendToLocalMembers(const Channel& channel, const std::string& line, Client* except) {
+    const std::vector<Client*>& clients = channel.getClients();
+    for (size_t i = 0; i < clients.size(); ++i) {
+        if (clients[i] == except || !clients[i]->isLocal())
+            continue;
+        clients[i]->addToOutputBuffer(line);
+        enableWriteEvent(clients[i]->getFd());
+        _metrics.fanOut(1);
+    }
+}
+
+// NICK and QUIT go to everyone sharing a channel with the user, once each
+void Server::sendToCommonChannels(Client* user, const std::string& line) {
+    std::set<Client*> told;
+    const std::set<std::string>& joined = user->getChannels();
+    for (std::set<std::string>::const_iterator key = joined.begin(); key != joined.end(); ++key) {
+        ChannelMap::iterator it = _channels.find(*key);
+        if (it == _channels.end())
+            continue;
+        const std::vector<Client*>& clients = it->second.getClients();
+        for (size_t i = 0; i < clients.size(); ++i) {
+            if (clients[i] == user || !clients[i]->isLocal() || !told.insert(clients[i]).second)
+                continue;
+            clients[i]->addToOutputBuffer(line);
+            enableWriteEvent(clients[i]->getFd());
+            _metrics.fanOut(1);
+        }
+    }
 }
 
 void Server::setNonBlocking(int fd) {
@@ -259,50 +767,116 @@ void Server::sendToClient(int fd, const std::string& message) {
     enableWriteEvent(fd);
 }
 
- void Server::enableWriteEvent(int fd) {
-    for (std::vector<pollfd>::iterator it = _pollfds.begin(); it != _pollfds.end(); ++it) {
-        if (it->fd == fd) {
-            it->events |= POLLOUT;  // maeen just read it and shut up , i know u will ask what is this weird syntax 
-            break;
-        }
-    }
+ // _pollIndex maps every polled fd to its slot, so finding one is a
+// lookup however many are connected. The first fd added (the listener, or
+// embed()'s placeholder) keeps slot 0 for good.
+void Server::watchFd(int fd, short events) {
+    if (fd >= static_cast<int>(_pollIndex.size()))
+        _pollIndex.resize(fd + 1, -1);
+    pollfd entry;
+    entry.fd = fd;
+    entry.events = events;
+    entry.revents = 0;
+    _pollIndex[fd] = _pollfds.size();
+    _pollfds.push_back(entry);
+}
+
+// The last slot moves into the hole. Its revents are cleared: the loop in
+// handleEvents() runs from the end, so it has already been handled.
+void Server::forgetPollfd(int fd) {
+    if (fd < 0 || fd >= static_cast<int>(_pollIndex.size()) || _pollIndex[fd] <= 0)
+        return;
+    size_t slot = _pollIndex[fd];
+    _pollIndex[fd] = -1;
+    if (slot != _pollfds.size() - 1) {
+        _pollfds[slot] = _pollfds.back();
+        _pollfds[slot].revents = 0;
+        _pollIndex[_pollfds[slot].fd] = slot;
+    }
+    _pollfds.pop_back();
+}
+
+bool Server::isPolled(int fd) const {
+    return fd >= 0 && fd < static_cast<int>(_pollIndex.size()) && _pollIndex[fd] >= 0;
+}
+
+// Nothing buffered either way and no LIST/WHO in progress: such a client
+// holds no buffer memory and costs the loop nothing until it speaks
+bool Server::isIdle(const Client* client) const {
+    return !client->hasPendingInput() && !client->hasDataToSend()
+        && _streams.find(client->getFd()) == _streams.end();
+}
+
+// A local connection's footprint: the Client itself, its entries in the
+// server's indexes and its channels' member lists, and its pollfd slot
+size_t Server::connectionMemory(const Client* client) const {
+    size_t bytes = client->memoryUsage()
+        + TREE_NODE_BYTES + sizeof(ClientMap::value_type)
+        + TREE_NODE_BYTES + sizeof(UidIndex::value_type) + stringHeapBytes(client->getUid())
+        + TREE_NODE_BYTES + sizeof(HostIndex::value_type) + stringHeapBytes(client->getIp())
+        + client->getChannels().size() * (sizeof(Client*) + TREE_NODE_BYTES + sizeof(Client*));
+    if (!client->getNickname().empty())
+        bytes += TREE_NODE_BYTES + sizeof(NickIndex::value_type) + stringHeapBytes(client->getNickname());
+    if (client->isRegistered())
+        bytes += 2 * (TREE_NODE_BYTES + sizeof(NameIndex::value_type))
+            + stringHeapBytes(client->getUsername()) + stringHeapBytes(client->getRealname());
+    if (isPolled(client->getFd()))
+        bytes += sizeof(pollfd) + sizeof(int);
+    return bytes;
+}
+
+void Server::enableWriteEvent(int fd) {
+    if (!isPolled(fd))
+        return;     // Not polled: a virtual client, whose buffer takeOutput() collects
+    _pollfds[_pollIndex[fd]].events |= POLLOUT;  // maeen just read it and shut up , i know u will ask what is this weird syntax 
 }
 
 void Server::disableWriteEvent(int fd) {
-    for (std::vector<pollfd>::iterator it = _pollfds.begin(); it != _pollfds.end(); ++it) {
-        if (it->fd == fd) {
-            it->events &= ~POLLOUT;  // Maeen shut up again and dont ask about the ~ its just mean
-            break;
-        }
-    }
+    if (!isPolled(fd))
+        return;
+    _pollfds[_pollIndex[fd]].events &= ~POLLOUT;  // Maeen shut up again and dont ask about the ~ its just mean
 }
 
 //
 
 void Server::handleClientOutput(int fd) {
+    if (Link* link = findLink(fd)) {
+        handleLinkOutput(link);
+        return;
+    }
+
     Client* client = getClientByFd(fd); //  // Find a client by their file descriptor
-    
+
+    // Top up from any pending LIST/WHO before the buffer runs dry
+    if (client && client->getOutputBuffer().size() < STREAM_LOW_WATER)
+        pumpStreams(client);
+
     if (!client || !client->hasDataToSend()) {
         // No client found or no data to send, disable write events
-        disableWriteEvent(fd);
+        // (a stream that produced nothing this round keeps POLLOUT on)
+        if (!client || _streams.find(fd) == _streams.end())
+            disableWriteEvent(fd);
         return;
     }
     
-    // Get the data from the client's output buffer
-    std::string dataToSend = client->getOutputBuffer();
+    // Send straight from the client's output buffer
+    const std::string& dataToSend = client->getOutputBuffer();
     
     // Try to send it
-    int bytesSent = send(fd, dataToSend.c_str(), dataToSend.size(), 0);
+    int bytesSent = send(fd, dataToSend.data(), dataToSend.size(), 0);
+    _metrics.add(Metrics::SEND_CALLS);
     
     if (bytesSent > 0) {
+        _metrics.add(Metrics::BYTES_SENT, bytesSent);
         std::cout << CYAN << "→ Sent " << bytesSent << " bytes to client " << fd << RESET << std::endl;
-        // Successfully sent some data
-        client->clearOutputBuffer();
+        // Successfully sent some data; if we didn't send everything, the
+        // remainder stays at the front of the buffer
+        bool partial = bytesSent < (int)dataToSend.size();
+        client->consumeOutput(bytesSent);
         
-        // If we didn't send everything, put the remainder back in the buffer
-        if (bytesSent < (int)dataToSend.size()) {
-            client->addToOutputBuffer(dataToSend.substr(bytesSent));
-        } else {
+        if (partial) {
+            _metrics.add(Metrics::PARTIAL_WRITES);
+        } else if (_streams.find(fd) == _streams.end()) {
             // All data sent, disable write events
             disableWriteEvent(fd);
         }
@@ -311,19 +885,98 @@ void Server::handleClientOutput(int fd) {
         if (errno != EWOULDBLOCK && errno != EAGAIN) {
             // A real error, not just "would block"
             std::cerr << BG_RED << WHITE << " ERROR " << RESET << " " << RED << "Error sending data: " << strerror(errno) << RESET << std::endl;
+            _metrics.disconnect(Metrics::DISCONNECT_SEND_ERROR);
             handleClientDisconnect(fd);
         }
         // If it would block, we'll try again later when poll says it's writable
     }
 }
 
+void Server::sendNumeric(Client* client, Numeric id) {
+    Reply::append(client->outputBuffer(), id, client->getNickname());
+    enableWriteEvent(client->getFd());
+}
+
+void Server::sendNumeric(Client* client, Numeric id, const std::string& p1) {
+    Reply::append(client->outputBuffer(), id, client->getNickname(), p1);
+    enableWriteEvent(client->getFd());
+}
+
+void Server::sendNumeric(Client* client, Numeric id, const std::string& p1, const std::string& p2) {
+    Reply::append(client->outputBuffer(), id, client->getNickname(), p1, p2);
+    enableWriteEvent(client->getFd());
+}
+
+void Server::sendNumericText(Client* client, Numeric id, const std::string& text) {
+    Reply::appendText(client->outputBuffer(), id, client->getNickname(), text);
+    enableWriteEvent(client->getFd());
+}
+
+void Server::sendNumericText(Client* client, Numeric id, const std::string& p1, const std::string& text) {
+    Reply::appendText(client->outputBuffer(), id, client->getNickname(), p1, text);
+    enableWriteEvent(client->getFd());
+}
+
 Client* Server::getClientByFd(int fd) {
-    for (std::vector<Client>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->getFd() == fd) {
-            return &(*it);
-        }
+    ClientMap::iterator it = _clients.find(fd);
+    if (it == _clients.end())
+        return NULL;  // Client not found
+    return it->second;
+}
+
+const ClientMap& Server::getClients() const {
+    return _clients;
+}
+
+const UidIndex& Server::getUsers() const {
+    return _uidIndex;
+}
+
+Channel* Server::findChannel(const std::string& name) {
+    Scratch::Scope scope(_scratch);
+    std::string& key = _scratch.string();
+    ircCaseFold(name, key);
+    ChannelMap::iterator it = _channels.find(key);
+    if (it == _channels.end())
+        return NULL;
+    return &it->second;
+}
+
+const ChannelMap& Server::getChannels() const {
+    return _channels;
+}
+
+// Queue a long reply behind any already running for this client
+void Server::startStream(Client* client, ReplyStream* stream) {
+    _streams[client->getFd()].push_back(stream);
+    pumpStreams(client);
+}
+
+void Server::pumpStreams(Client* client) {
+    std::map<int, std::deque<ReplyStream*> >::iterator it = _streams.find(client->getFd());
+    if (it == _streams.end())
+        return;
+
+    std::deque<ReplyStream*>& queue = it->second;
+    while (!queue.empty() && client->getOutputBuffer().size() < STREAM_LOW_WATER) {
+        if (!queue.front()->fill(*this, *client, STREAM_CHUNK_BYTES))
+            break;
+        delete queue.front();
+        queue.pop_front();
     }
-    return NULL;  // Client not found
+    if (queue.empty())
+        _streams.erase(it);
+    if (client->hasDataToSend() || _streams.find(client->getFd()) != _streams.end())
+        enableWriteEvent(client->getFd());
+}
+
+void Server::dropStreams(int fd) {
+    std::map<int, std::deque<ReplyStream*> >::iterator it = _streams.find(fd);
+    if (it == _streams.end())
+        return;
+    for (size_t i = 0; i < it->second.size(); ++i)
+        delete it->second[i];
+    _streams.erase(it);
 }
 
 void Server::handlePart(Client* client, const std::string& channelNameRaw, const std::string& partMessage) {
@@ -331,373 +984,1129 @@ void Server::handlePart(Client* client, const std::string& channelNameRaw, const
 
     // Validate channel name: must start with '#' or '&' and have at least 2 chars
     if ((channelName[0] != '#' && channelName[0] != '&') || !channelName[1]) {
-        std::string response = ":server 403 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " " + channelName + " :No such channel\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
         return;
     }
 
     // Look for the channel in the server's list
-    for (std::vector<Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
-        if (it->getName() == channelName) {
-            // Channel found: try to remove the client from the channel
-            if (it->removeClient(client)) {
-                // Prepare PART message to notify all clients
-                std::string partMsg = ":" + client->getNickname() + " PART " + channelName;
-                if (!partMessage.empty())
-                    partMsg += " :" + partMessage;
-                partMsg += "\r\n";
-
-                // Notify the leaving client
-                client->addToOutputBuffer(partMsg);
-
-                // Notify all other clients in the channel
-                const std::vector<Client*>& clients = it->getClients();
-                for (size_t i = 0; i < clients.size(); ++i) {
-                    if (clients[i] != client) {
-                        clients[i]->addToOutputBuffer(partMsg);
-                        enableWriteEvent(clients[i]->getFd());
-                    }
-                }
+    Channel* channel = findChannel(channelName);
+    if (channel) {
+        // Channel found: try to remove the client from the channel
+        if (channel->removeClient(client)) {
+            // Prepare PART message to notify all clients
+            std::string partMsg;
+            partMsg.reserve(client->getPrefix().size() + channelName.size() + partMessage.size() + 12);
+            partMsg.append(client->getPrefix()).append(" PART ").append(channelName);
+            if (!partMessage.empty())
+                partMsg.append(" :").append(partMessage);
+            partMsg.append("\r\n");
+
+            // Notify the leaving client
+            client->addToOutputBuffer(partMsg);
+
+            // Notify all other clients in the channel
+            sendToLocalMembers(*channel, partMsg, client);
 
-                enableWriteEvent(client->getFd());
-
-                // Remove the channel if it is now empty
-                if (it->getClients().empty()) {
-                    _channels.erase(it);
-                }
-
-            } else {
-                // Client wasn't in the channel, send error 442 (You're not on that channel)
-                std::string response = ":server 442 " + (client->getNickname().empty() ? "*" : client->getNickname());
-                response += " " + channelName + " :You're not on that channel\r\n";
-                client->addToOutputBuffer(response);
-                enableWriteEvent(client->getFd());
+            enableWriteEvent(client->getFd());
+            std::string relay = ":" + client->getUid() + " PART " + channel->getName();
+            if (!partMessage.empty())
+                relay.append(" :").append(partMessage);
+            sendToLinks(relay + "\r\n", NULL);
+            if (_currentMessage && _plugins.wants(PLUGIN_PART))
+                _plugins.part(*client, *channel, *_currentMessage);
+
+            // Remove the channel if it is now empty
+            client->removeChannel(ircCaseFold(channelName));
+            if (channel->getClients().empty()) {
+                _channels.erase(ircCaseFold(channelName));
             }
-            return;
+
+        } else {
+            // Client wasn't in the channel, send error 442 (You're not on that channel)
+            sendNumeric(client, ERR_NOTONCHANNEL, channelName);
         }
+        return;
     }
 
     // Channel does not exist, send error 403
-    std::string response = ":server 403 " + (client->getNickname().empty() ? "*" : client->getNickname());
-    response += " " + channelName + " :No such channel\r\n";
-    client->addToOutputBuffer(response);
-    enableWriteEvent(client->getFd());
+    sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
 }
 
 
 
 // NOTE: Now accepts the actual message content from the user, instead of a hardcoded string
-void Server::handlePrivmsg(Client* client, const std::string& channelNameRaw, const std::string& messageContent) {
-    std::string channelName = channelNameRaw;
+void Server::handlePrivmsg(Client* client, const std::string& channelName, const std::string& messageContent) {
+    Scratch::Scope scope(_scratch);
 
     // Validate channel name as before
-    if ((channelName[0] != '#' && channelName[0] != '&') || !channelName[1]) {
-        std::string response = ":server 403 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " " + channelName + " :No such channel\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+    if ((channelName[0] != '#' && channelName[0] != '&') || channelName.size() < 2) {
+        sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
         return;
     }
 
     // Find the channel in the server list
-    for (std::vector<Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
-        if (it->getName() == channelName) {
-
-            if (!it->hasClient(client)) {
-                std::string response = ":server 404 " + client->getNickname() + " " + channelName + " :Cannot send to channel\r\n";
-                client->addToOutputBuffer(response);
-                enableWriteEvent(client->getFd());
-                return;
-            }
-            // *** MODIFICATION: Use the actual message from the user ***
-            std::string message = ":" + client->getNickname() + " PRIVMSG " + channelName + " :" + messageContent + "\r\n";
-
-            // Send message to all clients in the channel
-            const std::vector<Client*>& clients = it->getClients();
-            for (size_t i = 0; i < clients.size(); ++i) {
-                clients[i]->addToOutputBuffer(message);
-                enableWriteEvent(clients[i]->getFd());
-            }
+    Channel* channel = findChannel(channelName);
+    if (channel) {
 
-            enableWriteEvent(client->getFd());
+        if (!channel->hasClient(client) || channel->isBanned(client)) {
+            sendNumeric(client, ERR_CANNOTSENDTOCHAN, channelName);
             return;
         }
+        // *** MODIFICATION: Use the actual message from the user ***
+        std::string& message = _scratch.string();
+        message.append(client->getPrefix()).append(" PRIVMSG ").append(channelName)
+               .append(" :").append(messageContent).append("\r\n");
+
+        // Serialised once into the history ring, members are sent the stored line
+        const HistoryEntry& entry = channel->history().push(message);
+        if (_messageLog.enabled()) {
+            std::string& key = _scratch.string();
+            ircCaseFold(channelName, key);
+            _messageLog.append(entry.time, key, message);
+        }
+        _metrics.mark("log");
+        const std::vector<Client*>& clients = channel->getClients();
+        for (size_t i = 0; i < clients.size(); ++i) {
+            if (!clients[i]->isLocal())
+                continue;
+            sendHistoryLine(clients[i], entry);
+            enableWriteEvent(clients[i]->getFd());
+            _metrics.fanOut(1);
+        }
+        _metrics.mark("fanout");
+        if (!_links.empty())
+            relayToChannelLinks(*channel, ":" + client->getUid() + " PRIVMSG " + channel->getName()
+                                + " :" + messageContent + "\r\n", NULL);
+        if (_currentMessage && _plugins.wants(PLUGIN_PRIVMSG))
+            _plugins.privmsg(*client, *channel, *_currentMessage);
+
+        enableWriteEvent(client->getFd());
+        return;
     }
 
     // Channel does not exist, send error 403
-    std::string response = ":server 403 " + (client->getNickname().empty() ? "*" : client->getNickname());
-    response += " " + channelName + " :No such channel\r\n";
-    client->addToOutputBuffer(response);
-    enableWriteEvent(client->getFd());
+    sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
 }
 
 
 void Server::handleKick(Client* client, const std::string& params)
 {
-    std::istringstream iss(params);
-    std::string channelName, targetNick;
-    iss >> channelName >> targetNick;
+    Scratch::Scope scope(_scratch);
+    std::string& channelName = _scratch.string();
+    std::string& targetNick = _scratch.string();
+    size_t pos = 0;
+    nextWord(params, pos, channelName);
+    nextWord(params, pos, targetNick);
 
     // Check for required parameters
     if (channelName.empty() || targetNick.empty()) {
-        std::string response = ":server 461 " + client->getNickname() + " KICK :Not enough parameters\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NEEDMOREPARAMS, "KICK");
         return;
     }
 
     // Check valid channel name format
     if ((channelName[0] != '#' && channelName[0] != '&') || channelName.size() < 2) {
-        std::string response = ":server 403 " + client->getNickname() + " " + channelName + " :No such channel\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
         return;
     }
 
     // Find the channel
-    Channel* targetChannel = nullptr;
-    for (std::vector<Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
-        if (it->getName() == channelName) {
-            targetChannel = &(*it);
-            break;
-        }
-    }
-
+    Channel* targetChannel = findChannel(channelName);
     if (!targetChannel) {
-        std::string response = ":server 403 " + client->getNickname() + " " + channelName + " :No such channel\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
         return;
     }
 
     // Check if the sender is a channel operator
     if (!targetChannel->isOperator(client)) {
-        std::string response = ":server 482 " + client->getNickname() + " " + channelName + " :You're not a channel operator\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_CHANOPRIVSNEEDED, channelName);
         return;
     }
 
     // Find the target client by nickname
     Client* targetClient = getClientByNickname(targetNick); // You need this helper
     if (!targetClient) {
-        std::string response = ":server 401 " + client->getNickname() + " " + targetNick + " :No such nick\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NOSUCHNICK, targetNick);
         return;
     }
 
     // Check if the target is in the channel
     if (!targetChannel->hasClient(targetClient)) {
-        std::string response = ":server 441 " + client->getNickname() + " " + targetNick + " " + channelName + " :They aren't on that channel\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_USERNOTINCHANNEL, targetNick, channelName);
         return;
     }
 
     // Notify all users in the channel
-    std::string kickMsg = ":" + client->getNickname() + " KICK " + channelName + " " + targetNick + "\r\n";
-    const std::vector<Client*>& clients = targetChannel->getClients();
-    for (size_t i = 0; i < clients.size(); ++i) {
-        clients[i]->addToOutputBuffer(kickMsg);
-        enableWriteEvent(clients[i]->getFd());
-    }
+    std::string& kickMsg = _scratch.string();
+    kickMsg.append(client->getPrefix()).append(" KICK ").append(channelName)
+           .append(" ").append(targetNick).append("\r\n");
+    sendToLocalMembers(*targetChannel, kickMsg, NULL);
+    sendToLinks(":" + client->getUid() + " KICK " + targetChannel->getName() + " " + targetClient->getUid() + "\r\n", NULL);
 
     // Remove target client from the channel
     targetChannel->removeClient(targetClient);
+    targetClient->removeChannel(ircCaseFold(channelName));
+    if (targetChannel->getClients().empty())
+        _channels.erase(ircCaseFold(channelName));
 }
 
 void Server::handleMode(Client* client, const std::string& params)
 {
-    std::vector<std::string> args;
-    std::istringstream iss(params);
-    std::string token;
-    while (iss >> token) {
-        args.push_back(token);
-    }
-
-    if (args.empty()) {
+    Scratch::Scope scope(_scratch);
+    // Words are read as they are needed: channel, modes, then one
+    // argument per list mode
+    std::string& channelName = _scratch.string();
+    std::string& modeStr = _scratch.string();
+    std::string& arg = _scratch.string();
+    size_t pos = 0;
+    if (!nextWord(params, pos, channelName)) {
         return; // no parameters at all
     }
-    const std::string& channelName = args[0]; // use args[0] consistently
 
     // Validate channel name
     if ((channelName[0] != '#' && channelName[0] != '&') || channelName.size() < 2) {
-        std::string response = ":server 403 " + client->getNickname() + " " + channelName + " :No such channel\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
         return;
     }
 
     // Find the channel
-    Channel* targetChannel = nullptr;
-    for (std::vector<Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
-        if (it->getName() == channelName) {
-            targetChannel = &(*it);
-            break;
-        }
-    }
-
+    Channel* targetChannel = findChannel(channelName);
     if (!targetChannel) {
-        std::string response = ":server 403 " + client->getNickname() + " " + channelName + " :No such channel\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
         return;
     }
 
     // If only channel name given, show current modes
-    if (args.size() == 1) {
+    if (!nextWord(params, pos, modeStr)) {
         std::string currentModes = "+";
         if (targetChannel->isInviteOnly()) currentModes += "i";
         if (targetChannel->isTopicRestricted()) currentModes += "t";
 
-        std::string response = ":server 324 " + client->getNickname() + " " + channelName + " " + currentModes + "\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, RPL_CHANNELMODEIS, channelName, currentModes);
         return;
     }
 
-    // Check if operator
-    if (!targetChannel->isOperator(client)) {
-        std::string response = ":server 482 " + client->getNickname() + " " + channelName + " :You're not a channel operator\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
-        return;
-    }
-
-    const std::string& modeStr = args[1];  // next argument after channel name
-
+    // List modes without an argument are queries, open to everyone
+    std::string applied;        // "+b-i..." actually changed
+    std::string appliedArgs;
+    bool isOperator = targetChannel->isOperator(client);
     bool adding = true;
+    char lastSign = 0;
     for (size_t i = 0; i < modeStr.size(); ++i) {
         char mode = modeStr[i];
-        if (mode == '+') {
-            adding = true;
-        } else if (mode == '-') {
-            adding = false;
-        } else if (mode == 'i') {
-            targetChannel->setInviteOnly(adding);
-        } else if (mode == 't') {
-            targetChannel->setTopicRestricted(adding);
+        if (mode == '+' || mode == '-') {
+            adding = (mode == '+');
+            continue;
+        }
+
+        bool changed = false;
+        std::string mask;
+        if (mode == 'b' || mode == 'e' || mode == 'I') {
+            Channel::ListMode list = mode == 'b' ? Channel::BAN_LIST
+                                   : mode == 'e' ? Channel::EXCEPT_LIST : Channel::INVITE_LIST;
+            if (!nextWord(params, pos, arg)) {
+                sendMaskList(client, *targetChannel, list);
+                continue;
+            }
+            mask = Mask::normalise(arg);
+            if (!isOperator) {
+                sendNumeric(client, ERR_CHANOPRIVSNEEDED, channelName);
+                return;
+            }
+            if (adding) {
+                changed = targetChannel->addMask(list, mask, client->getPrefix().substr(1));
+                if (!changed && targetChannel->getMasks(list).size() >= MAXLIST)
+                    sendNumeric(client, ERR_BANLISTFULL, channelName, mask);
+            } else {
+                changed = targetChannel->removeMask(list, mask);
+            }
+        } else if (mode == 'i' || mode == 't') {
+            if (!isOperator) {
+                sendNumeric(client, ERR_CHANOPRIVSNEEDED, channelName);
+                return;
+            }
+            bool current = mode == 'i' ? targetChannel->isInviteOnly() : targetChannel->isTopicRestricted();
+            if (current != adding) {
+                if (mode == 'i')
+                    targetChannel->setInviteOnly(adding);
+                else
+                    targetChannel->setTopicRestricted(adding);
+                changed = true;
+            }
         } else {
-            // Unknown mode: optionally send error or ignore
+            sendNumeric(client, ERR_UNKNOWNMODE, std::string(1, mode));
+            continue;
+        }
+
+        if (!changed)
+            continue;
+        if (lastSign != (adding ? '+' : '-')) {
+            lastSign = adding ? '+' : '-';
+            applied += lastSign;
         }
+        applied += mode;
+        if (!mask.empty())
+            appliedArgs.append(" ").append(mask);
     }
 
-    // Broadcast mode change
-    std::string modeChangeMsg = ":" + client->getNickname() + " MODE " + channelName + " " + modeStr + "\r\n";
-    const std::vector<Client*>& clients = targetChannel->getClients();
-    for (size_t i = 0; i < clients.size(); ++i) {
-        clients[i]->addToOutputBuffer(modeChangeMsg);
-        enableWriteEvent(clients[i]->getFd());
+    if (applied.empty())
+        return;
+
+    // Broadcast only what changed, with its arguments
+    std::string& modeChangeMsg = _scratch.string();
+    modeChangeMsg.append(client->getPrefix()).append(" MODE ").append(channelName)
+                 .append(" ").append(applied).append(appliedArgs).append("\r\n");
+    _metrics.mark("apply");
+    sendToLocalMembers(*targetChannel, modeChangeMsg, NULL);
+    _metrics.mark("broadcast");
+    sendToLinks(":" + client->getUid() + " TMODE " + toString(targetChannel->getCreationTime()) + " "
+                + targetChannel->getName() + " " + applied + appliedArgs + "\r\n", NULL);
+}
+
+void Server::sendMaskList(Client* client, const Channel& channel, Channel::ListMode list)
+{
+    static const Numeric entryReply[] = { RPL_BANLIST, RPL_EXCEPTLIST, RPL_INVITELIST };
+    static const Numeric endReply[] = { RPL_ENDOFBANLIST, RPL_ENDOFEXCEPTLIST, RPL_ENDOFINVITELIST };
+
+    std::string& out = client->outputBuffer();
+    const std::vector<Channel::MaskEntry>& entries = channel.getMasks(list);
+    const std::string& name = channel.getName();
+
+    for (size_t i = 0; i < entries.size(); ++i) {
+        std::string setAt = toString(entries[i].setAt);
+        const std::string* params[] = { &name, &entries[i].mask.str(), &entries[i].setBy };
+        Reply::appendList(out, entryReply[list], client->getNickname(), params, 3, setAt);
     }
+    Reply::append(out, endReply[list], client->getNickname(), name);
+    enableWriteEvent(client->getFd());
 }
 
 
 
 void Server::handleJoin(Client* client, const std::string& channelNameRaw)
 {
-    std::string channelName = channelNameRaw;
+    std::string channelName = channelNameRaw.substr(0, channelNameRaw.find(' '));
 
     // Validate channel name
-    if ((channelName[0] != '#' && channelName[0] != '&') || !channelName[1]) {
-        std::string response = ":server 403 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " " + channelName + " :No such channel\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+    if ((channelName[0] != '#' && channelName[0] != '&') || !channelName[1]
+        || channelName.size() > CHANNELLEN) {
+        sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
         return;
     }
 
     // Check if the channel already exists
-    for (std::vector<Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
-        if (it->getName() == channelName) {
-            // Channel already exists, try to add the client
-            if (it->addClient(client)) {
-                std::string joinMsg = ":" + client->getNickname() + " JOIN " + channelName + "\r\n";
-
-                // Notify the joining client
-                client->addToOutputBuffer(joinMsg);
-
-                // Send topic if exists
-                if (!it->getTopic().empty()) {
-                    std::string topicReply = ":server 332 " + client->getNickname() + " " + channelName + " :" + it->getTopic() + "\r\n";
-                    client->addToOutputBuffer(topicReply);
-                }
+    Channel* channel = findChannel(channelName);
+    if (channel) {
+        if (!channel->hasClient(client)) {
+            if (channel->isBanned(client)) {
+                sendNumeric(client, ERR_BANNEDFROMCHAN, channelName);
+                return;
+            }
+            if (channel->isInviteOnly() && !channel->isInviteExempt(client) && !channel->isSavedOperator(client)) {
+                sendNumeric(client, ERR_INVITEONLYCHAN, channelName);
+                return;
+            }
+        }
 
-                // Send NAMES list
-                std::string namesReply = ":server 353 " + client->getNickname() + " = " + channelName + " :";
-                const std::vector<Client*>& clients = it->getClients();
-                for (size_t i = 0; i < clients.size(); ++i) {
-                    namesReply += clients[i]->getNickname() + " ";
-                }
-                namesReply += "\r\n";
-                std::string endOfNames = ":server 366 " + client->getNickname() + " " + channelName + " :End of /NAMES list\r\n";
+        // Channel already exists, try to add the client
+        if (channel->addClient(client)) {
+            client->addChannel(ircCaseFold(channelName));
+            // Restored channels: returning operators get their status back,
+            // and an unclaimed channel goes to its first member as usual
+            if (!channel->claimSavedOperator(client) && channel->getClients().size() == 1
+                && channel->getSavedOperators().empty())
+                channel->addOperator(client);
+            std::string joinMsg;
+            joinMsg.reserve(client->getPrefix().size() + channelName.size() + 8);
+            joinMsg.append(client->getPrefix()).append(" JOIN ").append(channelName).append("\r\n");
+
+            // Notify the joining client
+            client->addToOutputBuffer(joinMsg);
+
+            // Send topic if exists
+            if (!channel->getTopic().empty())
+                Reply::appendText(client->outputBuffer(), RPL_TOPIC, client->getNickname(), channelName, channel->getTopic());
+
+            // Send NAMES list
+            sendNames(client, *channel);
+            _metrics.mark("names");
+
+            // Catch the newcomer up on the last few lines (CHATHISTORY
+            // can fetch them later if we are overloaded)
+            const HistoryRing& history = channel->history();
+            size_t replay = std::min(_joinReplay, history.size());
+            if (replay && _load.overloaded()) {
+                _metrics.add(Metrics::SHED_REPLAYS);
+                replay = 0;
+            }
+            for (size_t i = history.size() - replay; i < history.size(); ++i)
+                sendHistoryLine(client, history.at(i));
+            _metrics.mark("replay");
 
-                client->addToOutputBuffer(namesReply);
-                client->addToOutputBuffer(endOfNames);
+            // Broadcast JOIN to other clients
+            sendToLocalMembers(*channel, joinMsg, client);
+            relayJoin(*channel, client);
+            _metrics.mark("broadcast");
+            if (_currentMessage && _plugins.wants(PLUGIN_JOIN))
+                _plugins.join(*client, *channel, *_currentMessage);
 
-                // Broadcast JOIN to other clients
-                for (size_t i = 0; i < clients.size(); ++i) {
-                    if (clients[i] != client) {
-                        clients[i]->addToOutputBuffer(joinMsg);
-                        enableWriteEvent(clients[i]->getFd());
-                    }
-                }
-
-                enableWriteEvent(client->getFd());
-            } else {
-                // Client is already in the channel
-                std::string response = ":server 442 " + (client->getNickname().empty() ? "*" : client->getNickname());
-                response += " " + channelName + " :You're already on that channel\r\n";
-                client->addToOutputBuffer(response);
-                enableWriteEvent(client->getFd());
-            }
-            return;
+            enableWriteEvent(client->getFd());
+        } else {
+            // Client is already in the channel
+            sendNumeric(client, ERR_USERONCHANNEL, client->getNickname(), channelName);
         }
+        return;
     }
 
     // Channel doesn't exist: create new and add the client
-    Channel newChannel(channelName, client);
-    _channels.push_back(newChannel);
+    Channel& newChannel = _channels.insert(std::make_pair(ircCaseFold(channelName), Channel(channelName, client))).first->second;
+    client->addChannel(ircCaseFold(channelName));
 
-    std::string joinMsg = ":" + client->getNickname() + " JOIN " + channelName + "\r\n";
+    std::string joinMsg;
+    joinMsg.reserve(client->getPrefix().size() + channelName.size() + 8);
+    joinMsg.append(client->getPrefix()).append(" JOIN ").append(channelName).append("\r\n");
     client->addToOutputBuffer(joinMsg);
 
     // No topic yet
-    std::string namesReply = ":server 353 " + client->getNickname() + " = " + channelName + " :" + client->getNickname() + "\r\n";
-    std::string endOfNames = ":server 366 " + client->getNickname() + " " + channelName + " :End of /NAMES list\r\n";
+    sendNames(client, newChannel);
+    relayJoin(newChannel, client);
+    if (_currentMessage && _plugins.wants(PLUGIN_JOIN))
+        _plugins.join(*client, newChannel, *_currentMessage);
+}
+
+void Server::sendNames(Client* client, const Channel& channel)
+{
+    std::string& out = client->outputBuffer();
+    const std::vector<std::string>& chunks = channel.getNamesChunks();
+
+    for (size_t i = 0; i < chunks.size(); ++i)
+        Reply::appendText(out, RPL_NAMREPLY, client->getNickname(), "=", channel.getName(), chunks[i]);
+    Reply::append(out, RPL_ENDOFNAMES, client->getNickname(), channel.getName());
+    enableWriteEvent(client->getFd());
+}
+
+// NAMES [<channel>{,<channel>}]
+void Server::handleNames(Client* client, const std::string& params)
+{
+    std::string targets = params.substr(0, params.find(' '));
+
+    if (targets.empty()) {
+        sendNumeric(client, RPL_ENDOFNAMES, "*");
+        return;
+    }
+
+    size_t start = 0;
+    while (start <= targets.size()) {
+        size_t comma = targets.find(',', start);
+        if (comma == std::string::npos)
+            comma = targets.size();
+        std::string channelName = targets.substr(start, comma - start);
+        start = comma + 1;
+        if (channelName.empty())
+            continue;
+
+        Channel* channel = findChannel(channelName);
+        if (channel)
+            sendNames(client, *channel);
+        else
+            sendNumeric(client, RPL_ENDOFNAMES, channelName);
+    }
+}
+
+// LIST [<channel>{,<channel>}|<mask>] [<elist filters>]
+void Server::handleList(Client* client, const std::string& params)
+{
+    startStream(client, new ListStream(params));
+}
+
+// WHO <#channel> | WHO <mask>
+// Channel queries walk that channel's members. A mask without a leading
+// wildcard is resolved through the nick and host indexes (exact lookup or
+// prefix range), so only users sharing the literal prefix are touched;
+// those forms match on nick and host. Anything else scans every client.
+void Server::handleWho(Client* client, const std::string& params)
+{
+    std::string mask = params.substr(0, params.find(' '));
+
+    if (!mask.empty() && (mask[0] == '#' || mask[0] == '&')) {
+        Channel* channel = findChannel(mask);
+        std::vector<std::string> uids;
+        if (channel) {
+            const std::vector<Client*>& members = channel->getClients();
+            uids.reserve(members.size());
+            for (size_t i = 0; i < members.size(); ++i)
+                uids.push_back(members[i]->getUid());
+        }
+        startStream(client, new WhoStream(mask, ircCaseFold(mask), uids));
+        return;
+    }
+
+    size_t wild = mask.find_first_of("*?");
+    if (mask.empty() || mask == "0" || wild == 0) {
+        startStream(client, new WhoStream(mask));
+        return;
+    }
+
+    std::set<std::string> found;
+    std::string literal = mask.substr(0, wild);
+    std::string foldedLiteral = ircCaseFold(literal);
+
+    // Nick index: every key starting with the literal prefix
+    for (NickIndex::iterator it = _nickIndex.lower_bound(foldedLiteral);
+            it != _nickIndex.end() && it->first.compare(0, foldedLiteral.size(), foldedLiteral) == 0; ++it) {
+        if (it->second->isRegistered() && matchMask(mask, it->second->getNickname()))
+            found.insert(it->second->getUid());
+    }
+    // Host index: same idea over IPs ("10.0.*", "192.168.1.5")
+    for (HostIndex::iterator it = _hostIndex.lower_bound(literal);
+            it != _hostIndex.end() && it->first.compare(0, literal.size(), literal) == 0; ++it) {
+        if (it->second->isRegistered() && matchMask(mask, it->first))
+            found.insert(it->second->getUid());
+    }
+    // Name index: usernames and real names. A match on any field starts
+    // with the literal prefix, so the four scans find what a full
+    // whoMatches() scan would.
+    for (NameIndex::iterator it = _nameIndex.lower_bound(foldedLiteral);
+            it != _nameIndex.end() && it->first.compare(0, foldedLiteral.size(), foldedLiteral) == 0; ++it) {
+        if (it->second->isRegistered() && whoMatches(mask, *it->second))
+            found.insert(it->second->getUid());
+    }
+    startStream(client, new WhoStream(mask, "", std::vector<std::string>(found.begin(), found.end())));
+}
+
+// WHOIS [<server>] <nick>{,<nick>}
+void Server::handleWhois(Client* client, const std::string& params)
+{
+    Scratch::Scope scope(_scratch);
+    std::string& first = _scratch.string();
+    std::string& second = _scratch.string();
+    size_t pos = 0;
+    nextWord(params, pos, first);
+    nextWord(params, pos, second);
+    const std::string& nicks = second.empty() ? first : second;
+
+    if (nicks.empty()) {
+        sendNumeric(client, ERR_NONICKNAMEGIVEN);
+        return;
+    }
+
+    std::string& out = client->outputBuffer();
+    const std::string& me = client->getNickname();
+    size_t start = 0;
+    while (start <= nicks.size()) {
+        size_t comma = nicks.find(',', start);
+        if (comma == std::string::npos)
+            comma = nicks.size();
+        std::string nick = nicks.substr(start, comma - start);
+        start = comma + 1;
+        if (nick.empty())
+            continue;
+
+        Client* target = getClientByNickname(nick);
+        if (!target || !target->isRegistered()) {
+            Reply::append(out, ERR_NOSUCHNICK, me, nick);
+            Reply::append(out, RPL_ENDOFWHOIS, me, nick);
+            continue;
+        }
+
+        const std::string star("*");
+        const std::string* userParams[] = { &target->getNickname(), &target->getUsername(), &target->getIp(), &star };
+        Reply::appendList(out, RPL_WHOISUSER, me, userParams, 4, target->getRealname());
+
+        // Channels from the client's own membership set, split to fit 512 bytes
+        std::string line;
+        const std::set<std::string>& joined = target->getChannels();
+        for (std::set<std::string>::const_iterator key = joined.begin(); key != joined.end(); ++key) {
+            ChannelMap::iterator it = _channels.find(*key);
+            if (it == _channels.end())
+                continue;
+            if (line.size() + it->second.getName().size() + 2 > IRC_LINE_MAX - 64 - NICKLEN * 2) {
+                Reply::appendText(out, RPL_WHOISCHANNELS, me, target->getNickname(), line);
+                line.clear();
+            }
+            if (!line.empty())
+                line += ' ';
+            if (it->second.isOperator(target))
+                line += '@';
+            line += it->second.getName();
+        }
+        if (!line.empty())
+            Reply::appendText(out, RPL_WHOISCHANNELS, me, target->getNickname(), line);
+
+        Reply::appendText(out, RPL_WHOISSERVER, me, target->getNickname(), SERVER_NAME, "ircserv");
+        Reply::append(out, RPL_ENDOFWHOIS, me, target->getNickname());
+    }
+    enableWriteEvent(client->getFd());
+}
+
+// MONITOR +/- <targets> | C | L | S. Each client keeps its own list, the
+// server mirrors it as nick -> watchers so presence changes are pushed
+// to exactly the clients that asked.
+void Server::handleMonitor(Client* client, const std::string& params)
+{
+    std::istringstream iss(params);
+    std::string op, targets;
+    iss >> op >> targets;
+    if (!targets.empty() && targets[0] == ':')
+        targets.erase(0, 1);
+
+    if (op.empty()) {
+        sendNumeric(client, ERR_NEEDMOREPARAMS, "MONITOR");
+        return;
+    }
+
+    std::vector<std::string> online, offline;
+    if (op == "+" || op == "-") {
+        if (targets.empty()) {
+            sendNumeric(client, ERR_NEEDMOREPARAMS, "MONITOR");
+            return;
+        }
+        std::istringstream list(targets);
+        std::string nick;
+        while (std::getline(list, nick, ',')) {
+            if (nick.empty())
+                continue;
+            std::string key = ircCaseFold(nick);
+            if (op == "-") {
+                if (client->removeMonitor(key)) {
+                    WatcherIndex::iterator it = _watchers.find(key);
+                    if (it != _watchers.end()) {
+                        it->second.erase(client);
+                        if (it->second.empty())
+                            _watchers.erase(it);
+                    }
+                }
+                continue;
+            }
+            if (!isValidNickname(nick))
+                continue;
+            if (client->getMonitors().size() >= MONITOR_MAX && !client->getMonitors().count(key)) {
+                // Report the rest of the request as rejected
+                std::string rest = nick;
+                std::string more;
+                while (std::getline(list, more, ','))
+                    rest.append(",").append(more);
+                sendNumeric(client, ERR_MONLISTFULL, toString(MONITOR_MAX), rest);
+                break;
+            }
+            if (!client->addMonitor(key, nick))
+                continue;
+            _watchers[key].insert(client);
+
+            NickIndex::iterator target = _nickIndex.find(key);
+            if (target != _nickIndex.end() && target->second->isRegistered())
+                online.push_back(target->second->getPrefix().substr(1));
+            else
+                offline.push_back(nick);
+        }
+    } else if (op == "C" || op == "c") {
+        unwatchAll(client);
+        return;
+    } else if (op == "L" || op == "l") {
+        std::vector<std::string> all;
+        const std::map<std::string, std::string>& monitors = client->getMonitors();
+        for (std::map<std::string, std::string>::const_iterator it = monitors.begin(); it != monitors.end(); ++it)
+            all.push_back(it->second);
+        sendNickList(client, RPL_MONLIST, all);
+        sendNumeric(client, RPL_ENDOFMONLIST);
+        return;
+    } else if (op == "S" || op == "s") {
+        const std::map<std::string, std::string>& monitors = client->getMonitors();
+        for (std::map<std::string, std::string>::const_iterator it = monitors.begin(); it != monitors.end(); ++it) {
+            NickIndex::iterator target = _nickIndex.find(it->first);
+            if (target != _nickIndex.end() && target->second->isRegistered())
+                online.push_back(target->second->getPrefix().substr(1));
+            else
+                offline.push_back(it->second);
+        }
+    } else {
+        sendNumeric(client, ERR_UNKNOWNCOMMAND, "MONITOR");
+        return;
+    }
+
+    sendNickList(client, RPL_MONONLINE, online);
+    sendNickList(client, RPL_MONOFFLINE, offline);
+}
+
+// ISON <nick> [<nick>...]: answered from the nick index, no user scan
+void Server::handleIson(Client* client, const std::string& params)
+{
+    if (params.empty()) {
+        sendNumeric(client, ERR_NEEDMOREPARAMS, "ISON");
+        return;
+    }
+
+    Scratch::Scope scope(_scratch);
+    std::string& nick = _scratch.string();
+    std::string& key = _scratch.string();
+    std::string& present = _scratch.string();
+    size_t pos = 0;
+    while (nextWord(params, pos, nick)) {
+        if (nick[0] == ':')
+            nick.erase(0, 1);
+        ircCaseFold(nick, key);
+        NickIndex::iterator it = _nickIndex.find(key);
+        if (it == _nickIndex.end() || !it->second->isRegistered())
+            continue;
+        if (!present.empty())
+            present += ' ';
+        present += it->second->getNickname();
+    }
+    sendNumericText(client, RPL_ISON, present);
+}
+
+void Server::notifyWatchers(const std::string& nick, Numeric id, const std::string& item)
+{
+    WatcherIndex::iterator it = _watchers.find(ircCaseFold(nick));
+    if (it == _watchers.end())
+        return;
+    for (std::set<Client*>::iterator w = it->second.begin(); w != it->second.end(); ++w) {
+        Reply::appendText((*w)->outputBuffer(), id, (*w)->getNickname(), item);
+        enableWriteEvent((*w)->getFd());
+    }
+}
+
+void Server::unwatchAll(Client* client)
+{
+    const std::map<std::string, std::string>& monitors = client->getMonitors();
+    while (!monitors.empty()) {
+        std::string key = monitors.begin()->first;
+        WatcherIndex::iterator it = _watchers.find(key);
+        if (it != _watchers.end()) {
+            it->second.erase(client);
+            if (it->second.empty())
+                _watchers.erase(it);
+        }
+        client->removeMonitor(key);
+    }
+}
+
+void Server::sendNickList(Client* client, Numeric id, const std::vector<std::string>& items)
+{
+    // ":server NNN nick :" + CRLF around the comma-separated list
+    size_t budget = IRC_LINE_MAX - (sizeof(SERVER_NAME) - 1) - client->getNickname().size() - 10;
+    std::string line;
+
+    for (size_t i = 0; i < items.size(); ++i) {
+        if (!line.empty() && line.size() + 1 + items[i].size() > budget) {
+            Reply::appendText(client->outputBuffer(), id, client->getNickname(), line);
+            line.clear();
+        }
+        if (!line.empty())
+            line += ',';
+        line += items[i];
+    }
+    if (!line.empty())
+        Reply::appendText(client->outputBuffer(), id, client->getNickname(), line);
+    enableWriteEvent(client->getFd());
+}
+
+// CAP LS/LIST/REQ/END. Only multi-prefix and server-time are offered.
+void Server::handleCap(Client* client, const std::string& params)
+{
+    static const struct { const char* name; ClientCap bit; } known[] = {
+        { "multi-prefix", CAP_MULTI_PREFIX },
+        { "server-time", CAP_SERVER_TIME }
+    };
+    const size_t knownCount = sizeof(known) / sizeof(known[0]);
+
+    std::string subcommand = params.substr(0, params.find(' '));
+    for (size_t i = 0; i < subcommand.size(); ++i)
+        subcommand[i] = toupper(subcommand[i]);
+    std::string target = client->getNickname().empty() ? "*" : client->getNickname();
+    std::string reply = ":" SERVER_NAME " CAP " + target + " ";
+
+    if (subcommand == "LS" || subcommand == "LIST") {
+        std::string list;
+        for (size_t i = 0; i < knownCount; ++i) {
+            if (subcommand == "LIST" && !client->hasCap(known[i].bit))
+                continue;
+            if (!list.empty())
+                list += ' ';
+            list += known[i].name;
+        }
+        reply += subcommand + " :" + list + "\r\n";
+    } else if (subcommand == "REQ") {
+        size_t colon = params.find(':');
+        std::string requested = colon == std::string::npos
+            ? params.substr(std::min(params.size(), subcommand.size() + 1)) : params.substr(colon + 1);
+
+        // All or nothing: one unknown name NAKs the whole request
+        unsigned int caps = client->getCaps();
+        bool ok = true;
+        std::istringstream iss(requested);
+        std::string name;
+        while (ok && iss >> name) {
+            bool remove = name[0] == '-';
+            std::string bare = remove ? name.substr(1) : name;
+            size_t i = 0;
+            while (i < knownCount && bare != known[i].name)
+                ++i;
+            if (i == knownCount)
+                ok = false;
+            else if (remove)
+                caps &= ~known[i].bit;
+            else
+                caps |= known[i].bit;
+        }
+        if (ok)
+            client->setCaps(caps);
+        reply += (ok ? "ACK :" : "NAK :") + requested + "\r\n";
+    } else if (subcommand == "END") {
+        return;
+    } else {
+        sendNumeric(client, ERR_INVALIDCAPCMD, subcommand);
+        return;
+    }
+    client->addToOutputBuffer(reply);
+    enableWriteEvent(client->getFd());
+}
+
+// History lines are stored tagged; clients without server-time get the
+// same bytes minus the tag, nothing is re-formatted per recipient.
+void Server::sendHistoryLine(Client* client, const HistoryEntry& entry)
+{
+    if (client->hasCap(CAP_SERVER_TIME))
+        client->outputBuffer().append(entry.line);
+    else
+        client->outputBuffer().append(entry.line, entry.tagLen, std::string::npos);
+}
+
+// CHATHISTORY LATEST <channel> <* | timestamp=ts> <limit>
+// CHATHISTORY BEFORE|AFTER <channel> timestamp=ts <limit>
+// CHATHISTORY BETWEEN <channel> timestamp=ts timestamp=ts <limit>
+void Server::handleChatHistory(Client* client, const std::string& params)
+{
+    std::vector<std::string> args;
+    std::istringstream iss(params);
+    std::string token;
+    while (iss >> token)
+        args.push_back(token);
+
+    std::string fail = ":" SERVER_NAME " FAIL CHATHISTORY ";
+    if (args.size() < 4) {
+        client->addToOutputBuffer(fail + "NEED_MORE_PARAMS CHATHISTORY :Missing parameters\r\n");
+        enableWriteEvent(client->getFd());
+        return;
+    }
+
+    std::string subcommand = args[0];
+    for (size_t i = 0; i < subcommand.size(); ++i)
+        subcommand[i] = toupper(subcommand[i]);
+    const std::string& target = args[1];
+    bool between = subcommand == "BETWEEN";
+    size_t limitArg = between ? 4 : 3;
+
+    // Selectors: "*" (LATEST only) or timestamp=<server-time>
+    uint64_t from = 0, to = 0;
+    bool fromAny = false;
+    bool valid = args.size() > limitArg
+        && (subcommand == "LATEST" || subcommand == "BEFORE" || subcommand == "AFTER" || between);
+    if (valid) {
+        if (args[2] == "*" && subcommand == "LATEST")
+            fromAny = true;
+        else
+            valid = args[2].compare(0, 10, "timestamp=") == 0 && parseServerTime(args[2].substr(10), from);
+    }
+    if (valid && between)
+        valid = args[3].compare(0, 10, "timestamp=") == 0 && parseServerTime(args[3].substr(10), to);
+    size_t limit = valid ? std::strtoul(args[limitArg].c_str(), NULL, 10) : 0;
+    if (!valid || limit == 0) {
+        client->addToOutputBuffer(fail + "INVALID_PARAMS " + subcommand + " :Invalid parameters\r\n");
+        enableWriteEvent(client->getFd());
+        return;
+    }
+    limit = std::min<size_t>(limit, CHATHISTORY_MAX);
+
+    Channel* channel = findChannel(target);
+    if (!channel || !channel->hasClient(client)) {
+        client->addToOutputBuffer(fail + "INVALID_TARGET " + subcommand + " " + target + " :Messages could not be retrieved\r\n");
+        enableWriteEvent(client->getFd());
+        return;
+    }
 
-    client->addToOutputBuffer(namesReply);
-    client->addToOutputBuffer(endOfNames);
+    // Select [first, last) in ring order, then trim to the limit from the
+    // end nearest the reference point
+    const HistoryRing& history = channel->history();
+    size_t first = 0, last = history.size();
+    bool fromEnd = true;
+    if (subcommand == "LATEST") {
+        if (!fromAny)
+            first = history.lowerBound(from, true);
+    } else if (subcommand == "BEFORE") {
+        last = history.lowerBound(from, false);
+    } else if (subcommand == "AFTER") {
+        first = history.lowerBound(from, true);
+        fromEnd = false;
+    } else {
+        if (to < from)
+            std::swap(from, to);
+        first = history.lowerBound(from, true);
+        last = history.lowerBound(to, false);
+        fromEnd = false;
+    }
+    if (last < first)
+        last = first;
+
+    // The ring holds only the newest lines: it has wrapped, or it was
+    // emptied by a restart while the log kept everything. Reach into the
+    // log for whatever part of the window lies before the ring's oldest
+    // line; the query is bounded, see MSGLOG_QUERY_SCAN_MAX.
+    std::vector<LogRecord> older;
+    if (_messageLog.enabled() && first == 0 && (!fromEnd || last - first < limit)) {
+        uint64_t oldest = history.size() ? history.at(0).time : ~static_cast<uint64_t>(0);
+        uint64_t lo = fromAny || subcommand == "BEFORE" ? 0 : from + 1;
+        uint64_t hi = oldest;
+        if (subcommand == "BEFORE" && from <= hi)
+            hi = from ? from - 1 : 0;
+        if (between && to <= hi)
+            hi = to ? to - 1 : 0;
+
+        // Records at the ring's first millisecond may already be in the ring
+        size_t shared = 0;
+        while (shared < last && history.at(shared).time == oldest)
+            ++shared;
+        if (lo <= hi) {
+            _messageLog.query(ircCaseFold(target), lo, hi, limit + shared, fromEnd, older);
+            for (size_t n = 0; n < shared && !older.empty() && older.back().time == oldest; ++n)
+                older.pop_back();
+        }
+    }
 
+    // Trim the combined log + ring window to the limit
+    size_t total = older.size() + (last - first);
+    if (total > limit) {
+        size_t excess = total - limit;
+        if (fromEnd) {
+            size_t fromLog = std::min(excess, older.size());
+            older.erase(older.begin(), older.begin() + fromLog);
+            first += excess - fromLog;
+        } else {
+            size_t fromRing = std::min(excess, last - first);
+            last -= fromRing;
+            older.resize(older.size() - (excess - fromRing));
+        }
+    }
+
+    std::string& out = client->outputBuffer();
+    for (size_t i = 0; i < older.size(); ++i) {
+        if (client->hasCap(CAP_SERVER_TIME)) {
+            out.append("@time=");
+            appendServerTime(out, older[i].time);
+            out += ' ';
+        }
+        out.append(older[i].line);
+    }
+    for (size_t i = first; i < last; ++i)
+        sendHistoryLine(client, history.at(i));
     enableWriteEvent(client->getFd());
 }
 
-void Server::processCommand(Client* client , const std::string& message)
+// OPER <name> <password>, checked against IRCSERV_OPERS
+void Server::handleOper(Client* client, const std::string& params)
 {
-    std::string command;
-    std::string params;
+    std::istringstream iss(params);
+    std::string name, password;
+    iss >> name >> password;
+    if (name.empty() || password.empty()) {
+        sendNumeric(client, ERR_NEEDMOREPARAMS, "OPER");
+        return;
+    }
+    std::map<std::string, std::string>::const_iterator it = _opers.find(name);
+    if (it == _opers.end()) {
+        sendNumeric(client, ERR_NOOPERHOST);
+        return;
+    }
+    if (it->second != password) {
+        std::cout << RED << "✗ Client " << client->getFd() << " failed OPER as " << name << RESET << std::endl;
+        sendNumeric(client, ERR_PASSWDMISMATCH);
+        return;
+    }
+    client->setOper(true);
+    std::cout << BOLD << MAGENTA << "★ " << client->getNickname() << " is now an operator (" << name << ")" << RESET << std::endl;
+    sendNumeric(client, RPL_YOUREOPER);
+}
+
+// STATS m: per-command counts   STATS u: uptime   STATS z: every metric
+// STATS L: per-command latency   STATS T: slow command trace   STATS E: event loop load
+// STATS Z: connection memory
+void Server::handleStats(Client* client, const std::string& params)
+{
+    std::string query = params.substr(0, params.find(' '));
+    if (query.empty()) {
+        sendNumeric(client, ERR_NEEDMOREPARAMS, "STATS");
+        return;
+    }
+    if (!client->isOper()) {
+        sendNumeric(client, ERR_NOPRIVILEGES);
+        return;
+    }
+
+    std::string& out = client->outputBuffer();
+    const std::string& nick = client->getNickname();
+    if (query == "m") {
+        // <command> <count> <bytes> :<lines fanned out>
+        const std::map<std::string, Metrics::CommandStats>& commands = _metrics.commands();
+        for (std::map<std::string, Metrics::CommandStats>::const_iterator it = commands.begin(); it != commands.end(); ++it) {
+            std::string calls = toString(it->second.calls);
+            std::string bytes = toString(it->second.bytes);
+            const std::string* line[] = { &it->first, &calls, &bytes };
+            Reply::appendList(out, RPL_STATSCOMMANDS, nick, line, 3, toString(it->second.fanOut));
+        }
+    } else if (query == "u") {
+        unsigned long up = Clock::now() - _startTime;
+        std::ostringstream uptime;
+        uptime << "Server Up " << up / 86400 << " days " << (up / 3600) % 24 << ":"
+               << ((up / 60) % 60 < 10 ? "0" : "") << (up / 60) % 60 << ":"
+               << (up % 60 < 10 ? "0" : "") << up % 60;
+        Reply::appendText(out, RPL_STATSUPTIME, nick, uptime.str());
+    } else if (query == "L") {
+        const std::map<std::string, Metrics::CommandStats>& commands = _metrics.commands();
+        for (std::map<std::string, Metrics::CommandStats>::const_iterator it = commands.begin(); it != commands.end(); ++it) {
+            const Histogram& latency = it->second.latency;
+            Reply::appendText(out, RPL_STATSDEBUG, nick, "L", it->first + " calls=" + toString(latency.count)
+                              + " p50=" + toString(latency.quantile(0.5)) + "us p99=" + toString(latency.quantile(0.99))
+                              + "us max=" + toString(latency.max) + "us fanout_p99="
+                              + toString(it->second.fanOutSizes.quantile(0.99)));
+        }
+    } else if (query == "E") {
+        const Histogram& passes = _load.passes();
+        Reply::appendText(out, RPL_STATSDEBUG, nick, "E", std::string(_load.overloaded() ? "overloaded" : "normal")
+                          + " lag=" + toString(_load.lagUs()) + "us busy=" + toString(_load.busyPercent())
+                          + "% ready=" + toString(_load.readyFds()) + " overloads=" + toString(_metrics.get(Metrics::OVERLOADS))
+                          + " pass_p99=" + toString(passes.quantile(0.99)) + "us pass_max=" + toString(passes.max) + "us");
+    } else if (query == "Z") {
+        size_t idle = 0;
+        size_t idleBytes = 0;
+        size_t totalBytes = 0;
+        for (ClientMap::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+            size_t bytes = connectionMemory(it->second);
+            totalBytes += bytes;
+            if (isIdle(it->second)) {
+                ++idle;
+                idleBytes += bytes;
+            }
+        }
+        Reply::appendText(out, RPL_STATSDEBUG, nick, "Z", "clients=" + toString(_clients.size())
+                          + " bytes=" + toString(totalBytes) + " idle=" + toString(idle) + " idle_bytes_each="
+                          + toString(idle ? idleBytes / idle : 0) + " target=" + toString(IDLE_CLIENT_TARGET_BYTES)
+                          + " spare_buffers=" + toString(Client::spareBuffers()));
+    } else if (query == "z" || query == "T") {
+        // The admin socket's samples or trace, one per line
+        std::string text;
+        if (query == "z")
+            renderMetrics(text);
+        else if (!_metrics.tracing())
+            text = "Tracing is off (IRCSERV_TRACE_SLOW_US)\n";
+        else
+            _metrics.renderTrace(text);
+        size_t start = 0;
+        while (start < text.size()) {
+            size_t end = text.find('\n', start);
+            if (end == std::string::npos)
+                end = text.size();
+            if (text[start] != '#')
+                Reply::appendText(out, RPL_STATSDEBUG, nick, query, text.substr(start, end - start));
+            start = end + 1;
+        }
+    }
+    Reply::append(out, RPL_ENDOFSTATS, nick, query);
+    enableWriteEvent(client->getFd());
+}
+
+// Counters plus gauges read off the live state, in Prometheus text format
+void Server::renderMetrics(std::string& out) const
+{
+    _metrics.render(out);
+
+    size_t registered = 0;
+    uint64_t queued = 0;
+    size_t idle = 0;
+    uint64_t idleBytes = 0;
+    uint64_t clientBytes = 0;
+    for (ClientMap::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        registered += it->second->isRegistered();
+        queued += it->second->getOutputBuffer().size();
+        size_t bytes = connectionMemory(it->second);
+        clientBytes += bytes;
+        if (isIdle(it->second)) {
+            ++idle;
+            idleBytes += bytes;
+        }
+    }
+    for (LinkMap::const_iterator it = _links.begin(); it != _links.end(); ++it)
+        queued += it->second->outputBuffer().size();
+    Metrics::renderGauge(out, "ircserv_clients", "Connected local clients", _clients.size());
+    Metrics::renderGauge(out, "ircserv_clients_registered", "Local clients past registration", registered);
+    Metrics::renderGauge(out, "ircserv_users", "Users on the network, local and remote", _uidIndex.size());
+    Metrics::renderGauge(out, "ircserv_channels", "Channels", _channels.size());
+    Metrics::renderGauge(out, "ircserv_links", "Directly connected servers", _links.size());
+    Metrics::renderGauge(out, "ircserv_output_queued_bytes", "Bytes waiting in client and link send queues", queued);
+    Metrics::renderGauge(out, "ircserv_streams", "Clients with a LIST/WHO reply in progress", _streams.size());
+    Metrics::renderGauge(out, "ircserv_client_memory_bytes", "Estimated memory held for local connections", clientBytes);
+    Metrics::renderGauge(out, "ircserv_idle_clients", "Local clients with nothing buffered or streaming", idle);
+    Metrics::renderGauge(out, "ircserv_idle_client_bytes", "Average estimated memory of an idle connection",
+                         idle ? idleBytes / idle : 0);
+    Metrics::renderGauge(out, "ircserv_idle_client_target_bytes", "Budget per idle connection", IDLE_CLIENT_TARGET_BYTES);
+    Metrics::renderGauge(out, "ircserv_spare_buffers", "Pooled I/O buffers not held by any client", Client::spareBuffers());
+    Metrics::renderCounter(out, "ircserv_msglog_dropped_total", "Channel messages the log could not keep", _messageLog.dropped());
+    Metrics::renderGauge(out, "ircserv_scratch_strings", "Most scratch strings in use at once", _scratch.highWater());
+    Metrics::renderGauge(out, "ircserv_uptime_seconds", "Seconds since start", Clock::now() - _startTime);
+    Metrics::renderGauge(out, "ircserv_loop_lag_microseconds", "Slowest event loop pass in the last window", _load.lagUs());
+    Metrics::renderGauge(out, "ircserv_loop_busy_percent", "Share of the last window the event loop spent working", _load.busyPercent());
+    Metrics::renderGauge(out, "ircserv_loop_ready_fds", "Most sockets ready at once in the last window", _load.readyFds());
+    Metrics::renderGauge(out, "ircserv_overloaded", "1 while expensive work is being shed", _load.overloaded());
+    Metrics::renderHistogram(out, "ircserv_loop_pass_microseconds", "Event loop pass durations, poll() return to poll()", _load.passes());
+}
+
+// Overload mode answers the commands that cost the most per line with
+// 263; PRIVMSG, PING and the rest are never shed
+bool Server::shedCommand(Client* client, const std::string& command)
+{
+    if (!_load.overloaded())
+        return false;
+    _metrics.add(Metrics::SHED_COMMANDS);
+    sendNumeric(client, RPL_TRYAGAIN, command);
+    return true;
+}
+
+// With plugins loaded the line is parsed once here and every hook it
+// reaches sees the same Message. Scratch strings taken while handling
+// the line are handed back once it is done.
+void Server::processCommand(Client* client, const std::string& message)
+{
+    Scratch::Scope scope(_scratch);
+    if (_plugins.active() && parseMessage(message, _parsed))
+        _currentMessage = &_parsed;
+    dispatchCommand(client, message);
+    _currentMessage = NULL;
+    _metrics.endCommand();
+}
+
+void Server::dispatchCommand(Client* client , const std::string& message)
+{
+    std::string& command = _scratch.string();
+    std::string& params = _scratch.string();
 
     size_t pos = message.find(' ');
     if(pos != std::string::npos)
     {
-        command = message.substr(0 , pos);
-        params = message.substr(pos + 1);
+        command.assign(message, 0 , pos);
+        params.assign(message, pos + 1, std::string::npos);
     }else{
         command = message;
-        params = "";
     }
 
-    for(size_t i = 0; i < command.size(); i++)
-    {
-        command[i] = toupper(command[i]);
-    }
+    if (!command.empty())
+        Scan::foldUpper(&command[0], command.size());
 
     std::cout << YELLOW << "⮞ " << (client->getNickname().empty() ? "Anonymous" : client->getNickname()) 
               << " [" << client->getFd() << "]" << RESET << ": " 
               << BOLD << command << RESET << " " << params << std::endl;
 
+    // Timed from here: the console line above is not the command's cost
+    _metrics.beginCommand(commandId(command), command, message.size(), client->getFd());
+
     if(command == "PASS")
         handlePass(client , params);
     else if(command == "NICK")
@@ -705,32 +2114,13 @@ void Server::processCommand(Client* client , const std::string& message)
     else if(command == "USER"){
         handleUser(client , params);
     }else if(command == "PING"){
-        std::string response = ":server PONG " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " :Pong\r\n";
-        client->addToOutputBuffer(response);
+        client->outputBuffer().append(":server PONG ")
+              .append(client->getNickname().empty() ? "*" : client->getNickname()).append(" :Pong\r\n");
         enableWriteEvent(client->getFd());
     }
     else if(command == "CAP")
     {
-        if (params == "LS")
-        {
-            std::string response = ":server CAP * LS :multi-prefix\r\n";
-            client->addToOutputBuffer(response);
-            enableWriteEvent(client->getFd());
-        }
-        else if (params == "REQ")
-        {
-            std::string response = ":server CAP * ACK :multi-prefix\r\n";
-            client->addToOutputBuffer(response);
-            enableWriteEvent(client->getFd());
-        }
-        else
-        {
-            std::string response = ":server 501 " + (client->getNickname().empty() ? "*" : client->getNickname());
-            response += " :Unknown CAP command\r\n";
-            client->addToOutputBuffer(response);
-            enableWriteEvent(client->getFd());
-        }
+        handleCap(client, params);
     }
     else if(client->isAuthenticated() && client->isRegistered())
     {
@@ -738,25 +2128,22 @@ void Server::processCommand(Client* client , const std::string& message)
         {
             if (params.empty())
             {
-                std::string response = ":server 403 " + (client->getNickname().empty() ? "*" : client->getNickname());
-                response += " " + params + " :No such channel\r\n";
-                client->addToOutputBuffer(response);
-                enableWriteEvent(client->getFd());
+                sendNumeric(client, ERR_NEEDMOREPARAMS, command);
                 return;
             }
             else
                 handleJoin(client, params);
         }
         else if (command == "PART") {
-            std::string channelName;
-            std::string partMessage;
+            std::string& channelName = _scratch.string();
+            std::string& partMessage = _scratch.string();
         
             size_t firstSpace = params.find(' ');
             if (firstSpace != std::string::npos) {
-                channelName = params.substr(0, firstSpace);
-                partMessage = params.substr(firstSpace + 1);
+                channelName.assign(params, 0, firstSpace);
+                partMessage.assign(params, firstSpace + 1, std::string::npos);
                 if (!partMessage.empty() && partMessage[0] == ':')
-                    partMessage = partMessage.substr(1); // remove leading colon
+                    partMessage.erase(0, 1); // remove leading colon
             } else {
                 channelName = params; // No message, just the channel
             }
@@ -766,15 +2153,22 @@ void Server::processCommand(Client* client , const std::string& message)
         else if(command == "PRIVMSG")
         {
             size_t spacePos = params.find(' ');
-            std::string channelName = params.substr(0, spacePos);
-            std::string messageContent = params.substr(spacePos + 1);
+            std::string& channelName = _scratch.string();
+            std::string& messageContent = _scratch.string();
+            channelName.assign(params, 0, spacePos);
+            if (spacePos != std::string::npos)
+                messageContent.assign(params, spacePos + 1, std::string::npos);
+            if (!messageContent.empty() && messageContent[0] == ':')
+                messageContent.erase(0, 1);
             // Check if the message content is empty
-            if (messageContent.empty())
+            if (channelName.empty())
+            {
+                sendNumericText(client, ERR_NORECIPIENT, "No recipient given (PRIVMSG)");
+                return;
+            }
+            if (spacePos == std::string::npos || messageContent.empty())
             {
-                std::string response = ":server 411 " + (client->getNickname().empty() ? "*" : client->getNickname());
-                response += " " + channelName + " :No recipient given\r\n";
-                client->addToOutputBuffer(response);
-                enableWriteEvent(client->getFd());
+                sendNumeric(client, ERR_NOTEXTTOSEND);
                 return;
             }
             // Handle the PRIVMSG command
@@ -793,13 +2187,58 @@ void Server::processCommand(Client* client , const std::string& message)
 
             handleMode(client, params);
         }
+        else if(command == "NAMES")
+        {
+            if (!shedCommand(client, command))
+                handleNames(client, params);
+        }
+        else if(command == "MOTD")
+        {
+            sendMotd(client);
+        }
+        else if(command == "LIST")
+        {
+            if (!shedCommand(client, command))
+                handleList(client, params);
+        }
+        else if(command == "WHO")
+        {
+            if (!shedCommand(client, command))
+                handleWho(client, params);
+        }
+        else if(command == "WHOIS")
+        {
+            handleWhois(client, params);
+        }
+        else if(command == "MONITOR")
+        {
+            handleMonitor(client, params);
+        }
+        else if(command == "ISON")
+        {
+            handleIson(client, params);
+        }
+        else if(command == "CHATHISTORY")
+        {
+            if (!shedCommand(client, command))
+                handleChatHistory(client, params);
+        }
+        else if(command == "OPER")
+        {
+            handleOper(client, params);
+        }
+        else if(command == "STATS")
+        {
+            handleStats(client, params);
+        }
+        else if (!_currentMessage || !_plugins.command(*client, *_currentMessage))
+        {
+            sendNumeric(client, ERR_UNKNOWNCOMMAND, command);
+        }
 
     }
      else {
-        std::string response = " :server 421 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " " + command + " : Unknown command \r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NOTREGISTERED);
     }
 
 }
@@ -819,65 +2258,52 @@ void Server::handleTopic(Client* client, const std::string& params)
 
     // Validate channel name
     if ((channelName[0] != '#' && channelName[0] != '&') || channelName.length() < 2) {
-        std::string response = ":server 403 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " " + channelName + " :No such channel\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
         return;
     }
 
     // Find the channel
-    for (std::vector<Channel>::iterator it = _channels.begin(); it != _channels.end(); ++it) {
-        if (it->getName() == channelName) {
-
-            // If no topic is provided, it's a topic query
-            if (topic.empty()) {
-                std::string response;
-                if (it->getTopic().empty())
-                    response = ":server 331 " + client->getNickname() + " " + channelName + " :No topic is set\r\n";
-                else
-                    response = ":server 332 " + client->getNickname() + " " + channelName + " :topic is now: " + it->getTopic() + "\r\n";
+    Channel* channel = findChannel(channelName);
+    if (channel) {
 
-                client->addToOutputBuffer(response);
-                enableWriteEvent(client->getFd());
-                return;
-            }
-
-            // Topic is being changed - check if user is in the channel
-            if (!it->hasClient(client)) {
-                std::string response = ":server 442 " + client->getNickname() + " " + channelName + " :You're not on that channel\r\n";
-                client->addToOutputBuffer(response);
-                enableWriteEvent(client->getFd());
-                return;
-            }
-
-            // Check if +t is set and client is not an operator
-            if (it->isTopicRestricted() && !it->isOperator(client)) {
-                std::string response = ":server 482 " + client->getNickname() + " " + channelName + " :You're not channel operator\r\n";
-                client->addToOutputBuffer(response);
-                enableWriteEvent(client->getFd());
-                return;
-            }
+        // If no topic is provided, it's a topic query
+        if (topic.empty()) {
+            if (channel->getTopic().empty())
+                sendNumeric(client, RPL_NOTOPIC, channelName);
+            else
+                sendNumericText(client, RPL_TOPIC, channelName, channel->getTopic());
+            return;
+        }
 
-            // Set the topic
-            it->setTopic(topic);
+        // Topic is being changed - check if user is in the channel
+        if (!channel->hasClient(client)) {
+            sendNumeric(client, ERR_NOTONCHANNEL, channelName);
+            return;
+        }
 
-            // Notify all clients in the channel with clearer message
-            std::string topicMsg = ":" + client->getNickname() + " TOPIC " + channelName + " :topic is now: " + topic + "\r\n";
-            const std::vector<Client*>& clients = it->getClients();
-            for (size_t i = 0; i < clients.size(); ++i) {
-                clients[i]->addToOutputBuffer(topicMsg);
-                enableWriteEvent(clients[i]->getFd());
-            }
+        // Check if +t is set and client is not an operator
+        if (channel->isTopicRestricted() && !channel->isOperator(client)) {
+            sendNumeric(client, ERR_CHANOPRIVSNEEDED, channelName);
             return;
         }
+
+        // Set the topic
+        if (topic.size() > TOPICLEN)
+            topic.erase(TOPICLEN);
+        channel->setTopic(topic);
+
+        // Notify all clients in the channel with clearer message
+        std::string topicMsg;
+        topicMsg.reserve(client->getPrefix().size() + channelName.size() + topic.size() + 25);
+        topicMsg.append(client->getPrefix()).append(" TOPIC ").append(channelName)
+                .append(" :topic is now: ").append(topic).append("\r\n");
+        sendToLocalMembers(*channel, topicMsg, NULL);
+        sendToLinks(":" + client->getUid() + " TOPIC " + channel->getName() + " :" + topic + "\r\n", NULL);
+        return;
     }
 
     // Channel not found
-    std::string response = ":server 403 " + (client->getNickname().empty() ? "*" : client->getNickname());
-    response += " " + channelName + " :No such channel\r\n";
-    client->addToOutputBuffer(response);
-    enableWriteEvent(client->getFd());
+    sendNumeric(client, ERR_NOSUCHCHANNEL, channelName);
 }
 
 
@@ -886,18 +2312,12 @@ void Server::handlePass(Client* client , const std::string& params)
 {
     if(client->isAuthenticated())
     {
-        std::string response = " :server 462 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " : You may not register \n\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_ALREADYREGISTRED);
         return;
     }
 
     if (params.empty()) {
-        std::string response = ":server 461 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " PASS :Not enough parameters\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NEEDMOREPARAMS, "PASS");
         return;
     }
     if(params == _password)
@@ -907,11 +2327,7 @@ void Server::handlePass(Client* client , const std::string& params)
         isClientRegistered(client);
     }else {
         std::cout << RED << "✗ Client " << client->getFd() << " failed password authentication" << RESET << std::endl;
-        std::string response = ":server 464 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " :Password incorrect\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
-
+        sendNumeric(client, ERR_PASSWDMISMATCH);
     }
     
 }
@@ -919,10 +2335,7 @@ void Server::handlePass(Client* client , const std::string& params)
 void Server::handleNick(Client* client, const std::string& params) 
 {
      if (params.empty()) {
-        std::string response = ":server 431 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " :No nickname given\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+        sendNumeric(client, ERR_NONICKNAMEGIVEN);
         return;
     }
     //extract the name before the space and after the cmmand like "NICK AKRAM HELLO" We will take just akram bcz we found a space
@@ -930,31 +2343,57 @@ void Server::handleNick(Client* client, const std::string& params)
     size_t spacePos = nickname.find(' ');
     if (spacePos != std::string::npos) {
         nickname = nickname.substr(0, spacePos);
+    }
+    if (!isValidNickname(nickname)) {
+        sendNumeric(client, ERR_ERRONEUSNICKNAME, nickname);
+        return;
     }
       // Check if nickname is already in use
-    for (std::vector<Client>::iterator it = _clients.begin(); it != _clients.end(); ++it) {
-        if (it->getNickname() == nickname && &(*it) != client) {
-            std::string response = ":server 433 " + (client->getNickname().empty() ? "*" : client->getNickname());
-            response += " " + nickname + " :Nickname is already in use\r\n";
-            client->addToOutputBuffer(response);
-            enableWriteEvent(client->getFd());
-            return;
-        }
+    std::string folded = ircCaseFold(nickname);
+    NickIndex::iterator owner = _nickIndex.find(folded);
+    if (owner != _nickIndex.end() && owner->second != client) {
+        sendNumeric(client, ERR_NICKNAMEINUSE, nickname);
+        return;
     }
     //setting the nickname
 
     std::string oldNick = client->getNickname();
+    std::string oldPrefix = client->getPrefix(); // NICK is announced from the old identity
+    if (!oldNick.empty())
+        _nickIndex.erase(ircCaseFold(oldNick));
+    _nickIndex[folded] = client;
     client->setNickname(nickname);
+    if (oldNick != nickname)
+        client->setNickTs(Clock::now());
+    // Every channel the client sits in has the old nick in its NAMES cache
+    const std::set<std::string>& joined = client->getChannels();
+    for (std::set<std::string>::const_iterator key = joined.begin(); key != joined.end(); ++key) {
+        ChannelMap::iterator it = _channels.find(*key);
+        if (it != _channels.end())
+            it->second.invalidateNames();
+    }
     std::cout << BLUE << "✓ Client " << client->getFd() << " set nickname: " 
               << (oldNick.empty() ? "None" : oldNick) << " → " << nickname << RESET << std::endl;
 
-    //inform the client
-    std::string response;
+    // Presence: the old nick went away, the new one arrived
+    if (client->isRegistered() && ircCaseFold(oldNick) != folded) {
+        notifyWatchers(oldNick, RPL_MONOFFLINE, oldNick);
+        notifyWatchers(nickname, RPL_MONONLINE, client->getPrefix().substr(1));
+    }
+
+    //inform the client, and everyone who can see it
     if (!oldNick.empty()) {
-        std::string response = ":" + oldNick + " NICK " + nickname + "\r\n";
+        std::string response;
+        response.reserve(oldPrefix.size() + nickname.size() + 8);
+        response.append(oldPrefix).append(" NICK ").append(nickname).append("\r\n");
         client->addToOutputBuffer(response);
         enableWriteEvent(client->getFd());
+        sendToCommonChannels(client, response);
     }
+    if (client->isRegistered())
+        sendToLinks(":" + client->getUid() + " NICK " + nickname + " " + toString(client->getNickTs()) + "\r\n", NULL);
+    if (!oldNick.empty() && oldNick != nickname && _currentMessage && _plugins.wants(PLUGIN_NICK))
+        _plugins.nick(*client, oldNick, *_currentMessage);
     // Check if client is now fully registered
     isClientRegistered(client);
 
@@ -962,31 +2401,33 @@ void Server::handleNick(Client* client, const std::string& params)
 
 void Server::handleUser(Client* client, const std::string& params)
 {
-    if (countArguments(params) != 4) {
-        std::string response = ":server 461 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " USER :Invalid number of parameters\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+    if (client->isRegistered()) {
+        sendNumeric(client, ERR_ALREADYREGISTRED);
+        return;
+    }
+    if (countArguments(params) < 4) {
+        sendNumeric(client, ERR_NEEDMOREPARAMS, "USER");
         return;
     }
 
-    // Extract the parts using a stream
-    std::istringstream iss(params);
-    std::string username, hostname, servername, realname;
-    iss >> username >> hostname >> servername;
-    std::getline(iss, realname);
-    if (realname.empty() || realname[1] != ':') {
-        std::string response = ":server 461 " + (client->getNickname().empty() ? "*" : client->getNickname());
-        response += " USER :Real name must start with ':'\r\n";
-        client->addToOutputBuffer(response);
-        enableWriteEvent(client->getFd());
+    // Extract the parts word by word; the real name is the rest
+    Scratch::Scope scope(_scratch);
+    std::string& username = _scratch.string();
+    std::string& unused = _scratch.string();   // Hostname and servername
+    size_t pos = 0;
+    nextWord(params, pos, username);
+    nextWord(params, pos, unused);
+    nextWord(params, pos, unused);
+    size_t realStart = params.find_first_not_of(' ', pos);
+    if (realStart == std::string::npos || params[realStart] != ':') {
+        sendNumericText(client, ERR_NEEDMOREPARAMS, "USER", "Real name must start with ':'");
         return;
     }
-    realname = realname.erase(0, 1); // Remove the leading ':'  
+    std::string& realname = _scratch.string();
+    realname.assign(params, realStart + 1, std::string::npos); // Without the leading ':'
 
     // Set values
-    client->setUsername(username);
-    client->setRealname(realname);
+    setNames(client, username, realname);
 
     std::cout << BLUE << "✓ Client " << client->getFd() << " set username: " 
               << (client->getUsername().empty() ? "None" : client->getUsername()) << RESET << std::endl;
@@ -1016,19 +2457,16 @@ bool Server::isClientRegistered(Client* client) {
         // Check if this is the first time they're being registered
         if (!client->isRegistered()) {
             client->setRegistered(true);
+            _metrics.add(Metrics::REGISTRATIONS);
             
             std::cout << BOLD << GREEN << "★ Client " << client->getFd() 
                       << " (" << client->getNickname() << ") is now fully registered! ★" << RESET << std::endl;
             
-            // Send welcome messages (IRC numeric replies 001-004)
-            std::string nick = client->getNickname();
-            std::string welcomeMsg = ":server 001 " + nick + " :Welcome to the IRC server " + nick + "!\r\n";
-            welcomeMsg += ":server 002 " + nick + " :Your host is server, running version 1.0\r\n";
-            welcomeMsg += ":server 003 " + nick + " :This server was created today\r\n";
-            welcomeMsg += ":server 004 " + nick + " :server 1.0 o mtikl\r\n";
-            
-            client->addToOutputBuffer(welcomeMsg);
-            enableWriteEvent(client->getFd());
+            // Send welcome messages (IRC numeric replies 001-005) and the MOTD
+            _welcomeBurst.render(client->outputBuffer(), client->getNickname());
+            sendMotd(client);
+            notifyWatchers(client->getNickname(), RPL_MONONLINE, client->getPrefix().substr(1));
+            sendToLinks(uidLine(client), NULL);
             
             std::cout << "Client " << client->getFd() << " is now fully registered" << std::endl;
         }
@@ -1037,6 +2475,28 @@ bool Server::isClientRegistered(Client* client) {
     return false;
 }
 
+void Server::sendMotd(Client* client) {
+    _motd.refresh();
+    _motd.block().render(client->outputBuffer(), client->getNickname());
+    enableWriteEvent(client->getFd());
+}
+
+// nickname = ( letter / special ) *( letter / digit / special / "-" )
+bool isValidNickname(const std::string& nickname) {
+    if (nickname.empty() || nickname.size() > NICKLEN)
+        return false;
+    for (size_t i = 0; i < nickname.size(); ++i) {
+        unsigned char c = nickname[i];
+        bool special = c != '\0' && std::strchr("[]\\`_^{|}", c) != NULL;
+        if (isalpha(c) || special)
+            continue;
+        if (i > 0 && (isdigit(c) || c == '-'))
+            continue;
+        return false;
+    }
+    return true;
+}
+
 int countArguments(const std::string& params) {
     int count = 0;
     bool inArg = false;
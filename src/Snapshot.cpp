@@ -0,0 +1,226 @@
+#include "includes/Snapshot.hpp"
+#include "includes/Client.hpp"
+#include "includes/Utils.hpp"
+#include "includes/Clock.hpp"
+#include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+// File layout (host byte order, the file never leaves the machine):
+//   "IRCSNAP1" u32 channelCount, then one serialiseChannel() record each
+namespace {
+
+const char SNAPSHOT_MAGIC[8] = { 'I', 'R', 'C', 'S', 'N', 'A', 'P', '1' };
+const unsigned char FLAG_INVITE_ONLY = 1;
+const unsigned char FLAG_TOPIC_RESTRICTED = 2;
+
+bool writeFile(const std::string& path, const std::string& data) {
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return false;
+
+    const char* pos = data.data();
+    size_t left = data.size();
+    while (left > 0) {
+        ssize_t n = write(fd, pos, left);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0) {
+            close(fd);
+            unlink(tmp.c_str());
+            return false;
+        }
+        pos += n;
+        left -= n;
+    }
+    // Only a complete, synced file replaces the previous snapshot
+    bool ok = fsync(fd) == 0;
+    ok = close(fd) == 0 && ok;
+    if (!ok || std::rename(tmp.c_str(), path.c_str()) != 0) {
+        unlink(tmp.c_str());
+        return false;
+    }
+    return true;
+}
+
+} // namespace
+
+// str name, str topic, i64 topicSetAt, i64 createdAt, str password,
+// u8 flags, u32 n + str operatorPrefix[n],
+// 3 x (u32 n + n x (str mask, str setBy, i64 setAt))
+void serialiseChannel(std::string& out, const Channel& channel) {
+    Binary::putStr(out, channel.getName());
+    Binary::putStr(out, channel.getTopic());
+    Binary::putU64(out, channel.getTopicTime());
+    Binary::putU64(out, channel.getCreationTime());
+    Binary::putStr(out, channel.getPassword());
+    Binary::putU8(out, (channel.isInviteOnly() ? FLAG_INVITE_ONLY : 0)
+                     | (channel.isTopicRestricted() ? FLAG_TOPIC_RESTRICTED : 0));
+
+    // Present operators by prefix, plus saved ones that never came back
+    const std::vector<Client*>& operators = channel.getOperators();
+    const std::set<std::string>& saved = channel.getSavedOperators();
+    Binary::putU32(out, operators.size() + saved.size());
+    for (size_t i = 0; i < operators.size(); ++i)
+        Binary::putStr(out, operators[i]->getPrefix().substr(1));
+    for (std::set<std::string>::const_iterator op = saved.begin(); op != saved.end(); ++op)
+        Binary::putStr(out, *op);
+
+    for (int list = 0; list < Channel::LIST_MODE_COUNT; ++list) {
+        const std::vector<Channel::MaskEntry>& masks = channel.getMasks(static_cast<Channel::ListMode>(list));
+        Binary::putU32(out, masks.size());
+        for (size_t i = 0; i < masks.size(); ++i) {
+            Binary::putStr(out, masks[i].mask.str());
+            Binary::putStr(out, masks[i].setBy);
+            Binary::putU64(out, masks[i].setAt);
+        }
+    }
+}
+
+Channel parseChannel(Binary::Reader& in) {
+    std::string name = in.str();
+    std::string topic = in.str();
+    time_t topicSetAt = in.u64();
+    time_t createdAt = in.u64();
+    std::string password = in.str();
+    unsigned char flags = in.u8();
+
+    Channel channel(name, createdAt);
+    channel.restoreTopic(topic, topicSetAt);
+    channel.setPassword(password);
+    channel.setInviteOnly(flags & FLAG_INVITE_ONLY);
+    channel.setTopicRestricted(flags & FLAG_TOPIC_RESTRICTED);
+
+    uint32_t operators = in.u32();
+    for (uint32_t i = 0; i < operators && in.ok(); ++i)
+        channel.addSavedOperator(in.str());
+    for (int list = 0; list < Channel::LIST_MODE_COUNT && in.ok(); ++list) {
+        uint32_t masks = in.u32();
+        for (uint32_t i = 0; i < masks && in.ok(); ++i) {
+            std::string mask = in.str();
+            std::string setBy = in.str();
+            time_t setAt = in.u64();
+            if (in.ok())
+                channel.restoreMask(static_cast<Channel::ListMode>(list), mask, setBy, setAt);
+        }
+    }
+    return channel;
+}
+
+Snapshot::Snapshot() : _interval(SNAPSHOT_INTERVAL), _lastStart(Clock::now()), _child(-1) {
+}
+
+void Snapshot::configure() {
+    if (const char* path = std::getenv("IRCSERV_SNAPSHOT"))
+        _path = path;
+    if (const char* interval = std::getenv("IRCSERV_SNAPSHOT_INTERVAL"))
+        _interval = std::strtol(interval, NULL, 10);
+}
+
+bool Snapshot::enabled() const {
+    return !_path.empty();
+}
+
+bool Snapshot::due(time_t now) const {
+    return enabled() && _interval > 0 && now - _lastStart >= _interval;
+}
+
+bool Snapshot::running() const {
+    return _child != -1;
+}
+
+const std::string& Snapshot::path() const {
+    return _path;
+}
+
+bool Snapshot::start(const ChannelMap& channels) {
+    if (!enabled() || running())
+        return false;
+    _lastStart = Clock::now();
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        std::cerr << "Snapshot failed: fork: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (pid == 0) {
+        // Child: the parent's channels as of the fork, no locking needed.
+        // Nothing else: see the class comment
+        std::string data(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+        Binary::putU32(data, channels.size());
+        for (ChannelMap::const_iterator it = channels.begin(); it != channels.end(); ++it)
+            serialiseChannel(data, it->second);
+        _exit(writeFile(_path, data) ? 0 : 1);
+    }
+    _child = pid;
+    return true;
+}
+
+void Snapshot::reap() {
+    if (_child == -1)
+        return;
+    int status;
+    pid_t done = waitpid(_child, &status, WNOHANG);
+    if (done == 0 || (done < 0 && errno == EINTR))
+        return;
+    if (done < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        std::cerr << "Snapshot failed: could not write " << _path << std::endl;
+    _child = -1;
+}
+
+void Snapshot::wait() {
+    while (_child != -1) {
+        int status;
+        pid_t done = waitpid(_child, &status, 0);
+        if (done < 0 && errno == EINTR)
+            continue;
+        if (done < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            std::cerr << "Snapshot failed: could not write " << _path << std::endl;
+        _child = -1;
+    }
+}
+
+size_t Snapshot::load(ChannelMap& channels) const {
+    if (!enabled())
+        return 0;
+    int fd = open(_path.c_str(), O_RDONLY);
+    if (fd < 0)
+        return 0;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < static_cast<off_t>(sizeof(SNAPSHOT_MAGIC))) {
+        close(fd);
+        return 0;
+    }
+    void* mapped = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED)
+        return 0;
+
+    Binary::Reader in(static_cast<const char*>(mapped), st.st_size);
+    size_t restored = 0;
+    if (in.expect(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC))) {
+        uint32_t count = in.u32();
+        for (uint32_t c = 0; c < count && in.ok(); ++c) {
+            Channel channel = parseChannel(in);
+            // Never clobber a live channel, and drop a half-read one
+            if (!in.ok() || channel.getName().empty()
+                || !channels.insert(std::make_pair(ircCaseFold(channel.getName()), channel)).second)
+                continue;
+            ++restored;
+        }
+        if (!in.ok())
+            std::cerr << "Snapshot " << _path << " is truncated; restored " << restored << " channels" << std::endl;
+    } else {
+        std::cerr << "Snapshot " << _path << " has an unknown format, ignored" << std::endl;
+    }
+    munmap(mapped, st.st_size);
+    return restored;
+}
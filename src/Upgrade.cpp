@@ -0,0 +1,481 @@
+#include "includes/Server.hpp"
+#include "includes/Snapshot.hpp"
+#include "includes/Binary.hpp"
+#include <stdexcept>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <sstream>
+#include <climits>
+#include <sys/wait.h>
+
+// Hot upgrade: the running server hands its listening socket, every
+// client socket and the state behind them to a freshly exec'd binary
+// over a socketpair, then exits once the new process confirms. Clients
+// keep their TCP connections and see nothing but a short pause.
+//
+// Wire protocol, old -> new: u64 stateLen, state, u32 fdCount, then the
+// fds as SCM_RIGHTS batches of one byte each. new -> old: one 'K' byte
+// once the state has been rebuilt. old -> new: one 'G' byte, the commit.
+// The new process polls nothing before the 'G', so an ack that comes too
+// late cannot leave two processes serving the same sockets.
+namespace {
+
+const char UPGRADE_MAGIC[8] = { 'I', 'R', 'C', 'U', 'P', 'G', '0', '1' };
+const size_t FDS_PER_MESSAGE = 250;        // Stays under the kernel's SCM_MAX_FD
+const unsigned char CLIENT_AUTHENTICATED = 1;
+const unsigned char CLIENT_REGISTERED = 2;
+const unsigned char CLIENT_OPER = 4;
+
+bool sendAll(int fd, const char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = send(fd, data, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool recvAll(int fd, char* data, size_t len) {
+    while (len > 0) {
+        ssize_t n = recv(fd, data, len, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
+            return false;
+        data += n;
+        len -= n;
+    }
+    return true;
+}
+
+bool sendFds(int sock, const std::vector<int>& fds) {
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE));
+
+    for (size_t sent = 0; sent < fds.size(); ) {
+        size_t count = std::min(FDS_PER_MESSAGE, fds.size() - sent);
+        char byte = 'F';
+        struct iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control[0];
+        msg.msg_controllen = CMSG_SPACE(sizeof(int) * count);
+
+        struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg);
+        cmsg->cmsg_level = SOL_SOCKET;
+        cmsg->cmsg_type = SCM_RIGHTS;
+        cmsg->cmsg_len = CMSG_LEN(sizeof(int) * count);
+        std::memcpy(CMSG_DATA(cmsg), &fds[sent], sizeof(int) * count);
+
+        ssize_t n = sendmsg(sock, &msg, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n != 1)
+            return false;
+        sent += count;
+    }
+    return true;
+}
+
+bool recvFds(int sock, size_t count, std::vector<int>& fds) {
+    std::vector<char> control(CMSG_SPACE(sizeof(int) * FDS_PER_MESSAGE));
+
+    while (fds.size() < count) {
+        char byte;
+        struct iovec iov;
+        iov.iov_base = &byte;
+        iov.iov_len = 1;
+
+        struct msghdr msg;
+        std::memset(&msg, 0, sizeof(msg));
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = &control[0];
+        msg.msg_controllen = control.size();
+
+        ssize_t n = recvmsg(sock, &msg, 0);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n != 1 || (msg.msg_flags & MSG_CTRUNC))
+            return false;
+        for (struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msg); cmsg; cmsg = CMSG_NXTHDR(&msg, cmsg)) {
+            if (cmsg->cmsg_level != SOL_SOCKET || cmsg->cmsg_type != SCM_RIGHTS)
+                continue;
+            size_t received = (cmsg->cmsg_len - CMSG_LEN(0)) / sizeof(int);
+            const int* data = reinterpret_cast<const int*>(CMSG_DATA(cmsg));
+            fds.insert(fds.end(), data, data + received);
+        }
+    }
+    return fds.size() == count;
+}
+
+std::string absolutePath(const std::string& path) {
+    if (path.empty() || path[0] == '/')
+        return path;
+    char cwd[PATH_MAX];
+    return getcwd(cwd, sizeof(cwd)) ? std::string(cwd) + "/" + path : "";
+}
+
+// argv[0] as the shell found it: relative to the directory we started
+// in, or a bare name from PATH, neither of which execv() would find
+// later. Symlinks are kept, so swapping a link to a new build works;
+// /proc/self/exe is only the fallback, as it names the old inode once
+// the binary has been replaced.
+std::string resolveExecutable(const std::string& name) {
+    if (name.find('/') != std::string::npos)
+        return access(name.c_str(), X_OK) == 0 ? absolutePath(name) : "";
+
+    const char* env = std::getenv("PATH");
+    std::string dirs = env ? env : "";
+    for (size_t start = 0; env && start <= dirs.size(); ) {
+        size_t end = dirs.find(':', start);
+        if (end == std::string::npos)
+            end = dirs.size();
+        std::string dir = dirs.substr(start, end - start);
+        std::string candidate = (dir.empty() ? "." : dir) + "/" + name;
+        if (access(candidate.c_str(), X_OK) == 0)
+            return absolutePath(candidate);
+        start = end + 1;
+    }
+
+    char self[PATH_MAX];
+    ssize_t len = readlink("/proc/self/exe", self, sizeof(self) - 1);
+    return len > 0 ? std::string(self, len) : "";
+}
+
+} // namespace
+
+void Server::setExecutable(const std::string& path) {
+    _executable = resolveExecutable(path);
+}
+
+// Fds go out as [listening socket, client..., local listeners]; everything
+// else refers to clients by their position in that list. The local
+// (unix, then admin) listeners are optional and flagged at the end of
+// the state.
+std::string Server::serialiseState(std::vector<int>& fds) const {
+    std::string out(UPGRADE_MAGIC, sizeof(UPGRADE_MAGIC));
+    std::map<const Client*, uint32_t> indexOf;
+
+    fds.clear();
+    fds.push_back(_serverSocket);
+    Binary::putU32(out, _clients.size());
+    for (ClientMap::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        const Client* client = it->second;
+        indexOf[client] = fds.size() - 1;
+        fds.push_back(client->getFd());
+
+        Binary::putStr(out, client->getIp());
+        Binary::putStr(out, client->getNickname());
+        Binary::putStr(out, client->getUsername());
+        Binary::putStr(out, client->getRealname());
+        Binary::putU8(out, (client->isAuthenticated() ? CLIENT_AUTHENTICATED : 0)
+                         | (client->isRegistered() ? CLIENT_REGISTERED : 0)
+                         | (client->isOper() ? CLIENT_OPER : 0));
+        Binary::putU32(out, client->getCaps());
+        Binary::putStr(out, client->getInputBuffer());
+        Binary::putStr(out, client->getOutputBuffer());
+
+        const std::map<std::string, std::string>& monitors = client->getMonitors();
+        Binary::putU32(out, monitors.size());
+        for (std::map<std::string, std::string>::const_iterator m = monitors.begin(); m != monitors.end(); ++m) {
+            Binary::putStr(out, m->first);
+            Binary::putStr(out, m->second);
+        }
+    }
+
+    Binary::putU32(out, _channels.size());
+    for (ChannelMap::const_iterator it = _channels.begin(); it != _channels.end(); ++it) {
+        const Channel& channel = it->second;
+        serialiseChannel(out, channel);
+
+        const std::vector<Client*>& members = channel.getClients();
+        Binary::putU32(out, members.size());
+        for (size_t i = 0; i < members.size(); ++i)
+            Binary::putU32(out, indexOf[members[i]]);
+
+        const HistoryRing& history = channel.history();
+        Binary::putU32(out, history.size());
+        for (size_t i = 0; i < history.size(); ++i) {
+            Binary::putU64(out, history.at(i).time);
+            Binary::putU32(out, history.at(i).tagLen);
+            Binary::putStr(out, history.at(i).line);
+        }
+    }
+
+    const int listeners[] = { _unixSocket, _adminSocket };
+    for (size_t i = 0; i < 2; ++i) {
+        Binary::putU8(out, listeners[i] != -1);
+        if (listeners[i] != -1)
+            fds.push_back(listeners[i]);
+    }
+    return out;
+}
+
+bool Server::restoreState(const std::string& state, const std::vector<int>& fds) {
+    Binary::Reader in(state.data(), state.size());
+    if (!in.expect(UPGRADE_MAGIC, sizeof(UPGRADE_MAGIC)) || fds.empty())
+        return false;
+
+    _serverSocket = fds[0];
+    watchFd(_serverSocket, POLLIN);     // Slot 0, as in start()
+
+    std::vector<Client*> byIndex;
+    uint32_t clientCount = in.u32();
+    for (uint32_t i = 0; i < clientCount && in.ok(); ++i) {
+        std::string ip = in.str();
+        std::string nick = in.str();
+        std::string user = in.str();
+        std::string realname = in.str();
+        unsigned char flags = in.u8();
+        uint32_t caps = in.u32();
+        std::string input = in.str();
+        std::string output = in.str();
+        if (!in.ok() || i + 1 >= fds.size())
+            return false;
+
+        Client* client = adoptClient(fds[i + 1], ip);
+        byIndex.push_back(client);
+        if (!nick.empty()) {
+            client->setNickname(nick);
+            _nickIndex[ircCaseFold(nick)] = client;
+        }
+        setNames(client, user.empty() ? client->getUsername() : user, realname);
+        client->setAuthenticated(flags & CLIENT_AUTHENTICATED);
+        client->setRegistered(flags & CLIENT_REGISTERED);
+        client->setOper(flags & CLIENT_OPER);
+        client->setCaps(caps);
+        client->appendToInputBuffer(input);
+        if (!output.empty()) {
+            client->addToOutputBuffer(output);
+            enableWriteEvent(client->getFd());
+        }
+
+        uint32_t monitors = in.u32();
+        for (uint32_t m = 0; m < monitors && in.ok(); ++m) {
+            std::string key = in.str();
+            std::string target = in.str();
+            client->addMonitor(key, target);
+            _watchers[key].insert(client);
+        }
+    }
+
+    uint32_t channelCount = in.u32();
+    for (uint32_t c = 0; c < channelCount && in.ok(); ++c) {
+        Channel parsed = parseChannel(in);
+        std::string key = ircCaseFold(parsed.getName());
+        Channel& channel = _channels.insert(std::make_pair(key, parsed)).first->second;
+
+        uint32_t members = in.u32();
+        for (uint32_t m = 0; m < members && in.ok(); ++m) {
+            uint32_t index = in.u32();
+            if (index >= byIndex.size())
+                return false;
+            channel.addClient(byIndex[index]);
+            byIndex[index]->addChannel(key);
+        }
+        // Operators were saved by prefix; members holding one get it back
+        const std::vector<Client*>& joined = channel.getClients();
+        for (size_t m = 0; m < joined.size(); ++m)
+            channel.claimSavedOperator(joined[m]);
+
+        uint32_t lines = in.u32();
+        for (uint32_t l = 0; l < lines && in.ok(); ++l) {
+            HistoryEntry entry;
+            entry.time = in.u64();
+            entry.tagLen = in.u32();
+            entry.line = in.str();
+            channel.history().restore(entry);
+        }
+    }
+
+    // Older senders stop before some or all of these
+    int* listeners[] = { &_unixSocket, &_adminSocket };
+    size_t next = clientCount + 1;
+    for (size_t i = 0; i < 2 && in.ok() && !in.atEnd(); ++i) {
+        if (!in.u8())
+            continue;
+        if (next >= fds.size())
+            return false;
+        *listeners[i] = fds[next++];
+        watchFd(*listeners[i], POLLIN);
+    }
+    return in.ok() && in.atEnd();
+}
+
+void Server::hotUpgrade() {
+    if (_executable.empty()) {
+        std::cerr << RED << "✗ Hot upgrade unavailable: executable path unknown" << RESET << std::endl;
+        return;
+    }
+    std::cout << BOLD << YELLOW << "⟳ Hot upgrade: handing " << _clients.size()
+              << " clients to a new " << _executable << RESET << std::endl;
+
+    int pair[2];
+    if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0) {
+        std::cerr << RED << "✗ Hot upgrade failed: socketpair: " << strerror(errno) << RESET << std::endl;
+        return;
+    }
+
+    // LIST/WHO replies in progress cannot be carried over, and neither
+    // can links: peers see a split and reconnect to the new process
+    while (!_streams.empty())
+        dropStreams(_streams.begin()->first);
+    closeLinks("Server upgrading");
+    while (!_adminConns.empty())
+        closeAdmin(_adminConns.begin()->first);
+
+    std::vector<int> fds;
+    std::string state = serialiseState(fds);
+
+    // Only the handoff socket survives exec; the rest arrive over it
+    for (size_t i = 0; i < fds.size(); ++i)
+        fcntl(fds[i], F_SETFD, FD_CLOEXEC);
+    fcntl(pair[0], F_SETFD, FD_CLOEXEC);
+
+    // Flush the message log so the new process starts on a clean segment,
+    // and the capture so its session follows ours
+    _messageLog.flush();
+    _capture.flush();
+
+    // Everything the child needs is built before fork(): between fork
+    // and exec only async-signal-safe calls are allowed
+    std::ostringstream port, handoff;
+    port << _port;
+    handoff << pair[1];
+    std::string portArg = port.str();
+    setenv("IRCSERV_UPGRADE_FD", handoff.str().c_str(), 1);
+    std::vector<char*> argv;
+    argv.push_back(const_cast<char*>(_executable.c_str()));
+    argv.push_back(const_cast<char*>(portArg.c_str()));
+    argv.push_back(const_cast<char*>(_password.c_str()));
+    argv.push_back(NULL);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        execv(argv[0], &argv[0]);
+        _exit(127);
+    }
+    unsetenv("IRCSERV_UPGRADE_FD");
+    close(pair[1]);
+
+    bool ok = pid > 0;
+    if (ok) {
+        uint64_t len = state.size();
+        uint32_t count = fds.size();
+        ok = sendAll(pair[0], reinterpret_cast<const char*>(&len), sizeof(len))
+            && sendAll(pair[0], state.data(), state.size())
+            && sendAll(pair[0], reinterpret_cast<const char*>(&count), sizeof(count))
+            && sendFds(pair[0], fds);
+    }
+    if (ok) {
+        pollfd ack;
+        ack.fd = pair[0];
+        ack.events = POLLIN;
+        char byte = 0;
+        ok = poll(&ack, 1, UPGRADE_TIMEOUT_MS) == 1 && recv(pair[0], &byte, 1, 0) == 1 && byte == 'K';
+    }
+    // The commit: until the child reads this it has not touched a client,
+    // so killing it below is safe however late its ack was
+    if (ok) {
+        char go = 'G';
+        ok = sendAll(pair[0], &go, 1);
+    }
+    close(pair[0]);
+
+    if (!ok) {
+        std::cerr << RED << "✗ Hot upgrade failed, continuing with the current process" << RESET << std::endl;
+        if (pid > 0) {
+            kill(pid, SIGKILL);
+            waitpid(pid, NULL, 0);
+        }
+        return;
+    }
+
+    std::cout << BOLD << GREEN << "✓ Hot upgrade: process " << pid << " took over" << RESET << std::endl;
+    _handedOff = true;
+    _running = false;
+}
+
+// New side of the handoff, called from start() instead of binding
+bool Server::resumeFromUpgrade(int sock) {
+    uint64_t len = 0;
+    uint32_t count = 0;
+    std::string state;
+    std::vector<int> fds;
+
+    // Until the old process commits, the sockets and the unix socket file
+    // stay its own: a failed resume must not unlink it (see ~Server)
+    _handedOff = true;
+    if (!recvAll(sock, reinterpret_cast<char*>(&len), sizeof(len)))
+        return false;
+    state.resize(len);
+    if ((len && !recvAll(sock, &state[0], len))
+        || !recvAll(sock, reinterpret_cast<char*>(&count), sizeof(count))
+        || !recvFds(sock, count, fds))
+        return false;
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+        fcntl(fds[i], F_SETFD, 0);
+        setNonBlocking(fds[i]);
+    }
+    if (!restoreState(state, fds))
+        return false;
+
+    // Wait for the commit; an old process that gave up kills us or
+    // closes the socket instead
+    char ack = 'K';
+    char go = 0;
+    bool committed = sendAll(sock, &ack, 1) && recvAll(sock, &go, 1) && go == 'G';
+    close(sock);
+    if (!committed)
+        return false;
+    _handedOff = false;
+    std::cout << BOLD << GREEN << "✓ Resumed " << _clients.size() << " clients and "
+              << _channels.size() << " channels from the previous process" << RESET << std::endl;
+    return true;
+}
+
+// SIGTERM/SIGINT: stop accepting and reading, tell everyone, and keep
+// writing until every output buffer is empty or DRAIN_TIMEOUT passes
+void Server::beginDrain() {
+    std::cout << BOLD << YELLOW << "⏻ Shutting down: draining " << _clients.size() << " clients" << RESET << std::endl;
+    _draining = true;
+    _drainDeadline = Clock::now() + DRAIN_TIMEOUT;
+    closeLinks("Server shutting down");
+    closeUnixSocket(true);
+
+    if (_serverSocket != -1) {
+        _pollIndex[_serverSocket] = -1;
+        close(_serverSocket);
+        _serverSocket = -1;
+    }
+    _pollfds[0].fd = -1;        // poll() skips negative fds
+
+    for (size_t i = 1; i < _pollfds.size(); ++i)
+        _pollfds[i].events = 0;     // No more input; hangups are still reported
+    for (ClientMap::iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        it->second->addToOutputBuffer("ERROR :Closing Link: server shutting down\r\n");
+        enableWriteEvent(it->first);
+    }
+}
+
+bool Server::drained() const {
+    if (!_streams.empty())
+        return false;
+    for (ClientMap::const_iterator it = _clients.begin(); it != _clients.end(); ++it) {
+        if (it->second->hasDataToSend())
+            return false;
+    }
+    return true;
+}
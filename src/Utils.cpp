@@ -0,0 +1,94 @@
+#include "includes/Utils.hpp"
+#include "includes/Scan.hpp"
+
+char ircToLower(char c) {
+    if (c >= 'A' && c <= '^')   // A-Z [ \ ] ^ map 32 up to a-z { | } ~
+        return c + 32;
+    return c;
+}
+
+std::string ircCaseFold(const std::string& str) {
+    std::string folded(str);
+    if (!folded.empty())
+        Scan::foldIrc(&folded[0], folded.size());
+    return folded;
+}
+
+void ircCaseFold(const std::string& str, std::string& folded) {
+    folded = str;
+    if (!folded.empty())
+        Scan::foldIrc(&folded[0], folded.size());
+}
+
+bool ircEquals(const std::string& a, const std::string& b) {
+    return a.size() == b.size() && ircEqualsN(a, b, a.size());
+}
+
+bool ircEqualsN(const std::string& a, const std::string& b, size_t n) {
+    if (a.size() < n || b.size() < n)
+        return false;
+    for (size_t i = 0; i < n; ++i) {
+        if (ircToLower(a[i]) != ircToLower(b[i]))
+            return false;
+    }
+    return true;
+}
+
+// Iterative matcher with single-star backtracking: linear in practice and
+// no recursion on hostile masks like "*a*a*a*a*b".
+bool matchMask(const std::string& mask, const std::string& str) {
+    size_t m = 0, s = 0;
+    size_t starM = std::string::npos, starS = 0;
+
+    while (s < str.size()) {
+        // '*' first: a literal '*' in the subject must not consume it
+        if (m < mask.size() && mask[m] == '*') {
+            starM = m++;
+            starS = s;
+        } else if (m < mask.size() && (mask[m] == '?' || ircToLower(mask[m]) == ircToLower(str[s]))) {
+            ++m;
+            ++s;
+        } else if (starM != std::string::npos) {
+            m = starM + 1;
+            s = ++starS;
+        } else {
+            return false;
+        }
+    }
+    while (m < mask.size() && mask[m] == '*')
+        ++m;
+    return m == mask.size();
+}
+
+std::string toString(unsigned long value) {
+    char buf[24];
+    size_t pos = sizeof(buf);
+
+    do {
+        buf[--pos] = static_cast<char>('0' + value % 10);
+        value /= 10;
+    } while (value);
+    return std::string(buf + pos, sizeof(buf) - pos);
+}
+
+bool nextWord(const std::string& text, size_t& pos, std::string& word) {
+    static const char spaces[] = " \t\n\v\f\r";
+    size_t start = text.find_first_not_of(spaces, pos);
+    if (start == std::string::npos) {
+        pos = text.size();
+        return false;
+    }
+    pos = text.find_first_of(spaces, start);
+    if (pos == std::string::npos)
+        pos = text.size();
+    word.assign(text, start, pos - start);
+    return true;
+}
+
+size_t stringHeapBytes(const std::string& str) {
+    const char* data = str.data();
+    const char* self = reinterpret_cast<const char*>(&str);
+    if (data >= self && data < self + sizeof(str))
+        return 0;   // Short string, stored in the object
+    return str.capacity() + 1;
+}
@@ -0,0 +1,78 @@
+#include "includes/WhoStream.hpp"
+#include "includes/Server.hpp"
+
+// Users examined per fill() during a full scan
+#define WHO_SCAN_LIMIT 1024
+
+WhoStream::WhoStream(const std::string& mask, const std::string& channelKey, const std::vector<std::string>& uids)
+    : _mask(mask), _channelKey(channelKey), _uids(uids), _next(0), _scan(false) {
+}
+
+WhoStream::WhoStream(const std::string& mask)
+    : _mask(mask), _next(0), _scan(true) {
+}
+
+bool whoMatches(const std::string& mask, const Client& target) {
+    if (mask.empty() || mask == "0" || mask == "*")
+        return true;
+    return matchMask(mask, target.getNickname()) || matchMask(mask, target.getUsername())
+        || matchMask(mask, target.getIp()) || matchMask(mask, target.getRealname());
+}
+
+// 352 <me> <channel> <user> <host> <server> <nick> <H[@]> :0 <realname>
+static void appendWhoReply(std::string& out, const Client& me, const Client& target,
+                           const std::string& channelName, bool chanop)
+{
+    static const std::string server(SERVER_NAME);
+    const std::string flags(chanop ? "H@" : "H");
+    const std::string* params[] = { &channelName, &target.getUsername(), &target.getIp(),
+                                    &server, &target.getNickname(), &flags };
+    std::string trailing("0 ");
+    trailing += target.getRealname();
+    Reply::appendList(out, RPL_WHOREPLY, me.getNickname(), params, 6, trailing);
+}
+
+bool WhoStream::fill(Server& server, Client& client, size_t budget) {
+    std::string& out = client.outputBuffer();
+    size_t start = out.size();
+    static const std::string noChannel("*");
+
+    if (_scan) {
+        const UidIndex& users = server.getUsers();
+        UidIndex::const_iterator it = users.upper_bound(_scanCursor);
+        for (size_t scanned = 0; it != users.end() && scanned < WHO_SCAN_LIMIT
+                && out.size() - start < budget; ++it, ++scanned) {
+            _scanCursor = it->first;
+            const Client& target = *it->second;
+            if (target.isRegistered() && whoMatches(_mask, target))
+                appendWhoReply(out, client, target, noChannel, false);
+        }
+        if (it != users.end())
+            return false;
+    } else {
+        const Channel* channel = NULL;
+        if (!_channelKey.empty()) {
+            ChannelMap::const_iterator ch = server.getChannels().find(_channelKey);
+            if (ch != server.getChannels().end())
+                channel = &ch->second;
+            else
+                _next = _uids.size();   // Channel vanished meanwhile
+        }
+        for (; _next < _uids.size() && out.size() - start < budget; ++_next) {
+            Client* target = server.getClientByUid(_uids[_next]);
+            if (!target)
+                continue;               // Disconnected since the query started
+            if (channel) {
+                if (!channel->hasClient(target))
+                    continue;
+                appendWhoReply(out, client, *target, channel->getName(), channel->isOperator(target));
+            } else {
+                appendWhoReply(out, client, *target, noChannel, false);
+            }
+        }
+        if (_next < _uids.size())
+            return false;
+    }
+    Reply::append(out, RPL_ENDOFWHO, client.getNickname(), _mask.empty() ? noChannel : _mask);
+    return true;
+}
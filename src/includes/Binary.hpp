@@ -0,0 +1,39 @@
+#ifndef BINARY_HPP
+#define BINARY_HPP
+
+#include <string>
+#include <cstddef>
+#include <stdint.h>
+
+// Host-byte-order encoding shared by snapshots and hot-upgrade state.
+// Strings are a u32 length followed by the bytes.
+namespace Binary {
+    void putU8(std::string& out, unsigned char value);
+    void putU32(std::string& out, uint32_t value);
+    void putU64(std::string& out, uint64_t value);
+    void putStr(std::string& out, const std::string& value);
+
+    // Bounds-checked cursor; the first overrun clears ok() and every
+    // later read returns zero / empty, so callers check once at the end.
+    class Reader {
+    private:
+        const char* _pos;
+        const char* _end;
+        bool _ok;
+
+        bool take(void* dst, size_t len);
+
+    public:
+        Reader(const char* data, size_t len);
+
+        bool ok() const;
+        bool atEnd() const;
+        bool expect(const char* magic, size_t len);
+        unsigned char u8();
+        uint32_t u32();
+        uint64_t u64();
+        std::string str();
+    };
+}
+
+#endif // BINARY_HPP
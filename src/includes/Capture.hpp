@@ -0,0 +1,56 @@
+#ifndef CAPTURE_HPP
+#define CAPTURE_HPP
+
+#include <string>
+#include <map>
+#include <stdint.h>
+
+#define CAPTURE_MAGIC       "IRCCAP1"   // 8 bytes with the NUL; starts every session
+#define CAPTURE_FLUSH_BYTES (64 * 1024) // Buffered before a write(); runTimers() flushes the rest
+
+// Record types; every record is u8 type, u32 connection, u32 delta
+// (microseconds since the previous record, saturating), then:
+//   CAPTURE_OPEN   u8 flags (CAPTURE_LOCAL for the unix socket)
+//   CAPTURE_DATA   u32 length + the bytes exactly as recv() returned them
+//   CAPTURE_CLOSE  nothing
+enum CaptureRecord {
+    CAPTURE_OPEN  = 1,
+    CAPTURE_DATA  = 2,
+    CAPTURE_CLOSE = 3
+};
+#define CAPTURE_LOCAL       1
+
+// Inbound traffic of every client connection, for tools/ircreplay. A
+// session is the magic, then u64 wall-clock start (microseconds), then
+// records; a hot upgrade appends a new session whose connection ids
+// start over (clients it inherited are not in it).
+class Capture {
+private:
+    std::string _path;
+    int _fd;
+    std::string _pending;
+    uint64_t _last;                     // Monotonic time of the previous record
+    std::map<int, uint32_t> _ids;       // Client fd -> connection id
+    uint32_t _nextId;
+
+    Capture(const Capture&);
+    Capture& operator=(const Capture&);
+
+    void record(CaptureRecord type, uint32_t id);
+
+public:
+    Capture();
+    ~Capture();
+
+    // IRCSERV_CAPTURE names the file; truncated unless `resumed`
+    void configure(bool resumed);
+    bool enabled() const { return _fd != -1; }
+    const std::string& path() const { return _path; }
+
+    void open(int fd, bool local);
+    void data(int fd, const char* bytes, size_t len);
+    void close(int fd);
+    void flush();
+};
+
+#endif // CAPTURE_HPP
@@ -3,34 +3,84 @@
 
 #include <string>
 #include <vector>
+#include <set>
+#include <map>
+#include <ctime>
+#include "Mask.hpp"
+#include "History.hpp"
+
+#define MAXLIST 100                     // Entries per +b/+e/+I list
 
 class Client;
 
 class Channel {
+public:
+    enum ListMode { BAN_LIST, EXCEPT_LIST, INVITE_LIST, LIST_MODE_COUNT };
+
+    struct MaskEntry {
+        Mask mask;
+        std::string setBy;
+        time_t setAt;
+
+        MaskEntry(const std::string& raw, const std::string& by, time_t at);
+    };
+
 private:
+    // Ban verdict per member, valid while neither the +b/+e lists nor the
+    // member's prefix changed since it was computed
+    struct BanCacheEntry {
+        unsigned int listGeneration;
+        unsigned int prefixGeneration;
+        bool banned;
+    };
+
     std::string _name;                  // Channel name (starts with #)
     std::string _topic;                 // Channel topic
     // bool _inviteOnly;               // Invite-only flag
     // bool _passwordProtected;        // Password-protected flag
     std::string _password;               // Channel password
     std::vector<Client*> _clients;      // Clients in the channel
+    std::set<Client*> _memberSet;       // Same members, for O(log n) hasClient
     std::vector<Client*> _operators;    // Channel operators
     bool _topicRestricted;              // Topic restricted flag
     bool _inviteOnly;               // Invite-only flag
+    time_t _createdAt;                  // For LIST C< / C> filters
+    time_t _topicSetAt;                 // For LIST T< / T> filters
+
+    // NAMES cache: "@nick nick ..." pre-split so each 353 line fits in
+    // IRC_LINE_MAX. Joins append in place, anything else marks it dirty.
+    mutable std::vector<std::string> _namesChunks;
+    mutable bool _namesDirty;
+
+    std::vector<MaskEntry> _lists[LIST_MODE_COUNT];
+    unsigned int _listGeneration;
+    mutable std::map<Client*, BanCacheEntry> _banCache;
+
+    HistoryRing _history;
+    std::set<std::string> _savedOperators;  // Operator prefixes from a snapshot, not yet back
+
+    bool computeBanned(const Client* client) const;
+    size_t namesChunkBudget() const;
+    void appendNameEntry(Client* client) const;
 
 public:
     Channel(const std::string& name, Client* creator);
+    Channel(const std::string& name, time_t createdAt);    // Empty, restored from a snapshot
     ~Channel();
 
     //basic getters :
     const std::string& getName() const;
     const std::string& getTopic() const;
     const std::string& getPassword() const;
+    time_t getCreationTime() const;
+    time_t getTopicTime() const;
     // Setters
     void setTopic(const std::string& topic);
     void setInviteOnly(bool inviteOnly);
     void setTopicRestricted(bool restricted);
     void setPassword(const std::string& password);
+    void restoreTopic(const std::string& topic, time_t setAt);
+    void setCreationTime(time_t createdAt);    // A linked server's older copy wins
 
      // Client management
     bool addClient(Client* client);
@@ -38,12 +88,40 @@ public:
     bool hasClient(Client* client) const;
     const std::vector<Client*>& getClients() const { return _clients; };
     bool isOperator(Client* client) const;
+    const std::vector<Client*>& getOperators() const;
     void addOperator(Client* client);
     void removeOperator(Client* client);
     bool isInviteOnly() const;
     bool isTopicRestricted() const;
     bool isPasswordProtected() const;
-    
+
+    // +b / +e / +I lists
+    bool addMask(ListMode list, const std::string& raw, const std::string& setBy);
+    bool removeMask(ListMode list, const std::string& raw);
+    const std::vector<MaskEntry>& getMasks(ListMode list) const;
+    bool isBanned(Client* client) const;        // +b match not covered by +e
+    bool isInviteExempt(Client* client) const;  // +I match
+    void restoreMask(ListMode list, const std::string& raw, const std::string& setBy, time_t setAt);
+
+    // Operators saved in a snapshot are known by prefix until they rejoin
+    void addSavedOperator(const std::string& prefix);
+    const std::set<std::string>& getSavedOperators() const;
+    bool claimSavedOperator(Client* client);    // Re-op a returning operator
+    bool isSavedOperator(Client* client) const;
+    void clearSavedOperators();
+
+    // Recent PRIVMSG lines, for CHATHISTORY and JOIN replay
+    HistoryRing& history();
+    const HistoryRing& history() const;
+
+    // NAMES reply support
+    const std::vector<std::string>& getNamesChunks() const;
+    void invalidateNames();             // Call when a member's nickname changes
+
 };
 
+// Channels keyed by their case-folded name: O(log n) lookups, stable
+// addresses, and a sorted order LIST can resume from.
+typedef std::map<std::string, Channel> ChannelMap;
+
 #endif
\ No newline at end of file
@@ -3,18 +3,55 @@
 
 #include <string>
 #include <vector>
+#include <set>
+#include <map>
+#include <ctime>
+#include <stdint.h>
+
+// I/O buffers are taken from a shared pool when data arrives and handed
+// back once drained, so an idle connection holds no buffer memory
+#define CLIENT_BUFFER_MIN       1024        // Capacity a buffer starts with
+#define CLIENT_BUFFER_MAX       (16 * 1024) // Bigger ones are freed, not pooled
+#define CLIENT_BUFFER_SPARES    256         // Pool size limit
+
+// IRCv3 capabilities a client may enable with CAP REQ
+enum ClientCap {
+    CAP_MULTI_PREFIX = 1 << 0,
+    CAP_SERVER_TIME  = 1 << 1
+};
 
 class Client {
 private:
-    int _fd;
+    // Widest members first so the narrow ones pack at the end; strings
+    // up to 15 bytes (most nicks, idents, UIDs, IPv4 addresses) live
+    // inside the std::string itself
     std::string _ip;
     std::string _nickname;
     std::string _username;
-    bool _authenticated;
-    std::string _inputBuffer;
-    std::string _outputBuffer;
     std::string _realname;
-    bool _registered; 
+    std::string _prefix;              // Pre-rendered ":nick!user@host", rebuilt only on NICK/USER
+    std::string _uid;                 // Network-wide ID: our SID + 6 chars, never reused
+    std::string _inputBuffer;         // Both buffers hold no memory while empty (see releaseBuffer)
+    std::string _outputBuffer;
+    std::set<std::string> _channels;  // Case-folded names of the channels this client is in
+    std::map<std::string, std::string> _monitors;   // MONITOR list: folded nick -> nick as given
+    size_t _inputStart;               // Lines before this were already handed out
+    size_t _lineEnd;                  // '\n' ending the next complete line, npos if none yet
+    size_t _lineBad;                  // First NUL or CR in that line (so far), npos if none
+    size_t _scanned;                  // Input checked for '\n' up to here
+    time_t _nickTs;                   // When the nick was taken, settles nick collisions
+    int _fd;
+    uint32_t _ipv4;                   // _ip parsed once (network order, 0 if not IPv4) for CIDR bans
+    unsigned int _prefixGeneration;   // Bumped on every prefix change (ban cache key)
+    unsigned int _caps;               // ClientCap bits
+    bool _authenticated;
+    bool _registered;
+    bool _oper;                       // Authenticated with OPER
+
+    void rebuildPrefix();
+    void findLineEnd();
+    static void acquireBuffer(std::string& buffer);
+    static void releaseBuffer(std::string& buffer);
 
 public:
     Client(int fd, const std::string& ip);
@@ -23,29 +60,67 @@ public:
     // Getters
     int getFd() const;
     const std::string& getIp() const;
+    uint32_t getIpv4() const;
     const std::string& getNickname() const;
     const std::string& getUsername() const;
     bool isAuthenticated() const;
     const std::string& getRealname() const;
+    const std::string& getPrefix() const;   // Source prefix for outgoing messages
+    unsigned int getPrefixGeneration() const;
+    const std::string& getUid() const;
+    time_t getNickTs() const;
+    bool isLocal() const;                   // Connected here (remote users have no fd)
     
     // Setters
     void setNickname(const std::string& nickname);
     void setUsername(const std::string& username);
     void setAuthenticated(bool auth);
     void setRealname(const std::string& realname);
+    void setUid(const std::string& uid);
+    void setNickTs(time_t ts);
 
     //buffer management 
     void appendToInputBuffer(const std::string& data);
+    void appendToInputBuffer(const char* data, size_t len);
+    std::string getInputBuffer() const;    // Input not yet handed out as lines
+    bool hasPendingInput() const;
     bool hasCompleteMessage()const;
-    std::string getNextMessage();
+    std::string getNextMessage();          // Up to '\n', without it or a CR before it
+    // The same into a caller's string; false if none. `invalid` is set
+    // when the line holds a NUL or a CR other than the one before '\n'.
+    bool getNextMessage(std::string& message, bool& invalid);
     
     void addToOutputBuffer(const std::string& message);
-    std::string getOutputBuffer();
+    std::string& outputBuffer();           // Direct access so replies can be built in place
+    const std::string& getOutputBuffer() const;
+    void consumeOutput(size_t sent);       // Drops what the socket took
     void clearOutputBuffer();
     bool hasDataToSend() const;
 
     bool isRegistered() const;
     void setRegistered(bool reg);
+    bool isOper() const;
+    void setOper(bool oper);
+
+    bool hasCap(ClientCap cap) const;
+    void setCaps(unsigned int caps);
+    unsigned int getCaps() const;
+
+    // Channel membership, mirrored from Channel so per-client walks
+    // (WHOIS, NICK, QUIT) don't have to scan every channel
+    const std::set<std::string>& getChannels() const;
+    void addChannel(const std::string& key);
+    void removeChannel(const std::string& key);
+
+    // MONITOR targets; the server keeps the reverse (nick -> watchers) index
+    const std::map<std::string, std::string>& getMonitors() const;
+    bool addMonitor(const std::string& key, const std::string& nick);
+    bool removeMonitor(const std::string& key);
+
+    // Heap and object bytes owned by this client (the server's indexes
+    // and pollfd slot are counted by the server)
+    size_t memoryUsage() const;
+    static size_t spareBuffers();          // Pooled, ready for the next busy client
 };
 
 #endif // CLIENT_HPP
\ No newline at end of file
@@ -0,0 +1,30 @@
+#ifndef CLOCK_HPP
+#define CLOCK_HPP
+
+#include <ctime>
+#include <stdint.h>
+
+// Wall-clock time behind every timestamp and timeout: topics, bans,
+// history, snapshot intervals, link and admin timeouts, the drain
+// deadline. A host embedding the server (Server::embed) can stop it
+// and step it by hand, so a soak test crosses those deadlines without
+// sleeping. Durations the server measures about itself (command
+// latency, loop lag, capture deltas) stay on Metrics::monotonicUs.
+// Only the event loop thread reads it; the message log writer keeps
+// its fsync timer on real time.
+class Clock {
+private:
+    static bool _manual;
+    static uint64_t _millis;            // Current time while manual
+
+public:
+    static time_t now();                // In place of time(NULL)
+    static uint64_t nowMillis();
+
+    static void setManual(uint64_t millis);
+    static void advance(uint64_t millis);
+    static void setReal();
+    static bool manual() { return _manual; }
+};
+
+#endif // CLOCK_HPP
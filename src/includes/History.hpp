@@ -0,0 +1,52 @@
+#ifndef HISTORY_HPP
+#define HISTORY_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+
+#define HISTORY_LEN         100     // Lines kept per channel
+#define HISTORY_JOIN_REPLAY 0       // Lines replayed on JOIN (IRCSERV_JOIN_REPLAY overrides)
+#define CHATHISTORY_MAX     100     // Largest CHATHISTORY limit a client may ask for
+
+// One channel message, serialised once as "@time=... :prefix CMD ...\r\n".
+// Clients without server-time get the same string from tagLen onwards.
+struct HistoryEntry {
+    uint64_t time;          // Milliseconds since the epoch
+    std::string line;
+    size_t tagLen;          // Length of the "@time=... " tag prefix
+};
+
+// Fixed-size ring of a channel's recent messages. Slots are reused in
+// place, so once the ring is full an append is a string assign into
+// storage that already has capacity. Indexes run oldest (0) to newest.
+class HistoryRing {
+private:
+    std::vector<HistoryEntry> _entries;
+    size_t _head;           // Slot of the oldest entry once the ring is full
+
+public:
+    HistoryRing();
+
+    // Store a line (without tags, CRLF included); returns the stored entry
+    const HistoryEntry& push(const std::string& line);
+    // Re-insert an entry exactly as stored (hot upgrade)
+    void restore(const HistoryEntry& entry);
+
+    size_t size() const;
+    bool empty() const;
+    const HistoryEntry& at(size_t index) const;
+
+    // First entry with time >= t (or > t when strict); size() if none
+    size_t lowerBound(uint64_t t, bool strict) const;
+};
+
+uint64_t currentTimeMillis();
+
+// "YYYY-MM-DDThh:mm:ss.sssZ"
+std::string formatServerTime(uint64_t millis);
+void appendServerTime(std::string& out, uint64_t millis);
+bool parseServerTime(const std::string& text, uint64_t& millis);
+
+#endif // HISTORY_HPP
@@ -0,0 +1,75 @@
+#ifndef LINK_HPP
+#define LINK_HPP
+
+#include <string>
+#include <ctime>
+
+#define LINK_RETRY          10                  // Seconds between autoconnect attempts
+#define LINK_SENDQ_MAX      (16 * 1024 * 1024)  // Output a peer may fall behind by before it is dropped
+#define LINK_HANDSHAKE_TIMEOUT 30               // Seconds a link may take to authenticate
+
+class Client;
+
+// A connection to another ircserv. Everything the peer should hear is
+// appended to one output buffer and written with a single send() per
+// poll wakeup, so a burst or a busy channel costs a few large writes
+// rather than one syscall per line.
+class Link {
+public:
+    enum State {
+        CONNECTING,             // Outbound connect() in progress
+        HANDSHAKE,              // Waiting for the peer's SERVER line
+        ACTIVE                  // Authenticated and burst sent
+    };
+
+private:
+    int _fd;
+    State _state;
+    bool _outbound;
+    std::string _target;        // "host:port" for outbound links
+    std::string _sid;           // Peer's server ID once known
+    std::string _description;
+    time_t _since;
+    std::string _input;
+    std::string _output;
+
+public:
+    Link(int fd, State state, bool outbound, const std::string& target);
+
+    int getFd() const;
+    State getState() const;
+    void setState(State state);
+    bool isOutbound() const;
+    const std::string& getTarget() const;
+    const std::string& getSid() const;
+    const std::string& getDescription() const;
+    void setPeer(const std::string& sid, const std::string& description);
+    time_t getSince() const;
+
+    // Line framing, same rules as Client
+    void appendToInputBuffer(const char* data, size_t len);
+    bool hasCompleteMessage() const;
+    std::string getNextMessage();
+
+    void send(const std::string& line);     // Queue one CRLF-terminated line
+    std::string& outputBuffer();
+    bool hasDataToSend() const;
+};
+
+// Other servers, learnt from SERVER/SID. A server's users are the UIDs
+// that start with its SID.
+struct RemoteServer {
+    Link* route;                // Directly connected link this server is behind
+    std::string uplink;         // SID of the server that introduced it
+    std::string description;
+    int hops;
+};
+
+// An IRCSERV_LINKS entry we keep connecting to
+struct LinkTarget {
+    std::string address;        // "host:port"
+    std::string sid;            // Learnt on the first successful link
+    time_t nextAttempt;
+};
+
+#endif // LINK_HPP
@@ -0,0 +1,31 @@
+#ifndef LISTSTREAM_HPP
+#define LISTSTREAM_HPP
+
+#include <string>
+#include <vector>
+#include "ReplyStream.hpp"
+
+// LIST with ELIST filters (C, M, N, T, U), walked in channel-key order.
+// The cursor is the last key emitted, so channels created or removed
+// between slices never make the walk skip or repeat entries.
+class ListStream : public ReplyStream {
+private:
+    std::vector<std::string> _masks;        // Channel names or globs, OR'd
+    std::vector<std::string> _notMasks;     // !mask entries
+    size_t _minUsers;                       // >n
+    size_t _maxUsers;                       // <n
+    long _topicNewer;                       // T<n (minutes), -1 if unset
+    long _topicOlder;                       // T>n
+    long _createdNewer;                     // C<n
+    long _createdOlder;                     // C>n
+    bool _started;
+    std::string _cursor;
+
+    void parseFilter(const std::string& token);
+
+public:
+    explicit ListStream(const std::string& params);
+    virtual bool fill(Server& server, Client& client, size_t budget);
+};
+
+#endif // LISTSTREAM_HPP
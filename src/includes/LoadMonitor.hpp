@@ -0,0 +1,56 @@
+#ifndef LOADMONITOR_HPP
+#define LOADMONITOR_HPP
+
+#include <cstddef>
+#include <stdint.h>
+#include "Metrics.hpp"
+
+#define LOAD_WINDOW_US      1000000     // Lag and busy share are judged once per window
+#define OVERLOAD_LAG_MS     250         // Slowest pass; IRCSERV_OVERLOAD_LAG_MS overrides, 0 = never shed
+#define OVERLOAD_BUSY_PCT   90          // Share of the window spent working; IRCSERV_OVERLOAD_BUSY overrides
+#define OVERLOAD_RECOVERY   3           // Calm windows in a row before overload mode ends
+
+// Watches the event loop itself: how long a pass takes from poll()
+// returning to the next poll() (the longest any ready socket can wait),
+// how much of the wall clock goes to such passes, and how many sockets
+// poll() hands back at once. A window whose slowest pass or busy share
+// reaches its limit puts the server in overload mode; it leaves once
+// OVERLOAD_RECOVERY windows in a row stay under half of both limits.
+class LoadMonitor {
+private:
+    uint64_t _lagLimitUs;
+    unsigned _busyLimit;                // Percent
+
+    uint64_t _passStart;                // 0 outside a pass
+    uint64_t _windowStart;
+    uint64_t _windowBusy;
+    uint64_t _windowLag;
+    size_t _windowReady;
+
+    uint64_t _lag;                      // Last complete window
+    unsigned _busy;
+    size_t _ready;
+
+    bool _overloaded;
+    unsigned _calm;                     // Consecutive calm windows while overloaded
+    Histogram _passes;                  // Pass durations, microseconds
+
+public:
+    LoadMonitor();
+
+    // Reads IRCSERV_OVERLOAD_LAG_MS / IRCSERV_OVERLOAD_BUSY
+    void configure();
+
+    // poll() returned `ready` sockets
+    void beginPass(size_t ready);
+    // The pass is over; true when overload mode was entered or left
+    bool endPass();
+
+    bool overloaded() const { return _overloaded; }
+    uint64_t lagUs() const { return _lag; }
+    unsigned busyPercent() const { return _busy; }
+    size_t readyFds() const { return _ready; }
+    const Histogram& passes() const { return _passes; }
+};
+
+#endif // LOADMONITOR_HPP
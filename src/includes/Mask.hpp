@@ -0,0 +1,44 @@
+#ifndef MASK_HPP
+#define MASK_HPP
+
+#include <string>
+#include <stdint.h>
+
+class Client;
+
+// A nick!user@host mask parsed once when it is set, so checking it on
+// every JOIN/PRIVMSG is mostly prefix compares: "*" parts are skipped,
+// wildcard-free parts are a case-insensitive compare, wildcard parts
+// first test their literal prefix, and a host of the form a.b.c.d/n is
+// matched numerically against the client's IPv4 address.
+class Mask {
+private:
+    struct Part {
+        std::string pattern;
+        size_t literalLen;      // Characters before the first wildcard
+        bool any;               // Pattern is just "*"
+        bool literal;           // No wildcard at all
+
+        void compile(const std::string& text);
+        bool matches(const std::string& value) const;
+    };
+
+    std::string _text;          // Normalised nick!user@host form
+    Part _nick;
+    Part _user;
+    Part _host;
+    bool _cidr;
+    uint32_t _network;
+    uint32_t _netmask;
+
+public:
+    explicit Mask(const std::string& raw);
+
+    const std::string& str() const;
+    bool matches(const Client& client) const;
+
+    // Expand shorthand ("nick", "user@host", "nick!user") to nick!user@host
+    static std::string normalise(const std::string& raw);
+};
+
+#endif // MASK_HPP
@@ -0,0 +1,55 @@
+#ifndef MESSAGE_HPP
+#define MESSAGE_HPP
+
+#include <string>
+#include <vector>
+
+// One protocol line split into its parts:
+//   [":" source " "] command {" " param} [" :" trailing]
+// The trailing parameter is stored as the last entry of params with its
+// ':' removed, so callers never need to tell the two forms apart.
+struct Message {
+    std::string source;         // Without the leading ':', empty if absent
+    std::string command;        // Upper-cased
+    std::vector<std::string> params;
+
+    // Parameter n, or an empty string when the line had fewer
+    const std::string& param(size_t n) const;
+};
+
+// False for lines with no command (empty or only a source)
+bool parseMessage(const std::string& line, Message& out);
+
+// Commands the server handles itself: X(id, name). Plugins cannot take
+// these names, and their metrics are kept in an array rather than a map.
+#define BUILTIN_COMMANDS(X) \
+    X(CMD_PASS,        "PASS") \
+    X(CMD_NICK,        "NICK") \
+    X(CMD_USER,        "USER") \
+    X(CMD_PING,        "PING") \
+    X(CMD_CAP,         "CAP") \
+    X(CMD_JOIN,        "JOIN") \
+    X(CMD_PART,        "PART") \
+    X(CMD_PRIVMSG,     "PRIVMSG") \
+    X(CMD_TOPIC,       "TOPIC") \
+    X(CMD_KICK,        "KICK") \
+    X(CMD_MODE,        "MODE") \
+    X(CMD_NAMES,       "NAMES") \
+    X(CMD_MOTD,        "MOTD") \
+    X(CMD_LIST,        "LIST") \
+    X(CMD_WHO,         "WHO") \
+    X(CMD_WHOIS,       "WHOIS") \
+    X(CMD_MONITOR,     "MONITOR") \
+    X(CMD_ISON,        "ISON") \
+    X(CMD_CHATHISTORY, "CHATHISTORY") \
+    X(CMD_OPER,        "OPER") \
+    X(CMD_STATS,       "STATS")
+
+#define COMMAND_ENUM(id, name) id,
+enum CommandId { BUILTIN_COMMANDS(COMMAND_ENUM) CMD_OTHER };
+#undef COMMAND_ENUM
+
+CommandId commandId(const std::string& name);   // Upper-cased name; CMD_OTHER if not built in
+const char* commandName(CommandId id);
+
+#endif // MESSAGE_HPP
@@ -0,0 +1,118 @@
+#ifndef MESSAGELOG_HPP
+#define MESSAGELOG_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <stdint.h>
+#include <pthread.h>
+
+#define MSGLOG_SEGMENT_BYTES    (64UL << 20)
+#define MSGLOG_FSYNC_INTERVAL   1000        // ms between fsyncs under the "interval" policy
+#define MSGLOG_PENDING_MAX      (16UL << 20) // Queued bytes before new records are dropped
+#define MSGLOG_QUERY_SCAN_MAX   (1UL << 16) // Index entries one query may examine
+
+// On-disk layout. Segment NNNNNNNN.log holds records back to back; its
+// NNNNNNNN.idx holds one fixed-size entry per record, in append order
+// (and therefore time order), so lookups binary-search a mapped array
+// and pread only the records they return.
+struct LogRecordHeader {
+    uint64_t time;          // Milliseconds since the epoch
+    uint32_t channelLen;
+    uint32_t lineLen;       // Followed by channel key, then the line (CRLF included)
+};
+
+struct LogIndexEntry {
+    uint64_t time;
+    uint64_t offset;        // Record start in the segment
+    uint32_t channelHash;
+    uint32_t length;        // Whole record, header included
+};
+
+struct LogRecord {
+    uint64_t time;
+    std::string line;
+};
+
+// Durable, append-only channel message log. append() only copies the
+// record into the pending batch; a background thread writes each batch
+// with one write() per file and syncs according to the fsync policy, so
+// every message that arrived while the previous batch was being synced
+// is committed together (group commit).
+class MessageLog {
+public:
+    enum FsyncPolicy {
+        FSYNC_ALWAYS,       // Sync every batch before taking the next one
+        FSYNC_INTERVAL,     // Sync at most every MSGLOG_FSYNC_INTERVAL ms
+        FSYNC_NEVER         // Leave it to the kernel
+    };
+
+private:
+    std::string _dir;
+    FsyncPolicy _policy;
+    bool _enabled;
+
+    // Shared with the writer thread, guarded by _mutex
+    mutable pthread_mutex_t _mutex;
+    pthread_cond_t _wake;
+    pthread_cond_t _flushed;                // Signalled when a flush() is done
+    pthread_t _thread;
+    bool _threadStarted;
+    bool _stopping;
+    bool _flushing;                         // flush() waiting for the queue to drain
+    std::string _pending;                   // Serialised records
+    std::vector<LogIndexEntry> _pendingIndex;   // Offsets relative to _pending
+    std::vector<unsigned int> _segments;    // Segment numbers, oldest first
+    uint64_t _dropped;                      // Records lost to a full queue or a failed write
+
+    // Writer thread only
+    int _logFd;
+    int _indexFd;
+    uint64_t _segmentSize;                  // Bytes of whole records in the .log
+    uint64_t _indexSize;                    // Bytes of whole entries in the .idx
+    uint64_t _lastSync;
+
+    MessageLog(const MessageLog&);
+    MessageLog& operator=(const MessageLog&);
+
+    static void* writerMain(void* self);
+    void writerLoop();
+    void writeBatch(std::string& data, std::vector<LogIndexEntry>& index);
+    void openSegment(unsigned int number);
+    void closeSegment();
+    void syncSegment();
+    bool undoPartialWrite(int fd, uint64_t size);
+    std::string segmentPath(unsigned int number, const char* ext) const;
+
+    void scanSegment(unsigned int number, const std::string& channelKey, uint64_t from, uint64_t to,
+                     size_t limit, bool newest, size_t& budget, std::vector<LogRecord>& out) const;
+
+public:
+    MessageLog();
+    ~MessageLog();
+
+    // Reads IRCSERV_LOG_DIR / IRCSERV_LOG_FSYNC and starts the writer;
+    // off unless IRCSERV_LOG_DIR names a directory
+    void open();
+    bool enabled() const;
+
+    // Queue one channel message (line without tags, CRLF included). With
+    // MSGLOG_PENDING_MAX bytes already waiting the record is dropped.
+    void append(uint64_t time, const std::string& channelKey, const std::string& line);
+    uint64_t dropped() const;
+
+    // Committed records for channelKey with from <= time <= to, oldest
+    // first. When more than `limit` match, keep the newest (newest=true)
+    // or the oldest ones. It runs on the caller's thread, so it gives up
+    // after MSGLOG_QUERY_SCAN_MAX index entries, returning what it found.
+    void query(const std::string& channelKey, uint64_t from, uint64_t to,
+               size_t limit, bool newest, std::vector<LogRecord>& out) const;
+
+    // Write out and sync everything queued so far and close the segment;
+    // the writer keeps running and starts a new segment on the next append
+    void flush();
+    // The same, then stop the writer; open() may start it again
+    void close();
+};
+
+#endif // MESSAGELOG_HPP
@@ -0,0 +1,160 @@
+#ifndef METRICS_HPP
+#define METRICS_HPP
+
+#include <string>
+#include <map>
+#include <vector>
+#include <stdint.h>
+#include <ctime>
+#include "Message.hpp"
+
+// Counter catalogue: X(name, metric, help). Exposed as
+// ircserv_<metric>_total by the admin socket and STATS z.
+#define METRIC_COUNTERS(X) \
+    X(CONNECTIONS,      "connections",      "Client connections accepted (TCP and local)") \
+    X(REGISTRATIONS,    "registrations",    "Clients that completed registration") \
+    X(BYTES_RECEIVED,   "bytes_received",   "Bytes read from client sockets") \
+    X(BYTES_SENT,       "bytes_sent",       "Bytes written to client sockets") \
+    X(RECV_CALLS,       "recv_calls",       "recv() calls on client sockets") \
+    X(SEND_CALLS,       "send_calls",       "send() calls on client sockets") \
+    X(PARTIAL_WRITES,   "partial_writes",   "send() calls that left output queued") \
+    X(MESSAGES_IN,      "messages_in",      "Lines received from clients") \
+    X(INVALID_LINES,    "invalid_lines",    "Client lines dropped for containing NUL or a bare CR") \
+    X(MESSAGES_OUT,     "messages_out",     "Lines queued for other users on a client's behalf") \
+    X(OVERLOADS,        "overloads",        "Times the event loop fell behind and shedding began") \
+    X(SHED_CONNECTIONS, "shed_connections", "TCP connections refused while overloaded") \
+    X(SHED_COMMANDS,    "shed_commands",    "NAMES/LIST/WHO/CHATHISTORY answered with 263 while overloaded") \
+    X(SHED_REPLAYS,     "shed_replays",     "JOIN history replays skipped while overloaded")
+
+// Why a client went away
+#define METRIC_DISCONNECTS(X) \
+    X(DISCONNECT_EOF,        "eof") \
+    X(DISCONNECT_RECV_ERROR, "recv_error") \
+    X(DISCONNECT_SEND_ERROR, "send_error") \
+    X(DISCONNECT_HANGUP,     "hangup") \
+    X(DISCONNECT_KILLED,     "killed")
+
+#define METRIC_COMMANDS_MAX 64      // Distinct command labels; the rest count as "other"
+#define ADMIN_TIMEOUT       5       // Seconds an admin socket peer may stay connected
+#define HISTOGRAM_BUCKETS   25      // Bucket i < 24 holds values of bit length i; the last, the rest
+#define TRACE_RING          256     // Slow commands kept for STATS T and the admin socket
+#define TRACE_MARKS         8       // Phases recorded inside one command
+
+// Log2-bucketed distribution: recording is a bit-length loop and two
+// adds, quantiles are read back as the upper bound of their bucket
+struct Histogram {
+    uint64_t buckets[HISTOGRAM_BUCKETS];
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+
+    Histogram();
+    void record(uint64_t value);
+    uint64_t quantile(double q) const;
+    static uint64_t upperBound(size_t bucket);     // Largest value the bucket holds
+};
+
+// One command that took longer than the trace threshold
+struct TraceSpan {
+    struct Mark {
+        const char* label;          // String literal from the call site
+        uint32_t offset;            // Microseconds after the command started
+    };
+
+    uint64_t startUs;               // Wall clock
+    uint32_t durationUs;
+    std::string command;
+    int fd;
+    uint32_t fanOut;
+    std::vector<Mark> marks;
+};
+
+// Process-wide counters. Updating one is an array increment, and a
+// command's stats are found once per line, so it all stays on in
+// production; everything derived is computed when someone asks.
+class Metrics {
+public:
+#define METRIC_ENUM(name, metric, help) name,
+    enum Counter { METRIC_COUNTERS(METRIC_ENUM) COUNTER_COUNT };
+#undef METRIC_ENUM
+#define METRIC_ENUM(name, label) name,
+    enum Disconnect { METRIC_DISCONNECTS(METRIC_ENUM) DISCONNECT_COUNT };
+#undef METRIC_ENUM
+
+    struct CommandStats {
+        uint64_t calls;
+        uint64_t bytes;             // Received, CRLF excluded
+        uint64_t fanOut;            // Lines queued for other users
+        Histogram latency;          // Service time, microseconds
+        Histogram fanOutSizes;      // Lines queued per call
+
+        CommandStats() : calls(0), bytes(0), fanOut(0) {}
+    };
+
+private:
+    uint64_t _counters[COUNTER_COUNT];
+    uint64_t _disconnects[DISCONNECT_COUNT];
+    std::map<std::string, CommandStats> _commands;
+    std::pair<const std::string, CommandStats>* _builtins[CMD_OTHER];  // Their _commands entries, once seen
+    CommandStats* _current;         // Command being dispatched, NULL between lines
+    const std::string* _currentName;
+    int _currentFd;
+    uint64_t _started;              // Monotonic microseconds
+    uint32_t _callFanOut;
+
+    // Tracing, off while the threshold is 0
+    uint32_t _traceThresholdUs;
+    TraceSpan::Mark _marks[TRACE_MARKS];
+    size_t _markCount;
+    std::vector<TraceSpan> _trace;  // Ring, oldest at _traceNext once full
+    size_t _traceNext;
+
+public:
+    Metrics();
+
+    void configure();               // IRCSERV_TRACE_SLOW_US
+    static uint64_t monotonicUs();
+
+    void add(Counter counter, uint64_t n = 1) { _counters[counter] += n; }
+    uint64_t get(Counter counter) const { return _counters[counter]; }
+    void disconnect(Disconnect reason) { ++_disconnects[reason]; }
+
+    // Brackets the dispatch of one line; fanOut() and mark() charge it
+    void beginCommand(CommandId id, const std::string& command, size_t bytes, int fd);
+    void endCommand();
+    void fanOut(size_t lines) {
+        _counters[MESSAGES_OUT] += lines;
+        if (_current) {
+            _current->fanOut += lines;
+            _callFanOut += lines;
+        }
+    }
+    // A phase of the current command ended; kept only while tracing
+    void mark(const char* label) {
+        if (_traceThresholdUs && _current && _markCount < TRACE_MARKS) {
+            _marks[_markCount].label = label;
+            _marks[_markCount].offset = monotonicUs() - _started;
+            ++_markCount;
+        }
+    }
+
+    const std::map<std::string, CommandStats>& commands() const { return _commands; }
+    bool tracing() const { return _traceThresholdUs != 0; }
+    void renderTrace(std::string& out) const;      // Oldest first, one span per line
+
+    // Prometheus text exposition of every counter
+    void render(std::string& out) const;
+    static void renderGauge(std::string& out, const char* metric, const char* help, uint64_t value);
+    static void renderCounter(std::string& out, const char* metric, const char* help, uint64_t value);
+    static void renderHistogram(std::string& out, const char* metric, const char* help, const Histogram& h);
+};
+
+// One connection to the admin socket
+struct AdminRequest {
+    std::string input;
+    std::string output;             // Reply not yet written
+    time_t since;
+    bool answered;                  // Reply built, waiting for the peer to close
+};
+
+#endif // METRICS_HPP
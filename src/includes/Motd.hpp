@@ -0,0 +1,38 @@
+#ifndef MOTD_HPP
+#define MOTD_HPP
+
+#include <string>
+#include <ctime>
+#include <sys/types.h>
+#include "Replies.hpp"
+
+#define MOTD_PATH "ircd.motd"
+
+// Message of the day, read once per change and kept as a pre-framed
+// 375/372/376 block (or a single 422 when the file is missing).
+// The file is re-read only when its inode, size or mtime change, and
+// those are checked at most once per second.
+class Motd {
+private:
+    std::string _path;
+    ReplyTemplate _block;
+    bool _loaded;
+    time_t _lastCheck;
+    dev_t _dev;
+    ino_t _ino;
+    off_t _size;
+    time_t _mtime;
+
+    void load();
+    void frame(const char* data, size_t len);
+
+public:
+    explicit Motd(const std::string& path);
+    ~Motd();
+
+    // Re-read the file if it changed since the last load
+    void refresh();
+    const ReplyTemplate& block() const;
+};
+
+#endif // MOTD_HPP
@@ -0,0 +1,62 @@
+#ifndef PLUGIN_HPP
+#define PLUGIN_HPP
+
+#include <string>
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "Message.hpp"
+
+// In-process services. A plugin is a shared object exporting
+//   extern "C" Plugin* ircservPlugin(PluginHost& host);
+// which returns a heap-allocated Plugin (deleted by the server before
+// dlclose) after registering its commands and events with the host.
+// Hooks run inside the event loop and get the line as the server parsed
+// it, so they must not block and must not keep the Message around.
+#define PLUGIN_API_VERSION  1
+#define PLUGIN_ENTRY        "ircservPlugin"
+
+class Plugin;
+
+enum PluginEvent {
+    PLUGIN_JOIN    = 1 << 0,
+    PLUGIN_PART    = 1 << 1,
+    PLUGIN_PRIVMSG = 1 << 2,        // Channel messages
+    PLUGIN_NICK    = 1 << 3
+};
+
+// What a plugin may do to the server
+class PluginHost {
+public:
+    virtual ~PluginHost() {}
+
+    virtual int apiVersion() const = 0;
+    // Registered users only; false if the name is a built-in or already taken
+    virtual bool registerCommand(Plugin* plugin, const std::string& command) = 0;
+    virtual void subscribe(Plugin* plugin, int events) = 0;    // PluginEvent bits
+
+    virtual Client* findUser(const std::string& nick) = 0;
+    virtual Channel* findChannel(const std::string& name) = 0;
+    // Queue a CRLF-terminated line; remote users are ignored
+    virtual void send(Client* client, const std::string& line) = 0;
+    virtual void sendToChannel(const Channel& channel, const std::string& line, Client* except) = 0;
+};
+
+// Hooks default to doing nothing. Events fire for users on linked
+// servers too; their Message then has a UID as its source. Parameters
+// keep the client layout: PRIVMSG <#chan> <text>, PART <#chan> [reason],
+// JOIN <#chan>, NICK <nick>.
+class Plugin {
+public:
+    virtual ~Plugin() {}
+
+    virtual const char* name() const = 0;
+    virtual void onCommand(Client&, const Message&) {}
+    virtual void onJoin(Client&, Channel&, const Message&) {}
+    virtual void onPart(Client&, Channel&, const Message&) {}      // Already removed; channel may be empty
+    virtual void onPrivmsg(Client&, Channel&, const Message&) {}
+    virtual void onNick(Client&, const std::string& /* oldNick */, const Message&) {}
+};
+
+typedef Plugin* (*PluginEntry)(PluginHost& host);
+
+#endif // PLUGIN_HPP
@@ -0,0 +1,62 @@
+#ifndef PLUGINMANAGER_HPP
+#define PLUGINMANAGER_HPP
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "Plugin.hpp"
+
+#define PLUGIN_EVENTS   4       // Bits in PluginEvent
+
+class Server;
+
+// Loads IRCSERV_PLUGINS ("a.so,b.so") and routes commands and events to
+// them. With nothing loaded every hook is a single branch.
+class PluginManager : public PluginHost {
+private:
+    struct Loaded {
+        std::string path;
+        void* handle;
+        Plugin* plugin;
+    };
+
+    Server& _server;
+    std::vector<Loaded> _loaded;
+    std::map<std::string, Plugin*> _commands;           // Upper-cased name -> owner
+    std::vector<Plugin*> _subscribers[PLUGIN_EVENTS];
+    int _events;                                        // Union of every subscription
+
+    void forgetUnowned();               // Registrations left by a plugin that failed to load
+
+    PluginManager(const PluginManager&);
+    PluginManager& operator=(const PluginManager&);
+
+public:
+    explicit PluginManager(Server& server);
+    ~PluginManager();
+
+    void configure();                   // Load everything in IRCSERV_PLUGINS; throws on failure
+    void load(const std::string& path);
+    void unloadAll();
+    bool active() const { return !_loaded.empty(); }
+    bool wants(PluginEvent event) const { return (_events & event) != 0; }
+
+    // False when no plugin owns msg.command
+    bool command(Client& client, const Message& msg);
+    void join(Client& client, Channel& channel, const Message& msg);
+    void part(Client& client, Channel& channel, const Message& msg);
+    void privmsg(Client& client, Channel& channel, const Message& msg);
+    void nick(Client& client, const std::string& oldNick, const Message& msg);
+
+    // PluginHost
+    int apiVersion() const;
+    bool registerCommand(Plugin* plugin, const std::string& command);
+    void subscribe(Plugin* plugin, int events);
+    Client* findUser(const std::string& nick);
+    Channel* findChannel(const std::string& name);
+    void send(Client* client, const std::string& line);
+    void sendToChannel(const Channel& channel, const std::string& line, Client* except);
+};
+
+#endif // PLUGINMANAGER_HPP
@@ -0,0 +1,137 @@
+#ifndef REPLIES_HPP
+#define REPLIES_HPP
+
+#include <string>
+#include <vector>
+#include <cstddef>
+
+#define SERVER_NAME "server"
+
+// Protocol limits
+#define IRC_LINE_MAX    512     // Including the trailing CRLF
+#define NICKLEN         30
+#define CHANNELLEN      50
+#define TOPICLEN        307
+#define MONITOR_MAX     100     // Targets per MONITOR list
+
+// Numeric reply catalogue: X(name, code, trailing text).
+// An empty text means the reply has no fixed trailing part (the caller
+// supplies one, or the reply ends with its last parameter).
+#define IRC_NUMERICS(X) \
+    X(RPL_WELCOME,           "001", "") \
+    X(RPL_YOURHOST,          "002", "") \
+    X(RPL_CREATED,           "003", "") \
+    X(RPL_MYINFO,            "004", "") \
+    X(RPL_ISUPPORT,          "005", "are supported by this server") \
+    X(RPL_STATSCOMMANDS,     "212", "") \
+    X(RPL_ENDOFSTATS,        "219", "End of /STATS report") \
+    X(RPL_STATSUPTIME,       "242", "") \
+    X(RPL_STATSDEBUG,        "249", "") \
+    X(RPL_TRYAGAIN,          "263", "Please wait a while and try again.") \
+    X(RPL_ISON,              "303", "") \
+    X(RPL_WHOISUSER,         "311", "") \
+    X(RPL_WHOISSERVER,       "312", "") \
+    X(RPL_ENDOFWHO,          "315", "End of WHO list") \
+    X(RPL_ENDOFWHOIS,        "318", "End of /WHOIS list") \
+    X(RPL_WHOISCHANNELS,     "319", "") \
+    X(RPL_LISTSTART,         "321", "Users  Name") \
+    X(RPL_LIST,              "322", "") \
+    X(RPL_LISTEND,           "323", "End of /LIST") \
+    X(RPL_CHANNELMODEIS,     "324", "") \
+    X(RPL_NOTOPIC,           "331", "No topic is set") \
+    X(RPL_TOPIC,             "332", "") \
+    X(RPL_INVITELIST,        "346", "") \
+    X(RPL_ENDOFINVITELIST,   "347", "End of channel invite exception list") \
+    X(RPL_EXCEPTLIST,        "348", "") \
+    X(RPL_ENDOFEXCEPTLIST,   "349", "End of channel exception list") \
+    X(RPL_WHOREPLY,          "352", "") \
+    X(RPL_NAMREPLY,          "353", "") \
+    X(RPL_ENDOFNAMES,        "366", "End of /NAMES list") \
+    X(RPL_BANLIST,           "367", "") \
+    X(RPL_ENDOFBANLIST,      "368", "End of channel ban list") \
+    X(RPL_MOTD,              "372", "") \
+    X(RPL_MOTDSTART,         "375", "") \
+    X(RPL_ENDOFMOTD,         "376", "End of /MOTD command") \
+    X(RPL_YOUREOPER,         "381", "You are now an IRC operator") \
+    X(ERR_NOSUCHNICK,        "401", "No such nick/channel") \
+    X(ERR_NOSUCHCHANNEL,     "403", "No such channel") \
+    X(ERR_CANNOTSENDTOCHAN,  "404", "Cannot send to channel") \
+    X(ERR_INVALIDCAPCMD,     "410", "Invalid CAP command") \
+    X(ERR_NORECIPIENT,       "411", "No recipient given") \
+    X(ERR_NOTEXTTOSEND,      "412", "No text to send") \
+    X(ERR_UNKNOWNCOMMAND,    "421", "Unknown command") \
+    X(ERR_NOMOTD,            "422", "MOTD File is missing") \
+    X(ERR_NONICKNAMEGIVEN,   "431", "No nickname given") \
+    X(ERR_ERRONEUSNICKNAME,  "432", "Erroneous nickname") \
+    X(ERR_NICKNAMEINUSE,     "433", "Nickname is already in use") \
+    X(ERR_USERNOTINCHANNEL,  "441", "They aren't on that channel") \
+    X(ERR_NOTONCHANNEL,      "442", "You're not on that channel") \
+    X(ERR_USERONCHANNEL,     "443", "is already on channel") \
+    X(ERR_NOTREGISTERED,     "451", "You have not registered") \
+    X(ERR_NEEDMOREPARAMS,    "461", "Not enough parameters") \
+    X(ERR_ALREADYREGISTRED,  "462", "You may not reregister") \
+    X(ERR_PASSWDMISMATCH,    "464", "Password incorrect") \
+    X(ERR_UNKNOWNMODE,       "472", "is unknown mode char to me") \
+    X(ERR_INVITEONLYCHAN,    "473", "Cannot join channel (+i)") \
+    X(ERR_BANNEDFROMCHAN,    "474", "Cannot join channel (+b)") \
+    X(ERR_BANLISTFULL,       "478", "Channel list is full") \
+    X(ERR_NOPRIVILEGES,      "481", "Permission Denied- You're not an IRC operator") \
+    X(ERR_CHANOPRIVSNEEDED,  "482", "You're not channel operator") \
+    X(ERR_NOOPERHOST,        "491", "No O-lines for your host") \
+    X(RPL_MONONLINE,         "730", "") \
+    X(RPL_MONOFFLINE,        "731", "") \
+    X(RPL_MONLIST,           "732", "") \
+    X(RPL_ENDOFMONLIST,      "733", "End of MONITOR list") \
+    X(ERR_MONLISTFULL,       "734", "Monitor list is full")
+
+#define IRC_NUMERIC_ENUM(name, code, text) name,
+enum Numeric {
+    IRC_NUMERICS(IRC_NUMERIC_ENUM)
+    NUMERIC_COUNT
+};
+#undef IRC_NUMERIC_ENUM
+
+// Builds ":server <code> <target> [params...] [:text]\r\n" straight into
+// the destination buffer. The final length is computed up front so each
+// reply costs one reserve and a handful of appends, no temporaries.
+namespace Reply {
+    void append(std::string& out, Numeric id, const std::string& target);
+    void append(std::string& out, Numeric id, const std::string& target,
+                const std::string& p1);
+    void append(std::string& out, Numeric id, const std::string& target,
+                const std::string& p1, const std::string& p2);
+
+    // Same as append() but with a caller-supplied trailing text in place
+    // of the catalogue's (used for topics, NAMES lists, welcome lines...).
+    void appendText(std::string& out, Numeric id, const std::string& target,
+                    const std::string& text);
+    void appendText(std::string& out, Numeric id, const std::string& target,
+                    const std::string& p1, const std::string& text);
+    void appendText(std::string& out, Numeric id, const std::string& target,
+                    const std::string& p1, const std::string& p2, const std::string& text);
+
+    // Any number of middle parameters (WHO/WHOIS lines)
+    void appendList(std::string& out, Numeric id, const std::string& target,
+                    const std::string* const* params, size_t count, const std::string& text);
+}
+
+// A block of reply lines rendered once with a placeholder where the
+// recipient's nick goes, so per-client output is a few memcpy's.
+class ReplyTemplate {
+private:
+    std::vector<std::string> _parts;    // Literal text between nick slots
+    size_t _fixedSize;
+
+public:
+    ReplyTemplate();
+
+    // Placeholder to pass as the target/params while rendering the lines
+    static const std::string& nickSlot();
+
+    // Take a block rendered with nickSlot() and split it around the slots
+    void assign(const std::string& rendered);
+    void render(std::string& out, const std::string& nick) const;
+    bool empty() const;
+};
+
+#endif // REPLIES_HPP
@@ -0,0 +1,24 @@
+#ifndef REPLYSTREAM_HPP
+#define REPLYSTREAM_HPP
+
+#include <cstddef>
+
+class Server;
+class Client;
+
+// Output chunk handed to a stream each time the client's buffer drains
+// below STREAM_LOW_WATER, so long replies never sit in memory in full.
+#define STREAM_CHUNK_BYTES  8192
+#define STREAM_LOW_WATER    8192
+
+// A long reply (LIST, WHO...) that is produced a slice at a time.
+class ReplyStream {
+public:
+    virtual ~ReplyStream() {}
+
+    // Append roughly `budget` bytes of replies to the client's output
+    // buffer. Returns true once the reply is complete.
+    virtual bool fill(Server& server, Client& client, size_t budget) = 0;
+};
+
+#endif // REPLYSTREAM_HPP
@@ -0,0 +1,27 @@
+#ifndef SCAN_HPP
+#define SCAN_HPP
+
+#include <cstddef>
+
+// Byte kernels behind input framing, line validation and case folding.
+// Each has a scalar version and, on x86 with GCC or Clang, SSE2 and
+// AVX2 ones; the best the CPU supports is picked at startup, and
+// IRCSERV_SIMD=scalar|sse2|avx2 pins one (it can only step down).
+namespace Scan {
+    struct Line {
+        size_t end;         // First '\n', or the length if there is none
+        size_t bad;         // First NUL or CR, or the length; may lie past `end`
+    };
+
+    // One pass finding both, stopping at the block holding the '\n'
+    Line scanLine(const char* data, size_t len);
+
+    // In place: a-z to A-Z (command names), and the RFC 1459 mapping
+    // A-Z [\]^ to a-z {|}~ (nicks and channel names)
+    void foldUpper(char* data, size_t len);
+    void foldIrc(char* data, size_t len);
+
+    const char* implementation();       // "avx2", "sse2" or "scalar"
+}
+
+#endif // SCAN_HPP
@@ -0,0 +1,49 @@
+#ifndef SCRATCH_HPP
+#define SCRATCH_HPP
+
+#include <string>
+#include <deque>
+#include <cstddef>
+
+#define SCRATCH_KEEP_BYTES  (64 * 1024)     // Bigger strings are freed at reset()
+
+// Strings for work that is over by the end of the event loop pass: a
+// line being dispatched, its command and parameters, lookup keys and
+// replies being assembled. Taking one moves a cursor forward; release()
+// and reset() move it back, and every string keeps its capacity, so once
+// the pool has warmed up the common commands reach the heap only for
+// what they store. std::string cannot draw from a bump arena without
+// changing its type everywhere, hence whole strings rather than bytes.
+class Scratch {
+private:
+    std::deque<std::string> _strings;   // A deque never copies (and so shrinks) the others as it grows
+    size_t _used;
+    size_t _highWater;
+
+public:
+    Scratch();
+
+    std::string& string();              // Empty; valid until released
+    size_t mark() const;
+    void release(size_t mark);          // Everything taken since mark() goes back
+
+    void reset();                       // Once per pass
+    size_t highWater() const;           // Most strings in use at once
+
+    // Gives back, when it goes out of scope, what was taken after it was
+    // made; a function using scratch strings declares one first
+    class Scope {
+    private:
+        Scratch& _scratch;
+        size_t _mark;
+
+        Scope(const Scope&);
+        Scope& operator=(const Scope&);
+
+    public:
+        explicit Scope(Scratch& scratch) : _scratch(scratch), _mark(scratch.mark()) {}
+        ~Scope() { _scratch.release(_mark); }
+    };
+};
+
+#endif // SCRATCH_HPP
@@ -3,6 +3,9 @@
 
 #include <string>
 #include <vector>
+#include <map>
+#include <set>
+#include <deque>
 #include <iostream>
 #include <sys/socket.h>
 #include <netinet/in.h>
@@ -12,6 +15,20 @@
 #include <poll.h>
 #include "Client.hpp"
 #include "Channel.hpp"
+#include "Replies.hpp"
+#include "Motd.hpp"
+#include "ReplyStream.hpp"
+#include "Utils.hpp"
+#include "MessageLog.hpp"
+#include "Snapshot.hpp"
+#include "Link.hpp"
+#include "Message.hpp"
+#include "PluginManager.hpp"
+#include "Metrics.hpp"
+#include "LoadMonitor.hpp"
+#include "Capture.hpp"
+#include "Clock.hpp"
+#include "Scratch.hpp"
 
 #define RESET   "\033[0m"
 #define BOLD    "\033[1m"
@@ -32,20 +49,148 @@
 #define BG_CYAN    "\033[46m"
 
 
+#define POLL_TIMEOUT_MS     1000    // Upper bound between runTimers() calls
+#define DRAIN_TIMEOUT       5       // Seconds SIGTERM/SIGINT waits for output to flush
+#define UPGRADE_TIMEOUT_MS  10000   // How long a hot upgrade waits for the new process
+#define SERVER_SID          "0AA"   // This server's ID on a linked network (IRCSERV_SID overrides)
+#define VIRTUAL_FD_BASE     (1 << 28)   // Keys of attachVirtual() clients; no real fd gets this high
+#define IDLE_CLIENT_TARGET_BYTES    1024    // Budget per idle registered connection (STATS Z)
+
 // Forward declarations
 class Client;
 
+// Connected clients by fd. Clients are heap-allocated so the Client*
+// held by channels and indexes stays valid while others come and go.
+typedef std::map<int, Client*> ClientMap;
+typedef std::map<std::string, Client*> NickIndex;        // ircCaseFold(nick) -> client
+typedef std::multimap<std::string, Client*> HostIndex;   // host/IP -> clients
+typedef std::multimap<std::string, Client*> NameIndex;   // ircCaseFold(username and realname) -> clients
+typedef std::map<std::string, std::set<Client*> > WatcherIndex;   // ircCaseFold(nick) -> MONITOR watchers
+typedef std::map<std::string, Client*> UidIndex;         // UID -> every user on the network, local or remote
+typedef std::map<int, Link*> LinkMap;                    // Server links by fd
+typedef std::map<std::string, RemoteServer> ServerMap;   // SID -> servers behind our links
+
 class Server {
 private:
     int _port;                            // Port to listen on
     std::string _password;               // Password for clients to connect (authentication)
     int _serverSocket;                   // Main server socket file descriptor
+    int _unixSocket;                     // Local listener (IRCSERV_UNIX_SOCKET), -1 when off
+    std::string _unixPath;
+    std::set<uid_t> _unixTrusted;        // Peer uids authenticated without PASS
+    int _adminSocket;                    // Metrics endpoint (IRCSERV_ADMIN_SOCKET), -1 when off
+    std::string _adminPath;
+    std::map<int, AdminRequest> _adminConns;
 
-    std::vector<Client> _clients;        // List of all connected clients
+    ClientMap _clients;                  // All connected clients, by fd
+    NickIndex _nickIndex;                // Nick lookups and WHO nick-prefix scans
+    HostIndex _hostIndex;                // WHO host/IP-prefix scans
+    NameIndex _nameIndex;                // WHO username/realname-prefix scans
+    WatcherIndex _watchers;              // Presence changes notify only these
+    UidIndex _uidIndex;                  // Owns remote users (fd -1); local ones are owned by _clients
     std::vector<pollfd> _pollfds;        // List of pollfd structs used to monitor file descriptors (server + clients)
-    std::vector<Channel> _channels;      // List of channels (not used yet, but can be added later)
+    std::vector<int> _pollIndex;         // fd -> its slot in _pollfds, -1 if not polled
+    ChannelMap _channels;                // All channels, keyed by ircCaseFold(name)
+    std::map<int, std::deque<ReplyStream*> > _streams;  // Pending long replies per client fd
     bool _running;                       // Indicates if server is running
 
+    ReplyTemplate _welcomeBurst;         // 001-005, rendered once at startup
+    Motd _motd;                          // 375/372/376 block, reloaded on file change
+    size_t _joinReplay;                  // History lines replayed on JOIN
+    MessageLog _messageLog;              // Durable copy of every channel message
+    Snapshot _snapshot;                  // Channel state saved for restarts
+    Capture _capture;                    // Client input recorded for replay (IRCSERV_CAPTURE)
+    std::string _executable;             // Re-exec'd by a hot upgrade (SIGUSR2)
+    bool _draining;                      // Shutting down, flushing output
+    time_t _drainDeadline;
+    time_t _restoreDeadline;             // Unclaimed restored channels go then; 0 = none
+    bool _handedOff;                     // A hot upgrade took over our sockets
+
+    // Server linking (Linking.cpp)
+    std::string _sid;                    // Our server ID, prefix of every local UID
+    std::string _linkPassword;           // Shared by all links; linking is off while empty
+    std::string _description;
+    unsigned long _nextUid;
+    LinkMap _links;
+    ServerMap _servers;
+    std::vector<LinkTarget> _linkTargets;   // IRCSERV_LINKS autoconnect list
+
+    PluginManager _plugins;              // In-process services (IRCSERV_PLUGINS)
+    const Message* _currentMessage;      // Line being dispatched, parsed for plugins; NULL without them
+    Message _parsed;                     // What _currentMessage points at, reused line after line
+    Scratch _scratch;                    // Temporary strings, reset every event loop pass
+
+    Metrics _metrics;
+    LoadMonitor _load;                   // Event loop lag; overload mode sheds expensive work
+    time_t _startTime;
+    std::map<std::string, std::string> _opers;  // OPER name -> password (IRCSERV_OPERS)
+    int _nextVirtualFd;
+
+    void buildWelcomeBurst();
+    void configure();
+    void openStorage(bool resumed);
+    void expireRestoredChannels();
+    Client* addClient(int fd, const std::string& ip);
+    void consumeInput(int fd, const char* data, size_t len);
+
+    void configureLinks();
+    std::string nextUid();
+    Link* findLink(int fd);
+    void connectLinks();
+    void checkLinks();
+    void acceptLink(Client* client, const std::string& line);
+    void activateLink(Link* link);
+    void handleLinkInput(Link* link);
+    void handleLinkOutput(Link* link);
+    void drainLinkInput(int fd);
+    void dropLink(Link* link, const std::string& reason);
+    void closeLinks(const std::string& reason);
+    void processLinkMessage(Link* link, const std::string& line);
+    void sendBurst(Link* link);
+    bool fromLink(Link* link, const std::string& source);
+    Link* routeOf(const Client* user) const;
+    std::string sourcePrefix(const std::string& source);
+    std::string uidLine(const Client* user) const;
+    void removeServers(const std::set<std::string>& sids, const std::string& reason);
+    void removeRemoteUser(Client* user, const std::string& reason);
+    void killUser(Client* user, const std::string& reason, Link* except);
+    std::string applyModes(Channel& channel, const std::string& modes, const std::vector<std::string>& args,
+                           size_t next, const std::string& setBy, std::string& appliedArgs);
+    void resetChannelModes(Channel& channel);
+    void linkServer(Link* link, const Message& msg);
+    void linkSid(Link* link, const Message& msg, const std::string& line);
+    void linkUid(Link* link, const Message& msg, const std::string& line);
+    void linkSjoin(Link* link, const Message& msg, const std::string& line);
+    void linkPart(Link* link, const Message& msg, const std::string& line);
+    void linkKick(Link* link, const Message& msg, const std::string& line);
+    void linkTmode(Link* link, const Message& msg, const std::string& line);
+    void linkBmask(Link* link, const Message& msg, const std::string& line);
+    void linkTopic(Link* link, const Message& msg, const std::string& line);
+    void linkPrivmsg(Link* link, const Message& msg, const std::string& line);
+    void linkNick(Link* link, const Message& msg, const std::string& line);
+    void linkQuit(Link* link, const Message& msg, const std::string& line);
+    void linkSquit(Link* link, const Message& msg, const std::string& line);
+
+    // Local AF_UNIX listener (LocalSocket.cpp)
+    void configureUnixSocket();
+    void setupUnixSocket();
+    void closeUnixSocket(bool unlinkPaths);
+    void acceptUnixClient();
+    void acceptAdmin();
+    void handleAdmin(int fd, short revents);
+    void closeAdmin(int fd);
+    void checkAdmin();
+    void renderMetrics(std::string& out) const;
+
+    // Hot upgrade and graceful shutdown (Upgrade.cpp)
+    std::string serialiseState(std::vector<int>& fds) const;
+    bool restoreState(const std::string& state, const std::vector<int>& fds);
+    bool resumeFromUpgrade(int sock);
+    void hotUpgrade();
+    void beginDrain();
+    bool drained() const;
+    std::vector<std::string> isupportTokens() const;
+
     // Disable copy constructor and assignment (we don’t want accidental copying)
     Server(const Server&);
     Server& operator=(const Server&);
@@ -56,6 +201,17 @@ public:
 
     // Starts the server loop (sets up, listens, and handles connections)
     void start();
+    void setExecutable(const std::string& argv0);  // Binary a hot upgrade runs, made absolute now
+
+    // Embedding (libircserv): the host owns the loop and the clients,
+    // and may stop the clock (Clock::setManual) to step timeouts itself
+    void embed();                                   // Set up without listening
+    bool runOnce(int timeoutMs);                    // One loop turn; false once stopped
+    Client* attach(int fd, const std::string& host);        // Connected socket, e.g. a socketpair end
+    Client* attachVirtual(const std::string& host);         // In-memory client, no fd
+    void deliver(Client* client, const char* data, size_t len);    // Input as if recv()'d
+    std::string takeOutput(Client* client);                 // Drains what would be sent
+    void detach(Client* client, const std::string& reason);
 
     // Socket setup helpers
     void setupSocket();                  // Create and configure the server socket
@@ -63,16 +219,30 @@ public:
     void listenSocket();                 // Put server socket into listening mode
 
     // Event handling
-    void handleEvents();                 // Main polling loop to check for activity
+    void handleEvents(int timeoutMs = POLL_TIMEOUT_MS);     // Main polling loop to check for activity
+    void runTimers();                    // Snapshots and other periodic work
     void acceptClient();                 // Accept new client connection
+    Client* adoptClient(int fd, const std::string& ip);    // Register a connected socket
     void handleClientMessage(int fd);    // Handle message received from client
-    void handleClientDisconnect(int fd); // Handle client disconnecting
+    void handleClientDisconnect(int fd, const std::string& reason = "Client disconnected"); // Handle client disconnecting
 
     // Utilities
     void setNonBlocking(int fd);         // Set a file descriptor to non-blocking mode
     void sendToClient(int fd, const std::string& message); // Send data to a client
 
+    // Numeric replies, written straight into the client's output buffer
+    void sendNumeric(Client* client, Numeric id);
+    void sendNumeric(Client* client, Numeric id, const std::string& p1);
+    void sendNumeric(Client* client, Numeric id, const std::string& p1, const std::string& p2);
+    void sendNumericText(Client* client, Numeric id, const std::string& text);
+    void sendNumericText(Client* client, Numeric id, const std::string& p1, const std::string& text);
+
     //event management hahaha
+    void watchFd(int fd, short events);
+    void forgetPollfd(int fd);
+    bool isPolled(int fd) const;
+    bool isIdle(const Client* client) const;
+    size_t connectionMemory(const Client* client) const;
     void enableWriteEvent(int fd);
     void disableWriteEvent(int fd);
 
@@ -80,21 +250,60 @@ public:
     // fin the client by their file desccriptor 
     Client* getClientByFd(int fd);
     Client *getClientByNickname(const std::string& nickname);
+    Client* getClientByUid(const std::string& uid);
+    Channel* findChannel(const std::string& name);
+    const ChannelMap& getChannels() const;
+    const ClientMap& getClients() const;
+    const UidIndex& getUsers() const;
+
+    // Long replies produced incrementally as the client's socket drains
+    void startStream(Client* client, ReplyStream* stream);
+    void pumpStreams(Client* client);
+    void dropStreams(int fd);
 
     //auth commands
     void processCommand(Client* client, const std::string& message);
+    void dispatchCommand(Client* client, const std::string& message);
     void handlePass(Client* client, const std::string& params);
     void handleNick(Client* client, const std::string& params);
     void handleUser(Client* client, const std::string& params);
     bool isClientRegistered(Client* client);  // Helper to check if a client has completed registration
+    void sendMotd(Client* client);
     void handleJoin(Client* client, const std::string& channelNameRaw);
     void handlePart(Client* client, const std::string& channelNameRaw, const std::string& partMessage);
     void handleTopic(Client* client, const std::string& channelNameRaw);
     void handleMode(Client* client, const std::string& channelNameRaw);
     void handleKick(Client* client, const std::string& channelNameRaw);
     void handlePrivmsg(Client* client, const std::string& channelNameRaw, const std::string& message);
+    void handleNames(Client* client, const std::string& params);
+    void handleList(Client* client, const std::string& params);
+    void handleWho(Client* client, const std::string& params);
+    void handleWhois(Client* client, const std::string& params);
+    void sendNames(Client* client, const Channel& channel);   // 353 lines from the channel cache + 366
+    void sendMaskList(Client* client, const Channel& channel, Channel::ListMode list);  // 367/348/346 + end
+    void removeClientFromChannels(Client* client, const std::string& reason);   // Drop a leaving client from every channel
+    void unindexClient(Client* client);                       // Forget a departing user's nick/host/UID
+    void setNames(Client* client, const std::string& username, const std::string& realname);  // And index them
+    void unindexNames(Client* client);
+    void sendToLocalMembers(const Channel& channel, const std::string& line, Client* except);
+    void sendToCommonChannels(Client* user, const std::string& line);   // Each local channel peer once
+    void sendToLinks(const std::string& line, Link* except);
+    void relayToChannelLinks(const Channel& channel, const std::string& line, Link* except);
+    void relayJoin(const Channel& channel, Client* client);
+    void handleMonitor(Client* client, const std::string& params);
+    void handleIson(Client* client, const std::string& params);
+    void notifyWatchers(const std::string& nick, Numeric id, const std::string& item);  // 730/731 to watchers of nick
+    void unwatchAll(Client* client);                          // Drop a client's MONITOR list from the index
+    void sendNickList(Client* client, Numeric id, const std::vector<std::string>& items);   // Comma lists split per line
+    void handleCap(Client* client, const std::string& params);
+    void handleChatHistory(Client* client, const std::string& params);
+    void handleOper(Client* client, const std::string& params);
+    void handleStats(Client* client, const std::string& params);
+    bool shedCommand(Client* client, const std::string& command);
+    void sendHistoryLine(Client* client, const HistoryEntry& entry);
 };
 
 int countArguments(const std::string& params);
+bool isValidNickname(const std::string& nickname);
 
 #endif // SERVER_HPP
@@ -0,0 +1,55 @@
+#ifndef SNAPSHOT_HPP
+#define SNAPSHOT_HPP
+
+#include <string>
+#include <ctime>
+#include <sys/types.h>
+#include "Channel.hpp"
+#include "Binary.hpp"
+
+#define SNAPSHOT_INTERVAL   300                 // Seconds; IRCSERV_SNAPSHOT_INTERVAL overrides, 0 = on demand only
+#define SNAPSHOT_GRACE      600                 // Seconds restored channels wait for their members
+
+// Channel state (topics, modes, key, mask lists, operators) saved to a
+// compact binary file. Saving forks: the child serialises its
+// copy-on-write view of the channels and renames the result into
+// place, so the event loop only pays for the fork itself. Loading maps
+// the file and rebuilds the channels in one pass. The child runs next to
+// the message log's writer thread, whose mutex may be held at the fork:
+// it only serialises channels and writes its file, and leaves through
+// _exit() so no destructor or stdio flush runs there.
+class Snapshot {
+private:
+    std::string _path;
+    time_t _interval;
+    time_t _lastStart;
+    pid_t _child;           // Running writer, -1 if none
+
+public:
+    Snapshot();
+
+    // Reads IRCSERV_SNAPSHOT / IRCSERV_SNAPSHOT_INTERVAL; off unless
+    // IRCSERV_SNAPSHOT names a file
+    void configure();
+    bool enabled() const;
+    bool due(time_t now) const;         // Periodic snapshot is owed
+    bool running() const;
+
+    // Fork a writer; false if one is still running or fork failed
+    bool start(const ChannelMap& channels);
+    // Collect a finished writer, if any
+    void reap();
+    // Block until the running writer (if any) is done
+    void wait();
+
+    // Add the saved channels to `channels`; returns how many were restored
+    size_t load(ChannelMap& channels) const;
+
+    const std::string& path() const;
+};
+
+// One channel's persistent state (no members), shared with hot upgrade
+void serialiseChannel(std::string& out, const Channel& channel);
+Channel parseChannel(Binary::Reader& in);
+
+#endif // SNAPSHOT_HPP
@@ -0,0 +1,28 @@
+#ifndef UTILS_HPP
+#define UTILS_HPP
+
+#include <string>
+
+// RFC 1459 case mapping: A-Z plus [\]^ fold to a-z and {|}~
+char ircToLower(char c);
+std::string ircCaseFold(const std::string& str);
+void ircCaseFold(const std::string& str, std::string& folded);     // Into a caller's string
+bool ircEquals(const std::string& a, const std::string& b);
+bool ircEqualsN(const std::string& a, const std::string& b, size_t n);   // First n chars
+
+// Glob match ('*' and '?') under RFC 1459 case folding
+bool matchMask(const std::string& mask, const std::string& str);
+
+std::string toString(unsigned long value);
+
+// The next whitespace-separated word of `text` from `pos` on, as
+// istringstream >> would read it, into `word`; false once none is left
+bool nextWord(const std::string& text, size_t& pos, std::string& word);
+
+// Memory accounting estimates (STATS Z, metrics): a std::set/std::map
+// node's bookkeeping beyond its value, and what a string keeps on the
+// heap, which is nothing when it is short enough to be stored inline
+#define TREE_NODE_BYTES (4 * sizeof(void*))
+size_t stringHeapBytes(const std::string& str);
+
+#endif // UTILS_HPP
@@ -0,0 +1,33 @@
+#ifndef WHOSTREAM_HPP
+#define WHOSTREAM_HPP
+
+#include <string>
+#include <vector>
+#include "ReplyStream.hpp"
+
+// WHO results, sent in bounded slices. Indexed queries (channel members,
+// nick/host prefix lookups) hand over the matching UIDs up front; masks
+// with a leading wildcard fall back to walking every user, local or
+// remote, by UID cursor.
+class WhoStream : public ReplyStream {
+private:
+    std::string _mask;          // As given, echoed in 315
+    std::string _channelKey;    // Folded channel name for the channel form
+    std::vector<std::string> _uids;     // Pre-selected candidates (indexed forms)
+    size_t _next;
+    bool _scan;                 // Full walk over every user
+    std::string _scanCursor;    // Last UID examined
+
+public:
+    // Candidates already selected through an index
+    WhoStream(const std::string& mask, const std::string& channelKey, const std::vector<std::string>& uids);
+    // Full scan of all clients against mask
+    explicit WhoStream(const std::string& mask);
+
+    virtual bool fill(Server& server, Client& client, size_t budget);
+};
+
+// Does a WHO mask select this client (nick, user, host or realname)?
+bool whoMatches(const std::string& mask, const Client& target);
+
+#endif // WHOSTREAM_HPP
@@ -22,6 +22,7 @@ int main(int argc, char **argv) {
         }
         
         Server server(argv[1], argv[2]);
+        server.setExecutable(argv[0]);
         server.start();
     } catch (const std::exception& e) {
         std::cerr << RED << "Error: " << e.what() << RESET << std::endl;
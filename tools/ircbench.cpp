@@ -0,0 +1,680 @@
+// ircbench: end-to-end load generator for ircserv over loopback.
+//
+//   ircbench [-s ./ircserv] [-h host] [-p port] [-w password] [-c clients]
+//            [-m messages] [-r rate] [-C connecting] [-t scenario,...]
+//
+// -s starts the given server on the port first (persistence and overload
+// shedding off unless the environment says otherwise) and stops it at
+// the end. Scenarios, all by default:
+//   register   every client connects and registers at once
+//   fanout     everyone in one channel, FANOUT_SENDERS of them talking
+//   channels   channels of CHANNEL_SIZE members, everyone talking
+//   mesh       two-member channels with the next MESH_PEERS clients
+//              (PRIVMSG only reaches channels), everyone talking
+//   slow       fanout where every SLOW_EVERY-th member reads a trickle
+// Each message carries its send time, so latency is measured per line
+// delivered (the server echoes channel messages to the sender too).
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+namespace {
+
+const size_t FANOUT_SENDERS = 10;
+const size_t CHANNEL_SIZE = 5;
+const size_t MESH_PEERS = 2;
+const size_t SLOW_EVERY = 10;
+const size_t SLOW_READ_BYTES = 512;             // Per SLOW_READ_INTERVAL_US
+const uint64_t SLOW_READ_INTERVAL_US = 100000;
+const uint64_t IDLE_TIMEOUT_US = 10000000;      // A phase gives up after this long without progress
+const int SETTLE_TIMEOUT_MS = 300000;           // Longest wait for the server to finish a teardown
+const size_t MESSAGE_BYTES = 80;                // PRIVMSG text, timestamp included
+const size_t SEND_AHEAD = 4096;                 // Unsent bytes a talker may have queued
+
+struct Options {
+    const char* server;
+    std::string host;
+    std::string port;
+    std::string password;
+    size_t clients;
+    size_t messages;            // Per talking client
+    size_t rate;                // Messages/s across all talkers, 0 = as fast as possible
+    size_t connecting;          // Connection attempts in flight
+    std::vector<std::string> scenarios;
+};
+
+struct Bot {
+    int fd;
+    std::string nick;
+    std::string in;
+    std::string out;
+    bool connected;             // connect() finished and registration sent
+    bool registered;
+    bool slow;
+    uint64_t started;           // connect() called
+    uint64_t nextRead;          // Slow readers only
+    std::vector<std::string> channels;
+    size_t talkTo;              // Next of `channels` to message
+    size_t toSend;
+};
+
+struct Result {
+    std::string scenario;
+    size_t clients;
+    double connRate;            // Per second, 0 when not measured
+    double messageRate;
+    std::vector<uint32_t> latency;
+    size_t lost;
+    size_t refused;
+};
+
+uint64_t nowUs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+std::string toString(uint64_t value) {
+    std::ostringstream oss;
+    oss << value;
+    return oss.str();
+}
+
+std::vector<std::string> splitList(const std::string& text) {
+    std::vector<std::string> items;
+    std::istringstream iss(text);
+    std::string item;
+    while (std::getline(iss, item, ','))
+        if (!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+uint32_t percentile(const std::vector<uint32_t>& sorted, double q) {
+    if (sorted.empty())
+        return 0;
+    return sorted[static_cast<size_t>(q * (sorted.size() - 1))];
+}
+
+class Bench {
+private:
+    const Options& _opt;
+    struct sockaddr_storage _addr;
+    socklen_t _addrLen;
+    std::vector<Bot> _bots;
+    size_t _nextConnect;
+    size_t _inFlight;
+
+    // Phase progress
+    size_t _registered;
+    size_t _refused;
+    size_t _joined;
+    size_t _delivered;          // To fast readers
+    size_t _sent;
+    bool _recordRegistration;
+    uint64_t _sendStart;
+    std::vector<uint32_t> _latency;
+
+    void startConnects();
+    void feed();
+    void queueMessage(Bot& bot);
+    void flush(Bot& bot);
+    void receive(Bot& bot);
+    void handleLine(Bot& bot, const std::string& line);
+    void kill(Bot& bot);
+    void pump();
+    bool waitFor(const size_t& counter, size_t target);
+    size_t activity() const { return _registered + _refused + _joined + _delivered + _sent; }
+
+    void reset(size_t count, const std::string& tag);
+    bool registerAll(Result& result);
+    void join(size_t bot, const std::string& channel);
+    void talk(Result& result, size_t expected);
+    void closeAll();
+    void settle();
+
+public:
+    explicit Bench(const Options& opt);
+    Result run(const std::string& scenario);
+};
+
+Bench::Bench(const Options& opt)
+    : _opt(opt), _addrLen(0), _nextConnect(0), _inFlight(0), _registered(0), _refused(0), _joined(0),
+      _delivered(0), _sent(0), _recordRegistration(false), _sendStart(0) {
+    struct addrinfo hints;
+    struct addrinfo* info = NULL;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_socktype = SOCK_STREAM;
+    if (getaddrinfo(opt.host.c_str(), opt.port.c_str(), &hints, &info) != 0 || !info) {
+        std::cerr << "ircbench: cannot resolve " << opt.host << ":" << opt.port << std::endl;
+        std::exit(1);
+    }
+    std::memcpy(&_addr, info->ai_addr, info->ai_addrlen);
+    _addrLen = info->ai_addrlen;
+    freeaddrinfo(info);
+}
+
+// Bots are created unconnected; pump() connects them, at most
+// _opt.connecting at a time
+void Bench::reset(size_t count, const std::string& tag) {
+    _bots.assign(count, Bot());
+    for (size_t i = 0; i < count; ++i) {
+        _bots[i].fd = -1;
+        _bots[i].nick = tag + toString(i);
+        _bots[i].connected = false;
+        _bots[i].registered = false;
+        _bots[i].slow = false;
+        _bots[i].started = 0;
+        _bots[i].nextRead = 0;
+        _bots[i].talkTo = 0;
+        _bots[i].toSend = 0;
+    }
+    _nextConnect = 0;
+    _inFlight = 0;
+    _registered = _refused = _joined = _delivered = _sent = 0;
+    _recordRegistration = false;
+    _latency.clear();
+}
+
+void Bench::startConnects() {
+    while (_nextConnect < _bots.size() && _inFlight < _opt.connecting) {
+        Bot& bot = _bots[_nextConnect++];
+        bot.fd = socket(_addr.ss_family, SOCK_STREAM, 0);
+        if (bot.fd == -1) {
+            std::cerr << "ircbench: socket: " << strerror(errno) << std::endl;
+            std::exit(1);
+        }
+        fcntl(bot.fd, F_SETFL, O_NONBLOCK);
+        int one = 1;
+        setsockopt(bot.fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        bot.started = nowUs();
+        ++_inFlight;
+        if (connect(bot.fd, (struct sockaddr*)&_addr, _addrLen) == -1 && errno != EINPROGRESS) {
+            kill(bot);
+            ++_refused;
+        }
+    }
+}
+
+void Bench::kill(Bot& bot) {
+    if (bot.fd == -1)
+        return;
+    close(bot.fd);
+    bot.fd = -1;
+    if (!bot.registered)
+        --_inFlight;        // Still counted as connecting
+}
+
+// Talkers queue one message each per round, paced by -r if given
+void Bench::feed() {
+    size_t budget = static_cast<size_t>(-1);
+    if (_opt.rate && _sendStart) {
+        size_t due = (nowUs() - _sendStart) * _opt.rate / 1000000 + 1;
+        budget = due > _sent ? due - _sent : 0;
+    }
+    for (size_t i = 0; i < _bots.size() && budget; ++i) {
+        Bot& bot = _bots[i];
+        if (bot.toSend && bot.fd != -1 && bot.out.size() < SEND_AHEAD) {
+            queueMessage(bot);
+            flush(bot);
+            --budget;
+        }
+    }
+}
+
+void Bench::queueMessage(Bot& bot) {
+    const std::string& channel = bot.channels[bot.talkTo++ % bot.channels.size()];
+    std::string text = "bench " + toString(nowUs()) + " ";
+    text.append(MESSAGE_BYTES > text.size() ? MESSAGE_BYTES - text.size() : 0, 'x');
+    bot.out.append("PRIVMSG ").append(channel).append(" :").append(text).append("\r\n");
+    --bot.toSend;
+    ++_sent;
+}
+
+void Bench::flush(Bot& bot) {
+    if (bot.fd == -1 || bot.out.empty())
+        return;
+    ssize_t n = send(bot.fd, bot.out.data(), bot.out.size(), 0);
+    if (n > 0)
+        bot.out.erase(0, n);
+    else if (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK)
+        kill(bot);
+}
+
+void Bench::receive(Bot& bot) {
+    char buffer[16384];
+    size_t want = sizeof(buffer);
+    if (bot.slow) {
+        want = SLOW_READ_BYTES;
+        bot.nextRead = nowUs() + SLOW_READ_INTERVAL_US;
+    }
+    ssize_t n = recv(bot.fd, buffer, want, 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (n <= 0) {
+        if (!bot.registered)
+            ++_refused;
+        kill(bot);
+        return;
+    }
+    bot.in.append(buffer, n);
+    size_t start = 0;
+    size_t end;
+    while ((end = bot.in.find("\r\n", start)) != std::string::npos) {
+        handleLine(bot, bot.in.substr(start, end - start));
+        start = end + 2;
+    }
+    bot.in.erase(0, start);
+}
+
+void Bench::handleLine(Bot& bot, const std::string& line) {
+    if (line.compare(0, 5, "PING ") == 0) {
+        bot.out.append("PONG ").append(line, 5, std::string::npos).append("\r\n");
+        flush(bot);
+        return;
+    }
+    if (line.compare(0, 6, "ERROR ") == 0) {
+        if (!bot.registered)
+            ++_refused;
+        kill(bot);
+        return;
+    }
+    if (line.empty() || line[0] != ':')
+        return;
+    size_t space = line.find(' ');
+    if (space == std::string::npos)
+        return;
+    size_t end = line.find(' ', space + 1);
+    std::string command = line.substr(space + 1, end == std::string::npos ? std::string::npos : end - space - 1);
+
+    if (command == "001" && !bot.registered) {
+        bot.registered = true;
+        --_inFlight;
+        ++_registered;
+        if (_recordRegistration)
+            _latency.push_back(nowUs() - bot.started);
+    } else if (command == "366") {
+        ++_joined;
+    } else if (command == "PRIVMSG") {
+        size_t text = line.find(" :bench ");
+        if (text == std::string::npos || bot.slow)
+            return;
+        uint64_t sentAt = std::strtoull(line.c_str() + text + 8, NULL, 10);
+        _latency.push_back(nowUs() - sentAt);
+        ++_delivered;
+    }
+}
+
+// One poll() round over every live bot
+void Bench::pump() {
+    startConnects();
+    feed();
+
+    std::vector<pollfd> fds;
+    std::vector<size_t> owners;
+    uint64_t now = nowUs();
+    for (size_t i = 0; i < _bots.size(); ++i) {
+        const Bot& bot = _bots[i];
+        if (bot.fd == -1)
+            continue;
+        pollfd pfd;
+        pfd.fd = bot.fd;
+        pfd.events = (bot.slow && now < bot.nextRead) ? 0 : POLLIN;
+        if (!bot.connected || !bot.out.empty())
+            pfd.events |= POLLOUT;
+        pfd.revents = 0;
+        fds.push_back(pfd);
+        owners.push_back(i);
+    }
+    if (fds.empty()) {
+        usleep(10000);
+        return;
+    }
+    if (poll(&fds[0], fds.size(), 10) <= 0)
+        return;
+
+    for (size_t i = 0; i < fds.size(); ++i) {
+        Bot& bot = _bots[owners[i]];
+        if (!fds[i].revents)
+            continue;
+        if (!bot.connected && (fds[i].revents & (POLLOUT | POLLERR | POLLHUP))) {
+            int error = 0;
+            socklen_t len = sizeof(error);
+            getsockopt(bot.fd, SOL_SOCKET, SO_ERROR, &error, &len);
+            if (error) {
+                kill(bot);
+                ++_refused;
+                continue;
+            }
+            bot.connected = true;
+            bot.out.append("PASS ").append(_opt.password).append("\r\nNICK ").append(bot.nick)
+                   .append("\r\nUSER ").append(bot.nick).append(" 0 * :ircbench\r\n");
+        }
+        if (bot.fd != -1 && (fds[i].revents & POLLOUT))
+            flush(bot);
+        if (bot.fd != -1 && (fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            receive(bot);
+    }
+}
+
+// Pumps until `counter` reaches `target`; false when progress stalls
+bool Bench::waitFor(const size_t& counter, size_t target) {
+    size_t seen = activity();
+    uint64_t lastProgress = nowUs();
+    while (counter < target) {
+        pump();
+        if (activity() != seen) {
+            seen = activity();
+            lastProgress = nowUs();
+        } else if (nowUs() - lastProgress > IDLE_TIMEOUT_US) {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool Bench::registerAll(Result& result) {
+    uint64_t start = nowUs();
+    // Refused clients will never register, so count them as done
+    size_t done = 0;
+    size_t seen = activity();
+    uint64_t lastProgress = start;
+    while ((done = _registered + _refused) < _bots.size()) {
+        pump();
+        if (activity() != seen) {
+            seen = activity();
+            lastProgress = nowUs();
+        } else if (nowUs() - lastProgress > IDLE_TIMEOUT_US) {
+            break;
+        }
+    }
+    uint64_t elapsed = std::max<uint64_t>(nowUs() - start, 1);
+    result.connRate = _registered * 1000000.0 / elapsed;
+    result.refused = _refused;
+    return _registered == _bots.size();
+}
+
+void Bench::join(size_t bot, const std::string& channel) {
+    _bots[bot].out.append("JOIN ").append(channel).append("\r\n");
+    _bots[bot].channels.push_back(channel);
+    flush(_bots[bot]);
+}
+
+void Bench::talk(Result& result, size_t expected) {
+    _latency.clear();
+    _delivered = 0;
+    _sendStart = nowUs();
+    bool complete = waitFor(_delivered, expected);
+    uint64_t elapsed = std::max<uint64_t>(nowUs() - _sendStart, 1);
+    _sendStart = 0;
+    result.messageRate = _delivered * 1000000.0 / elapsed;
+    result.lost = complete ? 0 : expected - _delivered;
+}
+
+void Bench::closeAll() {
+    for (size_t i = 0; i < _bots.size(); ++i)
+        if (_bots[i].fd != -1)
+            close(_bots[i].fd);
+    _bots.clear();
+    settle();
+}
+
+// Hangups (and the QUITs they fan out) are handled before the server
+// gets back to poll(), so a PING answered now means the next scenario
+// starts on an idle server
+void Bench::settle() {
+    int fd = socket(_addr.ss_family, SOCK_STREAM, 0);
+    if (fd == -1 || connect(fd, (struct sockaddr*)&_addr, _addrLen) == -1) {
+        if (fd != -1)
+            close(fd);
+        return;
+    }
+    std::string seen;
+    const char ping[] = "PING settle\r\n";
+    send(fd, ping, sizeof(ping) - 1, 0);
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+    uint64_t deadline = nowUs() + SETTLE_TIMEOUT_MS * 1000ULL;
+    while (seen.find(" PONG ") == std::string::npos && nowUs() < deadline) {
+        char buffer[1024];
+        if (poll(&pfd, 1, 1000) <= 0)
+            continue;
+        ssize_t n = recv(fd, buffer, sizeof(buffer), 0);
+        if (n <= 0)
+            break;
+        seen.append(buffer, n);
+    }
+    close(fd);
+}
+
+Result Bench::run(const std::string& scenario) {
+    Result result;
+    result.scenario = scenario;
+    result.clients = _opt.clients;
+    result.connRate = 0;
+    result.messageRate = 0;
+    result.lost = 0;
+    result.refused = 0;
+
+    reset(_opt.clients, scenario.substr(0, 3));
+    _recordRegistration = scenario == "register";
+    bool registered = registerAll(result);
+    if (scenario == "register" || !registered) {
+        if (!registered)
+            result.lost = _bots.size() - _registered;
+        result.latency.swap(_latency);
+        closeAll();
+        return result;
+    }
+    _latency.clear();
+
+    // Who talks where; `expected` counts lines the fast readers must get
+    size_t n = _bots.size();
+    size_t expected = 0;
+    size_t joins = 0;
+    if (scenario == "fanout" || scenario == "slow") {
+        size_t fast = n;
+        for (size_t i = 0; i < n; ++i) {
+            join(i, "#bench");
+            ++joins;
+            // Talkers are never the slow ones
+            if (scenario == "slow" && i >= FANOUT_SENDERS && i % SLOW_EVERY == SLOW_EVERY - 1) {
+                _bots[i].slow = true;
+                --fast;
+            }
+        }
+        waitFor(_joined, joins);
+        for (size_t i = 0; i < std::min(FANOUT_SENDERS, n); ++i)
+            _bots[i].toSend = _opt.messages;
+        expected = std::min(FANOUT_SENDERS, n) * _opt.messages * fast;
+    } else if (scenario == "channels") {
+        for (size_t i = 0; i < n; ++i) {
+            join(i, "#group" + toString(i / CHANNEL_SIZE));
+            ++joins;
+        }
+        waitFor(_joined, joins);
+        for (size_t i = 0; i < n; ++i) {
+            size_t first = i / CHANNEL_SIZE * CHANNEL_SIZE;
+            _bots[i].toSend = _opt.messages;
+            expected += _opt.messages * (std::min(first + CHANNEL_SIZE, n) - first);
+        }
+    } else if (scenario == "mesh") {
+        // #p<i>_<j>: i talks there, i and j listen
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t k = 1; k <= MESH_PEERS && k < n; ++k) {
+                std::string channel = "#p" + toString(i) + "_" + toString((i + k) % n);
+                join(i, channel);
+                _bots[(i + k) % n].out.append("JOIN ").append(channel).append("\r\n");
+                flush(_bots[(i + k) % n]);
+                joins += 2;
+            }
+        }
+        waitFor(_joined, joins);
+        for (size_t i = 0; i < n; ++i) {
+            _bots[i].toSend = _bots[i].channels.empty() ? 0 : _opt.messages;
+            expected += _bots[i].toSend * 2;
+        }
+    } else {
+        std::cerr << "ircbench: unknown scenario " << scenario << std::endl;
+        std::exit(2);
+    }
+
+    talk(result, expected);
+    result.latency.swap(_latency);
+    closeAll();
+    return result;
+}
+
+// The server under test, with its own output discarded
+pid_t spawnServer(const Options& opt) {
+    pid_t pid = fork();
+    if (pid == -1) {
+        std::cerr << "ircbench: fork: " << strerror(errno) << std::endl;
+        std::exit(1);
+    }
+    if (pid == 0) {
+        setenv("IRCSERV_SNAPSHOT", "", 0);
+        setenv("IRCSERV_LOG_DIR", "", 0);
+        setenv("IRCSERV_OVERLOAD_LAG_MS", "0", 0);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execl(opt.server, opt.server, opt.port.c_str(), opt.password.c_str(), (char*)NULL);
+        _exit(127);
+    }
+
+    // Ready once it accepts a connection
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        usleep(50000);
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid) {
+            std::cerr << "ircbench: " << opt.server << " exited during startup" << std::endl;
+            std::exit(1);
+        }
+        struct addrinfo hints;
+        struct addrinfo* info = NULL;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(opt.host.c_str(), opt.port.c_str(), &hints, &info) != 0 || !info)
+            break;
+        int fd = socket(info->ai_family, SOCK_STREAM, 0);
+        bool up = fd != -1 && connect(fd, info->ai_addr, info->ai_addrlen) == 0;
+        if (fd != -1)
+            close(fd);
+        freeaddrinfo(info);
+        if (up)
+            return pid;
+    }
+    kill(pid, SIGKILL);
+    std::cerr << "ircbench: " << opt.server << " is not accepting connections" << std::endl;
+    std::exit(1);
+}
+
+void report(const std::vector<Result>& results) {
+    std::cout << std::left << std::setw(10) << "scenario" << std::right
+              << std::setw(9) << "clients" << std::setw(12) << "conn/s" << std::setw(12) << "msg/s"
+              << std::setw(10) << "p50(us)" << std::setw(10) << "p99(us)" << std::setw(10) << "p999(us)"
+              << std::setw(8) << "lost" << std::setw(9) << "refused" << std::endl;
+    std::cout << std::fixed << std::setprecision(0);
+    for (size_t i = 0; i < results.size(); ++i) {
+        Result r = results[i];
+        std::sort(r.latency.begin(), r.latency.end());
+        std::cout << std::left << std::setw(10) << r.scenario << std::right << std::setw(9) << r.clients;
+        if (r.connRate)
+            std::cout << std::setw(12) << r.connRate;
+        else
+            std::cout << std::setw(12) << "-";
+        if (r.messageRate)
+            std::cout << std::setw(12) << r.messageRate;
+        else
+            std::cout << std::setw(12) << "-";
+        std::cout << std::setw(10) << percentile(r.latency, 0.5) << std::setw(10) << percentile(r.latency, 0.99)
+                  << std::setw(10) << percentile(r.latency, 0.999) << std::setw(8) << r.lost
+                  << std::setw(9) << r.refused << std::endl;
+    }
+}
+
+void usage() {
+    std::cerr << "usage: ircbench [-s server] [-h host] [-p port] [-w password] [-c clients]\n"
+                 "                [-m messages] [-r rate] [-C connecting] [-t register,fanout,channels,mesh,slow]"
+              << std::endl;
+    std::exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.server = NULL;
+    opt.host = "127.0.0.1";
+    opt.port = "6667";
+    opt.password = "bench";
+    opt.clients = 1000;
+    opt.messages = 100;
+    opt.rate = 0;
+    opt.connecting = 128;
+    opt.scenarios = splitList("register,fanout,channels,mesh,slow");
+
+    int c;
+    while ((c = getopt(argc, argv, "s:h:p:w:c:m:r:C:t:")) != -1) {
+        switch (c) {
+            case 's': opt.server = optarg; break;
+            case 'h': opt.host = optarg; break;
+            case 'p': opt.port = optarg; break;
+            case 'w': opt.password = optarg; break;
+            case 'c': opt.clients = std::strtoul(optarg, NULL, 10); break;
+            case 'm': opt.messages = std::strtoul(optarg, NULL, 10); break;
+            case 'r': opt.rate = std::strtoul(optarg, NULL, 10); break;
+            case 'C': opt.connecting = std::max<size_t>(std::strtoul(optarg, NULL, 10), 1); break;
+            case 't': opt.scenarios = splitList(optarg); break;
+            default: usage();
+        }
+    }
+    if (optind != argc || !opt.clients)
+        usage();
+    signal(SIGPIPE, SIG_IGN);
+
+    // One fd per client, here and (when spawned) in the server
+    struct rlimit files;
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+    if (files.rlim_cur != RLIM_INFINITY && opt.clients + 64 > files.rlim_cur) {
+        std::cerr << "ircbench: " << opt.clients << " clients need more than the " << files.rlim_cur
+                  << " open files allowed" << std::endl;
+        return 1;
+    }
+
+    pid_t server = opt.server ? spawnServer(opt) : -1;
+    Bench bench(opt);
+    std::vector<Result> results;
+    for (size_t i = 0; i < opt.scenarios.size(); ++i)
+        results.push_back(bench.run(opt.scenarios[i]));
+    report(results);
+
+    if (server != -1) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    return 0;
+}
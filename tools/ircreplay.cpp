@@ -0,0 +1,573 @@
+// ircreplay: feeds a capture (IRCSERV_CAPTURE) back into a server.
+//
+//   ircreplay [-s ./ircserv -w password] [-h host] [-p port] [-u unix-socket]
+//             [-x speed] [-l] [-o output] [-e expected] capture
+//
+// -x scales the recorded gaps: 1 (the default) is recorded speed, 2 twice
+// as fast, 0 as fast as possible. -l (lockstep) waits after every record
+// until the server has handled it, so what each connection receives no
+// longer depends on timing; -o saves that and -e compares it with an
+// earlier run, e.g. of another build. Connections captured on the unix
+// socket replay there when -u is given, over TCP otherwise. Output is
+// compared per connection, without message tags and with digit runs of
+// TIMESTAMP_DIGITS or more (timestamps) read as "#".
+//
+// -s starts the given server on the port first, as ircbench does, with
+// persistence, capture and overload shedding off.
+#include "Capture.hpp"
+#include "Binary.hpp"
+#include <string>
+#include <vector>
+#include <map>
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <csignal>
+#include <ctime>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/wait.h>
+
+namespace {
+
+const size_t LOCKSTEP_CHUNK = 512;          // Below the server's recv() size, so one read takes it all
+const size_t TIMESTAMP_DIGITS = 9;
+const int QUIET_MS = 300;                   // Silence that ends the final drain
+const size_t DIFFS_SHOWN = 10;
+
+struct Options {
+    const char* server;
+    std::string host;
+    std::string port;
+    std::string password;
+    std::string unixPath;
+    double speed;
+    bool lockstep;
+    std::string output;
+    std::string expected;
+};
+
+struct Event {
+    unsigned char type;
+    std::string connection;     // "<session>.<id>"
+    uint64_t at;                // Microseconds into the capture
+    unsigned char flags;
+    std::string data;
+};
+
+struct Connection {
+    std::string label;
+    int fd;
+    std::string in;
+    std::string out;
+    bool closing;               // Captured client hung up; half-close once `out` is sent
+    std::vector<std::string> lines;
+};
+
+typedef std::vector<std::pair<std::string, std::vector<std::string> > > Transcript;
+
+uint64_t nowUs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000 + now.tv_nsec / 1000;
+}
+
+std::string toString(uint64_t value) {
+    std::ostringstream oss;
+    oss << value;
+    return oss.str();
+}
+
+void fail(const std::string& message) {
+    std::cerr << "ircreplay: " << message << std::endl;
+    std::exit(1);
+}
+
+// Sessions start with the magic; its first byte is never a record type
+void loadCapture(const std::string& path, std::vector<Event>& events) {
+    std::ifstream file(path.c_str(), std::ios::binary);
+    if (!file)
+        fail("cannot read " + path);
+    std::string data((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+
+    Binary::Reader in(data.data(), data.size());
+    unsigned session = 0;
+    uint64_t clock = 0;
+    while (in.ok() && !in.atEnd()) {
+        unsigned char type = in.u8();
+        if (type == static_cast<unsigned char>(CAPTURE_MAGIC[0])) {
+            in.expect(CAPTURE_MAGIC + 1, sizeof(CAPTURE_MAGIC) - 1);
+            in.u64();
+            ++session;
+            continue;
+        }
+        if (!session)
+            fail(path + " is not a capture");
+        Event event;
+        event.type = type;
+        event.connection = toString(session) + "." + toString(in.u32());
+        clock += in.u32();
+        event.at = clock;
+        event.flags = 0;
+        if (type == CAPTURE_OPEN)
+            event.flags = in.u8();
+        else if (type == CAPTURE_DATA)
+            event.data = in.str();
+        else if (type != CAPTURE_CLOSE)
+            fail(path + ": unknown record type " + toString(type));
+        events.push_back(event);
+    }
+    if (!in.ok())
+        fail(path + " is truncated");
+}
+
+// Tags and timestamps differ from run to run
+std::string normalise(const std::string& line) {
+    size_t start = 0;
+    if (!line.empty() && line[0] == '@') {
+        start = line.find(' ');
+        start = start == std::string::npos ? line.size() : start + 1;
+    }
+    std::string out;
+    for (size_t i = start; i < line.size();) {
+        size_t end = i;
+        while (end < line.size() && line[end] >= '0' && line[end] <= '9')
+            ++end;
+        if (end - i >= TIMESTAMP_DIGITS) {
+            out += '#';
+            i = end;
+        } else if (end > i) {
+            out.append(line, i, end - i);
+            i = end;
+        } else {
+            out += line[i++];
+        }
+    }
+    return out;
+}
+
+class Replay {
+private:
+    const Options& _opt;
+    std::vector<Connection> _connections;
+    std::map<std::string, size_t> _byLabel;
+    Connection _control;        // Lockstep barrier: PING here, wait for PONG
+    size_t _pongs;
+    size_t _failed;             // Connections that could not be opened
+    uint64_t _bytes;
+
+    int dial(bool local);
+    void receive(Connection& conn, bool control);
+    void pump(int timeoutMs);
+    void barrier();
+    bool pending() const;
+    size_t received() const;
+
+public:
+    explicit Replay(const Options& opt);
+    void waitUntil(uint64_t due);       // Keeps reading meanwhile
+    void apply(const Event& event);
+    void finish();
+    Transcript transcript() const;
+    size_t failed() const { return _failed; }
+    uint64_t bytes() const { return _bytes; }
+};
+
+Replay::Replay(const Options& opt) : _opt(opt), _pongs(0), _failed(0), _bytes(0) {
+    _control.fd = -1;
+    _control.closing = false;
+    if (opt.lockstep) {
+        _control.fd = dial(false);
+        if (_control.fd == -1)
+            fail("cannot connect to " + opt.host + ":" + opt.port);
+    }
+}
+
+// Blocking connect (it is local), then non-blocking for the replay
+int Replay::dial(bool local) {
+    int fd = -1;
+    if (local && !_opt.unixPath.empty()) {
+        struct sockaddr_un addr;
+        std::memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        std::strncpy(addr.sun_path, _opt.unixPath.c_str(), sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd != -1 && connect(fd, (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            close(fd);
+            fd = -1;
+        }
+    } else {
+        struct addrinfo hints;
+        struct addrinfo* info = NULL;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(_opt.host.c_str(), _opt.port.c_str(), &hints, &info) != 0 || !info)
+            return -1;
+        fd = socket(info->ai_family, SOCK_STREAM, 0);
+        if (fd != -1 && connect(fd, info->ai_addr, info->ai_addrlen) == -1) {
+            close(fd);
+            fd = -1;
+        }
+        freeaddrinfo(info);
+    }
+    if (fd != -1)
+        fcntl(fd, F_SETFL, O_NONBLOCK);
+    return fd;
+}
+
+void Replay::receive(Connection& conn, bool control) {
+    char buffer[16384];
+    ssize_t n = recv(conn.fd, buffer, sizeof(buffer), 0);
+    if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+        return;
+    if (n <= 0) {
+        if (control)
+            fail("the server closed the lockstep connection");
+        close(conn.fd);
+        conn.fd = -1;
+        return;
+    }
+    conn.in.append(buffer, n);
+    size_t start = 0;
+    size_t end;
+    while ((end = conn.in.find('\n', start)) != std::string::npos) {
+        std::string line = conn.in.substr(start, end - start);
+        if (!line.empty() && line[line.size() - 1] == '\r')
+            line.erase(line.size() - 1);
+        if (control)
+            _pongs += line.find(" PONG ") != std::string::npos;
+        else
+            conn.lines.push_back(normalise(line));
+        start = end + 1;
+    }
+    conn.in.erase(0, start);
+}
+
+// One poll() round: write what is queued, read what arrived
+void Replay::pump(int timeoutMs) {
+    std::vector<pollfd> fds;
+    std::vector<Connection*> owners;
+    for (size_t i = 0; i <= _connections.size(); ++i) {
+        Connection& conn = i < _connections.size() ? _connections[i] : _control;
+        if (conn.fd == -1)
+            continue;
+        pollfd pfd;
+        pfd.fd = conn.fd;
+        pfd.events = POLLIN | (conn.out.empty() ? 0 : POLLOUT);
+        pfd.revents = 0;
+        fds.push_back(pfd);
+        owners.push_back(&conn);
+    }
+    if (fds.empty()) {
+        usleep(timeoutMs * 1000);
+        return;
+    }
+    if (poll(&fds[0], fds.size(), timeoutMs) <= 0)
+        return;
+    for (size_t i = 0; i < fds.size(); ++i) {
+        Connection& conn = *owners[i];
+        bool control = &conn == &_control;
+        if (fds[i].revents & POLLOUT) {
+            ssize_t n = send(conn.fd, conn.out.data(), conn.out.size(), 0);
+            if (n > 0)
+                conn.out.erase(0, n);
+            if (conn.out.empty() && conn.closing)
+                shutdown(conn.fd, SHUT_WR);
+        }
+        if (fds[i].revents & (POLLIN | POLLHUP | POLLERR))
+            receive(conn, control);
+    }
+}
+
+void Replay::waitUntil(uint64_t due) {
+    for (uint64_t now = nowUs(); now < due; now = nowUs())
+        pump(static_cast<int>(std::min<uint64_t>((due - now + 999) / 1000, 100)));
+}
+
+size_t Replay::received() const {
+    size_t lines = 0;
+    for (size_t i = 0; i < _connections.size(); ++i)
+        lines += _connections[i].lines.size();
+    return lines;
+}
+
+bool Replay::pending() const {
+    for (size_t i = 0; i < _connections.size(); ++i)
+        if (_connections[i].fd != -1 && !_connections[i].out.empty())
+            return true;
+    return false;
+}
+
+// Everything sent so far is in the server's socket buffers once our
+// writes are done; the PONG comes back on a later pass than the one
+// that read them, so by then they have all been handled
+void Replay::barrier() {
+    while (pending())
+        pump(100);
+    size_t want = _pongs + 1;
+    _control.out.append("PING replay\r\n");
+    while (_pongs < want)
+        pump(100);
+}
+
+void Replay::apply(const Event& event) {
+    if (event.type == CAPTURE_OPEN) {
+        Connection conn;
+        conn.label = event.connection;
+        conn.fd = dial(event.flags & CAPTURE_LOCAL);
+        conn.closing = false;
+        _failed += conn.fd == -1;
+        _byLabel[conn.label] = _connections.size();
+        _connections.push_back(conn);
+        if (_opt.lockstep)
+            barrier();
+        return;
+    }
+
+    // Data of clients a hot upgrade inherited has no OPEN; skip it
+    std::map<std::string, size_t>::const_iterator it = _byLabel.find(event.connection);
+    if (it == _byLabel.end())
+        return;
+    Connection& conn = _connections[it->second];
+    if (conn.fd == -1)
+        return;
+    if (event.type == CAPTURE_CLOSE) {
+        conn.closing = true;
+        if (conn.out.empty())
+            shutdown(conn.fd, SHUT_WR);
+        if (_opt.lockstep)
+            barrier();
+        return;
+    }
+    _bytes += event.data.size();
+    if (!_opt.lockstep) {
+        conn.out += event.data;
+        pump(0);
+        return;
+    }
+    for (size_t pos = 0; pos < event.data.size(); pos += LOCKSTEP_CHUNK) {
+        conn.out.append(event.data, pos, LOCKSTEP_CHUNK);
+        barrier();
+    }
+}
+
+// Let the last replies arrive
+void Replay::finish() {
+    while (pending())
+        pump(100);
+    if (_opt.lockstep)
+        barrier();
+    size_t seen = received();
+    uint64_t lastChange = nowUs();
+    while (nowUs() - lastChange < QUIET_MS * 1000ULL) {
+        pump(50);
+        if (received() != seen) {
+            seen = received();
+            lastChange = nowUs();
+        }
+    }
+    for (size_t i = 0; i < _connections.size(); ++i)
+        if (_connections[i].fd != -1)
+            close(_connections[i].fd);
+    if (_control.fd != -1)
+        close(_control.fd);
+}
+
+Transcript Replay::transcript() const {
+    Transcript out;
+    for (size_t i = 0; i < _connections.size(); ++i)
+        out.push_back(std::make_pair(_connections[i].label, _connections[i].lines));
+    return out;
+}
+
+// "== <connection>" then its lines, connections in the order they opened
+void writeTranscript(const std::string& path, const Transcript& transcript) {
+    std::ofstream file(path.c_str());
+    for (size_t i = 0; i < transcript.size(); ++i) {
+        file << "== " << transcript[i].first << "\n";
+        for (size_t j = 0; j < transcript[i].second.size(); ++j)
+            file << transcript[i].second[j] << "\n";
+    }
+    if (!file)
+        fail("cannot write " + path);
+}
+
+Transcript readTranscript(const std::string& path) {
+    std::ifstream file(path.c_str());
+    if (!file)
+        fail("cannot read " + path);
+    Transcript transcript;
+    std::string line;
+    while (std::getline(file, line)) {
+        if (line.compare(0, 3, "== ") == 0)
+            transcript.push_back(std::make_pair(line.substr(3), std::vector<std::string>()));
+        else if (!transcript.empty())
+            transcript.back().second.push_back(line);
+    }
+    return transcript;
+}
+
+// Number of connections whose output differs; the first few differences are shown
+size_t compare(const Transcript& expected, const Transcript& actual) {
+    std::map<std::string, const std::vector<std::string>*> got;
+    for (size_t i = 0; i < actual.size(); ++i)
+        got[actual[i].first] = &actual[i].second;
+
+    size_t differing = 0;
+    size_t shown = 0;
+    for (size_t i = 0; i < expected.size(); ++i) {
+        const std::string& label = expected[i].first;
+        const std::vector<std::string>& want = expected[i].second;
+        std::map<std::string, const std::vector<std::string>*>::iterator it = got.find(label);
+        static const std::vector<std::string> none;
+        const std::vector<std::string>& have = it == got.end() ? none : *it->second;
+        if (it != got.end())
+            got.erase(it);
+        size_t line = 0;
+        while (line < want.size() && line < have.size() && want[line] == have[line])
+            ++line;
+        if (line == want.size() && line == have.size())
+            continue;
+        ++differing;
+        if (shown++ < DIFFS_SHOWN) {
+            std::cout << "connection " << label << ", line " << line + 1 << ":\n"
+                      << "  expected: " << (line < want.size() ? want[line] : "<end of output>") << "\n"
+                      << "  got:      " << (line < have.size() ? have[line] : "<end of output>") << std::endl;
+        }
+    }
+    for (std::map<std::string, const std::vector<std::string>*>::iterator it = got.begin(); it != got.end(); ++it) {
+        ++differing;
+        if (shown++ < DIFFS_SHOWN)
+            std::cout << "connection " << it->first << " is not in the expected output" << std::endl;
+    }
+    return differing;
+}
+
+pid_t spawnServer(const Options& opt) {
+    pid_t pid = fork();
+    if (pid == -1)
+        fail(std::string("fork: ") + strerror(errno));
+    if (pid == 0) {
+        unsetenv("IRCSERV_CAPTURE");
+        setenv("IRCSERV_SNAPSHOT", "", 0);
+        setenv("IRCSERV_LOG_DIR", "", 0);
+        setenv("IRCSERV_OVERLOAD_LAG_MS", "0", 0);
+        if (!opt.unixPath.empty())
+            setenv("IRCSERV_UNIX_SOCKET", opt.unixPath.c_str(), 1);
+        int null = open("/dev/null", O_WRONLY);
+        dup2(null, STDOUT_FILENO);
+        dup2(null, STDERR_FILENO);
+        execl(opt.server, opt.server, opt.port.c_str(), opt.password.c_str(), (char*)NULL);
+        _exit(127);
+    }
+
+    for (int attempt = 0; attempt < 100; ++attempt) {
+        usleep(50000);
+        int status;
+        if (waitpid(pid, &status, WNOHANG) == pid)
+            fail(std::string(opt.server) + " exited during startup");
+        struct addrinfo hints;
+        struct addrinfo* info = NULL;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_socktype = SOCK_STREAM;
+        if (getaddrinfo(opt.host.c_str(), opt.port.c_str(), &hints, &info) != 0 || !info)
+            break;
+        int fd = socket(info->ai_family, SOCK_STREAM, 0);
+        bool up = fd != -1 && connect(fd, info->ai_addr, info->ai_addrlen) == 0;
+        if (fd != -1)
+            close(fd);
+        freeaddrinfo(info);
+        if (up)
+            return pid;
+    }
+    kill(pid, SIGKILL);
+    fail(std::string(opt.server) + " is not accepting connections");
+    return -1;
+}
+
+void usage() {
+    std::cerr << "usage: ircreplay [-s server -w password] [-h host] [-p port] [-u unix-socket]\n"
+                 "                 [-x speed] [-l] [-o output] [-e expected] capture" << std::endl;
+    std::exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.server = NULL;
+    opt.host = "127.0.0.1";
+    opt.port = "6667";
+    opt.speed = 1;
+    opt.lockstep = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "s:w:h:p:u:x:lo:e:")) != -1) {
+        switch (c) {
+            case 's': opt.server = optarg; break;
+            case 'w': opt.password = optarg; break;
+            case 'h': opt.host = optarg; break;
+            case 'p': opt.port = optarg; break;
+            case 'u': opt.unixPath = optarg; break;
+            case 'x': opt.speed = std::strtod(optarg, NULL); break;
+            case 'l': opt.lockstep = true; break;
+            case 'o': opt.output = optarg; break;
+            case 'e': opt.expected = optarg; break;
+            default: usage();
+        }
+    }
+    if (optind + 1 != argc || (opt.server && opt.password.empty()) || opt.speed < 0)
+        usage();
+    signal(SIGPIPE, SIG_IGN);
+
+    std::vector<Event> events;
+    loadCapture(argv[optind], events);
+    pid_t server = opt.server ? spawnServer(opt) : -1;
+
+    Replay replay(opt);
+    uint64_t start = nowUs();
+    for (size_t i = 0; i < events.size(); ++i) {
+        if (opt.speed > 0)
+            replay.waitUntil(start + static_cast<uint64_t>(events[i].at / opt.speed));
+        replay.apply(events[i]);
+    }
+    replay.finish();
+    double elapsed = (nowUs() - start) / 1e6;
+
+    Transcript transcript = replay.transcript();
+    size_t lines = 0;
+    for (size_t i = 0; i < transcript.size(); ++i)
+        lines += transcript[i].second.size();
+    std::cout << "replayed " << events.size() << " records, " << transcript.size() << " connections ("
+              << replay.failed() << " refused), " << replay.bytes() << " bytes in " << elapsed << " s ("
+              << static_cast<uint64_t>(events.size() / std::max(elapsed, 1e-6)) << " records/s); received "
+              << lines << " lines" << std::endl;
+
+    int status = 0;
+    if (!opt.output.empty())
+        writeTranscript(opt.output, transcript);
+    if (!opt.expected.empty()) {
+        size_t differing = compare(readTranscript(opt.expected), transcript);
+        if (differing) {
+            std::cout << differing << " of " << transcript.size() << " connections differ" << std::endl;
+            status = 1;
+        } else {
+            std::cout << "output matches " << opt.expected << std::endl;
+        }
+    }
+
+    if (server != -1) {
+        kill(server, SIGTERM);
+        waitpid(server, NULL, 0);
+    }
+    return status;
+}
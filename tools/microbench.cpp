@@ -0,0 +1,510 @@
+// ircmicrobench: the server's hot primitives in isolation, on fixed
+// datasets, one JSON object per benchmark on stdout.
+//
+//   ircmicrobench [-r repetitions] [filter]
+//
+// Only benchmarks whose name contains `filter` run. Each is calibrated
+// until one repetition takes BENCH_MIN_NS, then repeated; ns_per_item is
+// the median repetition, min_ns_per_item the fastest, allocs_per_item
+// the global operator new calls over all repetitions per item. Server-level
+// benchmarks drive a real Server (never started, so no sockets are
+// bound) whose clients sit on unconnected AF_UNIX sockets; its console
+// logging goes to /dev/null but is still paid for.
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Channel.hpp"
+#include "Message.hpp"
+#include <string>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+namespace {
+
+uint64_t g_allocations = 0;
+
+} // namespace
+
+// Counted, and otherwise what the default ones do
+void* operator new(size_t size) throw(std::bad_alloc) {
+    ++g_allocations;
+    void* p = std::malloc(size ? size : 1);
+    if (!p)
+        throw std::bad_alloc();
+    return p;
+}
+
+void operator delete(void* p) throw() {
+    std::free(p);
+}
+
+namespace {
+
+const uint64_t BENCH_MIN_NS = 50000000;     // Calibrated length of one repetition
+const size_t DATASET_LINES = 4096;
+const size_t CLEAR_EVERY = 64;              // Iterations between output buffer resets (untimed)
+const char* const PASSWORD = "bench";
+
+uint64_t nowNs() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
+// Time spent inside start()/stop() pairs
+class Stopwatch {
+private:
+    uint64_t _total;
+    uint64_t _since;
+
+public:
+    Stopwatch() : _total(0), _since(0) {}
+    void start() { _since = nowNs(); }
+    void stop() { _total += nowNs() - _since; }
+    uint64_t total() const { return _total; }
+};
+
+// Deterministic, so every run sees the same bytes
+class Lcg {
+private:
+    uint32_t _state;
+
+public:
+    explicit Lcg(uint32_t seed) : _state(seed) {}
+    uint32_t next() {
+        _state = _state * 1103515245u + 12345u;
+        return _state >> 8;
+    }
+    size_t below(size_t n) { return next() % n; }
+};
+
+// Client traffic: mostly channel messages of varied length, the rest
+// the commands a busy client sends between them
+std::vector<std::string> trafficLines() {
+    static const char* const others[] = {
+        "PING :irc.example.net", "MODE #bench", "JOIN #bench", "PART #bench :bye",
+        "TOPIC #bench :benchmark topic", "WHO #bench", "NAMES #bench", "ISON alice bob carol"
+    };
+    Lcg rng(42);
+    std::vector<std::string> lines;
+    for (size_t i = 0; i < DATASET_LINES; ++i) {
+        if (rng.below(4) == 0) {
+            lines.push_back(others[rng.below(sizeof(others) / sizeof(others[0]))]);
+            continue;
+        }
+        std::string text(10 + rng.below(390), 'a');
+        for (size_t j = 0; j < text.size(); ++j)
+            text[j] = j % 6 == 5 ? ' ' : static_cast<char>('a' + rng.below(26));
+        lines.push_back("PRIVMSG #bench :" + text);
+    }
+    return lines;
+}
+
+class Benchmark {
+public:
+    virtual ~Benchmark() {}
+    virtual std::string name() const = 0;
+    virtual const char* item() const = 0;       // What one unit of work is
+    virtual size_t itemsPerIteration() const { return 1; }
+    virtual void setUp() {}
+    virtual void tearDown() {}
+    // Runs `iterations` and returns the time that counts
+    virtual uint64_t run(size_t iterations) = 0;
+};
+
+// Bytes as recv() hands them over, framed the way handleClientMessage does
+class FramingBench : public Benchmark {
+private:
+    size_t _chunk;
+    std::vector<std::string> _chunks;
+    size_t _lines;
+    Client* _client;
+
+public:
+    explicit FramingBench(size_t chunk) : _chunk(chunk), _lines(0), _client(NULL) {}
+    std::string name() const { return "framing/chunk=" + toString(_chunk); }
+    const char* item() const { return "line"; }
+    size_t itemsPerIteration() const { return _lines; }
+
+    void setUp() {
+        std::vector<std::string> lines = trafficLines();
+        std::string stream;
+        for (size_t i = 0; i < lines.size(); ++i)
+            stream.append(lines[i]).append("\r\n");
+        _lines = lines.size();
+        _chunks.clear();
+        for (size_t pos = 0; pos < stream.size(); pos += _chunk)
+            _chunks.push_back(stream.substr(pos, _chunk));
+        _client = new Client(-1, "127.0.0.1");
+    }
+    void tearDown() { delete _client; }
+
+    uint64_t run(size_t iterations) {
+        Stopwatch watch;
+        size_t framed = 0;
+        std::string line;
+        bool invalid;
+        watch.start();
+        for (size_t n = 0; n < iterations; ++n) {
+            for (size_t i = 0; i < _chunks.size(); ++i) {
+                _client->appendToInputBuffer(_chunks[i].data(), _chunks[i].size());
+                while (_client->getNextMessage(line, invalid))
+                    framed += line.size();
+            }
+        }
+        watch.stop();
+        if (framed == 0)
+            std::abort();
+        return watch.total();
+    }
+};
+
+// ircCaseFold on nick-sized names, or on whole JOIN/MONITOR-sized lists
+class FoldBench : public Benchmark {
+private:
+    size_t _maxLen;
+    std::vector<std::string> _names;
+
+public:
+    explicit FoldBench(size_t maxLen) : _maxLen(maxLen) {}
+    std::string name() const { return "fold/len<=" + toString(_maxLen); }
+    const char* item() const { return "name"; }
+    size_t itemsPerIteration() const { return _names.size(); }
+
+    void setUp() {
+        static const char chars[] = "ABCXYZabcxyz[]^{}|~-_0123456789#,";
+        Lcg rng(7);
+        _names.clear();
+        for (size_t i = 0; i < DATASET_LINES; ++i) {
+            std::string name(1 + rng.below(_maxLen), 'a');
+            for (size_t j = 0; j < name.size(); ++j)
+                name[j] = chars[rng.below(sizeof(chars) - 1)];
+            _names.push_back(name);
+        }
+    }
+
+    uint64_t run(size_t iterations) {
+        Stopwatch watch;
+        size_t folded = 0;
+        watch.start();
+        for (size_t n = 0; n < iterations; ++n) {
+            for (size_t i = 0; i < _names.size(); ++i)
+                folded += ircCaseFold(_names[i])[0];
+        }
+        watch.stop();
+        if (folded == 0)
+            std::abort();
+        return watch.total();
+    }
+};
+
+class ParseBench : public Benchmark {
+private:
+    std::vector<std::string> _lines;
+
+public:
+    std::string name() const { return "parse/message"; }
+    const char* item() const { return "line"; }
+    size_t itemsPerIteration() const { return _lines.size(); }
+
+    void setUp() {
+        std::vector<std::string> lines = trafficLines();
+        _lines.clear();
+        for (size_t i = 0; i < lines.size(); ++i)
+            _lines.push_back(i % 2 ? ":nick!user@host " + lines[i] : lines[i]);
+    }
+
+    uint64_t run(size_t iterations) {
+        Stopwatch watch;
+        Message msg;
+        size_t params = 0;
+        watch.start();
+        for (size_t n = 0; n < iterations; ++n) {
+            for (size_t i = 0; i < _lines.size(); ++i) {
+                parseMessage(_lines[i], msg);
+                params += msg.params.size();
+            }
+        }
+        watch.stop();
+        if (params == 0)
+            std::abort();
+        return watch.total();
+    }
+};
+
+// A never-started Server with `members` registered users in #big
+class ServerBench : public Benchmark {
+protected:
+    size_t _members;
+    Server* _server;
+    std::vector<Client*> _clients;
+
+    Client* connect(const std::string& nick) {
+        int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (fd == -1) {
+            std::perror("socket");
+            std::exit(1);
+        }
+        Client* client = _server->adoptClient(fd, "127.0.0.1");
+        _server->processCommand(client, std::string("PASS ") + PASSWORD);
+        _server->processCommand(client, "NICK " + nick);
+        _server->processCommand(client, "USER " + nick + " 0 * :" + nick);
+        client->clearOutputBuffer();
+        return client;
+    }
+
+    void clearOutput() {
+        for (size_t i = 0; i < _clients.size(); ++i)
+            _clients[i]->clearOutputBuffer();
+    }
+
+public:
+    explicit ServerBench(size_t members) : _members(members), _server(NULL) {}
+
+    void setUp() {
+        _server = new Server("6667", PASSWORD);
+        _clients.clear();
+        for (size_t i = 0; i < _members; ++i) {
+            _clients.push_back(connect("user" + toString(i)));
+            _server->handleJoin(_clients.back(), "#big");
+        }
+        clearOutput();
+    }
+    void tearDown() {
+        delete _server;
+        _clients.clear();
+    }
+};
+
+// One line through processCommand, from parsing to the reply
+class DispatchBench : public ServerBench {
+private:
+    std::string _label;
+    std::string _line;
+
+public:
+    DispatchBench(const std::string& label, const std::string& line) : ServerBench(1), _label(label), _line(line) {}
+    std::string name() const { return "dispatch/" + _label; }
+    const char* item() const { return "line"; }
+
+    uint64_t run(size_t iterations) {
+        Stopwatch watch;
+        Client* client = _clients[0];
+        for (size_t n = 0; n < iterations; n += CLEAR_EVERY) {
+            watch.start();
+            for (size_t i = n; i < iterations && i < n + CLEAR_EVERY; ++i)
+                _server->processCommand(client, _line);
+            watch.stop();
+            client->clearOutputBuffer();
+        }
+        return watch.total();
+    }
+};
+
+// JOIN (topic, NAMES, replay, broadcast) then PART, at a channel size
+class JoinBench : public ServerBench {
+private:
+    Client* _joiner;
+
+public:
+    explicit JoinBench(size_t members) : ServerBench(members), _joiner(NULL) {}
+    std::string name() const { return "join-part/members=" + toString(_members); }
+    const char* item() const { return "join+part"; }
+
+    void setUp() {
+        ServerBench::setUp();
+        _joiner = connect("joiner");
+        _clients.push_back(_joiner);
+    }
+
+    uint64_t run(size_t iterations) {
+        Stopwatch watch;
+        for (size_t n = 0; n < iterations; n += CLEAR_EVERY) {
+            watch.start();
+            for (size_t i = n; i < iterations && i < n + CLEAR_EVERY; ++i) {
+                _server->handleJoin(_joiner, "#big");
+                _server->handlePart(_joiner, "#big", "");
+            }
+            watch.stop();
+            clearOutput();
+        }
+        return watch.total();
+    }
+};
+
+// One channel message fanned out to every member
+class PrivmsgBench : public ServerBench {
+public:
+    explicit PrivmsgBench(size_t members) : ServerBench(members) {}
+    std::string name() const { return "privmsg/members=" + toString(_members); }
+    const char* item() const { return "message"; }
+
+    uint64_t run(size_t iterations) {
+        Stopwatch watch;
+        const std::string text = "the quick brown fox jumps over the lazy dog";
+        for (size_t n = 0; n < iterations; n += CLEAR_EVERY) {
+            watch.start();
+            for (size_t i = n; i < iterations && i < n + CLEAR_EVERY; ++i)
+                _server->handlePrivmsg(_clients[i % _clients.size()], "#big", text);
+            watch.stop();
+            clearOutput();
+        }
+        return watch.total();
+    }
+};
+
+// Membership operations on a bare Channel
+class ChannelBench : public Benchmark {
+public:
+    enum Op { HAS, ADD_REMOVE };
+
+private:
+    Op _op;
+    size_t _members;
+    std::vector<Client*> _clients;
+    Client* _extra;
+    Channel* _channel;
+    std::vector<size_t> _lookups;
+
+public:
+    ChannelBench(Op op, size_t members) : _op(op), _members(members), _extra(NULL), _channel(NULL) {}
+    std::string name() const {
+        return std::string(_op == HAS ? "channel/has" : "channel/add-remove") + "/members=" + toString(_members);
+    }
+    const char* item() const { return _op == HAS ? "lookup" : "add+remove"; }
+    size_t itemsPerIteration() const { return _op == HAS ? _lookups.size() : 1; }
+
+    void setUp() {
+        for (size_t i = 0; i < _members; ++i) {
+            _clients.push_back(new Client(-1, "10.0." + toString(i / 256 % 256) + "." + toString(i % 256)));
+            _clients.back()->setNickname("member" + toString(i));
+        }
+        _extra = new Client(-1, "10.1.0.1");
+        _extra->setNickname("extra");
+        _channel = new Channel("#bench", _clients[0]);
+        for (size_t i = 1; i < _members; ++i)
+            _channel->addClient(_clients[i]);
+        Lcg rng(7);
+        _lookups.clear();
+        for (size_t i = 0; i < 1024; ++i)
+            _lookups.push_back(rng.below(_members));
+    }
+    void tearDown() {
+        delete _channel;
+        for (size_t i = 0; i < _clients.size(); ++i)
+            delete _clients[i];
+        _clients.clear();
+        delete _extra;
+    }
+
+    uint64_t run(size_t iterations) {
+        Stopwatch watch;
+        size_t found = 0;
+        watch.start();
+        for (size_t n = 0; n < iterations; ++n) {
+            if (_op == HAS) {
+                for (size_t i = 0; i < _lookups.size(); ++i)
+                    found += _channel->hasClient(_clients[_lookups[i]]);
+            } else {
+                found += _channel->addClient(_extra);
+                found += _channel->removeClient(_extra);
+            }
+        }
+        watch.stop();
+        if (found == 0)
+            std::abort();
+        return watch.total();
+    }
+};
+
+void measure(FILE* out, Benchmark& bench, size_t repetitions) {
+    bench.setUp();
+    size_t iterations = 1;
+    while (bench.run(iterations) < BENCH_MIN_NS / 4 && iterations < (static_cast<size_t>(1) << 40))
+        iterations *= 2;
+    iterations *= 4;
+
+    std::vector<double> perItem;
+    perItem.reserve(repetitions);
+    uint64_t allocations = g_allocations;
+    for (size_t r = 0; r < repetitions; ++r)
+        perItem.push_back(static_cast<double>(bench.run(iterations)) / (iterations * bench.itemsPerIteration()));
+    allocations = g_allocations - allocations;
+    bench.tearDown();
+
+    std::sort(perItem.begin(), perItem.end());
+    std::fprintf(out, "{\"name\":\"%s\",\"item\":\"%s\",\"iterations\":%lu,\"items_per_iteration\":%lu,"
+                      "\"repetitions\":%lu,\"ns_per_item\":%.1f,\"min_ns_per_item\":%.1f,\"allocs_per_item\":%.2f}\n",
+                 bench.name().c_str(), bench.item(), static_cast<unsigned long>(iterations),
+                 static_cast<unsigned long>(bench.itemsPerIteration()), static_cast<unsigned long>(repetitions),
+                 perItem[perItem.size() / 2], perItem[0],
+                 static_cast<double>(allocations) / (repetitions * iterations * bench.itemsPerIteration()));
+    std::fflush(out);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    size_t repetitions = 5;
+    int c;
+    while ((c = getopt(argc, argv, "r:")) != -1) {
+        if (c != 'r') {
+            std::fprintf(stderr, "usage: ircmicrobench [-r repetitions] [filter]\n");
+            return 2;
+        }
+        repetitions = std::max<size_t>(std::strtoul(optarg, NULL, 10), 1);
+    }
+    std::string filter = optind < argc ? argv[optind] : "";
+
+    // Results keep the real stdout; the server's logging does not
+    int results = dup(STDOUT_FILENO);
+    int null = open("/dev/null", O_WRONLY);
+    if (results == -1 || null == -1)
+        return 1;
+    dup2(null, STDOUT_FILENO);
+    close(null);
+    FILE* out = fdopen(results, "w");
+
+    struct rlimit files;
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+
+    std::vector<Benchmark*> benches;
+    benches.push_back(new FramingBench(1024));
+    benches.push_back(new FramingBench(16384));
+    benches.push_back(new FoldBench(NICKLEN));
+    benches.push_back(new FoldBench(512));
+    benches.push_back(new ParseBench());
+    benches.push_back(new DispatchBench("ping", "PING :irc.example.net"));
+    benches.push_back(new DispatchBench("privmsg", "PRIVMSG #big :the quick brown fox jumps over the lazy dog"));
+    benches.push_back(new DispatchBench("mode-query", "MODE #big"));
+    benches.push_back(new DispatchBench("ison", "ISON user0 nobody"));
+    benches.push_back(new DispatchBench("unknown", "FROBNICATE a b c"));
+    static const size_t sizes[] = { 10, 100, 1000, 10000 };
+    for (size_t i = 0; i < 4; ++i) {
+        benches.push_back(new ChannelBench(ChannelBench::HAS, sizes[i]));
+        benches.push_back(new ChannelBench(ChannelBench::ADD_REMOVE, sizes[i]));
+    }
+    for (size_t i = 0; i < 3; ++i) {
+        benches.push_back(new JoinBench(sizes[i]));
+        benches.push_back(new PrivmsgBench(sizes[i]));
+    }
+
+    for (size_t i = 0; i < benches.size(); ++i) {
+        if (benches[i]->name().find(filter) != std::string::npos)
+            measure(out, *benches[i], repetitions);
+        delete benches[i];
+    }
+    std::fclose(out);
+    return 0;
+}
@@ -0,0 +1,331 @@
+// ircsoak: the server core driven in-process through libircserv, with
+// no TCP, no sleeping and a manual clock.
+//
+//   ircsoak [-c clients] [-k socketpairs] [-m members] [-r rounds]
+//           [-q churn%] [-t step_ms] [-v]
+//
+// The first `socketpairs` clients talk over a socketpair the server polls
+// like any other connection; the rest are in memory (Server::deliver and
+// Server::takeOutput). Everyone registers and joins a channel of
+// `members`. Each round every client says one line in its channel, then
+// churn% of them disconnect and come back under a new nick, and the clock
+// moves `step_ms` so timers fire as they would in real time. Deliveries
+// are counted: a member that hears anything but one line per member of
+// its channel (its own included), or that gets an error numeric, fails
+// the run (exit 1).
+// Persistence and overload shedding are off unless the environment says
+// otherwise; -v keeps the server's console log.
+#include "Server.hpp"
+#include "Client.hpp"
+#include "Clock.hpp"
+#include <string>
+#include <vector>
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <sys/resource.h>
+
+namespace {
+
+const char* const PASSWORD = "soak";
+const size_t MAX_FAILURES_SHOWN = 10;
+
+struct Options {
+    size_t clients;
+    size_t socketpairs;
+    size_t members;
+    size_t rounds;
+    size_t churn;
+    uint64_t step;
+    bool verbose;
+};
+
+struct SoakClient {
+    Client* client;         // Server side; NULL while disconnected
+    int fd;                 // Our end of the socketpair, -1 in memory
+    std::string nick;
+    std::string partial;    // Incomplete line from the last read
+    size_t heard;           // Channel lines since the round started
+    bool welcomed;
+};
+
+class Soak {
+private:
+    Options _opt;
+    Server _server;
+    std::vector<SoakClient> _clients;
+    std::vector<int> _closing;  // Half-closed socketpair ends, read until EOF
+    size_t _generation;
+    size_t _failures;
+    uint64_t _lines;        // Delivered to clients
+    uint64_t _bytes;
+
+    std::string channelOf(size_t i) const {
+        return "#soak" + toString(i / _opt.members);
+    }
+
+    size_t channelSize(size_t i) const {
+        size_t first = i / _opt.members * _opt.members;
+        return std::min(first + _opt.members, _opt.clients) - first;
+    }
+
+    void fail(size_t i, const std::string& what) {
+        if (_failures++ < MAX_FAILURES_SHOWN)
+            std::cerr << "ircsoak: " << _clients[i].nick << ": " << what << std::endl;
+    }
+
+    void send(size_t i, const std::string& lines) {
+        SoakClient& c = _clients[i];
+        if (c.fd == -1) {
+            _server.deliver(c.client, lines.data(), lines.size());
+            return;
+        }
+        // A few lines a round never fill the socket buffer
+        if (write(c.fd, lines.data(), lines.size()) != static_cast<ssize_t>(lines.size())) {
+            std::cerr << "ircsoak: write: " << strerror(errno) << std::endl;
+            std::exit(1);
+        }
+    }
+
+    void collect(size_t i, const char* data, size_t len) {
+        SoakClient& c = _clients[i];
+        _bytes += len;
+        c.partial.append(data, len);
+        size_t start = 0;
+        size_t end;
+        while ((end = c.partial.find("\r\n", start)) != std::string::npos) {
+            std::string line = c.partial.substr(start, end - start);
+            start = end + 2;
+            ++_lines;
+
+            // ":source COMMAND ..." or "ERROR :..."
+            size_t space = line.find(' ');
+            std::string command = line.substr(space + 1, line.find(' ', space + 1) - space - 1);
+            if (line.compare(0, 5, "ERROR") == 0)
+                fail(i, line);
+            else if (command == "PRIVMSG")
+                ++c.heard;
+            else if (command == "001")
+                c.welcomed = true;
+            else if (command.size() == 3 && command[0] == '4' && command != "422")     // No MOTD file is fine
+                fail(i, line);
+        }
+        c.partial.erase(0, start);
+    }
+
+    // Turns the loop until two passes in a row deliver nothing
+    void settle() {
+        char buffer[65536];
+        for (size_t quiet = 0; quiet < 2; ) {
+            _server.runOnce(0);
+            bool any = false;
+            for (size_t i = 0; i < _clients.size(); ++i) {
+                SoakClient& c = _clients[i];
+                if (!c.client)
+                    continue;
+                if (c.fd == -1) {
+                    std::string out = _server.takeOutput(c.client);
+                    if (!out.empty()) {
+                        collect(i, out.data(), out.size());
+                        any = true;
+                    }
+                    continue;
+                }
+                ssize_t n;
+                while ((n = read(c.fd, buffer, sizeof(buffer))) > 0) {
+                    collect(i, buffer, n);
+                    any = true;
+                }
+            }
+            for (size_t j = 0; j < _closing.size(); ) {
+                ssize_t n;
+                while ((n = read(_closing[j], buffer, sizeof(buffer))) > 0)
+                    any = true;
+                if (n == 0) {
+                    close(_closing[j]);
+                    _closing.erase(_closing.begin() + j);
+                } else {
+                    ++j;
+                }
+            }
+            quiet = any ? 0 : quiet + 1;
+        }
+    }
+
+    void connect(size_t i) {
+        SoakClient& c = _clients[i];
+        c.nick = "s" + toString(i) + "g" + toString(_generation);
+        c.partial.clear();
+        c.heard = 0;
+        c.welcomed = false;
+        if (i < _opt.socketpairs) {
+            int pair[2];
+            if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == -1) {
+                std::cerr << "ircsoak: socketpair: " << strerror(errno) << std::endl;
+                std::exit(1);
+            }
+            fcntl(pair[0], F_SETFL, fcntl(pair[0], F_GETFL, 0) | O_NONBLOCK);
+            c.fd = pair[0];
+            c.client = _server.attach(pair[1], "127.0.0.1");
+        } else {
+            c.fd = -1;
+            c.client = _server.attachVirtual("127.0.0.1");
+        }
+        send(i, std::string("PASS ") + PASSWORD + "\r\nNICK " + c.nick + "\r\nUSER " + c.nick
+                    + " 0 * :soak\r\nJOIN " + channelOf(i) + "\r\n");
+    }
+
+    void disconnect(size_t i) {
+        SoakClient& c = _clients[i];
+        if (c.fd == -1) {
+            _server.detach(c.client, "Client disconnected");
+        } else {
+            // The server reads EOF on its next pass and may still write
+            // (other leavers' QUITs) until it closes its end
+            shutdown(c.fd, SHUT_WR);
+            _closing.push_back(c.fd);
+            c.fd = -1;
+        }
+        c.client = NULL;
+    }
+
+    void checkWelcomed(size_t from, size_t to) {
+        for (size_t i = from; i < to; ++i) {
+            if (_clients[i].client && !_clients[i].welcomed)
+                fail(i, "not registered");
+        }
+    }
+
+public:
+    explicit Soak(const Options& opt)
+        : _opt(opt), _server("6667", PASSWORD), _generation(0), _failures(0), _lines(0), _bytes(0) {}
+
+    size_t failures() const { return _failures; }
+
+    void run(std::ostream& out) {
+        _server.embed();
+        Clock::setManual(0);
+
+        uint64_t started = Metrics::monotonicUs();
+        _clients.resize(_opt.clients);
+        for (size_t i = 0; i < _opt.clients; ++i)
+            connect(i);
+        settle();
+        checkWelcomed(0, _opt.clients);
+        uint64_t registered = Metrics::monotonicUs();
+
+        uint64_t messages = 0;
+        uint64_t reconnects = 0;
+        for (size_t round = 0; round < _opt.rounds; ++round) {
+            for (size_t i = 0; i < _clients.size(); ++i) {
+                _clients[i].heard = 0;
+                send(i, "PRIVMSG " + channelOf(i) + " :round " + toString(round) + " from " + _clients[i].nick
+                            + "\r\n");
+                ++messages;
+            }
+            settle();
+            for (size_t i = 0; i < _clients.size(); ++i) {
+                size_t expected = channelSize(i);     // Senders hear their own line too
+                if (_clients[i].heard != expected)
+                    fail(i, "round " + toString(round) + ": heard " + toString(_clients[i].heard) + " of "
+                                + toString(expected) + " lines");
+            }
+
+            // Leavers go in one pass, so no one rejoins a channel that
+            // still lists its departing members
+            ++_generation;
+            std::vector<size_t> leaving;
+            for (size_t i = 0; i < _clients.size(); ++i) {
+                if ((i * 7 + round) % 100 < _opt.churn)
+                    leaving.push_back(i);
+            }
+            for (size_t j = 0; j < leaving.size(); ++j)
+                disconnect(leaving[j]);
+            settle();
+            for (size_t j = 0; j < leaving.size(); ++j)
+                connect(leaving[j]);
+            settle();
+            for (size_t j = 0; j < leaving.size(); ++j)
+                checkWelcomed(leaving[j], leaving[j] + 1);
+            reconnects += leaving.size();
+            Clock::advance(_opt.step);
+        }
+        uint64_t finished = Metrics::monotonicUs();
+
+        double registerSecs = (registered - started) / 1e6;
+        double roundSecs = (finished - registered) / 1e6;
+        out << std::fixed << std::setprecision(0)
+                  << "clients " << _opt.clients << " (" << std::min(_opt.socketpairs, _opt.clients)
+                  << " socketpair), registered in " << registerSecs * 1000 << " ms; "
+                  << _opt.rounds << " rounds, " << messages << " messages, " << reconnects << " reconnects, "
+                  << _lines << " lines (" << _bytes / 1024 << " KiB) delivered in " << roundSecs * 1000 << " ms";
+        if (roundSecs > 0)
+            out << " (" << messages / roundSecs << " msg/s, " << _lines / roundSecs << " lines/s)";
+        out << "; " << _failures << " failures" << std::endl;
+    }
+};
+
+void usage() {
+    std::cerr << "usage: ircsoak [-c clients] [-k socketpairs] [-m members] [-r rounds] [-q churn%] [-t step_ms] [-v]"
+              << std::endl;
+    std::exit(2);
+}
+
+} // namespace
+
+int main(int argc, char** argv) {
+    Options opt;
+    opt.clients = 5000;
+    opt.socketpairs = 500;
+    opt.members = 50;
+    opt.rounds = 20;
+    opt.churn = 5;
+    opt.step = 1000;
+    opt.verbose = false;
+
+    int c;
+    while ((c = getopt(argc, argv, "c:k:m:r:q:t:v")) != -1) {
+        switch (c) {
+            case 'c': opt.clients = std::strtoul(optarg, NULL, 10); break;
+            case 'k': opt.socketpairs = std::strtoul(optarg, NULL, 10); break;
+            case 'm': opt.members = std::strtoul(optarg, NULL, 10); break;
+            case 'r': opt.rounds = std::strtoul(optarg, NULL, 10); break;
+            case 'q': opt.churn = std::min<size_t>(std::strtoul(optarg, NULL, 10), 100); break;
+            case 't': opt.step = std::strtoull(optarg, NULL, 10); break;
+            case 'v': opt.verbose = true; break;
+            default: usage();
+        }
+    }
+    if (optind != argc || !opt.clients || !opt.members)
+        usage();
+
+    // Two fds per socketpair client, both in this process
+    struct rlimit files;
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+    if (files.rlim_cur != RLIM_INFINITY && std::min(opt.socketpairs, opt.clients) * 2 + 64 > files.rlim_cur) {
+        std::cerr << "ircsoak: " << opt.socketpairs << " socketpairs need more than the " << files.rlim_cur
+                  << " open files allowed" << std::endl;
+        return 1;
+    }
+
+    setenv("IRCSERV_SNAPSHOT", "", 0);
+    setenv("IRCSERV_LOG_DIR", "", 0);
+    setenv("IRCSERV_OVERLOAD_LAG_MS", "0", 0);
+    // The summary keeps the console; the server's logging is skipped
+    // before it is formatted
+    std::ostream out(std::cout.rdbuf());
+    if (!opt.verbose)
+        std::cout.rdbuf(NULL);
+
+    Soak soak(opt);
+    soak.run(out);
+    return soak.failures() ? 1 : 0;
+}